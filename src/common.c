@@ -85,3 +85,50 @@ print_devices ()
   ow_free_usb_device_list (devices, total);
   return OW_OK;
 }
+
+int
+parse_cpu_list (const char *list, uint64_t *cpu_mask)
+{
+  long first, last;
+  char *endstr;
+  const char *s = list;
+
+  *cpu_mask = 0;
+
+  while (1)
+    {
+      first = strtol (s, &endstr, 10);
+      if (endstr == s || first < 0 || first >= 64)
+	{
+	  return -1;
+	}
+
+      last = first;
+      if (*endstr == '-')
+	{
+	  s = endstr + 1;
+	  last = strtol (s, &endstr, 10);
+	  if (endstr == s || last < first || last >= 64)
+	    {
+	      return -1;
+	    }
+	}
+
+      for (long i = first; i <= last; i++)
+	{
+	  *cpu_mask |= 1ULL << i;
+	}
+
+      if (*endstr == '\0')
+	{
+	  return 0;
+	}
+
+      if (*endstr != ',')
+	{
+	  return -1;
+	}
+
+      s = endstr + 1;
+    }
+}
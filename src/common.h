@@ -29,3 +29,6 @@
 void print_help (const char *, const char *, struct option *, const char *);
 
 ow_err_t print_devices ();
+
+//Lists of CPUs like "2,3" or "2-5,7" are converted into a mask with a bit per CPU. Returns 0 on success.
+int parse_cpu_list (const char *, uint64_t *);
@@ -0,0 +1,326 @@
+/*
+ *   convert.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include "convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OW_CONVERT_X86 1
+#include <immintrin.h>
+#define OW_TARGET(t) __attribute__ ((target (t)))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OW_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define INT32_TO_FLOAT32_SCALE ((float) (1.0f / INT_MAX))
+#define FLOAT32_TO_INT32_SCALE ((float) INT_MAX)	//This is 2^31 and not representable as an int32.
+
+#define MAX_KERNELS 4
+
+static const struct ow_convert_kernels *available_kernels[MAX_KERNELS + 1];
+static const struct ow_convert_kernels *best_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static inline int32_t
+ow_convert_float_to_int32 (float f)
+{
+  float v = f * FLOAT32_TO_INT32_SCALE;
+
+  if (isnan (v))
+    {
+      return 0;
+    }
+  if (v >= FLOAT32_TO_INT32_SCALE)
+    {
+      return INT_MAX;
+    }
+  if (v <= -FLOAT32_TO_INT32_SCALE)
+    {
+      return INT_MIN;
+    }
+  return (int32_t) v;
+}
+
+static void
+ow_convert_be32_to_float_scalar (float *f, const int32_t * s, size_t n)
+{
+  int32_t hv;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      hv = be32toh (*s);
+      *f = INT32_TO_FLOAT32_SCALE * hv;
+      f++;
+      s++;
+    }
+}
+
+static void
+ow_convert_float_to_be32_scalar (int32_t * s, const float *f, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      *s = htobe32 (ow_convert_float_to_int32 (*f));
+      f++;
+      s++;
+    }
+}
+
+static const struct ow_convert_kernels SCALAR_KERNELS = {
+  .name = "scalar",
+  .be32_to_float = ow_convert_be32_to_float_scalar,
+  .float_to_be32 = ow_convert_float_to_be32_scalar
+};
+
+//Samples are copied with memcpy as the buffers are declared as floats.
+
+static void
+ow_convert_be32_to_int32 (float *f, const int32_t * s, size_t n)
+{
+  int32_t hv;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      hv = be32toh (s[i]);
+      memcpy (&f[i], &hv, sizeof (int32_t));
+    }
+}
+
+static void
+ow_convert_int32_to_be32 (int32_t * s, const float *f, size_t n)
+{
+  int32_t hv;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      memcpy (&hv, &f[i], sizeof (int32_t));
+      s[i] = htobe32 (hv);
+    }
+}
+
+static const struct ow_convert_kernels INT32_KERNELS = {
+  .name = "int32",
+  .be32_to_float = ow_convert_be32_to_int32,
+  .float_to_be32 = ow_convert_int32_to_be32
+};
+
+#ifdef OW_CONVERT_X86
+
+//SSSE3 is needed for the byte swapping and SSE4.1 for the blending.
+
+OW_TARGET ("sse4.1") static void
+ow_convert_be32_to_float_sse4 (float *f, const int32_t * s, size_t n)
+{
+  size_t i = 0;
+  const __m128i bswap = _mm_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6,
+				      7, 0, 1, 2, 3);
+  const __m128 scale = _mm_set1_ps (INT32_TO_FLOAT32_SCALE);
+
+  for (; i + 4 <= n; i += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) &s[i]);
+      v = _mm_shuffle_epi8 (v, bswap);
+      _mm_storeu_ps (&f[i], _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+
+  ow_convert_be32_to_float_scalar (&f[i], &s[i], n - i);
+}
+
+OW_TARGET ("sse4.1") static void
+ow_convert_float_to_be32_sse4 (int32_t * s, const float *f, size_t n)
+{
+  size_t i = 0;
+  const __m128i bswap = _mm_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6,
+				      7, 0, 1, 2, 3);
+  const __m128 scale = _mm_set1_ps (FLOAT32_TO_INT32_SCALE);
+  const __m128i max = _mm_set1_epi32 (INT_MAX);
+
+  for (; i + 4 <= n; i += 4)
+    {
+      __m128 x = _mm_mul_ps (_mm_loadu_ps (&f[i]), scale);
+      //Positive overflows are fixed here while negative ones and NaNs are already INT_MIN after the conversion.
+      __m128i over = _mm_castps_si128 (_mm_cmpge_ps (x, scale));
+      x = _mm_and_ps (x, _mm_cmpord_ps (x, x));
+      __m128i v = _mm_blendv_epi8 (_mm_cvttps_epi32 (x), max, over);
+      _mm_storeu_si128 ((__m128i *) & s[i], _mm_shuffle_epi8 (v, bswap));
+    }
+
+  ow_convert_float_to_be32_scalar (&s[i], &f[i], n - i);
+}
+
+static const struct ow_convert_kernels SSE4_KERNELS = {
+  .name = "SSE4.1",
+  .be32_to_float = ow_convert_be32_to_float_sse4,
+  .float_to_be32 = ow_convert_float_to_be32_sse4
+};
+
+OW_TARGET ("avx2") static void
+ow_convert_be32_to_float_avx2 (float *f, const int32_t * s, size_t n)
+{
+  size_t i = 0;
+  const __m256i bswap = _mm256_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5,
+					 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8,
+					 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  const __m256 scale = _mm256_set1_ps (INT32_TO_FLOAT32_SCALE);
+
+  for (; i + 8 <= n; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) &s[i]);
+      v = _mm256_shuffle_epi8 (v, bswap);
+      _mm256_storeu_ps (&f[i], _mm256_mul_ps (_mm256_cvtepi32_ps (v),
+					      scale));
+    }
+
+  ow_convert_be32_to_float_sse4 (&f[i], &s[i], n - i);
+}
+
+OW_TARGET ("avx2") static void
+ow_convert_float_to_be32_avx2 (int32_t * s, const float *f, size_t n)
+{
+  size_t i = 0;
+  const __m256i bswap = _mm256_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5,
+					 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8,
+					 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  const __m256 scale = _mm256_set1_ps (FLOAT32_TO_INT32_SCALE);
+  const __m256i max = _mm256_set1_epi32 (INT_MAX);
+
+  for (; i + 8 <= n; i += 8)
+    {
+      __m256 x = _mm256_mul_ps (_mm256_loadu_ps (&f[i]), scale);
+      __m256i over = _mm256_castps_si256 (_mm256_cmp_ps (x, scale,
+							 _CMP_GE_OQ));
+      x = _mm256_and_ps (x, _mm256_cmp_ps (x, x, _CMP_ORD_Q));
+      __m256i v = _mm256_blendv_epi8 (_mm256_cvttps_epi32 (x), max, over);
+      _mm256_storeu_si256 ((__m256i *) & s[i],
+			   _mm256_shuffle_epi8 (v, bswap));
+    }
+
+  ow_convert_float_to_be32_sse4 (&s[i], &f[i], n - i);
+}
+
+static const struct ow_convert_kernels AVX2_KERNELS = {
+  .name = "AVX2",
+  .be32_to_float = ow_convert_be32_to_float_avx2,
+  .float_to_be32 = ow_convert_float_to_be32_avx2
+};
+
+#endif
+
+#ifdef OW_CONVERT_NEON
+
+static void
+ow_convert_be32_to_float_neon (float *f, const int32_t * s, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    {
+      uint8x16_t b = vrev32q_u8 (vld1q_u8 ((const uint8_t *) &s[i]));
+      float32x4_t x = vcvtq_f32_s32 (vreinterpretq_s32_u8 (b));
+      vst1q_f32 (&f[i], vmulq_n_f32 (x, INT32_TO_FLOAT32_SCALE));
+    }
+
+  ow_convert_be32_to_float_scalar (&f[i], &s[i], n - i);
+}
+
+//NEON conversions already saturate and convert NaN to 0.
+static void
+ow_convert_float_to_be32_neon (int32_t * s, const float *f, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    {
+      float32x4_t x = vmulq_n_f32 (vld1q_f32 (&f[i]), FLOAT32_TO_INT32_SCALE);
+      uint8x16_t b = vreinterpretq_u8_s32 (vcvtq_s32_f32 (x));
+      vst1q_u8 ((uint8_t *) & s[i], vrev32q_u8 (b));
+    }
+
+  ow_convert_float_to_be32_scalar (&s[i], &f[i], n - i);
+}
+
+static const struct ow_convert_kernels NEON_KERNELS = {
+  .name = "NEON",
+  .be32_to_float = ow_convert_be32_to_float_neon,
+  .float_to_be32 = ow_convert_float_to_be32_neon
+};
+
+#endif
+
+static void
+ow_convert_init_kernels ()
+{
+  const struct ow_convert_kernels **k = available_kernels;
+
+  *k = &SCALAR_KERNELS;
+  best_kernels = *k;
+  k++;
+
+#ifdef OW_CONVERT_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse4.1"))
+    {
+      *k = &SSE4_KERNELS;
+      best_kernels = *k;
+      k++;
+    }
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      *k = &AVX2_KERNELS;
+      best_kernels = *k;
+      k++;
+    }
+#endif
+
+#ifdef OW_CONVERT_NEON
+  *k = &NEON_KERNELS;
+  best_kernels = *k;
+  k++;
+#endif
+
+  *k = NULL;
+}
+
+const struct ow_convert_kernels **
+ow_convert_get_available_kernels ()
+{
+  pthread_once (&kernels_once, ow_convert_init_kernels);
+  return available_kernels;
+}
+
+const struct ow_convert_kernels *
+ow_convert_get_kernels ()
+{
+  pthread_once (&kernels_once, ow_convert_init_kernels);
+  return best_kernels;
+}
+
+const struct ow_convert_kernels *
+ow_convert_get_int32_kernels ()
+{
+  return &INT32_KERNELS;
+}
@@ -0,0 +1,49 @@
+/*
+ *   convert.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Conversion between the big-endian int32 samples used by the devices and floats.
+//Float to int32 conversion saturates at [-1.0, 1.0] and converts NaN to 0.
+
+typedef void (*ow_convert_be32_to_float_t) (float *, const int32_t *, size_t);
+typedef void (*ow_convert_float_to_be32_t) (int32_t *, const float *, size_t);
+
+struct ow_convert_kernels
+{
+  const char *name;
+  ow_convert_be32_to_float_t be32_to_float;
+  ow_convert_float_to_be32_t float_to_be32;
+};
+
+//The scalar kernels are the reference implementation and always the first element.
+const struct ow_convert_kernels **ow_convert_get_available_kernels ();
+
+//The fastest kernels supported by the running CPU.
+const struct ow_convert_kernels *ow_convert_get_kernels ();
+
+//These only swap the bytes so that the float buffers hold the native endian int32 samples, which makes the round trips bit exact.
+const struct ow_convert_kernels *ow_convert_get_int32_kernels ();
+
+#endif
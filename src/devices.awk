@@ -0,0 +1,81 @@
+# Generates the compiled in device descriptions from devices.json.
+# Only the layout of that file is supported, i.e., one member or one array element per line.
+
+function flush ()
+{
+  if (pid == "")
+    return
+  printf "  {\n"
+  printf "   .pid = %s,\n", pid
+  printf "   .name = %s,\n", name
+  printf "   .inputs = %d,\n", inputs
+  printf "   .outputs = %d,\n", outputs
+  printf "   .input_track_names = {%s},\n", input_track_names
+  printf "   .output_track_names = {%s}\n", output_track_names
+  printf "  },\n"
+  pid = ""
+}
+
+function value (line)
+{
+  sub (/^[^:]*:[ \t]*/, "", line)
+  sub (/[ \t]*,?[ \t]*$/, "", line)
+  return line
+}
+
+BEGIN {
+  print "//Generated from devices.json. Do not edit."
+  print ""
+  print "static const struct ow_device_desc_static OB_DEVICE_DESCS[] = {"
+}
+
+/^[ \t]*"pid"[ \t]*:/ {
+  flush()
+  pid = value($0)
+  inputs = 0
+  outputs = 0
+  input_track_names = ""
+  output_track_names = ""
+  next
+}
+
+/^[ \t]*"name"[ \t]*:/ {
+  name = value($0)
+  next
+}
+
+/^[ \t]*"input_track_names"[ \t]*:/ {
+  array = "input"
+  next
+}
+
+/^[ \t]*"output_track_names"[ \t]*:/ {
+  array = "output"
+  next
+}
+
+/^[ \t]*\][ \t]*,?[ \t]*$/ {
+  array = ""
+  next
+}
+
+array != "" && /^[ \t]*"/ {
+  track = $0
+  sub (/^[ \t]*/, "", track)
+  sub (/[ \t]*,?[ \t]*$/, "", track)
+  if (array == "input")
+    {
+      input_track_names = input_track_names (inputs ? ", " : "") track
+      inputs++
+    }
+  else
+    {
+      output_track_names = output_track_names (outputs ? ", " : "") track
+      outputs++
+    }
+}
+
+END {
+  flush()
+  print "};"
+}
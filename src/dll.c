@@ -54,6 +54,24 @@ ow_dll_overwitch_inc (struct ow_dll_overwitch *dll_ow,
   dll_ow->i1.frames += frames_per_transfer;
 }
 
+//When the frames per transfer change, the loop is set as if it had been initialized with them but the period estimation is kept.
+inline void
+ow_dll_overwitch_set_frames (struct ow_dll_overwitch *dll_ow,
+			     double samplerate, int frames_per_transfer)
+{
+  double dtime = frames_per_transfer / samplerate;
+  double w = 2 * M_PI * 0.1 * dtime;
+  uint32_t last_frames = dll_ow->i1.frames - dll_ow->i0.frames;
+
+  dll_ow->b = 1.6 * w;
+  dll_ow->c = w * w;
+
+  if (last_frames)
+    {
+      dll_ow->e2 *= frames_per_transfer / (double) last_frames;
+    }
+}
+
 //The whole calculation of the delay and the loop filter is taken from https://github.com/jackaudio/tools/blob/master/zalsa/jackclient.cc.
 inline void
 ow_dll_primary_update_err (struct ow_dll *dll, double time)
@@ -124,6 +142,15 @@ ow_dll_primary_first_time_run (struct ow_dll *dll)
   dll->err -= n;
 }
 
+//As the ratio is 1.0 minus the filter state, the integrator is set so that the loop starts from the given ratio.
+inline void
+ow_dll_primary_set_ratio (struct ow_dll *dll, double ratio)
+{
+  dll->ratio = ratio;
+  dll->_z2 = 0.0;
+  dll->_z3 = 1.0 - ratio;
+}
+
 //Taken from https://github.com/jackaudio/tools/blob/master/zalsa/jackclient.cc.
 inline void
 ow_dll_primary_set_loop_filter (struct ow_dll *dll, double bw,
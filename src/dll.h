@@ -65,6 +65,8 @@ void ow_dll_overwitch_init (struct ow_dll_overwitch *, double, int, double);
 
 void ow_dll_overwitch_inc (struct ow_dll_overwitch *, int, double);
 
+void ow_dll_overwitch_set_frames (struct ow_dll_overwitch *, double, int);
+
 void ow_dll_primary_init (struct ow_dll *);
 
 void ow_dll_primary_reset (struct ow_dll *, double, double, int, int);
@@ -79,6 +81,8 @@ void ow_dll_primary_calc_avg (struct ow_dll *, int);
 
 void ow_dll_primary_first_time_run (struct ow_dll *);
 
+void ow_dll_primary_set_ratio (struct ow_dll *, double);
+
 void ow_dll_primary_load_dll_overwitch (struct ow_dll *);
 
 int ow_dll_tuned (struct ow_dll *);
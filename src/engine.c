@@ -29,7 +29,14 @@
 #include <endian.h>
 #include <time.h>
 #include <unistd.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "engine.h"
+#include "histogram.h"
+#include "rtlog.h"
 
 #define AUDIO_OUT_EP 0x03
 #define AUDIO_IN_EP  (AUDIO_OUT_EP | 0x80)
@@ -44,17 +51,65 @@
 
 #define USB_BULK_MIDI_LEN 512
 
-#define USB_CONTROL_LEN (sizeof (struct libusb_control_setup) + OB_NAME_MAX_LEN)
+#define USB_FRAME_TIME 0.001
+
+#define P2O_MIDI_HISTOGRAM_BIN_WIDTH 0.0001
+#define USB_INTERVAL_BINS_PER_TRANSFER 8	//The histogram covers up to 4 transfers.
+#define FILL_BINS_PER_TRANSFER 4	//The histograms cover up to 8 transfers.
 
-#define SAMPLE_TIME_NS (1e9 / ((int)OB_SAMPLE_RATE))
+#define USB_CONTROL_LEN (sizeof (struct libusb_control_setup) + OB_NAME_MAX_LEN)
 
-#define INT32_TO_FLOAT32_SCALE ((float) (1.0f / INT_MAX))
 
-static void prepare_cycle_in_audio ();
-static void prepare_cycle_out_audio ();
+static void prepare_cycle_in_audio (struct ow_engine *,
+				    struct libusb_transfer *,
+				    unsigned char *);
+static void prepare_cycle_out_audio (struct ow_engine *,
+				     struct libusb_transfer *,
+				     unsigned char *);
 static void prepare_cycle_in_midi ();
 static void ow_engine_load_overbridge_name (struct ow_engine *);
 
+//Engines in a group are not resubmitted once stopped so that their loop knows when they can be released.
+static inline int
+ow_engine_submit_transfer (struct ow_engine *engine,
+			   struct libusb_transfer *xfr)
+{
+  int err;
+
+  if (engine->loop
+      && ow_engine_get_status (engine) <= OW_ENGINE_STATUS_STOP)
+    {
+      return LIBUSB_SUCCESS;
+    }
+
+  err = libusb_submit_transfer (xfr);
+  if (!err)
+    {
+      atomic_fetch_add_explicit (&engine->usb.xfr_in_flight, 1,
+				 memory_order_relaxed);
+    }
+  return err;
+}
+
+static inline void
+ow_engine_complete_transfer (struct ow_engine *engine)
+{
+  atomic_fetch_sub_explicit (&engine->usb.xfr_in_flight, 1,
+			     memory_order_relaxed);
+}
+
+//Threads waiting for a status change sleep on the status itself.
+static inline void
+ow_engine_wait_while_status (struct ow_engine *engine,
+			     ow_engine_status_t status)
+{
+  while (ow_engine_get_status (engine) == status)
+    {
+      syscall (SYS_futex, (int *) &engine->status, FUTEX_WAIT_PRIVATE,
+	       status, NULL, NULL, 0);
+    }
+}
+
 static void
 ow_engine_init_name (struct ow_engine *engine, uint8_t bus, uint8_t address)
 {
@@ -66,16 +121,19 @@ ow_engine_init_name (struct ow_engine *engine, uint8_t bus, uint8_t address)
 static int
 prepare_transfers (struct ow_engine *engine)
 {
-  engine->usb.xfr_audio_in = libusb_alloc_transfer (0);
-  if (!engine->usb.xfr_audio_in)
+  for (int i = 0; i < OW_MAX_AUDIO_TRANSFERS; i++)
     {
-      return -ENOMEM;
-    }
+      engine->usb.xfr_audio_in[i] = libusb_alloc_transfer (0);
+      if (!engine->usb.xfr_audio_in[i])
+	{
+	  return -ENOMEM;
+	}
 
-  engine->usb.xfr_audio_out = libusb_alloc_transfer (0);
-  if (!engine->usb.xfr_audio_out)
-    {
-      return -ENOMEM;
+      engine->usb.xfr_audio_out[i] = libusb_alloc_transfer (0);
+      if (!engine->usb.xfr_audio_out[i])
+	{
+	  return -ENOMEM;
+	}
     }
 
   engine->usb.xfr_midi_in = libusb_alloc_transfer (0);
@@ -108,108 +166,465 @@ prepare_transfers (struct ow_engine *engine)
 static void
 free_transfers (struct ow_engine *engine)
 {
-  libusb_free_transfer (engine->usb.xfr_audio_in);
-  libusb_free_transfer (engine->usb.xfr_audio_out);
+  for (int i = 0; i < OW_MAX_AUDIO_TRANSFERS; i++)
+    {
+      libusb_free_transfer (engine->usb.xfr_audio_in[i]);
+      libusb_free_transfer (engine->usb.xfr_audio_out[i]);
+    }
   libusb_free_transfer (engine->usb.xfr_midi_in);
   libusb_free_transfer (engine->usb.xfr_midi_out);
   libusb_free_transfer (engine->usb.xfr_control_in);
   libusb_free_transfer (engine->usb.xfr_control_out);
 }
 
+//Everything depending on the blocks per transfer is set here so that it matches the transfer being processed.
+static inline void
+ow_engine_set_blocks (struct ow_engine *engine, int blocks)
+{
+  if (blocks == engine->blocks_per_transfer)
+    {
+      return;
+    }
+
+  engine->blocks_per_transfer = blocks;
+  engine->frames_per_transfer = OB_FRAMES_PER_BLOCK * blocks;
+  engine->o2p_transfer_size =
+    engine->frames_per_transfer * engine->o2p_frame_size;
+  engine->p2o_transfer_size =
+    engine->frames_per_transfer * engine->p2o_frame_size;
+  engine->usb.xfr_audio_in_data_len = engine->usb.audio_in_blk_len * blocks;
+  engine->usb.xfr_audio_out_data_len =
+    engine->usb.audio_out_blk_len * blocks;
+  engine->p2o_data.input_frames = engine->frames_per_transfer;
+  engine->p2o_data.output_frames = engine->frames_per_transfer;
+}
+
+//The index list is only rebuilt when the mask changes.
+static inline void
+ow_engine_update_o2p_active_tracks (struct ow_engine *engine)
+{
+  uint64_t mask = atomic_load_explicit (&engine->o2p_active_tracks,
+					memory_order_relaxed);
+
+  if (mask == engine->o2p_index_tracks)
+    {
+      return;
+    }
+
+  engine->o2p_index_tracks = mask;
+  engine->o2p_active_len = 0;
+  for (int i = 0; i < engine->device_desc.outputs; i++)
+    {
+      if (mask & (1ULL << i))
+	{
+	  engine->o2p_active_index[engine->o2p_active_len] = i;
+	  engine->o2p_active_len++;
+	}
+    }
+
+  rt_debug_print (2, "o2p: Decoding %d tracks\n", engine->o2p_active_len);
+}
+
+static inline int
+ow_engine_are_all_o2p_tracks_active (struct ow_engine *engine)
+{
+  return engine->o2p_active_len == engine->device_desc.outputs;
+}
+
+//Only the samples of the active tracks are gathered and converted at once.
+static inline void
+ow_engine_read_usb_input_block_active (struct ow_engine *engine, float *f,
+				       struct ow_engine_usb_blk *blk)
+{
+  int32_t s[OB_FRAMES_PER_BLOCK * OB_MAX_TRACKS];
+  float d[OB_FRAMES_PER_BLOCK * OB_MAX_TRACKS];
+  int outputs = engine->device_desc.outputs;
+  int n = 0;
+
+  for (int j = 0; j < OB_FRAMES_PER_BLOCK; j++)
+    {
+      for (int k = 0; k < engine->o2p_active_len; k++, n++)
+	{
+	  s[n] = blk->data[j * outputs + engine->o2p_active_index[k]];
+	}
+    }
+
+  engine->convert->be32_to_float (d, s, n);
+
+  n = 0;
+  for (int j = 0; j < OB_FRAMES_PER_BLOCK; j++)
+    {
+      for (int k = 0; k < engine->o2p_active_len; k++, n++)
+	{
+	  f[j * outputs + engine->o2p_active_index[k]] = d[n];
+	}
+    }
+}
+
 inline void
 ow_engine_read_usb_input_blocks (struct ow_engine *engine)
 {
-  int32_t hv;
-  int32_t *s;
   struct ow_engine_usb_blk *blk;
   float *f = engine->o2p_transfer_buf;
+  size_t samples = OB_FRAMES_PER_BLOCK * engine->device_desc.outputs;
+
+  ow_engine_update_o2p_active_tracks (engine);
+
+  for (int i = 0; i < engine->blocks_per_transfer; i++)
+    {
+      blk = GET_NTH_INPUT_USB_BLK (engine, i);
+      if (ow_engine_are_all_o2p_tracks_active (engine))
+	{
+	  engine->convert->be32_to_float (f, blk->data, samples);
+	}
+      else
+	{
+	  ow_engine_read_usb_input_block_active (engine, f, blk);
+	}
+      f += samples;
+    }
+}
+
+//Planes of inactive tracks are not touched.
+inline void
+ow_engine_read_usb_input_blocks_planar (struct ow_engine *engine)
+{
+  struct ow_engine_usb_blk *blk;
+  float f[OB_FRAMES_PER_BLOCK * OB_MAX_TRACKS];
+  int32_t t[OB_FRAMES_PER_BLOCK];
+  float *planes[OB_MAX_TRACKS];
+  float *plane;
+  int track;
+  int outputs = engine->device_desc.outputs;
+  size_t samples = OB_FRAMES_PER_BLOCK * outputs;
+
+  ow_engine_update_o2p_active_tracks (engine);
+
+  for (int k = 0; k < outputs; k++)
+    {
+      planes[k] = &engine->o2p_transfer_buf[k * engine->frames_per_transfer];
+    }
+
+  for (int i = 0; i < engine->blocks_per_transfer; i++)
+    {
+      blk = GET_NTH_INPUT_USB_BLK (engine, i);
+      plane = &engine->o2p_transfer_buf[i * OB_FRAMES_PER_BLOCK];
+
+      if (!ow_engine_are_all_o2p_tracks_active (engine))
+	{
+	  for (int k = 0; k < engine->o2p_active_len; k++)
+	    {
+	      track = engine->o2p_active_index[k];
+	      for (int j = 0; j < OB_FRAMES_PER_BLOCK; j++)
+		{
+		  t[j] = blk->data[j * outputs + track];
+		}
+	      engine->convert->be32_to_float (&plane
+					      [track *
+					       engine->frames_per_transfer],
+					      t, OB_FRAMES_PER_BLOCK);
+	    }
+	  continue;
+	}
+
+      engine->convert->be32_to_float (f, blk->data, samples);
+      engine->o2p_interleave->deinterleave (planes,
+					    i * OB_FRAMES_PER_BLOCK, f,
+					    OB_FRAMES_PER_BLOCK, outputs);
+    }
+}
+
+//Blocks are decoded straight into the ring memory, which might be split into two regions.
+static inline void
+ow_engine_read_usb_input_blocks_ring (struct ow_engine *engine)
+{
+  struct ow_engine_usb_blk *blk;
+  struct ow_ring_vector vector[2];
+  struct ow_ring *ring = engine->context->o2p_audio;
+  size_t samples = OB_FRAMES_PER_BLOCK * engine->device_desc.outputs;
+  size_t left, n;
+  const int32_t *s;
+  float *f;
+
+  ow_ring_write_reserve (ring, vector);
+  f = (float *) vector[0].buf;
+  left = vector[0].len / OB_BYTES_PER_SAMPLE;
 
   for (int i = 0; i < engine->blocks_per_transfer; i++)
     {
       blk = GET_NTH_INPUT_USB_BLK (engine, i);
       s = blk->data;
-      for (int j = 0; j < OB_FRAMES_PER_BLOCK; j++)
+      n = samples;
+      if (n > left)
 	{
-	  for (int k = 0; k < engine->device_desc.outputs; k++)
+	  engine->convert->be32_to_float (f, s, left);
+	  s += left;
+	  n -= left;
+	  f = (float *) vector[1].buf;
+	  left = vector[1].len / OB_BYTES_PER_SAMPLE;
+	}
+      engine->convert->be32_to_float (f, s, n);
+      f += n;
+      left -= n;
+    }
+
+  ow_ring_write_commit (ring, engine->o2p_transfer_size);
+}
+
+//In planar mode, the last plane is the last one to be written and read so its read and write spaces are the lowest.
+
+static inline size_t
+ow_engine_get_audio_read_space (struct ow_engine *engine, void *buffer,
+				int tracks)
+{
+  if (engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO)
+    {
+      void **planes = buffer;
+      return engine->context->read_space (planes[tracks - 1]) * tracks;
+    }
+  return engine->context->read_space (buffer);
+}
+
+static inline size_t
+ow_engine_get_audio_write_space (struct ow_engine *engine, void *buffer,
+				 int tracks)
+{
+  if (engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO)
+    {
+      void **planes = buffer;
+      return engine->context->write_space (planes[tracks - 1]) * tracks;
+    }
+  return engine->context->write_space (buffer);
+}
+
+static inline void
+ow_engine_write_o2p_audio (struct ow_engine *engine)
+{
+  void **planes;
+  size_t plane_size;
+
+  if (engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO)
+    {
+      planes = engine->context->o2p_audio;
+      plane_size = engine->frames_per_transfer * OB_BYTES_PER_SAMPLE;
+      for (int i = 0; i < engine->device_desc.outputs; i++)
+	{
+	  //The write space has already been checked for all the planes.
+	  if (!(engine->o2p_index_tracks & (1ULL << i)) &&
+	      (engine->context->options & OW_ENGINE_OPTION_RINGS))
 	    {
-	      hv = be32toh (*s);
-	      *f = INT32_TO_FLOAT32_SCALE * hv;
-	      f++;
-	      s++;
+	      ow_ring_write_commit (planes[i], plane_size);
+	      continue;
 	    }
+	  engine->context->write (planes[i],
+				  (void *) &engine->o2p_transfer_buf[i *
+								     engine->frames_per_transfer],
+				  plane_size);
+	}
+    }
+  else
+    {
+      engine->context->write (engine->context->o2p_audio,
+			      (void *) engine->o2p_transfer_buf,
+			      engine->o2p_transfer_size);
+    }
+}
+
+//In planar mode, buf is filled with contiguous planes of bytes / p2o_frame_size frames.
+static inline void
+ow_engine_read_p2o_audio (struct ow_engine *engine, float *buf, size_t bytes)
+{
+  void **planes;
+  size_t frames;
+
+  if (engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO)
+    {
+      planes = engine->context->p2o_audio;
+      frames = bytes / engine->p2o_frame_size;
+      for (int i = 0; i < engine->device_desc.inputs; i++)
+	{
+	  engine->context->read (planes[i],
+				 buf ? (void *) &buf[i * frames] : NULL,
+				 frames * OB_BYTES_PER_SAMPLE);
 	}
     }
+  else
+    {
+      engine->context->read (engine->context->p2o_audio, (void *) buf,
+			     bytes);
+    }
 }
 
 static void
 set_usb_input_data_blks (struct ow_engine *engine)
 {
-  size_t wso2p;
+  size_t wso2p, latency;
   ow_engine_status_t status;
+  double now;
+  int ring = (engine->context->options & OW_ENGINE_OPTION_RINGS) &&
+    !(engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO);
 
-  pthread_spin_lock (&engine->lock);
-  if (engine->context->dll)
+  //Decoding straight into the ring is only done when all the tracks are active.
+  if (ring)
+    {
+      ow_engine_update_o2p_active_tracks (engine);
+      ring = ow_engine_are_all_o2p_tracks_active (engine);
+    }
+
+  if (engine->context->get_time)
     {
-      ow_dll_overwitch_inc (engine->context->dll, engine->frames_per_transfer,
-			    engine->context->get_time ());
+      now = engine->context->get_time ();
+      ow_seqlock_write_begin (&engine->seqlock);
+      if (engine->context->dll)
+	{
+	  if (engine->o2p_blocks != engine->blocks_per_transfer)
+	    {
+	      ow_dll_overwitch_set_frames (engine->context->dll,
+					   OB_SAMPLE_RATE,
+					   engine->frames_per_transfer);
+	    }
+	  ow_dll_overwitch_inc (engine->context->dll,
+				engine->frames_per_transfer, now);
+	}
+      if (engine->usb_last_time > 0.0)
+	{
+	  ow_histogram_add (&engine->stats.usb_interval,
+			    now - engine->usb_last_time);
+	}
+      ow_seqlock_write_end (&engine->seqlock);
+      engine->usb_last_time = now;
     }
-  status = engine->status;
-  pthread_spin_unlock (&engine->lock);
+  engine->o2p_blocks = engine->blocks_per_transfer;
+  status = ow_engine_get_status (engine);
 
-  ow_engine_read_usb_input_blocks (engine);
+  if (engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO)
+    {
+      ow_engine_read_usb_input_blocks_planar (engine);
+    }
+  else if (!ring)
+    {
+      ow_engine_read_usb_input_blocks (engine);
+    }
 
   if (status < OW_ENGINE_STATUS_RUN)
     {
       return;
     }
 
-  pthread_spin_lock (&engine->lock);
-  engine->o2p_latency =
-    engine->context->read_space (engine->context->o2p_audio);
-  if (engine->o2p_latency > engine->o2p_max_latency)
+  latency = ow_engine_get_audio_read_space (engine,
+					    engine->context->o2p_audio,
+					    engine->device_desc.outputs);
+  ow_seqlock_write_begin (&engine->seqlock);
+  engine->latency.o2p = latency;
+  if (engine->latency.o2p > engine->latency.o2p_max)
     {
-      engine->o2p_max_latency = engine->o2p_latency;
+      engine->latency.o2p_max = engine->latency.o2p;
     }
-  pthread_spin_unlock (&engine->lock);
+  ow_histogram_add (&engine->stats.o2p_fill,
+		    latency / (double) (engine->o2p_frame_size *
+					OB_SAMPLE_RATE));
+  ow_seqlock_write_end (&engine->seqlock);
 
-  wso2p = engine->context->write_space (engine->context->o2p_audio);
+  wso2p =
+    ow_engine_get_audio_write_space (engine, engine->context->o2p_audio,
+				     engine->device_desc.outputs);
   if (engine->o2p_transfer_size <= wso2p)
     {
-      engine->context->write (engine->context->o2p_audio,
-			      (void *) engine->o2p_transfer_buf,
-			      engine->o2p_transfer_size);
+      if (ring)
+	{
+	  ow_engine_read_usb_input_blocks_ring (engine);
+	}
+      else
+	{
+	  ow_engine_write_o2p_audio (engine);
+	}
+      atomic_store_explicit (&engine->o2p_decoded_tracks,
+			     engine->o2p_index_tracks, memory_order_release);
     }
   else
     {
-      error_print ("o2p: Audio ring buffer overflow. Discarding data...\n");
+      rt_error_print ("o2p: Audio ring buffer overflow. Discarding data...\n");
     }
 }
 
 inline void
 ow_engine_write_usb_output_blocks (struct ow_engine *engine)
 {
-  int32_t ov;
-  int32_t *s;
   struct ow_engine_usb_blk *blk;
   float *f = engine->p2o_transfer_buf;
+  size_t samples = OB_FRAMES_PER_BLOCK * engine->device_desc.inputs;
 
   for (int i = 0; i < engine->blocks_per_transfer; i++)
     {
       blk = GET_NTH_OUTPUT_USB_BLK (engine, i);
       blk->frames = htobe16 (engine->usb.audio_frames_counter);
       engine->usb.audio_frames_counter += OB_FRAMES_PER_BLOCK;
-      s = blk->data;
-      for (int j = 0; j < OB_FRAMES_PER_BLOCK; j++)
-	{
-	  for (int k = 0; k < engine->device_desc.inputs; k++)
-	    {
-	      ov = htobe32 ((int32_t) (*f * INT_MAX));
-	      *s = ov;
-	      f++;
-	      s++;
-	    }
-	}
+      engine->convert->float_to_be32 (blk->data, f, samples);
+      f += samples;
+    }
+}
+
+inline void
+ow_engine_write_usb_output_blocks_planar (struct ow_engine *engine)
+{
+  struct ow_engine_usb_blk *blk;
+  float f[OB_FRAMES_PER_BLOCK * OB_MAX_TRACKS];
+  float *planes[OB_MAX_TRACKS];
+  int inputs = engine->device_desc.inputs;
+  size_t samples = OB_FRAMES_PER_BLOCK * inputs;
+
+  for (int k = 0; k < inputs; k++)
+    {
+      planes[k] = &engine->p2o_transfer_buf[k * engine->frames_per_transfer];
+    }
+
+  for (int i = 0; i < engine->blocks_per_transfer; i++)
+    {
+      blk = GET_NTH_OUTPUT_USB_BLK (engine, i);
+      blk->frames = htobe16 (engine->usb.audio_frames_counter);
+      engine->usb.audio_frames_counter += OB_FRAMES_PER_BLOCK;
+      engine->p2o_interleave->interleave (f, planes, i * OB_FRAMES_PER_BLOCK,
+					  OB_FRAMES_PER_BLOCK, inputs);
+      engine->convert->float_to_be32 (blk->data, f, samples);
+    }
+}
+
+//Resampling starts from the last frame of the previous transfer, which is still in the transfer buffer, so there are no discontinuities.
+static int
+ow_engine_resample_p2o (struct ow_engine *engine, int last_frames)
+{
+  ow_interpolator_prime (engine->p2o_interpolator,
+			 &engine->p2o_transfer_buf[(last_frames - 1) *
+						   engine->device_desc.
+						   inputs]);
+  return ow_interpolator_process (engine->p2o_interpolator,
+				  &engine->p2o_data);
+}
+
+//The last frames are saved first as the planes of both transfers might overlap when the blocks change.
+static int
+ow_engine_resample_p2o_planar (struct ow_engine *engine, int last_frames)
+{
+  int res = 0;
+  float last[OB_MAX_TRACKS];
+  SRC_DATA data = engine->p2o_data;
+
+  for (int i = 0; i < engine->device_desc.inputs; i++)
+    {
+      last[i] = engine->p2o_transfer_buf[(i + 1) * last_frames - 1];
     }
+
+  for (int i = 0; i < engine->device_desc.inputs && !res; i++)
+    {
+      data.data_in = &engine->p2o_resampler_buf[i * data.input_frames];
+      data.data_out =
+	&engine->p2o_transfer_buf[i * engine->frames_per_transfer];
+      ow_interpolator_prime (engine->p2o_planar_interpolator, &last[i]);
+      res = ow_interpolator_process (engine->p2o_planar_interpolator, &data);
+    }
+
+  engine->p2o_data.output_frames_gen = data.output_frames_gen;
+  return res;
 }
 
 static void
@@ -220,19 +635,37 @@ set_usb_output_data_blks (struct ow_engine *engine)
   long frames;
   int res;
   int p2o_enabled = ow_engine_is_option (engine, OW_ENGINE_OPTION_P2O_AUDIO);
+  int planar = engine->context->options & OW_ENGINE_OPTION_PLANAR_AUDIO;
+  //Integer samples can not be interpolated so underflows are just muted.
+  int stretch = !(engine->context->options & OW_ENGINE_OPTION_INT32_AUDIO);
+  int last_frames = OB_FRAMES_PER_BLOCK * engine->p2o_blocks;
+
+  //Bigger transfers need more buffered data so the buffer is filled again as when starting.
+  if (engine->blocks_per_transfer > engine->p2o_blocks &&
+      engine->reading_at_p2o_end &&
+      ow_engine_is_option (engine, OW_ENGINE_OPTION_DLL))
+    {
+      rt_debug_print (2, "p2o: Refilling buffer for %d blocks...\n",
+		      engine->blocks_per_transfer);
+      engine->reading_at_p2o_end = 0;
+    }
+  engine->p2o_blocks = engine->blocks_per_transfer;
 
   if (p2o_enabled)
     {
-      rsp2o = engine->context->read_space (engine->context->p2o_audio);
+      rsp2o =
+	ow_engine_get_audio_read_space (engine, engine->context->p2o_audio,
+					engine->device_desc.inputs);
       if (!engine->reading_at_p2o_end)
 	{
 	  if (rsp2o >= engine->p2o_transfer_size &&
 	      ow_engine_get_status (engine) == OW_ENGINE_STATUS_RUN)
 	    {
 	      bytes = ow_bytes_to_frame_bytes (rsp2o, engine->p2o_frame_size);
-	      debug_print (2, "p2o: Emptying buffer (%zu B) and running...\n",
-			   bytes);
-	      engine->context->read (engine->context->p2o_audio, NULL, bytes);
+	      rt_debug_print (2,
+			      "p2o: Emptying buffer (%zu B) and running...\n",
+			      bytes);
+	      ow_engine_read_p2o_audio (engine, NULL, bytes);
 	      engine->reading_at_p2o_end = 1;
 	    }
 	  goto set_blocks;
@@ -242,54 +675,62 @@ set_usb_output_data_blks (struct ow_engine *engine)
     {
       if (engine->reading_at_p2o_end)
 	{
-	  debug_print (3, "p2o: Clearing buffer and stopping...\n");
+	  rt_debug_print (3, "p2o: Clearing buffer and stopping...\n");
 	  memset (engine->p2o_transfer_buf, 0, engine->p2o_transfer_size);
 	  engine->reading_at_p2o_end = 0;
-	  engine->p2o_max_latency = 0;
+	  ow_seqlock_write_begin (&engine->seqlock);
+	  engine->latency.p2o_max = 0;
+	  ow_seqlock_write_end (&engine->seqlock);
 	  goto set_blocks;
 	}
       return;
     }
 
-  pthread_spin_lock (&engine->lock);
-  engine->p2o_latency = rsp2o;
-  if (engine->p2o_latency > engine->p2o_max_latency)
+  ow_seqlock_write_begin (&engine->seqlock);
+  engine->latency.p2o = rsp2o;
+  if (engine->latency.p2o > engine->latency.p2o_max)
     {
-      engine->p2o_max_latency = engine->p2o_latency;
+      engine->latency.p2o_max = engine->latency.p2o;
     }
-  pthread_spin_unlock (&engine->lock);
+  ow_histogram_add (&engine->stats.p2o_fill,
+		    rsp2o / (double) (engine->p2o_frame_size *
+				      OB_SAMPLE_RATE));
+  ow_seqlock_write_end (&engine->seqlock);
 
   if (rsp2o >= engine->p2o_transfer_size)
     {
-      engine->context->read (engine->context->p2o_audio,
-			     (void *) engine->p2o_transfer_buf,
-			     engine->p2o_transfer_size);
+      ow_engine_read_p2o_audio (engine, engine->p2o_transfer_buf,
+				engine->p2o_transfer_size);
     }
-  else if (rsp2o > engine->p2o_frame_size)	//At least 2 frames to apply resampling to
+  else if (stretch && rsp2o > engine->p2o_frame_size)	//At least 2 frames to apply resampling to
     {
-      debug_print (2,
-		   "p2o: Audio ring buffer underflow (%zu B < %zu B). Resampling...\n",
-		   rsp2o, engine->p2o_transfer_size);
+      rt_debug_print (2,
+		      "p2o: Audio ring buffer underflow (%zu B < %zu B). Resampling...\n",
+		      rsp2o, engine->p2o_transfer_size);
       frames = rsp2o / engine->p2o_frame_size;
       bytes = frames * engine->p2o_frame_size;
-      engine->context->read (engine->context->p2o_audio,
-			     (void *) engine->p2o_resampler_buf, bytes);
+      ow_engine_read_p2o_audio (engine, engine->p2o_resampler_buf, bytes);
       engine->p2o_data.input_frames = frames;
       engine->p2o_data.src_ratio =
 	(double) engine->frames_per_transfer / frames;
-      //We should NOT use the simple API but since this only happens very occasionally and mostly at startup, this has very low impact on audio quality.
-      res = src_simple (&engine->p2o_data, SRC_SINC_FASTEST,
-			engine->device_desc.inputs);
+      if (planar)
+	{
+	  res = ow_engine_resample_p2o_planar (engine, last_frames);
+	}
+      else
+	{
+	  res = ow_engine_resample_p2o (engine, last_frames);
+	}
       if (res)
 	{
-	  error_print
-	    ("p2o: Error while resampling %zu frames (%zu B, ratio %f): %s\n",
-	     frames, bytes, engine->p2o_data.src_ratio, src_strerror (res));
+	  rt_error_print
+	    ("p2o: Error while resampling %zu frames (%zu B, ratio %f)\n",
+	     frames, bytes, engine->p2o_data.src_ratio);
 	}
       else if (engine->p2o_data.output_frames_gen !=
 	       engine->frames_per_transfer)
 	{
-	  error_print
+	  rt_error_print
 	    ("p2o: Unexpected frames with ratio %f (output %ld, expected %d)\n",
 	     engine->p2o_data.src_ratio, engine->p2o_data.output_frames_gen,
 	     engine->frames_per_transfer);
@@ -297,64 +738,88 @@ set_usb_output_data_blks (struct ow_engine *engine)
     }
   else
     {
-      debug_print (2, "p2o: Not enough data (%zu B). Waiting...\n", rsp2o);
+      rt_debug_print (2, "p2o: Not enough data (%zu B). Waiting...\n", rsp2o);
       memset (engine->p2o_transfer_buf, 0, engine->p2o_transfer_size);
     }
 
 set_blocks:
-  ow_engine_write_usb_output_blocks (engine);
+  if (planar)
+    {
+      ow_engine_write_usb_output_blocks_planar (engine);
+    }
+  else
+    {
+      ow_engine_write_usb_output_blocks (engine);
+    }
 }
 
 static void LIBUSB_CALL
 cb_xfr_audio_in (struct libusb_transfer *xfr)
 {
+  struct ow_engine *engine = xfr->user_data;
+
+  ow_engine_complete_transfer (engine);
+
   if (xfr->status == LIBUSB_TRANSFER_COMPLETED)
     {
       if (xfr->length < xfr->actual_length)
 	{
-	  error_print
+	  rt_error_print
 	    ("o2p: incomplete USB audio transfer (%d B < %d B)\n",
 	     xfr->length, xfr->actual_length);
 	}
 
-      struct ow_engine *engine = xfr->user_data;
-      if (engine->context->options & OW_ENGINE_OPTION_O2P_AUDIO)
+      if (ow_engine_is_option (engine, OW_ENGINE_OPTION_O2P_AUDIO))
 	{
+	  ow_engine_set_blocks (engine,
+				xfr->length / engine->usb.audio_in_blk_len);
+	  engine->usb.xfr_audio_in_data = xfr->buffer;
 	  set_usb_input_data_blks (engine);
 	}
     }
   else
     {
-      error_print ("o2p: Error on USB audio transfer: %s\n",
-		   libusb_error_name (xfr->status));
+      rt_error_print ("o2p: Error on USB audio transfer: %s\n",
+		      libusb_error_name (xfr->status));
     }
   // start new cycle even if this one did not succeed
-  prepare_cycle_in_audio (xfr->user_data);
+  ow_engine_set_blocks (engine, atomic_load_explicit (&engine->target_blocks,
+						      memory_order_relaxed));
+  prepare_cycle_in_audio (engine, xfr, xfr->buffer);
 }
 
 static void LIBUSB_CALL
 cb_xfr_audio_out (struct libusb_transfer *xfr)
 {
+  struct ow_engine *engine = xfr->user_data;
+
+  ow_engine_complete_transfer (engine);
+
   if (xfr->status == LIBUSB_TRANSFER_COMPLETED)
     {
       if (xfr->length < xfr->actual_length)
 	{
-	  error_print
+	  rt_error_print
 	    ("p2o: incomplete USB audio transfer (%d B < %d B)\n",
 	     xfr->length, xfr->actual_length);
 	}
     }
   else
     {
-      error_print ("p2o: Error on USB audio transfer: %s\n",
-		   libusb_error_name (xfr->status));
+      rt_error_print ("p2o: Error on USB audio transfer: %s\n",
+		      libusb_error_name (xfr->status));
     }
 
-  set_usb_output_data_blks (xfr->user_data);
+  //Transfers complete in the same order they were submitted so the frames counter is always kept consecutive.
+  //The buffer is filled for the next submission so it already uses the target blocks.
+  ow_engine_set_blocks (engine, atomic_load_explicit (&engine->target_blocks,
+						      memory_order_relaxed));
+  engine->usb.xfr_audio_out_data = xfr->buffer;
+  set_usb_output_data_blks (engine);
 
   // We have to make sure that the out cycle is always started after its callback
   // Race condition on slower systems!
-  prepare_cycle_out_audio (xfr->user_data);
+  prepare_cycle_out_audio (engine, xfr, xfr->buffer);
 }
 
 static void LIBUSB_CALL
@@ -364,6 +829,8 @@ cb_xfr_midi_in (struct libusb_transfer *xfr)
   int length;
   struct ow_engine *engine = xfr->user_data;
 
+  ow_engine_complete_transfer (engine);
+
   if (ow_engine_get_status (engine) < OW_ENGINE_STATUS_RUN)
     {
       goto end;
@@ -381,9 +848,9 @@ cb_xfr_midi_in (struct libusb_transfer *xfr)
 	  //Note-off, Note-on, Poly-KeyPress, Control Change, Program Change, Channel Pressure, PitchBend Change, Single Byte
 	  if (event.bytes[0] >= 0x08 && event.bytes[0] <= 0x0f)
 	    {
-	      debug_print (2, "o2p MIDI: %02x, %02x, %02x, %02x (%f)\n",
-			   event.bytes[0], event.bytes[1], event.bytes[2],
-			   event.bytes[3], event.time);
+	      rt_debug_print (2, "o2p MIDI: %02x, %02x, %02x, %02x (%f)\n",
+			      event.bytes[0], event.bytes[1], event.bytes[2],
+			      event.bytes[3], event.time);
 
 	      if (engine->context->write_space (engine->context->o2p_midi) >=
 		  sizeof (struct ow_midi_event))
@@ -394,7 +861,7 @@ cb_xfr_midi_in (struct libusb_transfer *xfr)
 		}
 	      else
 		{
-		  error_print
+		  rt_error_print
 		    ("o2p: MIDI ring buffer overflow. Discarding data...\n");
 		}
 	    }
@@ -405,8 +872,8 @@ cb_xfr_midi_in (struct libusb_transfer *xfr)
     {
       if (xfr->status != LIBUSB_TRANSFER_TIMED_OUT)
 	{
-	  error_print ("Error on USB MIDI in transfer: %s\n",
-		       libusb_strerror (xfr->status));
+	  rt_error_print ("Error on USB MIDI in transfer: %s\n",
+			  libusb_strerror (xfr->status));
 	}
     }
 
@@ -419,49 +886,48 @@ cb_xfr_midi_out (struct libusb_transfer *xfr)
 {
   struct ow_engine *engine = xfr->user_data;
 
-  pthread_spin_lock (&engine->p2o_midi_lock);
+  ow_engine_complete_transfer (engine);
   engine->p2o_midi_ready = 1;
-  pthread_spin_unlock (&engine->p2o_midi_lock);
 
   if (xfr->status != LIBUSB_TRANSFER_COMPLETED)
     {
-      error_print ("Error on USB MIDI out transfer: %s\n",
-		   libusb_strerror (xfr->status));
+      rt_error_print ("Error on USB MIDI out transfer: %s\n",
+		      libusb_strerror (xfr->status));
     }
 }
 
 static void
-prepare_cycle_out_audio (struct ow_engine *engine)
+prepare_cycle_out_audio (struct ow_engine *engine,
+			 struct libusb_transfer *xfr, unsigned char *data)
 {
-  libusb_fill_interrupt_transfer (engine->usb.xfr_audio_out,
-				  engine->usb.device_handle, AUDIO_OUT_EP,
-				  engine->usb.xfr_audio_out_data,
+  libusb_fill_interrupt_transfer (xfr, engine->usb.device_handle,
+				  AUDIO_OUT_EP, data,
 				  engine->usb.xfr_audio_out_data_len,
 				  cb_xfr_audio_out, engine, XFR_TIMEOUT);
 
-  int err = libusb_submit_transfer (engine->usb.xfr_audio_out);
+  int err = ow_engine_submit_transfer (engine, xfr);
   if (err)
     {
-      error_print ("p2o: Error when submitting USB audio transfer: %s\n",
-		   libusb_strerror (err));
+      rt_error_print ("p2o: Error when submitting USB audio transfer: %s\n",
+		      libusb_strerror (err));
       ow_engine_set_status (engine, OW_ENGINE_STATUS_ERROR);
     }
 }
 
 static void
-prepare_cycle_in_audio (struct ow_engine *engine)
+prepare_cycle_in_audio (struct ow_engine *engine,
+			struct libusb_transfer *xfr, unsigned char *data)
 {
-  libusb_fill_interrupt_transfer (engine->usb.xfr_audio_in,
-				  engine->usb.device_handle, AUDIO_IN_EP,
-				  engine->usb.xfr_audio_in_data,
+  libusb_fill_interrupt_transfer (xfr, engine->usb.device_handle,
+				  AUDIO_IN_EP, data,
 				  engine->usb.xfr_audio_in_data_len,
 				  cb_xfr_audio_in, engine, XFR_TIMEOUT);
 
-  int err = libusb_submit_transfer (engine->usb.xfr_audio_in);
+  int err = ow_engine_submit_transfer (engine, xfr);
   if (err)
     {
-      error_print ("o2p: Error when submitting USB audio in transfer: %s\n",
-		   libusb_strerror (err));
+      rt_error_print ("o2p: Error when submitting USB audio in transfer: %s\n",
+		      libusb_strerror (err));
       ow_engine_set_status (engine, OW_ENGINE_STATUS_ERROR);
     }
 }
@@ -475,11 +941,11 @@ prepare_cycle_in_midi (struct ow_engine *engine)
 			     USB_BULK_MIDI_LEN, cb_xfr_midi_in, engine,
 			     XFR_TIMEOUT);
 
-  int err = libusb_submit_transfer (engine->usb.xfr_midi_in);
+  int err = ow_engine_submit_transfer (engine, engine->usb.xfr_midi_in);
   if (err)
     {
-      error_print ("o2p: Error when submitting USB MIDI transfer: %s\n",
-		   libusb_strerror (err));
+      rt_error_print ("o2p: Error when submitting USB MIDI transfer: %s\n",
+		      libusb_strerror (err));
       ow_engine_set_status (engine, OW_ENGINE_STATUS_ERROR);
     }
 }
@@ -493,11 +959,11 @@ prepare_cycle_out_midi (struct ow_engine *engine)
 			     USB_BULK_MIDI_LEN, cb_xfr_midi_out, engine,
 			     XFR_TIMEOUT);
 
-  int err = libusb_submit_transfer (engine->usb.xfr_midi_out);
+  int err = ow_engine_submit_transfer (engine, engine->usb.xfr_midi_out);
   if (err)
     {
-      error_print ("p2o: Error when submitting USB MIDI transfer: %s\n",
-		   libusb_strerror (err));
+      rt_error_print ("p2o: Error when submitting USB MIDI transfer: %s\n",
+		      libusb_strerror (err));
       ow_engine_set_status (engine, OW_ENGINE_STATUS_ERROR);
     }
 }
@@ -505,29 +971,187 @@ prepare_cycle_out_midi (struct ow_engine *engine)
 static void
 usb_shutdown (struct ow_engine *engine)
 {
+  //Engines not backed by a device, as the ones used in the benchmarks, have nothing to release.
+  if (!engine->usb.device_handle)
+    {
+      return;
+    }
+
   libusb_release_interface (engine->usb.device_handle, 1);
   libusb_release_interface (engine->usb.device_handle, 2);
   libusb_release_interface (engine->usb.device_handle, 3);
   libusb_close (engine->usb.device_handle);
-  libusb_exit (engine->usb.context);
+  if (!engine->loop)
+    {
+      libusb_exit (engine->usb.context);
+    }
 }
 
-void
-ow_engine_init_mem (struct ow_engine *engine, int blocks_per_transfer)
+static void
+ow_engine_free_usb_mem (struct ow_engine *engine)
 {
-  struct ow_engine_usb_blk *blk;
-
-  engine->context = NULL;
-
-  pthread_spin_init (&engine->lock, PTHREAD_PROCESS_SHARED);
+#if LIBUSB_API_VERSION >= 0x01000105
+  if (engine->usb.dev_mem)
+    {
+      libusb_device_handle *handle = engine->usb.device_handle;
 
-  engine->blocks_per_transfer = blocks_per_transfer;
-  engine->frames_per_transfer =
-    OB_FRAMES_PER_BLOCK * engine->blocks_per_transfer;
+      //libusb_dev_mem_free does not accept NULL pointers.
+      if (engine->usb.xfr_audio_in_pool)
+	{
+	  libusb_dev_mem_free (handle, engine->usb.xfr_audio_in_pool,
+			       engine->usb.xfr_audio_in_max_len *
+			       OW_MAX_AUDIO_TRANSFERS);
+	}
+      if (engine->usb.xfr_audio_out_pool)
+	{
+	  libusb_dev_mem_free (handle, engine->usb.xfr_audio_out_pool,
+			       engine->usb.xfr_audio_out_max_len *
+			       OW_MAX_AUDIO_TRANSFERS);
+	}
+      if (engine->usb.xfr_midi_out_data)
+	{
+	  libusb_dev_mem_free (handle, engine->usb.xfr_midi_out_data,
+			       USB_BULK_MIDI_LEN);
+	}
+      if (engine->usb.xfr_midi_in_data)
+	{
+	  libusb_dev_mem_free (handle, engine->usb.xfr_midi_in_data,
+			       USB_BULK_MIDI_LEN);
+	}
+      if (engine->usb.xfr_control_out_data)
+	{
+	  libusb_dev_mem_free (handle, engine->usb.xfr_control_out_data,
+			       USB_CONTROL_LEN);
+	}
+      if (engine->usb.xfr_control_in_data)
+	{
+	  libusb_dev_mem_free (handle, engine->usb.xfr_control_in_data,
+			       OB_NAME_MAX_LEN);
+	}
+      engine->usb.dev_mem = 0;
+      return;
+    }
+#endif
+
+  free (engine->usb.xfr_audio_in_pool);
+  free (engine->usb.xfr_audio_out_pool);
+  free (engine->usb.xfr_midi_out_data);
+  free (engine->usb.xfr_midi_in_data);
+  free (engine->usb.xfr_control_out_data);
+  free (engine->usb.xfr_control_in_data);
+}
+
+//With usbfs, memory mapped from the kernel saves the copies of every transfer to and from the user space.
+//All the transfer buffers come from the same allocator so that they are freed the same way.
+static void
+ow_engine_alloc_usb_mem (struct ow_engine *engine)
+{
+  size_t audio_in_len =
+    engine->usb.xfr_audio_in_max_len * OW_MAX_AUDIO_TRANSFERS;
+  size_t audio_out_len =
+    engine->usb.xfr_audio_out_max_len * OW_MAX_AUDIO_TRANSFERS;
+
+  engine->usb.dev_mem = 0;
+
+#if LIBUSB_API_VERSION >= 0x01000105
+  if (engine->usb.device_handle)
+    {
+      libusb_device_handle *handle = engine->usb.device_handle;
+
+      engine->usb.xfr_audio_in_pool =
+	libusb_dev_mem_alloc (handle, audio_in_len);
+      engine->usb.xfr_audio_out_pool =
+	libusb_dev_mem_alloc (handle, audio_out_len);
+      engine->usb.xfr_midi_out_data =
+	libusb_dev_mem_alloc (handle, USB_BULK_MIDI_LEN);
+      engine->usb.xfr_midi_in_data =
+	libusb_dev_mem_alloc (handle, USB_BULK_MIDI_LEN);
+      engine->usb.xfr_control_out_data =
+	libusb_dev_mem_alloc (handle, USB_CONTROL_LEN);
+      engine->usb.xfr_control_in_data =
+	libusb_dev_mem_alloc (handle, OB_NAME_MAX_LEN);
+
+      if (engine->usb.xfr_audio_in_pool && engine->usb.xfr_audio_out_pool
+	  && engine->usb.xfr_midi_out_data && engine->usb.xfr_midi_in_data
+	  && engine->usb.xfr_control_out_data
+	  && engine->usb.xfr_control_in_data)
+	{
+	  debug_print (1, "Using device memory for the USB transfers\n");
+	  engine->usb.dev_mem = 1;
+	}
+      else
+	{
+	  debug_print (1,
+		       "Device memory not available. Using heap memory for the USB transfers...\n");
+	  //The buffers obtained so far are freed with the device allocator.
+	  engine->usb.dev_mem = 1;
+	  ow_engine_free_usb_mem (engine);
+	}
+    }
+#endif
+
+  if (!engine->usb.dev_mem)
+    {
+      engine->usb.xfr_audio_in_pool = malloc (audio_in_len);
+      engine->usb.xfr_audio_out_pool = malloc (audio_out_len);
+      engine->usb.xfr_midi_out_data = malloc (USB_BULK_MIDI_LEN);
+      engine->usb.xfr_midi_in_data = malloc (USB_BULK_MIDI_LEN);
+      engine->usb.xfr_control_out_data = malloc (USB_CONTROL_LEN);
+      engine->usb.xfr_control_in_data = malloc (OB_NAME_MAX_LEN);
+    }
+
+  memset (engine->usb.xfr_audio_in_pool, 0, audio_in_len);
+  memset (engine->usb.xfr_audio_out_pool, 0, audio_out_len);
+  memset (engine->usb.xfr_midi_out_data, 0, USB_BULK_MIDI_LEN);
+  memset (engine->usb.xfr_midi_in_data, 0, USB_BULK_MIDI_LEN);
+}
+
+void
+ow_engine_init_mem (struct ow_engine *engine, int blocks_per_transfer)
+{
+  struct ow_engine_usb_blk *blk;
+  double transfer_time;
+  size_t max_frames;
+
+  engine->context = NULL;
+
+  atomic_init (&engine->status, OW_ENGINE_STATUS_STOP);
+  engine->loop_state = OW_ENGINE_LOOP_STATE_IDLE;
+  atomic_init (&engine->running, 0);
+  atomic_init (&engine->usb.xfr_in_flight, 0);
+
+  ow_seqlock_init (&engine->seqlock);
+  engine->p2o_midi_ready = 1;
+  engine->p2o_midi_event_pending = 0;
+
+  engine->convert = ow_convert_get_kernels ();
+  debug_print (2, "Using %s conversion kernels\n", engine->convert->name);
+
+  engine->o2p_interleave =
+    ow_interleave_get_kernels (engine->device_desc.outputs);
+  engine->p2o_interleave =
+    ow_interleave_get_kernels (engine->device_desc.inputs);
+
+  atomic_init (&engine->o2p_active_tracks, UINT64_MAX);
+  atomic_init (&engine->o2p_decoded_tracks, UINT64_MAX);
+  engine->o2p_index_tracks = 0;
+  engine->o2p_active_len = 0;
 
   engine->o2p_frame_size = OB_BYTES_PER_SAMPLE * engine->device_desc.outputs;
   engine->p2o_frame_size = OB_BYTES_PER_SAMPLE * engine->device_desc.inputs;
 
+  //Bin widths are fixed from the startup blocks even when adaptive blocks change them later, as the Prometheus buckets must not change.
+  transfer_time =
+    OB_FRAMES_PER_BLOCK * blocks_per_transfer / (double) OB_SAMPLE_RATE;
+  ow_histogram_init (&engine->stats.usb_interval,
+		     transfer_time / USB_INTERVAL_BINS_PER_TRANSFER);
+  ow_histogram_init (&engine->stats.o2p_fill,
+		     transfer_time / FILL_BINS_PER_TRANSFER);
+  ow_histogram_init (&engine->stats.p2o_fill,
+		     transfer_time / FILL_BINS_PER_TRANSFER);
+  ow_histogram_init (&engine->stats.p2o_midi, P2O_MIDI_HISTOGRAM_BIN_WIDTH);
+  engine->usb_last_time = 0.0;
+
   debug_print (2, "o2p: USB in frame size: %zu B\n", engine->o2p_frame_size);
   debug_print (2, "p2o: USB out frame size: %zu B\n", engine->p2o_frame_size);
 
@@ -543,59 +1167,59 @@ ow_engine_init_mem (struct ow_engine *engine, int blocks_per_transfer)
   debug_print (2, "p2o: USB out block size: %zu B\n",
 	       engine->usb.audio_out_blk_len);
 
-  engine->o2p_transfer_size =
-    engine->frames_per_transfer * engine->o2p_frame_size;
-  engine->p2o_transfer_size =
-    engine->frames_per_transfer * engine->p2o_frame_size;
+  engine->blocks_per_transfer = 0;
+  ow_engine_set_blocks (engine, blocks_per_transfer);
+  atomic_init (&engine->target_blocks, blocks_per_transfer);
+  engine->o2p_blocks = blocks_per_transfer;
+  engine->p2o_blocks = blocks_per_transfer;
 
   debug_print (2, "o2p: audio transfer size: %zu B\n",
 	       engine->o2p_transfer_size);
   debug_print (2, "p2o: audio transfer size: %zu B\n",
 	       engine->p2o_transfer_size);
 
+  //Every buffer depending on the blocks per transfer is allocated for the maximum so that these can be changed while running.
+  max_frames = OB_FRAMES_PER_BLOCK * OW_ENGINE_MAX_BLOCKS;
   engine->usb.audio_frames_counter = 0;
-  engine->usb.xfr_audio_in_data_len =
-    engine->usb.audio_in_blk_len * engine->blocks_per_transfer;
-  engine->usb.xfr_audio_out_data_len =
-    engine->usb.audio_out_blk_len * engine->blocks_per_transfer;
-  engine->usb.xfr_audio_in_data = malloc (engine->usb.xfr_audio_in_data_len);
-  engine->usb.xfr_audio_out_data =
-    malloc (engine->usb.xfr_audio_out_data_len);
-  memset (engine->usb.xfr_audio_in_data, 0,
-	  engine->usb.xfr_audio_in_data_len);
-  memset (engine->usb.xfr_audio_out_data, 0,
-	  engine->usb.xfr_audio_out_data_len);
-
-  for (int i = 0; i < engine->blocks_per_transfer; i++)
-    {
-      blk = GET_NTH_OUTPUT_USB_BLK (engine, i);
-      blk->header = htobe16 (0x07ff);
+  engine->usb.xfr_audio_in_max_len =
+    engine->usb.audio_in_blk_len * OW_ENGINE_MAX_BLOCKS;
+  engine->usb.xfr_audio_out_max_len =
+    engine->usb.audio_out_blk_len * OW_ENGINE_MAX_BLOCKS;
+  //All the transfers are allocated here as the amount in use is only known when starting.
+  engine->usb.audio_transfers = 1;
+  ow_engine_alloc_usb_mem (engine);
+
+  for (int i = 0; i < OW_MAX_AUDIO_TRANSFERS; i++)
+    {
+      engine->usb.xfr_audio_out_data =
+	&engine->usb.xfr_audio_out_pool[i *
+					engine->usb.xfr_audio_out_max_len];
+      for (int j = 0; j < OW_ENGINE_MAX_BLOCKS; j++)
+	{
+	  blk = GET_NTH_OUTPUT_USB_BLK (engine, j);
+	  blk->header = htobe16 (0x07ff);
+	}
     }
 
-  engine->p2o_transfer_buf = malloc (engine->p2o_transfer_size);
-  engine->o2p_transfer_buf = malloc (engine->o2p_transfer_size);
-  memset (engine->p2o_transfer_buf, 0, engine->p2o_transfer_size);
-  memset (engine->o2p_transfer_buf, 0, engine->o2p_transfer_size);
+  engine->usb.xfr_audio_in_data = engine->usb.xfr_audio_in_pool;
+  engine->usb.xfr_audio_out_data = engine->usb.xfr_audio_out_pool;
+
+  engine->p2o_transfer_buf = malloc (max_frames * engine->p2o_frame_size);
+  engine->o2p_transfer_buf = malloc (max_frames * engine->o2p_frame_size);
+  memset (engine->p2o_transfer_buf, 0, max_frames * engine->p2o_frame_size);
+  memset (engine->o2p_transfer_buf, 0, max_frames * engine->o2p_frame_size);
 
   //o2p resampler
-  engine->p2o_resampler_buf = malloc (engine->p2o_transfer_size);
-  memset (engine->p2o_resampler_buf, 0, engine->p2o_transfer_size);
+  engine->p2o_resampler_buf = malloc (max_frames * engine->p2o_frame_size);
+  memset (engine->p2o_resampler_buf, 0, max_frames * engine->p2o_frame_size);
   engine->p2o_data.data_in = engine->p2o_resampler_buf;
   engine->p2o_data.data_out = engine->p2o_transfer_buf;
   engine->p2o_data.end_of_input = 1;
-  engine->p2o_data.input_frames = engine->frames_per_transfer;
-  engine->p2o_data.output_frames = engine->frames_per_transfer;
-
-  //MIDI
-  engine->usb.xfr_midi_out_data = malloc (USB_BULK_MIDI_LEN);
-  engine->usb.xfr_midi_in_data = malloc (USB_BULK_MIDI_LEN);
-  memset (engine->usb.xfr_midi_out_data, 0, USB_BULK_MIDI_LEN);
-  memset (engine->usb.xfr_midi_in_data, 0, USB_BULK_MIDI_LEN);
-  pthread_spin_init (&engine->p2o_midi_lock, PTHREAD_PROCESS_SHARED);
-
-  //Control
-  engine->usb.xfr_control_out_data = malloc (USB_CONTROL_LEN);
-  engine->usb.xfr_control_in_data = malloc (OB_NAME_MAX_LEN);
+  engine->p2o_interpolator =
+    ow_interpolator_new (OW_INTERPOLATOR_LINEAR, engine->device_desc.inputs,
+			 NULL, NULL);
+  engine->p2o_planar_interpolator =
+    ow_interpolator_new (OW_INTERPOLATOR_LINEAR, 1, NULL, NULL);
 }
 
 // initialization taken from sniffed session
@@ -712,6 +1336,7 @@ ow_engine_init_from_libusb_device_descriptor (struct ow_engine **engine_,
     }
 
   engine = malloc (sizeof (struct ow_engine));
+  engine->loop = NULL;
 
   if (libusb_init (&engine->usb.context) != LIBUSB_SUCCESS)
     {
@@ -760,6 +1385,18 @@ ow_err_t
 ow_engine_init_from_bus_address (struct ow_engine **engine_,
 				 uint8_t bus, uint8_t address,
 				 int blocks_per_transfer)
+{
+  return ow_engine_init_from_bus_address_in_group (engine_, NULL, bus,
+						   address,
+						   blocks_per_transfer);
+}
+
+//Devices are spread across the loops of the group in the order they are added.
+ow_err_t
+ow_engine_init_from_bus_address_in_group (struct ow_engine **engine_,
+					  struct ow_engine_group *group,
+					  uint8_t bus, uint8_t address,
+					  int blocks_per_transfer)
 {
   int err;
   ow_err_t ret;
@@ -771,10 +1408,20 @@ ow_engine_init_from_bus_address (struct ow_engine **engine_,
 
   engine = malloc (sizeof (struct ow_engine));
 
-  if (libusb_init (&engine->usb.context) != LIBUSB_SUCCESS)
+  if (group)
     {
-      ret = OW_USB_ERROR_LIBUSB_INIT_FAILED;
-      goto error;
+      engine->loop = &group->loops[group->next_loop % group->loops_len];
+      group->next_loop++;
+      engine->usb.context = engine->loop->context;
+    }
+  else
+    {
+      engine->loop = NULL;
+      if (libusb_init (&engine->usb.context) != LIBUSB_SUCCESS)
+	{
+	  ret = OW_USB_ERROR_LIBUSB_INIT_FAILED;
+	  goto error;
+	}
     }
 
   engine->usb.device_handle = NULL;
@@ -844,168 +1491,392 @@ static const char *ob_err_strgs[] = {
   "'o2p_midi' not set in context",
   "'p2o_midi' not set in context",
   "'get_time' not set in context",
-  "'dll' not set in context"
+  "'dll' not set in context",
+  "int32 audio can not be used with the DLL or planar audio"
 };
 
-static void *
-run_p2o_midi (void *data)
+//Events are sent when their time comes and all the events inside the same USB frame are sent in a single transfer.
+//While a transfer is in flight, nothing is done as its callback will run the event loop again.
+//This returns the time until the next pending event or a negative value if there is nothing to wait for.
+static double
+ow_engine_schedule_p2o_midi (struct ow_engine *engine)
 {
-  int pos, p2o_midi_ready, event_read = 0;
-  double last_time, diff;
-  struct timespec sleep_time, smallest_sleep_time;
-  struct ow_midi_event event;
-  struct ow_engine *engine = data;
-
-  smallest_sleep_time.tv_sec = 0;
-  smallest_sleep_time.tv_nsec = SAMPLE_TIME_NS * 32 / 2;	//Average wait time for a 32 buffer sample
+  int pos = 0;
+  double now, frame_end;
+  struct ow_midi_event *event = &engine->p2o_midi_event;
 
-  pos = 0;
-  diff = 0.0;
-  last_time = engine->context->get_time ();
-  engine->p2o_midi_ready = 1;
-  while (1)
+  if (!engine->p2o_midi_ready ||
+      !ow_engine_is_option (engine, OW_ENGINE_OPTION_P2O_MIDI))
     {
+      return -1.0;
+    }
 
-      while (engine->context->read_space (engine->context->p2o_midi) >=
-	     sizeof (struct ow_midi_event) && pos < USB_BULK_MIDI_LEN)
-	{
-	  if (!pos)
-	    {
-	      memset (engine->usb.xfr_midi_out_data, 0, USB_BULK_MIDI_LEN);
-	      diff = 0;
-	    }
+  now = engine->context->get_time ();
+  frame_end = (floor (now / USB_FRAME_TIME) + 1) * USB_FRAME_TIME;
 
-	  if (!event_read)
-	    {
-	      engine->context->read (engine->context->p2o_midi,
-				     (void *) &event,
-				     sizeof (struct ow_midi_event));
-	      event_read = 1;
-	    }
-
-	  if (event.time > last_time)
+  while (pos < USB_BULK_MIDI_LEN)
+    {
+      if (!engine->p2o_midi_event_pending)
+	{
+	  if (engine->context->read_space (engine->context->p2o_midi) <
+	      sizeof (struct ow_midi_event))
 	    {
-	      diff = event.time - last_time;
-	      last_time = event.time;
 	      break;
 	    }
-
-	  memcpy (&engine->usb.xfr_midi_out_data[pos], event.bytes,
-		  OB_MIDI_EVENT_SIZE);
-	  pos += OB_MIDI_EVENT_SIZE;
-	  event_read = 0;
+	  engine->context->read (engine->context->p2o_midi, (void *) event,
+				 sizeof (struct ow_midi_event));
+	  engine->p2o_midi_event_pending = 1;
 	}
 
-      if (pos)
+      if (event->time >= frame_end)
 	{
-	  debug_print (2, "Event frames: %f; diff: %f\n", event.time, diff);
-	  engine->p2o_midi_ready = 0;
-	  prepare_cycle_out_midi (engine);
-	  pos = 0;
+	  break;
 	}
 
-      if (diff)
-	{
-	  sleep_time.tv_sec = diff;
-	  sleep_time.tv_nsec = (diff - sleep_time.tv_sec) * 1.0e9;
-	  nanosleep (&sleep_time, NULL);
-	}
-      else
+      if (!pos)
 	{
-	  nanosleep (&smallest_sleep_time, NULL);
+	  memset (engine->usb.xfr_midi_out_data, 0, USB_BULK_MIDI_LEN);
 	}
+      memcpy (&engine->usb.xfr_midi_out_data[pos], event->bytes,
+	      OB_MIDI_EVENT_SIZE);
+      pos += OB_MIDI_EVENT_SIZE;
+      engine->p2o_midi_event_pending = 0;
 
-      pthread_spin_lock (&engine->p2o_midi_lock);
-      p2o_midi_ready = engine->p2o_midi_ready;
-      pthread_spin_unlock (&engine->p2o_midi_lock);
-      while (!p2o_midi_ready)
-	{
-	  nanosleep (&smallest_sleep_time, NULL);
-	  pthread_spin_lock (&engine->p2o_midi_lock);
-	  p2o_midi_ready = engine->p2o_midi_ready;
-	  pthread_spin_unlock (&engine->p2o_midi_lock);
-	};
+      ow_seqlock_write_begin (&engine->seqlock);
+      ow_histogram_add (&engine->stats.p2o_midi, fabs (now - event->time));
+      ow_seqlock_write_end (&engine->seqlock);
+    }
 
-      if (ow_engine_get_status (engine) <= OW_ENGINE_STATUS_STOP)
-	{
-	  break;
-	}
+  if (pos)
+    {
+      rt_debug_print (2, "Sending %d MIDI events at %f...\n",
+		      pos / OB_MIDI_EVENT_SIZE, now);
+      engine->p2o_midi_ready = 0;
+      prepare_cycle_out_midi (engine);
+      return -1.0;
     }
 
-  return NULL;
+  if (engine->p2o_midi_event_pending)
+    {
+      return event->time - now;
+    }
+
+  return -1.0;
+}
+
+static inline void
+ow_engine_handle_usb_events (libusb_context * context, double wait)
+{
+  struct timeval tv;
+
+  if (wait < 0)
+    {
+      libusb_handle_events_completed (context, NULL);
+    }
+  else
+    {
+      tv.tv_sec = wait;
+      tv.tv_usec = (wait - tv.tv_sec) * 1.0e6;
+      libusb_handle_events_timeout_completed (context, &tv, NULL);
+    }
+}
+
+//Both these calls always need to be called and can not be skipped.
+static void
+ow_engine_start_transfers (struct ow_engine *engine)
+{
+  rt_debug_print (1, "Using %d audio transfers per direction...\n",
+		  engine->usb.audio_transfers);
+  for (int i = 0; i < engine->usb.audio_transfers; i++)
+    {
+      prepare_cycle_in_audio (engine, engine->usb.xfr_audio_in[i],
+			      &engine->usb.xfr_audio_in_pool[i *
+							     engine->usb.xfr_audio_in_max_len]);
+      prepare_cycle_out_audio (engine, engine->usb.xfr_audio_out[i],
+			       &engine->usb.xfr_audio_out_pool[i *
+							       engine->usb.xfr_audio_out_max_len]);
+    }
+  if (ow_engine_is_option (engine, OW_ENGINE_OPTION_O2P_MIDI))
+    {
+      prepare_cycle_in_midi (engine);
+    }
+}
+
+//status == OW_ENGINE_STATUS_BOOT
+static void
+ow_engine_boot (struct ow_engine *engine)
+{
+  engine->reading_at_p2o_end =
+    ow_engine_is_option (engine, OW_ENGINE_OPTION_DLL) ? 0 : 1;
+
+  ow_seqlock_write_begin (&engine->seqlock);
+  memset (&engine->latency, 0, sizeof (struct ow_engine_latency));
+  ow_seqlock_write_end (&engine->seqlock);
+  engine->usb_last_time = 0.0;
+
+  if (engine->context->dll)
+    {
+      ow_seqlock_write_begin (&engine->seqlock);
+      ow_dll_overwitch_init (engine->context->dll, OB_SAMPLE_RATE,
+			     engine->frames_per_transfer,
+			     engine->context->get_time ());
+      engine->o2p_blocks = engine->blocks_per_transfer;
+      ow_seqlock_write_end (&engine->seqlock);
+      ow_engine_set_status (engine, OW_ENGINE_STATUS_WAIT);
+    }
+  else
+    {
+      ow_engine_set_status (engine, OW_ENGINE_STATUS_RUN);
+    }
+}
+
+//status == OW_ENGINE_STATUS_BOOT
+static void
+ow_engine_reboot (struct ow_engine *engine)
+{
+  size_t rsp2o, bytes;
+
+  rt_debug_print (1, "Rebooting engine...\n");
+
+  rsp2o =
+    ow_engine_get_audio_read_space (engine, engine->context->p2o_audio,
+				    engine->device_desc.inputs);
+  bytes = ow_bytes_to_frame_bytes (rsp2o, engine->p2o_frame_size);
+  ow_engine_read_p2o_audio (engine, NULL, bytes);
+  memset (engine->p2o_transfer_buf, 0, engine->p2o_transfer_size);
 }
 
 static void *
 run_audio_o2p_midi (void *data)
 {
-  size_t rsp2o, bytes;
   struct ow_engine *engine = data;
 
-  while (ow_engine_get_status (engine) == OW_ENGINE_STATUS_READY);
+  ow_engine_wait_while_status (engine, OW_ENGINE_STATUS_READY);
 
-  //status == OW_ENGINE_STATUS_BOOT
+  ow_engine_start_transfers (engine);
 
-  //Both these calls always need to be called and can not be skipped.
-  prepare_cycle_in_audio (engine);
-  prepare_cycle_out_audio (engine);
-  if (engine->context->options & OW_ENGINE_OPTION_O2P_MIDI)
+  while (1)
     {
-      prepare_cycle_in_midi (engine);
+      ow_engine_boot (engine);
+
+      while (ow_engine_get_status (engine) >= OW_ENGINE_STATUS_WAIT)
+	{
+	  ow_engine_handle_usb_events (engine->usb.context,
+				       ow_engine_schedule_p2o_midi (engine));
+	}
+
+      if (ow_engine_get_status (engine) < OW_ENGINE_STATUS_BOOT)
+	{
+	  break;
+	}
+
+      ow_engine_reboot (engine);
     }
 
-  while (1)
+  return NULL;
+}
+
+//This runs the same steps as run_audio_o2p_midi but without blocking so that many engines can share a thread.
+//Returns 1 when the engine can be released.
+int
+ow_engine_loop_step (struct ow_engine *engine)
+{
+  ow_engine_status_t status = ow_engine_get_status (engine);
+
+  switch (engine->loop_state)
     {
-      engine->p2o_latency = 0;
-      engine->p2o_max_latency = 0;
-      engine->reading_at_p2o_end =
-	engine->context->options & OW_ENGINE_OPTION_DLL ? 0 : 1;
-      engine->o2p_latency = 0;
-      engine->o2p_max_latency = 0;
+    case OW_ENGINE_LOOP_STATE_IDLE:
+      if (status == OW_ENGINE_STATUS_READY)
+	{
+	  return 0;
+	}
+      ow_engine_start_transfers (engine);
+      ow_engine_boot (engine);
+      engine->loop_state = OW_ENGINE_LOOP_STATE_RUN;
+      return 0;
+    case OW_ENGINE_LOOP_STATE_RUN:
+      if (status >= OW_ENGINE_STATUS_WAIT)
+	{
+	  return 0;
+	}
+      if (status == OW_ENGINE_STATUS_BOOT)
+	{
+	  ow_engine_reboot (engine);
+	  ow_engine_boot (engine);
+	  return 0;
+	}
+      engine->loop_state = OW_ENGINE_LOOP_STATE_DRAIN;
+      break;
+    case OW_ENGINE_LOOP_STATE_DRAIN:
+      break;
+    }
 
-      //status == OW_ENGINE_STATUS_BOOT
+  return !atomic_load_explicit (&engine->usb.xfr_in_flight,
+				memory_order_relaxed);
+}
 
-      pthread_spin_lock (&engine->lock);
-      if (engine->context->dll)
+//The slot is freed before waking up the engine owner so that the engine can be started again right away.
+void
+ow_engine_loop_release (struct ow_engine_loop *loop, int slot)
+{
+  struct ow_engine *engine = atomic_load (&loop->engines[slot]);
+
+  rt_debug_print (1, "Releasing %s from its loop...\n", engine->name);
+  atomic_store (&loop->engines[slot], NULL);
+  atomic_store_explicit (&engine->running, 0, memory_order_release);
+  syscall (SYS_futex, (int *) &engine->running, FUTEX_WAKE_PRIVATE, INT_MAX,
+	   NULL, NULL, 0);
+}
+
+static void *
+run_engine_loop (void *data)
+{
+  double wait, next;
+  struct ow_engine *engine;
+  struct ow_engine_loop *loop = data;
+
+  while (!atomic_load (&loop->end))
+    {
+      wait = -1.0;
+      for (int i = 0; i < OW_ENGINE_GROUP_MAX_ENGINES; i++)
 	{
-	  ow_dll_overwitch_init (engine->context->dll, OB_SAMPLE_RATE,
-				 engine->frames_per_transfer,
-				 engine->context->get_time ());
-	  engine->status = OW_ENGINE_STATUS_WAIT;
+	  engine = atomic_load (&loop->engines[i]);
+	  if (!engine)
+	    {
+	      continue;
+	    }
+
+	  if (ow_engine_loop_step (engine))
+	    {
+	      ow_engine_loop_release (loop, i);
+	      continue;
+	    }
+
+	  if (engine->loop_state == OW_ENGINE_LOOP_STATE_RUN)
+	    {
+	      next = ow_engine_schedule_p2o_midi (engine);
+	      if (next >= 0 && (wait < 0 || next < wait))
+		{
+		  wait = next;
+		}
+	    }
+	  else if (engine->loop_state == OW_ENGINE_LOOP_STATE_DRAIN)
+	    {
+	      //Transfers complete or time out so this will not take long.
+	      wait = 0.001;
+	    }
 	}
-      else
+
+      ow_engine_handle_usb_events (loop->context, wait);
+    }
+
+  return NULL;
+}
+
+ow_err_t
+ow_engine_group_init (struct ow_engine_group **group_, int loops)
+{
+  struct ow_engine_loop *loop;
+  struct ow_engine_group *group;
+
+  if (loops < 1)
+    {
+      return OW_GENERIC_ERROR;
+    }
+
+  group = malloc (sizeof (struct ow_engine_group));
+  group->loops = malloc (sizeof (struct ow_engine_loop) * loops);
+  group->loops_len = 0;
+  group->next_loop = 0;
+
+  for (int i = 0; i < loops; i++)
+    {
+      loop = &group->loops[i];
+      atomic_init (&loop->end, 0);
+      for (int j = 0; j < OW_ENGINE_GROUP_MAX_ENGINES; j++)
 	{
-	  engine->status = OW_ENGINE_STATUS_RUN;
+	  atomic_init (&loop->engines[j], NULL);
 	}
-      pthread_spin_unlock (&engine->lock);
 
-      while (ow_engine_get_status (engine) >= OW_ENGINE_STATUS_WAIT)
+      if (libusb_init (&loop->context) != LIBUSB_SUCCESS)
 	{
-	  libusb_handle_events_completed (engine->usb.context, NULL);
+	  ow_engine_group_destroy (group);
+	  return OW_USB_ERROR_LIBUSB_INIT_FAILED;
 	}
 
-      if (ow_engine_get_status (engine) < OW_ENGINE_STATUS_BOOT)
+      if (pthread_create (&loop->thread, NULL, run_engine_loop, loop))
 	{
-	  break;
+	  error_print ("Could not start group thread\n");
+	  libusb_exit (loop->context);
+	  ow_engine_group_destroy (group);
+	  return OW_GENERIC_ERROR;
 	}
+      ow_set_thread_rt_priority (loop->thread, OW_DEFAULT_RT_PROPERTY);
 
-      //status == OW_ENGINE_STATUS_BOOT
+      group->loops_len++;
+    }
 
-      debug_print (1, "Rebooting engine...\n");
+  debug_print (1, "Using %d USB event threads...\n", group->loops_len);
 
-      rsp2o = engine->context->read_space (engine->context->p2o_audio);
-      bytes = ow_bytes_to_frame_bytes (rsp2o, engine->p2o_frame_size);
-      engine->context->read (engine->context->p2o_audio, NULL, bytes);
-      memset (engine->p2o_transfer_buf, 0, engine->p2o_transfer_size);
+  *group_ = group;
+  return OW_OK;
+}
+
+void
+ow_engine_group_destroy (struct ow_engine_group *group)
+{
+  struct ow_engine_loop *loop = group->loops;
+
+  for (int i = 0; i < group->loops_len; i++, loop++)
+    {
+      atomic_store (&loop->end, 1);
+      libusb_interrupt_event_handler (loop->context);
+      pthread_join (loop->thread, NULL);
+      libusb_exit (loop->context);
     }
 
-  return NULL;
+  free (group->loops);
+  free (group);
+}
+
+//Engines in a group are started by adding them to their loop.
+ow_err_t
+ow_engine_loop_add (struct ow_engine *engine)
+{
+  struct ow_engine *expected;
+  struct ow_engine_loop *loop = engine->loop;
+
+  engine->loop_state = OW_ENGINE_LOOP_STATE_IDLE;
+  atomic_store (&engine->running, 1);
+
+  for (int i = 0; i < OW_ENGINE_GROUP_MAX_ENGINES; i++)
+    {
+      expected = NULL;
+      if (atomic_compare_exchange_strong (&loop->engines[i], &expected,
+					  engine))
+	{
+	  engine->context->set_rt_priority (loop->thread,
+					    engine->context->priority);
+	  if (engine->context->cpu_mask)
+	    {
+	      ow_set_thread_affinity (loop->thread,
+				      engine->context->cpu_mask);
+	    }
+	  libusb_interrupt_event_handler (loop->context);
+	  return OW_OK;
+	}
+    }
+
+  error_print ("Too many engines in the same loop (%d)\n",
+	       OW_ENGINE_GROUP_MAX_ENGINES);
+  atomic_store (&engine->running, 0);
+  return OW_GENERIC_ERROR;
 }
 
 ow_err_t
 ow_engine_start (struct ow_engine *engine, struct ow_context *context)
 {
   int audio_o2p_midi_thread = 0;
-  int p2o_midi_thread = 0;
 
   engine->context = context;
 
@@ -1014,6 +1885,23 @@ ow_engine_start (struct ow_engine *engine, struct ow_context *context)
       return OW_GENERIC_ERROR;
     }
 
+  if (context->options & OW_ENGINE_OPTION_RINGS)
+    {
+      ow_ring_set_context_functions (context);
+    }
+
+  engine->usb.audio_transfers = context->transfers;
+  if (engine->usb.audio_transfers < 1)
+    {
+      engine->usb.audio_transfers = 1;
+    }
+  else if (engine->usb.audio_transfers > OW_MAX_AUDIO_TRANSFERS)
+    {
+      error_print ("Too many audio transfers (%d). Using %d...\n",
+		   engine->usb.audio_transfers, OW_MAX_AUDIO_TRANSFERS);
+      engine->usb.audio_transfers = OW_MAX_AUDIO_TRANSFERS;
+    }
+
   if (context->options & OW_ENGINE_OPTION_O2P_AUDIO)
     {
       audio_o2p_midi_thread = 1;
@@ -1067,7 +1955,7 @@ ow_engine_start (struct ow_engine *engine, struct ow_context *context)
 
   if (context->options & OW_ENGINE_OPTION_P2O_MIDI)
     {
-      p2o_midi_thread = 1;
+      audio_o2p_midi_thread = 1;
       if (!context->get_time)
 	{
 	  return OW_INIT_ERROR_NO_GET_TIME;
@@ -1088,26 +1976,44 @@ ow_engine_start (struct ow_engine *engine, struct ow_context *context)
 	{
 	  return OW_INIT_ERROR_NO_DLL;
 	}
-      engine->status = OW_ENGINE_STATUS_READY;
+      ow_engine_set_status (engine, OW_ENGINE_STATUS_READY);
     }
 
+  if (context->options & OW_ENGINE_OPTION_INT32_AUDIO)
+    {
+      if (context->options &
+	  (OW_ENGINE_OPTION_DLL | OW_ENGINE_OPTION_PLANAR_AUDIO))
+	{
+	  return OW_INIT_ERROR_INT32_AUDIO;
+	}
+      engine->convert = ow_convert_get_int32_kernels ();
+      debug_print (2, "Using %s conversion kernels\n",
+		   engine->convert->name);
+    }
+  else
+    {
+      engine->convert = ow_convert_get_kernels ();
+    }
+
+  atomic_store_explicit (&engine->options, context->options,
+			 memory_order_relaxed);
+
   if (!context->set_rt_priority)
     {
       context->set_rt_priority = ow_set_thread_rt_priority;
       context->priority = OW_DEFAULT_RT_PROPERTY;
     }
 
-  if (p2o_midi_thread)
+  //Every engine buffer has already been written so locking is enough to have them resident. Threads created from now on get their stacks locked too.
+  if (context->lock_memory)
     {
-      debug_print (1, "Starting p2o MIDI thread...\n");
-      if (pthread_create (&engine->p2o_midi_thread, NULL, run_p2o_midi,
-			  engine))
-	{
-	  error_print ("Could not start MIDI thread\n");
-	  return OW_GENERIC_ERROR;
-	}
-      context->set_rt_priority (engine->p2o_midi_thread,
-				engine->context->priority);
+      ow_lock_memory ();
+    }
+
+  if (audio_o2p_midi_thread && engine->loop)
+    {
+      debug_print (1, "Adding engine to its group loop...\n");
+      return ow_engine_loop_add (engine);
     }
 
   if (audio_o2p_midi_thread)
@@ -1121,6 +2027,11 @@ ow_engine_start (struct ow_engine *engine, struct ow_context *context)
 	}
       context->set_rt_priority (engine->audio_o2p_midi_thread,
 				engine->context->priority);
+      if (context->cpu_mask)
+	{
+	  ow_set_thread_affinity (engine->audio_o2p_midi_thread,
+				  context->cpu_mask);
+	}
     }
 
   return OW_OK;
@@ -1129,10 +2040,19 @@ ow_engine_start (struct ow_engine *engine, struct ow_context *context)
 inline void
 ow_engine_wait (struct ow_engine *engine)
 {
-  pthread_join (engine->audio_o2p_midi_thread, NULL);
-  if (engine->context->options & OW_ENGINE_OPTION_P2O_MIDI)
+  int running;
+
+  if (!engine->loop)
+    {
+      pthread_join (engine->audio_o2p_midi_thread, NULL);
+      return;
+    }
+
+  while ((running = atomic_load_explicit (&engine->running,
+					  memory_order_acquire)))
     {
-      pthread_join (engine->p2o_midi_thread, NULL);
+      syscall (SYS_futex, (int *) &engine->running, FUTEX_WAIT_PRIVATE,
+	       running, NULL, NULL, 0);
     }
 }
 
@@ -1142,12 +2062,13 @@ ow_get_err_str (ow_err_t errcode)
   return ob_err_strgs[errcode];
 }
 
+//Device memory is freed before closing the device as it belongs to the handle.
 void
 ow_engine_destroy (struct ow_engine *engine)
 {
-  usb_shutdown (engine);
   free_transfers (engine);
   ow_engine_free_mem (engine);
+  usb_shutdown (engine);
   free (engine);
 }
 
@@ -1157,66 +2078,161 @@ ow_engine_free_mem (struct ow_engine *engine)
   free (engine->p2o_transfer_buf);
   free (engine->p2o_resampler_buf);
   free (engine->o2p_transfer_buf);
-  free (engine->usb.xfr_audio_in_data);
-  free (engine->usb.xfr_audio_out_data);
-  free (engine->usb.xfr_midi_out_data);
-  free (engine->usb.xfr_midi_in_data);
-  free (engine->usb.xfr_control_out_data);
-  free (engine->usb.xfr_control_in_data);
-  pthread_spin_destroy (&engine->lock);
-  pthread_spin_destroy (&engine->p2o_midi_lock);
+  ow_interpolator_delete (engine->p2o_interpolator);
+  ow_interpolator_delete (engine->p2o_planar_interpolator);
+  ow_engine_free_usb_mem (engine);
   ow_free_device_desc (&engine->device_desc);
 }
 
 inline ow_engine_status_t
 ow_engine_get_status (struct ow_engine *engine)
 {
-  ow_engine_status_t status;
-  pthread_spin_lock (&engine->lock);
-  status = engine->status;
-  pthread_spin_unlock (&engine->lock);
-  return status;
+  return atomic_load_explicit (&engine->status, memory_order_acquire);
 }
 
 inline void
 ow_engine_set_status (struct ow_engine *engine, ow_engine_status_t status)
 {
-  pthread_spin_lock (&engine->lock);
-  engine->status = status;
-  pthread_spin_unlock (&engine->lock);
+  if (atomic_exchange_explicit (&engine->status, status,
+				memory_order_release) != status)
+    {
+      syscall (SYS_futex, (int *) &engine->status, FUTEX_WAKE_PRIVATE,
+	       INT_MAX, NULL, NULL, 0);
+      //Loops also need to know when their engines leave the ready status.
+      if (engine->usb.context && (status <= OW_ENGINE_STATUS_STOP
+				  || engine->loop))
+	{
+	  libusb_interrupt_event_handler (engine->usb.context);
+	}
+    }
+}
+
+void
+ow_engine_notify_p2o_midi (struct ow_engine *engine)
+{
+  libusb_interrupt_event_handler (engine->usb.context);
+}
+
+void
+ow_engine_get_p2o_midi_histogram (struct ow_engine *engine,
+				  struct ow_histogram *histogram)
+{
+  unsigned int seq;
+
+  do
+    {
+      seq = ow_seqlock_read_begin (&engine->seqlock);
+      *histogram = engine->stats.p2o_midi;
+    }
+  while (ow_seqlock_read_retry (&engine->seqlock, seq));
+}
+
+void
+ow_engine_get_stats (struct ow_engine *engine, struct ow_engine_stats *stats)
+{
+  unsigned int seq;
+
+  do
+    {
+      seq = ow_seqlock_read_begin (&engine->seqlock);
+      *stats = engine->stats;
+    }
+  while (ow_seqlock_read_retry (&engine->seqlock, seq));
 }
 
 inline int
 ow_engine_is_option (struct ow_engine *engine, ow_engine_option_t option)
 {
-  int enabled;
-  pthread_spin_lock (&engine->lock);
-  enabled = (engine->context->options & option) != 0;
-  pthread_spin_unlock (&engine->lock);
-  return enabled;
+  return (atomic_load_explicit (&engine->options, memory_order_relaxed) &
+	  option) != 0;
 }
 
 inline void
 ow_engine_set_option (struct ow_engine *engine, ow_engine_option_t option,
 		      int enabled)
 {
-  int last = ow_engine_is_option (engine, option);
-  if (last != enabled)
+  int last;
+
+  if (enabled)
     {
-      pthread_spin_lock (&engine->lock);
-      if (enabled)
-	{
-	  engine->context->options |= option;
-	}
-      else
-	{
-	  engine->context->options &= ~option;
-	}
-      pthread_spin_unlock (&engine->lock);
-      debug_print (1, "Setting option %d to %d...\n", option, enabled);
+      last = atomic_fetch_or_explicit (&engine->options, option,
+				       memory_order_relaxed);
+    }
+  else
+    {
+      last = atomic_fetch_and_explicit (&engine->options, ~option,
+					memory_order_relaxed);
+    }
+
+  if (((last & option) != 0) != (enabled != 0))
+    {
+      rt_debug_print (1, "Setting option %d to %d...\n", option, enabled);
+    }
+}
+
+void
+ow_engine_set_blocks_per_transfer (struct ow_engine *engine, int blocks)
+{
+  int last;
+
+  if (blocks < OW_ENGINE_MIN_BLOCKS)
+    {
+      blocks = OW_ENGINE_MIN_BLOCKS;
+    }
+  else if (blocks > OW_ENGINE_MAX_BLOCKS)
+    {
+      blocks = OW_ENGINE_MAX_BLOCKS;
+    }
+
+  last = atomic_exchange_explicit (&engine->target_blocks, blocks,
+				   memory_order_relaxed);
+  //This is also called from the host thread when adapting the blocks.
+  if (last != blocks)
+    {
+      rt_debug_print (1, "Setting blocks per transfer to %d...\n", blocks);
     }
 }
 
+int
+ow_engine_get_blocks_per_transfer (struct ow_engine *engine)
+{
+  return atomic_load_explicit (&engine->target_blocks, memory_order_relaxed);
+}
+
+void
+ow_engine_set_o2p_active_tracks (struct ow_engine *engine, uint64_t mask)
+{
+  uint64_t last = atomic_exchange_explicit (&engine->o2p_active_tracks, mask,
+					    memory_order_relaxed);
+
+  if (last != mask)
+    {
+      debug_print (1, "Setting o2p active tracks to 0x%" PRIx64 "...\n",
+		   mask);
+    }
+}
+
+uint64_t
+ow_engine_get_o2p_active_tracks (struct ow_engine *engine)
+{
+  return atomic_load_explicit (&engine->o2p_decoded_tracks,
+			       memory_order_acquire);
+}
+
+void
+ow_engine_get_latency (struct ow_engine *engine,
+		       struct ow_engine_latency *latency)
+{
+  unsigned int seq;
+
+  do
+    {
+      seq = ow_seqlock_read_begin (&engine->seqlock);
+      *latency = engine->latency;
+    }
+  while (ow_seqlock_read_retry (&engine->seqlock, seq));
+}
+
 inline int
 ow_bytes_to_frame_bytes (int bytes, int bytes_per_frame)
 {
@@ -1307,6 +2323,8 @@ ow_engine_load_overbridge_name (struct ow_engine *engine)
 static void LIBUSB_CALL
 cb_xfr_control_out (struct libusb_transfer *xfr)
 {
+  ow_engine_complete_transfer (xfr->user_data);
+
   if (xfr->status != LIBUSB_TRANSFER_COMPLETED)
     {
       error_print ("Error on USB control out transfer: %s\n",
@@ -1331,7 +2349,7 @@ ow_engine_set_overbridge_name (struct ow_engine *engine, const char *name)
 				engine->usb.xfr_control_out_data,
 				cb_xfr_control_out, engine, XFR_TIMEOUT);
 
-  int err = libusb_submit_transfer (engine->usb.xfr_control_out);
+  int err = ow_engine_submit_transfer (engine, engine->usb.xfr_control_out);
   if (err)
     {
       error_print ("Error when submitting USB control transfer: %s\n",
@@ -22,6 +22,9 @@
  * SOFTWARE.
  */
 
+#ifndef ENGINE_H
+#define ENGINE_H
+
 /*
  Protocol details known so far
  -----------------------------
@@ -149,6 +152,10 @@
 #include <pthread.h>
 #include "utils.h"
 #include "dll.h"
+#include "convert.h"
+#include "interleave.h"
+#include "interpolator.h"
+#include "seqlock.h"
 #include "overwitch.h"
 
 #define GET_NTH_USB_BLK(blks,blk_len,n) ((struct ow_engine_usb_blk *) &blks[n * blk_len])
@@ -159,20 +166,62 @@
 
 #define OB_NAME_MAX_LEN 32
 
+#define OW_ENGINE_GROUP_MAX_ENGINES 16
+
+//Values in bytes
+struct ow_engine_latency
+{
+  size_t o2p;
+  size_t o2p_max;
+  size_t p2o;
+  size_t p2o_max;
+};
+
+typedef enum
+{
+  OW_ENGINE_LOOP_STATE_IDLE = 0,
+  OW_ENGINE_LOOP_STATE_RUN,
+  OW_ENGINE_LOOP_STATE_DRAIN
+} ow_engine_loop_state_t;
+
+//Every loop is an event thread with its own libusb context serving some engines.
+//Engines are only added to a loop when started and only the loop removes them once they are stopped and have no transfers in flight.
+struct ow_engine_loop
+{
+  libusb_context *context;
+  pthread_t thread;
+  atomic_int end;
+  _Atomic (struct ow_engine *) engines[OW_ENGINE_GROUP_MAX_ENGINES];
+};
+
+struct ow_engine_group
+{
+  int loops_len;
+  int next_loop;
+  struct ow_engine_loop *loops;
+};
+
 struct ow_engine
 {
   char name[OW_LABEL_MAX_LEN];
   char overbridge_name[OB_NAME_MAX_LEN];
-  ow_engine_status_t status;
+  _Atomic ow_engine_status_t status;
+  atomic_int options;		//Copied from the context when starting as options can be changed on the fly.
+  //These are the values of the transfer being processed and might change on every one.
   int blocks_per_transfer;
   int frames_per_transfer;
-  pthread_spinlock_t lock;
-  size_t o2p_latency;
-  size_t o2p_max_latency;
-  size_t p2o_latency;
-  size_t p2o_max_latency;
-  pthread_t audio_o2p_midi_thread;
-  pthread_t p2o_midi_thread;
+  atomic_int target_blocks;	//Blocks of the transfers to be submitted.
+  //Blocks of the last processed transfer in every direction. Only used by the audio thread.
+  int o2p_blocks;
+  int p2o_blocks;
+  //Only the audio thread writes the latency and the DLL data so this never blocks it.
+  struct ow_seqlock seqlock;
+  struct ow_engine_latency latency;
+  pthread_t audio_o2p_midi_thread;	//p2o MIDI is also sent from this thread.
+  //Only set for engines in a group.
+  struct ow_engine_loop *loop;
+  ow_engine_loop_state_t loop_state;
+  atomic_int running;
   struct ow_device_desc device_desc;
   size_t p2o_transfer_size;
   size_t o2p_transfer_size;
@@ -180,20 +229,39 @@ struct ow_engine
   float *o2p_transfer_buf;
   size_t o2p_frame_size;
   size_t p2o_frame_size;
+  //Requested by the clients. The audio thread publishes the mask it decodes once a transfer has been written with it.
+  _Atomic uint64_t o2p_active_tracks;
+  _Atomic uint64_t o2p_decoded_tracks;
+  //Only used by the audio thread.
+  uint64_t o2p_index_tracks;
+  int o2p_active_len;
+  int o2p_active_index[OB_MAX_TRACKS];
+  const struct ow_convert_kernels *convert;
+  //Used by the planar audio.
+  const struct ow_interleave_kernels *o2p_interleave;
+  const struct ow_interleave_kernels *p2o_interleave;
   struct
   {
     libusb_context *context;
     libusb_device_handle *device_handle;
+    atomic_int xfr_in_flight;
     //Audio
     uint16_t audio_frames_counter;
-    struct libusb_transfer *xfr_audio_in;
-    struct libusb_transfer *xfr_audio_out;
+    int audio_transfers;
+    struct libusb_transfer *xfr_audio_in[OW_MAX_AUDIO_TRANSFERS];
+    struct libusb_transfer *xfr_audio_out[OW_MAX_AUDIO_TRANSFERS];
+    unsigned char *xfr_audio_in_pool;
+    unsigned char *xfr_audio_out_pool;
+    //These point to the data of the transfers being processed.
     unsigned char *xfr_audio_in_data;
     unsigned char *xfr_audio_out_data;
     size_t audio_in_blk_len;
     size_t audio_out_blk_len;
     int xfr_audio_in_data_len;
     int xfr_audio_out_data_len;
+    //Distance between the transfers in the pools, which are allocated for OW_ENGINE_MAX_BLOCKS.
+    int xfr_audio_in_max_len;
+    int xfr_audio_out_max_len;
     //MIDI
     struct libusb_transfer *xfr_midi_out;
     struct libusb_transfer *xfr_midi_in;
@@ -204,14 +272,21 @@ struct ow_engine
     struct libusb_transfer *xfr_control_in;
     unsigned char *xfr_control_out_data;
     unsigned char *xfr_control_in_data;
+    int dev_mem;		//Set if the transfer buffers are device memory.
   } usb;
   //j2o resampler
   float *p2o_resampler_buf;
   SRC_DATA p2o_data;
+  //Created beforehand so that underflows never allocate in the audio thread.
+  struct ow_interpolator *p2o_interpolator;
+  struct ow_interpolator *p2o_planar_interpolator;
   //MIDI
   int reading_at_p2o_end;
-  pthread_spinlock_t p2o_midi_lock;
   int p2o_midi_ready;
+  int p2o_midi_event_pending;
+  struct ow_midi_event p2o_midi_event;
+  struct ow_engine_stats stats;
+  double usb_last_time;
   struct ow_context *context;
 };
 
@@ -229,8 +304,22 @@ void ow_engine_read_usb_input_blocks (struct ow_engine *);
 
 void ow_engine_write_usb_output_blocks (struct ow_engine *);
 
+void ow_engine_read_usb_input_blocks_planar (struct ow_engine *);
+
+void ow_engine_write_usb_output_blocks_planar (struct ow_engine *);
+
 void ow_engine_init_mem (struct ow_engine *, int);
 
 void ow_engine_free_mem (struct ow_engine *);
 
+int ow_engine_loop_step (struct ow_engine *);
+
+ow_err_t ow_engine_loop_add (struct ow_engine *);
+
+void ow_engine_loop_release (struct ow_engine_loop *, int);
+
 void ow_engine_print_blocks (struct ow_engine *, char *, size_t);
+
+void ow_engine_get_latency (struct ow_engine *, struct ow_engine_latency *);
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ *   gather.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "gather.h"
+
+#if defined(__SSE__)
+#define OW_GATHER_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OW_GATHER_NEON 1
+#include <arm_neon.h>
+#endif
+
+//Comparisons are written this way so the existing peak is kept with NaNs and the compiler can emit min and max instructions.
+
+static inline void
+ow_gather_track (struct ow_gather *gather, int k, int track, float *dst,
+		 const float *src, size_t frames)
+{
+  float mx = gather->max[k];
+  float mn = gather->min[k];
+  float *d = dst ? &dst[k] : NULL;
+
+  src += track;
+  for (size_t i = 0; i < frames; i++)
+    {
+      float x = *src;
+      if (d)
+	{
+	  *d = x;
+	  d += gather->count;
+	}
+      mx = x > mx ? x : mx;
+      mn = x < mn ? x : mn;
+      src += gather->tracks;
+    }
+
+  gather->max[k] = mx;
+  gather->min[k] = mn;
+}
+
+//Tracks are traversed in groups of 4 and for every group the whole block is processed keeping the peaks in registers.
+//With a NULL dst only the peaks are computed.
+static inline void
+ow_gather_range (struct ow_gather *gather, float *dst, const float *src,
+		 size_t frames)
+{
+  int k = 0;
+
+#if defined(OW_GATHER_SSE) || defined(OW_GATHER_NEON)
+  for (; k + 4 <= gather->count; k += 4)
+    {
+      const float *s = &src[gather->first + k];
+      float *d = dst ? &dst[k] : NULL;
+#if defined(OW_GATHER_SSE)
+      __m128 mx = _mm_loadu_ps (&gather->max[k]);
+      __m128 mn = _mm_loadu_ps (&gather->min[k]);
+
+      for (size_t i = 0; i < frames; i++)
+	{
+	  __m128 v = _mm_loadu_ps (s);
+	  if (d)
+	    {
+	      _mm_storeu_ps (d, v);
+	      d += gather->count;
+	    }
+	  mx = _mm_max_ps (v, mx);
+	  mn = _mm_min_ps (v, mn);
+	  s += gather->tracks;
+	}
+
+      _mm_storeu_ps (&gather->max[k], mx);
+      _mm_storeu_ps (&gather->min[k], mn);
+#else
+      float32x4_t mx = vld1q_f32 (&gather->max[k]);
+      float32x4_t mn = vld1q_f32 (&gather->min[k]);
+
+      for (size_t i = 0; i < frames; i++)
+	{
+	  float32x4_t v = vld1q_f32 (s);
+	  if (d)
+	    {
+	      vst1q_f32 (d, v);
+	      d += gather->count;
+	    }
+	  mx = vmaxq_f32 (v, mx);
+	  mn = vminq_f32 (v, mn);
+	  s += gather->tracks;
+	}
+
+      vst1q_f32 (&gather->max[k], mx);
+      vst1q_f32 (&gather->min[k], mn);
+#endif
+    }
+#endif
+
+  for (; k < gather->count; k++)
+    {
+      ow_gather_track (gather, k, gather->first + k, dst, src, frames);
+    }
+}
+
+static void
+ow_gather_all (struct ow_gather *gather, float *dst, const float *src,
+	       size_t frames)
+{
+  memcpy (dst, src, frames * gather->tracks * OB_BYTES_PER_SAMPLE);
+  ow_gather_range (gather, NULL, src, frames);
+}
+
+static void
+ow_gather_contiguous (struct ow_gather *gather, float *dst, const float *src,
+		      size_t frames)
+{
+  ow_gather_range (gather, dst, src, frames);
+}
+
+static void
+ow_gather_stereo (struct ow_gather *gather, float *dst, const float *src,
+		  size_t frames)
+{
+#if defined(OW_GATHER_SSE)
+  __m128 mx = _mm_loadl_pi (_mm_setzero_ps (), (const __m64 *) gather->max);
+  __m128 mn = _mm_loadl_pi (_mm_setzero_ps (), (const __m64 *) gather->min);
+
+  src += gather->first;
+  for (size_t i = 0; i < frames; i++)
+    {
+      __m128 v = _mm_loadl_pi (_mm_setzero_ps (), (const __m64 *) src);
+      _mm_storel_pi ((__m64 *) dst, v);
+      mx = _mm_max_ps (v, mx);
+      mn = _mm_min_ps (v, mn);
+      src += gather->tracks;
+      dst += 2;
+    }
+
+  _mm_storel_pi ((__m64 *) gather->max, mx);
+  _mm_storel_pi ((__m64 *) gather->min, mn);
+#elif defined(OW_GATHER_NEON)
+  float32x2_t mx = vld1_f32 (gather->max);
+  float32x2_t mn = vld1_f32 (gather->min);
+
+  src += gather->first;
+  for (size_t i = 0; i < frames; i++)
+    {
+      float32x2_t v = vld1_f32 (src);
+      vst1_f32 (dst, v);
+      mx = vmax_f32 (v, mx);
+      mn = vmin_f32 (v, mn);
+      src += gather->tracks;
+      dst += 2;
+    }
+
+  vst1_f32 (gather->max, mx);
+  vst1_f32 (gather->min, mn);
+#else
+  ow_gather_range (gather, dst, src, frames);
+#endif
+}
+
+static void
+ow_gather_indexed (struct ow_gather *gather, float *dst, const float *src,
+		   size_t frames)
+{
+  for (int k = 0; k < gather->count; k++)
+    {
+      ow_gather_track (gather, k, gather->index[k], dst, src, frames);
+    }
+}
+
+void
+ow_gather_peaks (struct ow_gather *gather, const float *src, size_t frames)
+{
+  if (gather->kernel == ow_gather_indexed)
+    {
+      for (int k = 0; k < gather->count; k++)
+	{
+	  ow_gather_track (gather, k, gather->index[k], NULL, src, frames);
+	}
+    }
+  else
+    {
+      ow_gather_range (gather, NULL, src, frames);
+    }
+}
+
+void
+ow_gather_reset_peaks (struct ow_gather *gather)
+{
+  for (int k = 0; k < OB_MAX_TRACKS; k++)
+    {
+      gather->max[k] = 0.0f;
+      gather->min[k] = 0.0f;
+    }
+}
+
+int
+ow_gather_init (struct ow_gather *gather, int tracks, const char *mask)
+{
+  size_t mask_len = mask ? strlen (mask) : tracks;
+
+  gather->tracks = tracks;
+  gather->count = 0;
+  for (int i = 0; i < tracks; i++)
+    {
+      if (!mask || (i < mask_len && mask[i] != '0'))
+	{
+	  gather->index[gather->count] = i;
+	  gather->count++;
+	}
+    }
+
+  gather->first = gather->count ? gather->index[0] : 0;
+  ow_gather_reset_peaks (gather);
+
+  if (gather->count && gather->index[gather->count - 1] - gather->first ==
+      gather->count - 1)
+    {
+      if (gather->count == tracks)
+	{
+	  gather->kernel = ow_gather_all;
+	  gather->kernel_name = "all";
+	}
+      else if (gather->count == 2)
+	{
+	  gather->kernel = ow_gather_stereo;
+	  gather->kernel_name = "stereo";
+	}
+      else
+	{
+	  gather->kernel = ow_gather_contiguous;
+	  gather->kernel_name = "contiguous";
+	}
+    }
+  else
+    {
+      gather->kernel = ow_gather_indexed;
+      gather->kernel_name = "indexed";
+    }
+
+  return gather->count;
+}
@@ -0,0 +1,63 @@
+/*
+ *   gather.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GATHER_H
+#define GATHER_H
+
+#include <stddef.h>
+#include "overwitch.h"
+
+//Selection of some tracks from interleaved frames together with their peaks.
+//The track mask is compiled once into an index list and the kernel is chosen from it so nothing is parsed per sample.
+
+struct ow_gather;
+
+typedef void (*ow_gather_kernel_t) (struct ow_gather *, float *,
+				    const float *, size_t);
+
+struct ow_gather
+{
+  int tracks;			//Tracks in the source frames
+  int count;			//Selected tracks
+  int first;			//First selected track, used by the contiguous kernels
+  int index[OB_MAX_TRACKS];
+  float max[OB_MAX_TRACKS];	//Peaks of the selected tracks
+  float min[OB_MAX_TRACKS];
+  ow_gather_kernel_t kernel;
+  const char *kernel_name;
+};
+
+//A NULL mask selects all the tracks. Otherwise, every character different from '0' selects its track and the tracks beyond the mask length are not selected.
+//Returns the amount of selected tracks.
+int ow_gather_init (struct ow_gather *, int, const char *);
+
+void ow_gather_reset_peaks (struct ow_gather *);
+
+//Only update the peaks of the selected tracks.
+void ow_gather_peaks (struct ow_gather *, const float *, size_t);
+
+static inline void
+ow_gather_run (struct ow_gather *gather, float *dst, const float *src,
+	       size_t frames)
+{
+  gather->kernel (gather, dst, src, frames);
+}
+
+#endif
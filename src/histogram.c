@@ -0,0 +1,77 @@
+/*
+ *   histogram.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "histogram.h"
+
+void
+ow_histogram_init (struct ow_histogram *histogram, double bin_width)
+{
+  memset (histogram, 0, sizeof (struct ow_histogram));
+  histogram->bin_width = bin_width;
+}
+
+void
+ow_histogram_add (struct ow_histogram *histogram, double value)
+{
+  //Clamping is done before the conversion as a NaN or a quotient out of the int range, which a zero bin width gives, are undefined behavior.
+  double bin = value / histogram->bin_width;
+
+  if (!(bin >= 0))
+    {
+      bin = 0;
+    }
+  else if (bin >= OW_HISTOGRAM_BINS)
+    {
+      bin = OW_HISTOGRAM_BINS - 1;
+    }
+
+  histogram->bins[(int) bin]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max)
+    {
+      histogram->max = value;
+    }
+}
+
+double
+ow_histogram_get_percentile (struct ow_histogram *histogram, double fraction)
+{
+  uint64_t acc = 0;
+  uint64_t target = ceil (histogram->count * fraction);
+
+  if (!histogram->count)
+    {
+      return 0.0;
+    }
+
+  for (int i = 0; i < OW_HISTOGRAM_BINS - 1; i++)
+    {
+      acc += histogram->bins[i];
+      if (acc >= target)
+	{
+	  return (i + 1) * histogram->bin_width;
+	}
+    }
+
+  return histogram->max;
+}
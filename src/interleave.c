@@ -0,0 +1,223 @@
+/*
+ *   interleave.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "interleave.h"
+
+#if defined(__SSE__)
+#define OW_INTERLEAVE_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OW_INTERLEAVE_NEON
+#include <arm_neon.h>
+#endif
+
+//The track count of the specialized kernels is a constant so these are always inlined.
+
+static inline __attribute__ ((always_inline)) void
+ow_deinterleave_tracks (float *const *planes, size_t offset,
+			const float *src, size_t frames, int tracks)
+{
+  for (size_t i = 0; i < frames; i++)
+    {
+      for (int k = 0; k < tracks; k++)
+	{
+	  planes[k][offset + i] = *src;
+	  src++;
+	}
+    }
+}
+
+static inline __attribute__ ((always_inline)) void
+ow_interleave_tracks (float *dst, float *const *planes, size_t offset,
+		      size_t frames, int tracks)
+{
+  for (size_t i = 0; i < frames; i++)
+    {
+      for (int k = 0; k < tracks; k++)
+	{
+	  *dst = planes[k][offset + i];
+	  dst++;
+	}
+    }
+}
+
+//Rows s0 to s3 are stored as columns in d0 to d3.
+static inline __attribute__ ((always_inline)) void
+ow_transpose_4x4 (float *d0, float *d1, float *d2, float *d3,
+		  const float *s0, const float *s1, const float *s2,
+		  const float *s3)
+{
+#if defined(OW_INTERLEAVE_SSE)
+  __m128 r0 = _mm_loadu_ps (s0);
+  __m128 r1 = _mm_loadu_ps (s1);
+  __m128 r2 = _mm_loadu_ps (s2);
+  __m128 r3 = _mm_loadu_ps (s3);
+  _MM_TRANSPOSE4_PS (r0, r1, r2, r3);
+  _mm_storeu_ps (d0, r0);
+  _mm_storeu_ps (d1, r1);
+  _mm_storeu_ps (d2, r2);
+  _mm_storeu_ps (d3, r3);
+#elif defined(OW_INTERLEAVE_NEON)
+  float32x4x2_t r01 = vtrnq_f32 (vld1q_f32 (s0), vld1q_f32 (s1));
+  float32x4x2_t r23 = vtrnq_f32 (vld1q_f32 (s2), vld1q_f32 (s3));
+  vst1q_f32 (d0, vcombine_f32 (vget_low_f32 (r01.val[0]),
+			       vget_low_f32 (r23.val[0])));
+  vst1q_f32 (d1, vcombine_f32 (vget_low_f32 (r01.val[1]),
+			       vget_low_f32 (r23.val[1])));
+  vst1q_f32 (d2, vcombine_f32 (vget_high_f32 (r01.val[0]),
+			       vget_high_f32 (r23.val[0])));
+  vst1q_f32 (d3, vcombine_f32 (vget_high_f32 (r01.val[1]),
+			       vget_high_f32 (r23.val[1])));
+#else
+  float *d[] = { d0, d1, d2, d3 };
+  const float *s[] = { s0, s1, s2, s3 };
+  for (int i = 0; i < 4; i++)
+    {
+      for (int j = 0; j < 4; j++)
+	{
+	  d[j][i] = s[i][j];
+	}
+    }
+#endif
+}
+
+//When the track count is a multiple of 4, tiles of 4 frames by 4 tracks are transposed in registers.
+//The remaining frames are copied one by one.
+
+static inline __attribute__ ((always_inline)) void
+ow_deinterleave_tiles (float *const *planes, size_t offset,
+		       const float *src, size_t frames, int tracks)
+{
+  size_t i;
+
+  for (i = 0; i + 4 <= frames; i += 4)
+    {
+      const float *s = &src[i * tracks];
+      for (int k = 0; k < tracks; k += 4)
+	{
+	  ow_transpose_4x4 (&planes[k][offset + i],
+			    &planes[k + 1][offset + i],
+			    &planes[k + 2][offset + i],
+			    &planes[k + 3][offset + i], &s[k],
+			    &s[tracks + k], &s[2 * tracks + k],
+			    &s[3 * tracks + k]);
+	}
+    }
+
+  ow_deinterleave_tracks (planes, offset + i, &src[i * tracks], frames - i,
+			  tracks);
+}
+
+static inline __attribute__ ((always_inline)) void
+ow_interleave_tiles (float *dst, float *const *planes, size_t offset,
+		     size_t frames, int tracks)
+{
+  size_t i;
+
+  for (i = 0; i + 4 <= frames; i += 4)
+    {
+      float *d = &dst[i * tracks];
+      for (int k = 0; k < tracks; k += 4)
+	{
+	  ow_transpose_4x4 (&d[k], &d[tracks + k], &d[2 * tracks + k],
+			    &d[3 * tracks + k], &planes[k][offset + i],
+			    &planes[k + 1][offset + i],
+			    &planes[k + 2][offset + i],
+			    &planes[k + 3][offset + i]);
+	}
+    }
+
+  ow_interleave_tracks (&dst[i * tracks], planes, offset + i, frames - i,
+			tracks);
+}
+
+static void
+ow_deinterleave_generic (float *const *planes, size_t offset,
+			 const float *src, size_t frames, int tracks)
+{
+  ow_deinterleave_tracks (planes, offset, src, frames, tracks);
+}
+
+static void
+ow_interleave_generic (float *dst, float *const *planes, size_t offset,
+		       size_t frames, int tracks)
+{
+  ow_interleave_tracks (dst, planes, offset, frames, tracks);
+}
+
+//The method is either tracks or tiles.
+#define OW_INTERLEAVE_KERNELS(n, method) \
+static void \
+ow_deinterleave_##n (float *const *planes, size_t offset, \
+		     const float *src, size_t frames, int tracks) \
+{ \
+  ow_deinterleave_##method (planes, offset, src, frames, n); \
+} \
+ \
+static void \
+ow_interleave_##n (float *dst, float *const *planes, size_t offset, \
+		   size_t frames, int tracks) \
+{ \
+  ow_interleave_##method (dst, planes, offset, frames, n); \
+}
+
+OW_INTERLEAVE_KERNELS (2, tracks)
+OW_INTERLEAVE_KERNELS (4, tiles)
+OW_INTERLEAVE_KERNELS (6, tracks)
+OW_INTERLEAVE_KERNELS (8, tiles)
+OW_INTERLEAVE_KERNELS (12, tiles)
+OW_INTERLEAVE_KERNELS (20, tiles)
+
+#define OW_INTERLEAVE_ENTRY(n) {n, ow_deinterleave_##n, ow_interleave_##n}
+
+//These are the input and output track counts in res/devices.json.
+static const struct ow_interleave_kernels KERNELS[] = {
+  OW_INTERLEAVE_ENTRY (2),
+  OW_INTERLEAVE_ENTRY (4),
+  OW_INTERLEAVE_ENTRY (6),
+  OW_INTERLEAVE_ENTRY (8),
+  OW_INTERLEAVE_ENTRY (12),
+  OW_INTERLEAVE_ENTRY (20)
+};
+
+static const struct ow_interleave_kernels GENERIC_KERNELS = {
+  .tracks = 0,
+  .deinterleave = ow_deinterleave_generic,
+  .interleave = ow_interleave_generic
+};
+
+const struct ow_interleave_kernels *
+ow_interleave_get_kernels (int tracks)
+{
+  for (int i = 0; i < sizeof (KERNELS) / sizeof (KERNELS[0]); i++)
+    {
+      if (KERNELS[i].tracks == tracks)
+	{
+	  return &KERNELS[i];
+	}
+    }
+  return &GENERIC_KERNELS;
+}
+
+const struct ow_interleave_kernels *
+ow_interleave_get_generic_kernels ()
+{
+  return &GENERIC_KERNELS;
+}
@@ -0,0 +1,46 @@
+/*
+ *   interleave.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include <stddef.h>
+
+//Copies between interleaved frames and planes of tracks.
+//There are kernels for the track counts of the known devices, which transpose tiles of 4 frames by 4 tracks when possible, and a generic one for any other count.
+
+//The planes are written and read from the given offset.
+typedef void (*ow_deinterleave_t) (float *const *, size_t, const float *,
+				   size_t, int);
+typedef void (*ow_interleave_t) (float *, float *const *, size_t, size_t,
+				 int);
+
+struct ow_interleave_kernels
+{
+  int tracks;			//0 for the generic kernels
+  ow_deinterleave_t deinterleave;
+  ow_interleave_t interleave;
+};
+
+const struct ow_interleave_kernels *ow_interleave_get_kernels (int);
+
+const struct ow_interleave_kernels *ow_interleave_get_generic_kernels ();
+
+#endif
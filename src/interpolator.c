@@ -0,0 +1,301 @@
+/*
+ *   interpolator.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "interpolator.h"
+
+#if defined(__SSE__)
+#define OW_INTERPOLATOR_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OW_INTERPOLATOR_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define GET_WINDOW_FRAME(interp,n) (&(interp)->window[(((interp)->head + (n)) % OW_INTERPOLATOR_WINDOW) * (interp)->channels])
+
+struct ow_interpolator *
+ow_interpolator_new (ow_interpolator_type_t type, int channels,
+		     src_callback_t callback, void *cb_data)
+{
+  struct ow_interpolator *interp = malloc (sizeof (struct ow_interpolator));
+
+  interp->type = type;
+  interp->channels = channels;
+  interp->window =
+    malloc (OW_INTERPOLATOR_WINDOW * channels * sizeof (float));
+  interp->callback = callback;
+  interp->cb_data = cb_data;
+  ow_interpolator_reset (interp);
+
+  return interp;
+}
+
+void
+ow_interpolator_delete (struct ow_interpolator *interp)
+{
+  free (interp->window);
+  free (interp);
+}
+
+void
+ow_interpolator_reset (struct ow_interpolator *interp)
+{
+  memset (interp->window, 0,
+	  OW_INTERPOLATOR_WINDOW * interp->channels * sizeof (float));
+  interp->head = 0;
+  interp->frac = 0.0;
+  interp->saved_data = NULL;
+  interp->saved_frames = 0;
+}
+
+void
+ow_interpolator_prime (struct ow_interpolator *interp, const float *frame)
+{
+  for (int i = 0; i < OW_INTERPOLATOR_WINDOW; i++)
+    {
+      memcpy (&interp->window[i * interp->channels], frame,
+	      interp->channels * sizeof (float));
+    }
+  interp->head = 0;
+  interp->frac = 1.0;
+  interp->saved_data = NULL;
+  interp->saved_frames = 0;
+}
+
+//The oldest frame is overwritten so the window moves forward one frame.
+static inline void
+ow_interpolator_push (struct ow_interpolator *interp, const float *frame)
+{
+  memcpy (GET_WINDOW_FRAME (interp, 0), frame,
+	  interp->channels * sizeof (float));
+  interp->head = (interp->head + 1) % OW_INTERPOLATOR_WINDOW;
+}
+
+//Catmull-Rom spline between x0 and x1.
+//Channels are computed in groups of 4 with the same operations as the scalar code for the remaining ones.
+static inline void
+ow_interpolator_cubic (const float *restrict xm1, const float *restrict x0,
+		       const float *restrict x1, const float *restrict x2,
+		       float t, int channels, float *restrict out)
+{
+  int i = 0;
+
+#if defined(OW_INTERPOLATOR_SSE)
+  const __m128 vt = _mm_set1_ps (t);
+  const __m128 half = _mm_set1_ps (0.5f);
+  const __m128 one_half = _mm_set1_ps (1.5f);
+  const __m128 two = _mm_set1_ps (2.0f);
+  const __m128 two_half = _mm_set1_ps (2.5f);
+
+  for (; i + 4 <= channels; i += 4)
+    {
+      __m128 a = _mm_loadu_ps (&xm1[i]);
+      __m128 b = _mm_loadu_ps (&x0[i]);
+      __m128 c = _mm_loadu_ps (&x1[i]);
+      __m128 d = _mm_loadu_ps (&x2[i]);
+      __m128 c1 = _mm_mul_ps (half, _mm_sub_ps (c, a));
+      __m128 c2 = _mm_sub_ps (a, _mm_mul_ps (two_half, b));
+      c2 = _mm_add_ps (c2, _mm_mul_ps (two, c));
+      c2 = _mm_sub_ps (c2, _mm_mul_ps (half, d));
+      __m128 c3 = _mm_add_ps (_mm_mul_ps (half, _mm_sub_ps (d, a)),
+			      _mm_mul_ps (one_half, _mm_sub_ps (b, c)));
+      __m128 v = _mm_add_ps (_mm_mul_ps (c3, vt), c2);
+      v = _mm_add_ps (_mm_mul_ps (v, vt), c1);
+      v = _mm_add_ps (_mm_mul_ps (v, vt), b);
+      _mm_storeu_ps (&out[i], v);
+    }
+#elif defined(OW_INTERPOLATOR_NEON)
+  const float32x4_t vt = vdupq_n_f32 (t);
+  const float32x4_t half = vdupq_n_f32 (0.5f);
+  const float32x4_t one_half = vdupq_n_f32 (1.5f);
+  const float32x4_t two = vdupq_n_f32 (2.0f);
+  const float32x4_t two_half = vdupq_n_f32 (2.5f);
+
+  for (; i + 4 <= channels; i += 4)
+    {
+      float32x4_t a = vld1q_f32 (&xm1[i]);
+      float32x4_t b = vld1q_f32 (&x0[i]);
+      float32x4_t c = vld1q_f32 (&x1[i]);
+      float32x4_t d = vld1q_f32 (&x2[i]);
+      float32x4_t c1 = vmulq_f32 (half, vsubq_f32 (c, a));
+      float32x4_t c2 = vsubq_f32 (a, vmulq_f32 (two_half, b));
+      c2 = vaddq_f32 (c2, vmulq_f32 (two, c));
+      c2 = vsubq_f32 (c2, vmulq_f32 (half, d));
+      float32x4_t c3 = vaddq_f32 (vmulq_f32 (half, vsubq_f32 (d, a)),
+				  vmulq_f32 (one_half, vsubq_f32 (b, c)));
+      float32x4_t v = vaddq_f32 (vmulq_f32 (c3, vt), c2);
+      v = vaddq_f32 (vmulq_f32 (v, vt), c1);
+      v = vaddq_f32 (vmulq_f32 (v, vt), b);
+      vst1q_f32 (&out[i], v);
+    }
+#endif
+
+  for (; i < channels; i++)
+    {
+      float c1 = 0.5f * (x1[i] - xm1[i]);
+      float c2 = xm1[i] - 2.5f * x0[i] + 2.0f * x1[i] - 0.5f * x2[i];
+      float c3 = 0.5f * (x2[i] - xm1[i]) + 1.5f * (x0[i] - x1[i]);
+      out[i] = ((c3 * t + c2) * t + c1) * t + x0[i];
+    }
+}
+
+//Linear interpolation between x1 and x2 as there is no need to wait for more frames.
+static inline void
+ow_interpolator_linear (const float *restrict x1, const float *restrict x2,
+			float t, int channels, float *restrict out)
+{
+  int i = 0;
+
+#if defined(OW_INTERPOLATOR_SSE)
+  const __m128 vt = _mm_set1_ps (t);
+
+  for (; i + 4 <= channels; i += 4)
+    {
+      __m128 a = _mm_loadu_ps (&x1[i]);
+      __m128 b = _mm_loadu_ps (&x2[i]);
+      _mm_storeu_ps (&out[i],
+		     _mm_add_ps (a, _mm_mul_ps (vt, _mm_sub_ps (b, a))));
+    }
+#elif defined(OW_INTERPOLATOR_NEON)
+  const float32x4_t vt = vdupq_n_f32 (t);
+
+  for (; i + 4 <= channels; i += 4)
+    {
+      float32x4_t a = vld1q_f32 (&x1[i]);
+      float32x4_t b = vld1q_f32 (&x2[i]);
+      vst1q_f32 (&out[i], vaddq_f32 (a, vmulq_f32 (vt, vsubq_f32 (b, a))));
+    }
+#endif
+
+  for (; i < channels; i++)
+    {
+      out[i] = x1[i] + t * (x2[i] - x1[i]);
+    }
+}
+
+//The window frames are only looked up when the window moves and the fraction is kept in a local so that the per frame work is just the kernel.
+int
+ow_interpolator_process (struct ow_interpolator *interp, SRC_DATA * data)
+{
+  double step, frac;
+  const float *xm1, *x0, *x1, *x2;
+  int channels = interp->channels;
+  const float *in = data->data_in;
+  float *out = data->data_out;
+
+  if (data->src_ratio <= 0.0)
+    {
+      return 1;
+    }
+
+  step = 1.0 / data->src_ratio;
+  frac = interp->frac;
+  data->input_frames_used = 0;
+  data->output_frames_gen = 0;
+
+  xm1 = GET_WINDOW_FRAME (interp, 0);
+  x0 = GET_WINDOW_FRAME (interp, 1);
+  x1 = GET_WINDOW_FRAME (interp, 2);
+  x2 = GET_WINDOW_FRAME (interp, 3);
+
+  while (data->output_frames_gen < data->output_frames)
+    {
+      if (frac >= 1.0)
+	{
+	  while (frac >= 1.0)
+	    {
+	      if (data->input_frames_used == data->input_frames)
+		{
+		  interp->frac = frac;
+		  return 0;
+		}
+	      ow_interpolator_push (interp, in);
+	      in += channels;
+	      data->input_frames_used++;
+	      frac -= 1.0;
+	    }
+
+	  xm1 = GET_WINDOW_FRAME (interp, 0);
+	  x0 = GET_WINDOW_FRAME (interp, 1);
+	  x1 = GET_WINDOW_FRAME (interp, 2);
+	  x2 = GET_WINDOW_FRAME (interp, 3);
+	}
+
+      if (interp->type == OW_INTERPOLATOR_CUBIC)
+	{
+	  ow_interpolator_cubic (xm1, x0, x1, x2, frac, channels, out);
+	}
+      else
+	{
+	  ow_interpolator_linear (x1, x2, frac, channels, out);
+	}
+      out += channels;
+      data->output_frames_gen++;
+      frac += step;
+    }
+
+  interp->frac = frac;
+  return 0;
+}
+
+long
+ow_interpolator_callback_read (struct ow_interpolator *interp, double ratio,
+			       long frames, float *data)
+{
+  SRC_DATA src_data;
+  long gen_frames = 0;
+
+  src_data.src_ratio = ratio;
+  src_data.end_of_input = 0;
+
+  while (gen_frames < frames)
+    {
+      if (interp->saved_frames == 0)
+	{
+	  interp->saved_frames =
+	    interp->callback (interp->cb_data, &interp->saved_data);
+	  if (interp->saved_frames <= 0)
+	    {
+	      interp->saved_frames = 0;
+	      break;
+	    }
+	}
+
+      src_data.data_in = interp->saved_data;
+      src_data.input_frames = interp->saved_frames;
+      src_data.data_out = &data[gen_frames * interp->channels];
+      src_data.output_frames = frames - gen_frames;
+
+      if (ow_interpolator_process (interp, &src_data))
+	{
+	  break;
+	}
+
+      interp->saved_data += src_data.input_frames_used * interp->channels;
+      interp->saved_frames -= src_data.input_frames_used;
+      gen_frames += src_data.output_frames_gen;
+    }
+
+  return gen_frames;
+}
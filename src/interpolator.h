@@ -0,0 +1,65 @@
+/*
+ *   interpolator.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INTERPOLATOR_H
+#define INTERPOLATOR_H
+
+#include <samplerate.h>
+
+//Lightweight resamplers for ratios close to 1.0 that process all the channels in one pass.
+//The API mimics the libsamplerate one so they can be used interchangeably.
+
+#define OW_INTERPOLATOR_WINDOW 4
+
+typedef enum
+{
+  OW_INTERPOLATOR_CUBIC = 0,
+  OW_INTERPOLATOR_LINEAR
+} ow_interpolator_type_t;
+
+struct ow_interpolator
+{
+  ow_interpolator_type_t type;
+  int channels;
+  float *window;		//Circular buffer with the last OW_INTERPOLATOR_WINDOW input frames.
+  int head;
+  double frac;
+  src_callback_t callback;
+  void *cb_data;
+  float *saved_data;
+  long saved_frames;
+};
+
+struct ow_interpolator *ow_interpolator_new (ow_interpolator_type_t, int,
+					     src_callback_t, void *);
+
+void ow_interpolator_delete (struct ow_interpolator *);
+
+void ow_interpolator_reset (struct ow_interpolator *);
+
+//The window is filled with the given frame, which will be the first one output. This allows to resample isolated chunks without discontinuities.
+void ow_interpolator_prime (struct ow_interpolator *, const float *);
+
+int ow_interpolator_process (struct ow_interpolator *, SRC_DATA *);
+
+long ow_interpolator_callback_read (struct ow_interpolator *, double, long,
+				    float *);
+
+#endif
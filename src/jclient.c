@@ -30,11 +30,11 @@
 
 #include "utils.h"
 #include "jclient.h"
+#include "rtlog.h"
 
 #define MSG_ERROR_PORT_REGISTER "Error while registering JACK port\n"
 
-#define MIDI_BUF_EVENTS 64
-#define MIDI_BUF_LEN (MIDI_BUF_EVENTS * OB_MIDI_EVENT_SIZE * 8)
+#define MIDI_BUF_EVENTS 128
 
 #define MAX_LATENCY (8192 * 2)	//This is twice the maximum JACK latency.
 
@@ -44,17 +44,44 @@ jclient_get_time ()
   return jack_get_time () * 1.0e-6;
 }
 
-size_t
-jclient_buffer_read (void *buffer, char *src, size_t size)
+//In planar mode, there is a ring buffer for every track.
+static void *
+jclient_create_audio_buffer (struct jclient *jclient,
+			     struct ow_ring **planes, int tracks,
+			     size_t frame_size)
+{
+  struct ow_ring *ring;
+
+  if (jclient->planar)
+    {
+      for (int i = 0; i < tracks; i++)
+	{
+	  planes[i] = ow_ring_new (MAX_LATENCY, OB_BYTES_PER_SAMPLE);
+	  ow_ring_mlock (planes[i]);
+	}
+      return planes;
+    }
+
+  ring = ow_ring_new (MAX_LATENCY, frame_size);
+  ow_ring_mlock (ring);
+  return ring;
+}
+
+static void
+jclient_free_audio_buffer (struct jclient *jclient, void *buffer, int tracks)
 {
-  if (src)
+  struct ow_ring **planes = buffer;
+
+  if (jclient->planar && planes)
     {
-      return jack_ringbuffer_read (buffer, src, size);
+      for (int i = 0; i < tracks; i++)
+	{
+	  ow_ring_free (planes[i]);
+	}
     }
   else
     {
-      jack_ringbuffer_read_advance (buffer, size);
-      return 0;
+      ow_ring_free (buffer);
     }
 }
 
@@ -62,7 +89,7 @@ static int
 jclient_thread_xrun_cb (void *cb_data)
 {
   struct ow_resampler *resampler = cb_data;
-  error_print ("JACK xrun\n");
+  rt_error_print ("JACK xrun\n");
   ow_resampler_inc_xruns (resampler);
   return 0;
 }
@@ -73,9 +100,10 @@ jclient_port_connect_cb (jack_port_id_t a, jack_port_id_t b, int connect,
 {
   struct jclient *jclient = cb_data;
   int p2o_enabled = 0;
+  uint64_t o2p_tracks = 0;
   struct ow_engine *engine = ow_resampler_get_engine (jclient->resampler);
   const struct ow_device_desc *desc = ow_engine_get_device_desc (engine);
-  //We only check for j2o (input) ports as o2j must always be running.
+  //o2j must always be running as it drives the DLL.
   for (int i = 0; i < desc->inputs; i++)
     {
       if (jack_port_connected (jclient->input_ports[i]))
@@ -85,6 +113,19 @@ jclient_port_connect_cb (jack_port_id_t a, jack_port_id_t b, int connect,
 	}
     }
   ow_engine_set_option (engine, OW_ENGINE_OPTION_P2O_AUDIO, p2o_enabled);
+
+  //Only the planes of unconnected o2j tracks can be skipped.
+  if (jclient->planar)
+    {
+      for (int i = 0; i < desc->outputs; i++)
+	{
+	  if (jack_port_connected (jclient->output_ports[i]))
+	    {
+	      o2p_tracks |= 1ULL << i;
+	    }
+	}
+      ow_engine_set_o2p_active_tracks (engine, o2p_tracks);
+    }
 }
 
 static void
@@ -128,11 +169,11 @@ jclient_o2j_midi (struct jclient *jclient, jack_nframes_t nframes)
 
   first_frames = jack_last_frame_time (jclient->client);
 
-  while (jack_ringbuffer_read_space (jclient->context.o2p_midi) >=
+  while (ow_ring_read_space (jclient->context.o2p_midi) >=
 	 sizeof (struct ow_midi_event))
     {
-      jack_ringbuffer_peek (jclient->context.o2p_midi, (void *) &event,
-			    sizeof (struct ow_midi_event));
+      ow_ring_peek (jclient->context.o2p_midi, (void *) &event,
+		    sizeof (struct ow_midi_event));
 
       // We add 1 JACK cycle because it's the maximum delay we want to achieve
       // as everyting generated during the previous cycle will always be played.
@@ -141,26 +182,26 @@ jclient_o2j_midi (struct jclient *jclient, jack_nframes_t nframes)
 	+ nframes;
       if (event_frames >= first_frames + nframes)
 	{
-	  debug_print (2,
-		       "Skipping until the next cycle (event frames %d)...\n",
-		       event_frames);
+	  rt_debug_print (2,
+			  "Skipping until the next cycle (event frames %d)...\n",
+			  event_frames);
 	  break;
 	}
 
       if (event_frames < first_frames)
 	{
 	  jack_nframes_t delay = first_frames - event_frames;
-	  debug_print (2, "Event delayed %u frames\n", delay);
+	  rt_debug_print (2, "Event delayed %u frames\n", delay);
 	  frames = 0;
 	}
       else
 	{
 	  frames = (event_frames - first_frames) % nframes;
 	}
-      debug_print (2, "Event frames: %u\n", frames);
+      rt_debug_print (2, "Event frames: %u\n", frames);
 
-      jack_ringbuffer_read_advance (jclient->context.o2p_midi,
-				    sizeof (struct ow_midi_event));
+      ow_ring_read (jclient->context.o2p_midi, NULL,
+		    sizeof (struct ow_midi_event));
 
       if (event.bytes[0] == 0x0f)
 	{
@@ -191,6 +232,7 @@ jclient_j2o_midi (struct jclient *jclient, jack_nframes_t nframes)
   struct ow_midi_event oevent;
   jack_nframes_t event_count;
   jack_midi_data_t status_byte;
+  int events = 0;
   struct ow_engine *engine = ow_resampler_get_engine (jclient->resampler);
 
   if (ow_engine_get_status (engine) < OW_ENGINE_STATUS_RUN)
@@ -255,50 +297,43 @@ jclient_j2o_midi (struct jclient *jclient, jack_nframes_t nframes)
 
       if (oevent.bytes[0])
 	{
-	  if (jack_ringbuffer_write_space (jclient->context.p2o_midi)
+	  if (ow_ring_write_space (jclient->context.p2o_midi)
 	      >= sizeof (struct ow_midi_event))
 	    {
-	      jack_ringbuffer_write (jclient->context.p2o_midi,
-				     (void *) &oevent,
-				     sizeof (struct ow_midi_event));
+	      ow_ring_write (jclient->context.p2o_midi, (void *) &oevent,
+			     sizeof (struct ow_midi_event));
+	      events++;
 	    }
 	  else
 	    {
-	      error_print
+	      rt_error_print
 		("j2o: MIDI ring buffer overflow. Discarding data...\n");
 	    }
 	}
     }
+
+  if (events)
+    {
+      ow_engine_notify_p2o_midi (engine);
+    }
 }
 
 inline void
 jclient_copy_o2j_audio (float *f, jack_nframes_t nframes,
 			jack_default_audio_sample_t * buffer[],
-			const struct ow_device_desc *desc)
+			const struct ow_device_desc *desc,
+			const struct ow_interleave_kernels *kernels)
 {
-  for (int i = 0; i < nframes; i++)
-    {
-      for (int j = 0; j < desc->outputs; j++)
-	{
-	  buffer[j][i] = *f;
-	  f++;
-	}
-    }
+  kernels->deinterleave (buffer, 0, f, nframes, desc->outputs);
 }
 
 inline void
 jclient_copy_j2o_audio (float *f, jack_nframes_t nframes,
 			jack_default_audio_sample_t * buffer[],
-			const struct ow_device_desc *desc)
+			const struct ow_device_desc *desc,
+			const struct ow_interleave_kernels *kernels)
 {
-  for (int i = 0; i < nframes; i++)
-    {
-      for (int j = 0; j < desc->inputs; j++)
-	{
-	  *f = buffer[j][i];
-	  f++;
-	}
-    }
+  kernels->interleave (f, buffer, 0, nframes, desc->inputs);
 }
 
 static inline int
@@ -313,6 +348,7 @@ jclient_process_cb (jack_nframes_t nframes, void *arg)
   jack_time_t next_usecs;
   float period_usecs;
   double time;
+  double start = jclient_get_time ();
   struct ow_engine *engine = ow_resampler_get_engine (jclient->resampler);
   const struct ow_device_desc *desc = ow_engine_get_device_desc (engine);
 
@@ -320,7 +356,7 @@ jclient_process_cb (jack_nframes_t nframes, void *arg)
 			    &current_frames,
 			    &current_usecs, &next_usecs, &period_usecs))
     {
-      error_print ("Error while getting JACK time\n");
+      rt_error_print ("Error while getting JACK time\n");
     }
 
   time = current_usecs * 1.0e-6;
@@ -337,9 +373,17 @@ jclient_process_cb (jack_nframes_t nframes, void *arg)
       buffer[i] = jack_port_get_buffer (jclient->output_ports[i], nframes);
     }
 
-  f = ow_resampler_get_o2p_audio_buffer (jclient->resampler);
-  ow_resampler_read_audio (jclient->resampler);
-  jclient_copy_o2j_audio (f, nframes, buffer, desc);
+  if (jclient->planar)
+    {
+      ow_resampler_read_audio_planar (jclient->resampler, buffer);
+    }
+  else
+    {
+      f = ow_resampler_get_o2p_audio_buffer (jclient->resampler);
+      ow_resampler_read_audio (jclient->resampler);
+      jclient_copy_o2j_audio (f, nframes, buffer, desc,
+			      jclient->o2j_interleave);
+    }
 
   //p2o
 
@@ -350,15 +394,26 @@ jclient_process_cb (jack_nframes_t nframes, void *arg)
 	  buffer[i] = jack_port_get_buffer (jclient->input_ports[i], nframes);
 	}
 
-      f = ow_resampler_get_p2o_audio_buffer (jclient->resampler);
-      jclient_copy_j2o_audio (f, nframes, buffer, desc);
-      ow_resampler_write_audio (jclient->resampler);
+      if (jclient->planar)
+	{
+	  ow_resampler_write_audio_planar (jclient->resampler, buffer);
+	}
+      else
+	{
+	  f = ow_resampler_get_p2o_audio_buffer (jclient->resampler);
+	  jclient_copy_j2o_audio (f, nframes, buffer, desc,
+				  jclient->j2o_interleave);
+	  ow_resampler_write_audio (jclient->resampler);
+	}
     }
 
   jclient_o2j_midi (jclient, nframes);
 
   jclient_j2o_midi (jclient, nframes);
 
+  ow_resampler_add_process_time (jclient->resampler,
+				 jclient_get_time () - start);
+
   return 0;
 }
 
@@ -387,10 +442,12 @@ jclient_init (struct jclient *jclient)
 {
   struct ow_resampler *resampler;
   struct ow_engine *engine;
-  ow_err_t err = ow_resampler_init_from_bus_address (&resampler, jclient->bus,
-						     jclient->address,
-						     jclient->blocks_per_transfer,
-						     jclient->quality);
+  ow_err_t err =
+    ow_resampler_init_from_bus_address_in_group (&resampler, jclient->group,
+						 jclient->bus,
+						 jclient->address,
+						 jclient->blocks_per_transfer,
+						 jclient->quality);
 
   if (err)
     {
@@ -398,9 +455,19 @@ jclient_init (struct jclient *jclient)
       return -1;
     }
 
+  if (jclient->resampler_group
+      && ow_resampler_group_add (jclient->resampler_group, resampler))
+    {
+      ow_resampler_destroy (resampler);
+      return -1;
+    }
+
   jclient->resampler = resampler;
   engine = ow_resampler_get_engine (jclient->resampler);
   jclient->name = ow_engine_get_overbridge_name (engine);
+  ow_resampler_load_clock_cache (jclient->resampler);
+  ow_resampler_set_adaptive_blocks (jclient->resampler,
+				    jclient->adaptive_blocks);
 
   return 0;
 }
@@ -430,6 +497,9 @@ jclient_run (struct jclient *jclient)
   engine = ow_resampler_get_engine (jclient->resampler);
   desc = ow_engine_get_device_desc (engine);
 
+  jclient->o2j_interleave = ow_interleave_get_kernels (desc->outputs);
+  jclient->j2o_interleave = ow_interleave_get_kernels (desc->inputs);
+
   jclient->client =
     jack_client_open (jclient->name, JackNoStartServer, &status, NULL);
   if (jclient->client == NULL)
@@ -554,37 +624,40 @@ jclient_run (struct jclient *jclient)
     }
 
   jclient->context.o2p_audio =
-    jack_ringbuffer_create (MAX_LATENCY *
-			    ow_resampler_get_o2p_frame_size
-			    (jclient->resampler));
-  jack_ringbuffer_mlock (jclient->context.o2p_audio);
+    jclient_create_audio_buffer (jclient, jclient->o2p_audio_planes,
+				 desc->outputs,
+				 ow_resampler_get_o2p_frame_size
+				 (jclient->resampler));
 
   jclient->context.p2o_audio =
-    jack_ringbuffer_create (MAX_LATENCY *
-			    ow_resampler_get_p2o_frame_size
-			    (jclient->resampler));
-  jack_ringbuffer_mlock (jclient->context.p2o_audio);
-
-  jclient->context.o2p_midi = jack_ringbuffer_create (MIDI_BUF_LEN);
-  jack_ringbuffer_mlock (jclient->context.o2p_midi);
-
-  jclient->context.p2o_midi = jack_ringbuffer_create (MIDI_BUF_LEN);
-  jack_ringbuffer_mlock (jclient->context.p2o_midi);
-
-  jclient->context.read_space =
-    (ow_buffer_rw_space_t) jack_ringbuffer_read_space;
-  jclient->context.write_space =
-    (ow_buffer_rw_space_t) jack_ringbuffer_write_space;
-  jclient->context.read = jclient_buffer_read;
-  jclient->context.write = (ow_buffer_write_t) jack_ringbuffer_write;
+    jclient_create_audio_buffer (jclient, jclient->p2o_audio_planes,
+				 desc->inputs,
+				 ow_resampler_get_p2o_frame_size
+				 (jclient->resampler));
+
+  jclient->context.o2p_midi = ow_ring_new (MIDI_BUF_EVENTS,
+					   sizeof (struct ow_midi_event));
+  ow_ring_mlock (jclient->context.o2p_midi);
+
+  jclient->context.p2o_midi = ow_ring_new (MIDI_BUF_EVENTS,
+					   sizeof (struct ow_midi_event));
+  ow_ring_mlock (jclient->context.p2o_midi);
+
   jclient->context.get_time = jclient_get_time;
 
   jclient->context.set_rt_priority = set_rt_priority;
   jclient->context.priority = jclient->priority;
+  jclient->context.transfers = jclient->transfers;
+  jclient->context.cpu_mask = jclient->cpu_mask;
+  jclient->context.lock_memory = jclient->lock_memory;
 
   jclient->context.options =
     OW_ENGINE_OPTION_O2P_AUDIO | OW_ENGINE_OPTION_O2P_MIDI |
-    OW_ENGINE_OPTION_P2O_MIDI;
+    OW_ENGINE_OPTION_P2O_MIDI | OW_ENGINE_OPTION_RINGS;
+  if (jclient->planar)
+    {
+      jclient->context.options |= OW_ENGINE_OPTION_PLANAR_AUDIO;
+    }
 
   err = ow_resampler_start (jclient->resampler, &jclient->context);
   if (err)
@@ -603,12 +676,15 @@ jclient_run (struct jclient *jclient)
 
   debug_print (1, "Exiting...\n");
   jack_deactivate (jclient->client);
+  ow_resampler_save_clock_cache (jclient->resampler);
 
 cleanup_jack:
-  jack_ringbuffer_free (jclient->context.p2o_audio);
-  jack_ringbuffer_free (jclient->context.o2p_audio);
-  jack_ringbuffer_free (jclient->context.p2o_midi);
-  jack_ringbuffer_free (jclient->context.o2p_midi);
+  jclient_free_audio_buffer (jclient, jclient->context.p2o_audio,
+			     desc->inputs);
+  jclient_free_audio_buffer (jclient, jclient->context.o2p_audio,
+			     desc->outputs);
+  ow_ring_free (jclient->context.p2o_midi);
+  ow_ring_free (jclient->context.o2p_midi);
   jack_client_close (jclient->client);
   free (jclient->output_ports);
   free (jclient->input_ports);
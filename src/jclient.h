@@ -18,9 +18,13 @@
  *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <jack/ringbuffer.h>
+#ifndef JCLIENT_H
+#define JCLIENT_H
+
+#include <jack/jack.h>
 #include <jack/midiport.h>
 #include "overwitch.h"
+#include "interleave.h"
 
 typedef void (*jclient_end_notifier_t) (uint8_t, uint8_t);
 
@@ -39,10 +43,21 @@ struct jclient
   int blocks_per_transfer;
   int quality;
   int priority;
+  int planar;
+  int adaptive_blocks;
+  int transfers;
+  uint64_t cpu_mask;
+  int lock_memory;
+  struct ow_engine_group *group;	//NULL to use a thread for this device only.
+  struct ow_resampler_group *resampler_group;	//NULL to use a target delay for this device only.
   jack_nframes_t bufsize;
   // Overwitch stuff
   struct ow_resampler *resampler;
   struct ow_context context;
+  struct ow_ring *o2p_audio_planes[OB_MAX_TRACKS];
+  struct ow_ring *p2o_audio_planes[OB_MAX_TRACKS];
+  const struct ow_interleave_kernels *o2j_interleave;
+  const struct ow_interleave_kernels *j2o_interleave;
   // Thread stuff
   pthread_t thread;
   jclient_end_notifier_t end_notifier;
@@ -62,8 +77,12 @@ void jclient_print_latencies (struct ow_resampler *, const char *);
 
 void jclient_copy_o2j_audio (float *, jack_nframes_t,
 			     jack_default_audio_sample_t *[],
-			     const struct ow_device_desc *);
+			     const struct ow_device_desc *,
+			     const struct ow_interleave_kernels *);
 
 void jclient_copy_j2o_audio (float *, jack_nframes_t,
 			     jack_default_audio_sample_t *[],
-			     const struct ow_device_desc *);
+			     const struct ow_device_desc *,
+			     const struct ow_interleave_kernels *);
+
+#endif
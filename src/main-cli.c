@@ -22,28 +22,99 @@
 #include <errno.h>
 #include "../config.h"
 #include "jclient.h"
+#include "metrics.h"
 #include "utils.h"
 #include "common.h"
+#include "rtlog.h"
 
 #define DEFAULT_QUALITY 2
 #define DEFAULT_BLOCKS 24
 #define DEFAULT_PRIORITY -1	//With this value the default priority will be used.
+#define DEFAULT_TRANSFERS 1
+#define DEFAULT_EVENT_THREADS 0	//With this value every device uses its own thread.
+#define MAX_EVENT_THREADS 16
+#define MAX_DAEMON_DEVICES 16
+#define HOTPLUG_WAIT 0.5
 
 static size_t jclient_count;
 static struct jclient *jclients;
+static struct ow_resampler_group *resampler_group;
+//In daemon mode the clients are created and destroyed by the hotplug callback so the signal handler only sets flags for the daemon loop.
+static volatile sig_atomic_t daemon_mode;
+static volatile sig_atomic_t daemon_end;
+static volatile sig_atomic_t daemon_report;
 
 static struct option options[] = {
   {"use-device-number", 1, NULL, 'n'},
   {"use-device", 1, NULL, 'd'},
   {"resampling-quality", 1, NULL, 'q'},
   {"transfer-blocks", 1, NULL, 'b'},
+  {"usb-transfers", 1, NULL, 't'},
   {"rt-priority", 1, NULL, 'p'},
+  {"planar-audio", 0, NULL, 'a'},
+  {"adaptive-blocks", 0, NULL, 'A'},
+  {"event-threads", 1, NULL, 'e'},
+  {"common-clock", 0, NULL, 'c'},
+  {"cpu-affinity", 1, NULL, 'C'},
+  {"lock-memory", 0, NULL, 'L'},
+  {"daemon", 0, NULL, 'D'},
+  {"metrics-socket", 1, NULL, 'm'},
   {"list-devices", 0, NULL, 'l'},
   {"verbose", 0, NULL, 'v'},
   {"help", 0, NULL, 'h'},
   {NULL, 0, NULL, 0}
 };
 
+static void
+print_histogram (const char *name, struct ow_histogram *histogram)
+{
+  printf ("  %s: p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max. %.3f ms\n",
+	  name, ow_histogram_get_percentile (histogram, 0.5) * 1000.0,
+	  ow_histogram_get_percentile (histogram, 0.99) * 1000.0,
+	  ow_histogram_get_percentile (histogram, 0.999) * 1000.0,
+	  histogram->max * 1000.0);
+}
+
+static void
+print_stats (struct jclient *jclient)
+{
+  struct ow_engine_stats engine_stats;
+  struct ow_resampler_stats resampler_stats;
+  struct ow_engine *engine = ow_resampler_get_engine (jclient->resampler);
+
+  ow_engine_get_stats (engine, &engine_stats);
+  ow_resampler_get_stats (jclient->resampler, &resampler_stats);
+
+  printf ("%s stats:\n", jclient->name);
+  print_histogram ("USB interval", &engine_stats.usb_interval);
+  print_histogram ("o2p buffer", &engine_stats.o2p_fill);
+  print_histogram ("p2o buffer", &engine_stats.p2o_fill);
+  print_histogram ("p2o MIDI error", &engine_stats.p2o_midi);
+  print_histogram ("JACK process", &resampler_stats.process);
+  print_histogram ("DLL error", &resampler_stats.dll_error);
+}
+
+static void
+print_status ()
+{
+  struct jclient *jclient = jclients;
+  for (int i = 0; i < jclient_count; i++, jclient++)
+    {
+      if (jclient->resampler)
+	{
+	  ow_resampler_report_status (jclient->resampler);
+	  print_stats (jclient);
+	}
+    }
+  if (resampler_group)
+    {
+      double target, max;
+      ow_resampler_group_get_latency (resampler_group, &target, &max);
+      printf ("Group: target latency: %4.1f ms; max. o2p latency: %4.1f ms\n",
+	      target, max);
+    }
+}
+
 static void
 signal_handler (int signo)
 {
@@ -51,6 +122,11 @@ signal_handler (int signo)
       || signo == SIGTSTP)
     {
       struct jclient *jclient = jclients;
+      daemon_end = 1;
+      if (daemon_mode)
+	{
+	  return;
+	}
       for (int i = 0; i < jclient_count; i++, jclient++)
 	{
 	  jclient_stop (jclient);
@@ -58,19 +134,23 @@ signal_handler (int signo)
     }
   else if (signo == SIGUSR1)
     {
-      struct jclient *jclient = jclients;
-      for (int i = 0; i < jclient_count; i++, jclient++)
+      if (daemon_mode)
 	{
-	  ow_resampler_report_status (jclient->resampler);
+	  daemon_report = 1;
+	  return;
 	}
+      print_status ();
     }
 }
 
 static int
 run_single (int device_num, const char *device_name,
-	    int blocks_per_transfer, int quality, int priority)
+	    int blocks_per_transfer, int transfers, int quality, int priority,
+	    int planar, int adaptive_blocks, uint64_t cpu_mask,
+	    int lock_memory, const char *metrics_path)
 {
   struct ow_usb_device *device;
+  struct metrics metrics;
   ow_err_t err = OW_OK;
 
   if (ow_get_usb_device_from_device_attrs (device_num, device_name, &device))
@@ -78,37 +158,73 @@ run_single (int device_num, const char *device_name,
       return OW_GENERIC_ERROR;
     }
 
+  if (metrics_path && metrics_init (&metrics, metrics_path, 1))
+    {
+      free (device);
+      return OW_GENERIC_ERROR;
+    }
+
   jclient_count = 1;
   jclients = malloc (sizeof (struct jclient));
   jclients->bus = device->bus;
   jclients->address = device->address;
   jclients->blocks_per_transfer = blocks_per_transfer;
+  jclients->transfers = transfers;
   jclients->quality = quality;
   jclients->priority = priority;
+  jclients->planar = planar;
+  jclients->adaptive_blocks = adaptive_blocks;
+  jclients->cpu_mask = cpu_mask;
+  jclients->lock_memory = lock_memory;
+  jclients->group = NULL;
+  jclients->resampler_group = NULL;
   jclients->end_notifier = NULL;
 
   free (device);
 
   if (jclient_init (jclients))
     {
+      if (metrics_path)
+	{
+	  metrics_destroy (&metrics);
+	}
       err = OW_GENERIC_ERROR;
       goto end;
     }
 
+  if (metrics_path)
+    {
+      metrics_add (&metrics, jclients);
+      if (metrics_start (&metrics))
+	{
+	  metrics_destroy (&metrics);
+	  metrics_path = NULL;
+	}
+    }
+
   jclient_start (jclients);
   jclient_wait (jclients);
 
+  if (metrics_path)
+    {
+      metrics_stop (&metrics);
+    }
+
 end:
   free (jclients);
   return err;
 }
 
 static int
-run_all (int blocks_per_transfer, int quality, int priority)
+run_all (int blocks_per_transfer, int transfers, int quality, int priority,
+	 int planar, int adaptive_blocks, uint64_t cpu_mask, int lock_memory,
+	 int event_threads, int common_clock, const char *metrics_path)
 {
   struct ow_usb_device *devices;
   struct ow_usb_device *device;
   struct jclient *jclient;
+  struct ow_engine_group *group = NULL;
+  struct metrics metrics;
   ow_err_t err = ow_get_usb_device_list (&devices, &jclient_count);
 
   if (err)
@@ -116,6 +232,31 @@ run_all (int blocks_per_transfer, int quality, int priority)
       return err;
     }
 
+  if (metrics_path && metrics_init (&metrics, metrics_path, jclient_count))
+    {
+      ow_free_usb_device_list (devices, jclient_count);
+      return OW_GENERIC_ERROR;
+    }
+
+  if (event_threads)
+    {
+      err = ow_engine_group_init (&group, event_threads);
+      if (err)
+	{
+	  if (metrics_path)
+	    {
+	      metrics_destroy (&metrics);
+	    }
+	  ow_free_usb_device_list (devices, jclient_count);
+	  return err;
+	}
+    }
+
+  if (common_clock)
+    {
+      ow_resampler_group_init (&resampler_group);
+    }
+
   jclients = malloc (sizeof (struct jclient) * jclient_count);
 
   device = devices;
@@ -125,24 +266,71 @@ run_all (int blocks_per_transfer, int quality, int priority)
       jclient->bus = device->bus;
       jclient->address = device->address;
       jclient->blocks_per_transfer = blocks_per_transfer;
+      jclient->transfers = transfers;
       jclient->quality = quality;
       jclient->priority = priority;
+      jclient->planar = planar;
+      jclient->adaptive_blocks = adaptive_blocks;
+      jclient->cpu_mask = cpu_mask;
+      jclient->lock_memory = lock_memory;
+      jclient->group = group;
+      jclient->resampler_group = resampler_group;
       jclient->end_notifier = NULL;
 
       if (jclient_init (jclient))
 	{
+	  jclient->resampler = NULL;
 	  continue;
 	}
 
+      if (metrics_path)
+	{
+	  metrics_add (&metrics, jclient);
+	}
+
       jclient_start (jclient);
     }
 
   ow_free_usb_device_list (devices, jclient_count);
 
+  if (metrics_path && metrics_start (&metrics))
+    {
+      metrics_destroy (&metrics);
+      metrics_path = NULL;
+    }
+
   jclient = jclients;
   for (int i = 0; i < jclient_count; i++, jclient++)
     {
-      jclient_wait (jclient);
+      if (jclient->resampler)
+	{
+	  jclient_wait (jclient);
+	}
+    }
+
+  if (metrics_path)
+    {
+      metrics_stop (&metrics);
+    }
+
+  //Engines in a group are kept until all of them are done as they share the USB contexts.
+  if (group)
+    {
+      jclient = jclients;
+      for (int i = 0; i < jclient_count; i++, jclient++)
+	{
+	  if (jclient->resampler)
+	    {
+	      jclient_destroy (jclient);
+	    }
+	}
+      ow_engine_group_destroy (group);
+    }
+
+  if (resampler_group)
+    {
+      ow_resampler_group_destroy (resampler_group);
+      resampler_group = NULL;
     }
 
   free (jclients);
@@ -150,20 +338,185 @@ run_all (int blocks_per_transfer, int quality, int priority)
   return OW_OK;
 }
 
+//Free slots have no resampler.
+static struct jclient *
+daemon_find_jclient (uint8_t bus, uint8_t address, int used)
+{
+  struct jclient *jclient = jclients;
+  for (int i = 0; i < jclient_count; i++, jclient++)
+    {
+      if (!used && !jclient->resampler)
+	{
+	  return jclient;
+	}
+      if (used && jclient->resampler && jclient->bus == bus
+	  && jclient->address == address)
+	{
+	  return jclient;
+	}
+    }
+  return NULL;
+}
+
+static void
+daemon_stop_jclient (struct jclient *jclient)
+{
+  debug_print (1, "Stopping %s...\n", jclient->name);
+  jclient_stop (jclient);
+  jclient_wait (jclient);
+  jclient_destroy (jclient);
+  jclient->resampler = NULL;
+  jclient->client = NULL;
+}
+
+static void
+daemon_hotplug_cb (void *data, const struct ow_usb_device *device,
+		   int arrived)
+{
+  struct jclient *template = data;
+  struct jclient *jclient = daemon_find_jclient (device->bus,
+						 device->address, 1);
+
+  if (!arrived)
+    {
+      if (jclient)
+	{
+	  daemon_stop_jclient (jclient);
+	}
+      return;
+    }
+
+  if (jclient)
+    {
+      return;
+    }
+
+  jclient = daemon_find_jclient (0, 0, 0);
+  if (!jclient)
+    {
+      error_print ("Too many devices. Ignoring %s...\n", device->desc.name);
+      return;
+    }
+
+  *jclient = *template;
+  jclient->bus = device->bus;
+  jclient->address = device->address;
+
+  if (jclient_init (jclient))
+    {
+      jclient->resampler = NULL;
+      return;
+    }
+
+  jclient_start (jclient);
+}
+
+//Clients are started and stopped as the devices come and go until a signal ends the daemon.
+static int
+run_daemon (int blocks_per_transfer, int transfers, int quality,
+	    int priority, int planar, int adaptive_blocks, uint64_t cpu_mask,
+	    int lock_memory, int event_threads, int common_clock)
+{
+  struct jclient template;
+  struct jclient *jclient;
+  struct ow_hotplug *hotplug;
+  struct ow_engine_group *group = NULL;
+  ow_err_t err;
+
+  if (event_threads)
+    {
+      err = ow_engine_group_init (&group, event_threads);
+      if (err)
+	{
+	  return err;
+	}
+    }
+
+  if (common_clock)
+    {
+      ow_resampler_group_init (&resampler_group);
+    }
+
+  memset (&template, 0, sizeof (struct jclient));
+  template.blocks_per_transfer = blocks_per_transfer;
+  template.transfers = transfers;
+  template.quality = quality;
+  template.priority = priority;
+  template.planar = planar;
+  template.adaptive_blocks = adaptive_blocks;
+  template.cpu_mask = cpu_mask;
+  template.lock_memory = lock_memory;
+  template.group = group;
+  template.resampler_group = resampler_group;
+  template.end_notifier = NULL;
+
+  daemon_mode = 1;
+  jclients = calloc (MAX_DAEMON_DEVICES, sizeof (struct jclient));
+  jclient_count = MAX_DAEMON_DEVICES;
+
+  err = ow_hotplug_init (&hotplug, daemon_hotplug_cb, &template);
+  if (!err)
+    {
+      debug_print (1, "Waiting for devices...\n");
+      while (!daemon_end)
+	{
+	  ow_hotplug_handle_events (hotplug, HOTPLUG_WAIT);
+	  if (daemon_report)
+	    {
+	      daemon_report = 0;
+	      print_status ();
+	    }
+	}
+      ow_hotplug_destroy (hotplug);
+    }
+
+  jclient = jclients;
+  for (int i = 0; i < jclient_count; i++, jclient++)
+    {
+      if (jclient->resampler)
+	{
+	  daemon_stop_jclient (jclient);
+	}
+    }
+
+  if (group)
+    {
+      ow_engine_group_destroy (group);
+    }
+
+  if (resampler_group)
+    {
+      ow_resampler_group_destroy (resampler_group);
+      resampler_group = NULL;
+    }
+
+  jclient_count = 0;
+  free (jclients);
+
+  return err;
+}
+
 int
 main (int argc, char *argv[])
 {
   int opt;
-  int vflg = 0, lflg = 0, dflg = 0, bflg = 0, pflg = 0, nflg = 0, errflg = 0;
+  int vflg = 0, lflg = 0, dflg = 0, bflg = 0, tflg = 0, pflg = 0, nflg = 0,
+    aflg = 0, Aflg = 0, eflg = 0, cflg = 0, Cflg = 0, Lflg = 0, Dflg = 0,
+    mflg = 0, errflg = 0;
   char *endstr;
   char *device_name = NULL;
+  char *metrics_path = NULL;
   int long_index = 0;
+  int err;
   ow_err_t ow_err;
   struct sigaction action;
   int device_num = -1;
   int blocks_per_transfer = DEFAULT_BLOCKS;
+  int transfers = DEFAULT_TRANSFERS;
   int quality = DEFAULT_QUALITY;
   int priority = DEFAULT_PRIORITY;
+  int event_threads = DEFAULT_EVENT_THREADS;
+  uint64_t cpu_mask = 0;
 
   action.sa_handler = signal_handler;
   sigemptyset (&action.sa_mask);
@@ -174,7 +527,7 @@ main (int argc, char *argv[])
   sigaction (SIGUSR1, &action, NULL);
   sigaction (SIGTSTP, &action, NULL);
 
-  while ((opt = getopt_long (argc, argv, "n:d:q:b:p:lvh",
+  while ((opt = getopt_long (argc, argv, "n:d:q:b:t:p:aAe:cC:LDm:lvh",
 			     options, &long_index)) != -1)
     {
       switch (opt)
@@ -201,15 +554,29 @@ main (int argc, char *argv[])
 	case 'b':
 	  blocks_per_transfer = (int) strtol (optarg, &endstr, 10);
 	  if (errno || endstr == optarg || *endstr != '\0'
-	      || blocks_per_transfer < 2 || blocks_per_transfer > 32)
+	      || blocks_per_transfer < OW_ENGINE_MIN_BLOCKS
+	      || blocks_per_transfer > OW_ENGINE_MAX_BLOCKS)
 	    {
 	      blocks_per_transfer = DEFAULT_BLOCKS;
 	      fprintf (stderr,
-		       "Blocks value must be in [2..32]. Using value %d...\n",
+		       "Blocks value must be in [%d..%d]. Using value %d...\n",
+		       OW_ENGINE_MIN_BLOCKS, OW_ENGINE_MAX_BLOCKS,
 		       blocks_per_transfer);
 	    }
 	  bflg++;
 	  break;
+	case 't':
+	  transfers = (int) strtol (optarg, &endstr, 10);
+	  if (errno || endstr == optarg || *endstr != '\0' || transfers < 1
+	      || transfers > OW_MAX_AUDIO_TRANSFERS)
+	    {
+	      transfers = DEFAULT_TRANSFERS;
+	      fprintf (stderr,
+		       "Transfers value must be in [1..%d]. Using value %d...\n",
+		       OW_MAX_AUDIO_TRANSFERS, transfers);
+	    }
+	  tflg++;
+	  break;
 	case 'p':
 	  priority = (int) strtol (optarg, &endstr, 10);
 	  if (errno || endstr == optarg || *endstr != '\0' || priority < 0
@@ -221,6 +588,46 @@ main (int argc, char *argv[])
 	    }
 	  pflg++;
 	  break;
+	case 'a':
+	  aflg++;
+	  break;
+	case 'A':
+	  Aflg++;
+	  break;
+	case 'e':
+	  event_threads = (int) strtol (optarg, &endstr, 10);
+	  if (errno || endstr == optarg || *endstr != '\0'
+	      || event_threads < 0 || event_threads > MAX_EVENT_THREADS)
+	    {
+	      event_threads = DEFAULT_EVENT_THREADS;
+	      fprintf (stderr,
+		       "Event threads value must be in [0..%d]. Using value %d...\n",
+		       MAX_EVENT_THREADS, event_threads);
+	    }
+	  eflg++;
+	  break;
+	case 'c':
+	  cflg++;
+	  break;
+	case 'C':
+	  if (parse_cpu_list (optarg, &cpu_mask))
+	    {
+	      cpu_mask = 0;
+	      fprintf (stderr,
+		       "CPU affinity must be a list of CPUs in [0..63] like '2,3' or '2-5'. Not using it...\n");
+	    }
+	  Cflg++;
+	  break;
+	case 'L':
+	  Lflg++;
+	  break;
+	case 'D':
+	  Dflg++;
+	  break;
+	case 'm':
+	  metrics_path = optarg;
+	  mflg++;
+	  break;
 	case 'l':
 	  lflg++;
 	  break;
@@ -263,20 +670,64 @@ main (int argc, char *argv[])
       exit (EXIT_FAILURE);
     }
 
+  if (tflg > 1)
+    {
+      fprintf (stderr, "Undetermined transfers\n");
+      exit (EXIT_FAILURE);
+    }
+
   if (pflg > 1)
     {
       fprintf (stderr, "Undetermined priority\n");
       exit (EXIT_FAILURE);
     }
 
-  if (nflg + dflg == 0)
+  if (eflg > 1)
+    {
+      fprintf (stderr, "Undetermined event threads\n");
+      exit (EXIT_FAILURE);
+    }
+
+  if (mflg > 1)
+    {
+      fprintf (stderr, "Undetermined metrics socket\n");
+      exit (EXIT_FAILURE);
+    }
+
+  if (Cflg > 1)
+    {
+      fprintf (stderr, "Undetermined CPU affinity\n");
+      exit (EXIT_FAILURE);
+    }
+
+  ow_rtlog_start ();
+
+  if (Dflg)
+    {
+      if (nflg + dflg)
+	{
+	  fprintf (stderr, "Daemon mode serves all the devices\n");
+	  exit (EXIT_FAILURE);
+	}
+      if (mflg)
+	{
+	  fprintf (stderr, "Metrics are not available in daemon mode\n");
+	  exit (EXIT_FAILURE);
+	}
+      err = run_daemon (blocks_per_transfer, transfers, quality, priority,
+			aflg, Aflg, cpu_mask, Lflg, event_threads, cflg);
+    }
+  else if (nflg + dflg == 0)
     {
-      return run_all (blocks_per_transfer, quality, priority);
+      err = run_all (blocks_per_transfer, transfers, quality, priority,
+		     aflg, Aflg, cpu_mask, Lflg, event_threads, cflg,
+		     metrics_path);
     }
   else if (nflg + dflg == 1)
     {
-      return run_single (device_num, device_name,
-			 blocks_per_transfer, quality, priority);
+      err = run_single (device_num, device_name,
+			blocks_per_transfer, transfers, quality, priority,
+			aflg, Aflg, cpu_mask, Lflg, metrics_path);
     }
   else
     {
@@ -284,5 +735,7 @@ main (int argc, char *argv[])
       exit (EXIT_FAILURE);
     }
 
-  return EXIT_SUCCESS;
+  ow_rtlog_stop ();
+
+  return err;
 }
@@ -21,26 +21,58 @@
 #include <signal.h>
 #include <sndfile.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../config.h"
 #include "utils.h"
 #include "common.h"
+#include "gather.h"
+#include "rtlog.h"
 
 #define DEFAULT_BLOCKS 24
+#define PREFETCH_SECONDS 4
+#define PREFETCH_REFILL_DIV 4	//The reader is woken up when a quarter of the ring is free.
 
 static struct ow_context context;
 static struct ow_engine *engine;
 static SF_INFO sfinfo;
 static SNDFILE *sf;
 static const struct ow_device_desc *desc;
-static float max[OB_MAX_TRACKS];
-static float min[OB_MAX_TRACKS];
 static char *file;
 static sf_count_t frames;
+static int int32_audio;		//The samples are the device int32 ones instead of floats.
+
+//The RT thread only copies from a ring filled ahead by the reader thread or from the mapped file.
+static struct
+{
+  struct ow_ring *ring;
+  size_t refill_len;
+  pthread_t pthread;
+  int prefetching;
+  sem_t sem;
+  atomic_int hungry;
+  atomic_int eof;
+  atomic_int end;
+  struct ow_gather gather;
+  const char *map;
+  size_t map_len;
+  size_t data_offset;
+  size_t data_len;
+  size_t pos;
+} buffer;
 
 static struct option options[] = {
   {"use-device-number", 1, NULL, 'n'},
   {"use-device", 1, NULL, 'd'},
   {"list-devices", 0, NULL, 'l'},
+  {"cpu-affinity", 1, NULL, 'C'},
+  {"lock-memory", 0, NULL, 'L'},
+  {"mmap", 0, NULL, 'm'},
   {"verbose", 0, NULL, 'v'},
   {"help", 0, NULL, 'h'},
   {NULL, 0, NULL, 0}
@@ -55,7 +87,24 @@ print_status ()
 static size_t
 buffer_read_space (void *data)
 {
-  size_t rbsp = (sfinfo.frames - frames) * desc->inputs * OB_BYTES_PER_SAMPLE;
+  size_t rbsp;
+  int eof;
+
+  if (buffer.map)
+    {
+      rbsp = buffer.data_len - buffer.pos;
+    }
+  else
+    {
+      //The end of the file is loaded first as the last frames are committed before it is set.
+      eof = atomic_load (&buffer.eof);
+      rbsp = ow_ring_read_space (buffer.ring);
+      if (!rbsp && !eof)
+	{
+	  //This is an underflow, not the end of the file.
+	  return rbsp;
+	}
+    }
 
   if (!rbsp)
     {
@@ -68,58 +117,250 @@ buffer_read_space (void *data)
 static size_t
 buffer_read (void *data, char *buf, size_t size)
 {
-  int bytes_per_frame = desc->inputs * OB_BYTES_PER_SAMPLE;
-  sf_count_t wanted_frames, read_frames;
-
-  wanted_frames = size / bytes_per_frame;
-
-  debug_print (2, "Reading %ld bytes (%ld frames) from file...\n", size,
-	       wanted_frames);
+  size_t len;
 
-  read_frames = sf_readf_float (sf, (float *) buf, wanted_frames);
+  rt_debug_print (2, "Reading %zu bytes (%zu frames) from buffer...\n", size,
+		  size / (desc->inputs * OB_BYTES_PER_SAMPLE));
 
-  if (read_frames < wanted_frames)
+  if (buffer.map)
     {
-      ow_engine_stop (engine);
+      len = buffer.data_len - buffer.pos;
+      len = size < len ? size : len;
+      if (buf)
+	{
+	  memcpy (buf, &buffer.map[buffer.data_offset + buffer.pos], len);
+	}
+      buffer.pos += len;
     }
+  else
+    {
+      len = ow_ring_read (buffer.ring, buf, size);
+      if (atomic_load (&buffer.hungry)
+	  && ow_ring_write_space (buffer.ring) >= buffer.refill_len
+	  && atomic_exchange (&buffer.hungry, 0))
+	{
+	  sem_post (&buffer.sem);
+	}
+    }
+
+  frames += len / (desc->inputs * OB_BYTES_PER_SAMPLE);
+  return len;
+}
 
-  for (int i = 0; i < read_frames; i++)
+//Decodes straight into the ring memory. Returns 1 at the end of the file.
+static int
+prefetch_fill ()
+{
+  sf_count_t read_frames, wanted_frames;
+  struct ow_ring_vector vector[2];
+  size_t frame_size = ow_ring_get_frame_size (buffer.ring);
+
+  while (ow_ring_write_reserve (buffer.ring, vector))
     {
-      for (int j = 0; j < desc->inputs; j++)
+      for (int i = 0; i < 2; i++)
 	{
-	  float x = *((float *) buf);
-	  if (x >= 0.0)
+	  wanted_frames = vector[i].len / frame_size;
+	  if (!wanted_frames)
 	    {
-	      if (x > max[j])
-		{
-		  max[j] = x;
-		}
+	      continue;
+	    }
+	  if (int32_audio)
+	    {
+	      read_frames = sf_readf_int (sf, (int *) vector[i].buf,
+					  wanted_frames);
 	    }
 	  else
 	    {
-	      if (x < min[j])
+	      read_frames = sf_readf_float (sf, (float *) vector[i].buf,
+					    wanted_frames);
+	    }
+	  if (read_frames > 0)
+	    {
+	      if (!int32_audio)
 		{
-		  min[j] = x;
+		  ow_gather_peaks (&buffer.gather, (float *) vector[i].buf,
+				   read_frames);
 		}
+	      ow_ring_write_commit (buffer.ring, read_frames * frame_size);
+	    }
+	  if (read_frames < wanted_frames)
+	    {
+	      atomic_store (&buffer.eof, 1);
+	      return 1;
 	    }
-	  buf += OB_BYTES_PER_SAMPLE;
 	}
     }
 
-  frames += read_frames;
-  return read_frames * bytes_per_frame;
+  return 0;
+}
+
+static void *
+prefetch_run (void *data)
+{
+  while (!atomic_load (&buffer.end))
+    {
+      if (prefetch_fill ())
+	{
+	  break;
+	}
+
+      atomic_store (&buffer.hungry, 1);
+      //The RT thread might have consumed data before the flag was set.
+      if (ow_ring_write_space (buffer.ring) < buffer.refill_len)
+	{
+	  sem_wait (&buffer.sem);
+	}
+    }
+
+  return NULL;
+}
+
+static void
+prefetch_stop ()
+{
+  atomic_store (&buffer.end, 1);
+  sem_post (&buffer.sem);
+  pthread_join (buffer.pthread, NULL);
+}
+
+static int
+prefetch_start ()
+{
+  size_t frame_size = desc->inputs * OB_BYTES_PER_SAMPLE;
+
+  buffer.ring = ow_ring_new (PREFETCH_SECONDS * OB_SAMPLE_RATE, frame_size);
+  if (!buffer.ring)
+    {
+      return 1;
+    }
+  ow_ring_mlock (buffer.ring);
+  buffer.refill_len =
+    (PREFETCH_SECONDS * OB_SAMPLE_RATE / PREFETCH_REFILL_DIV) * frame_size;
+  atomic_init (&buffer.hungry, 0);
+  atomic_init (&buffer.eof, 0);
+  atomic_init (&buffer.end, 0);
+  sem_init (&buffer.sem, 0, 0);
+
+  //The ring is full before starting the engine so there are no underflows at startup.
+  if (prefetch_fill ())
+    {
+      return 0;
+    }
+
+  if (pthread_create (&buffer.pthread, NULL, prefetch_run, NULL))
+    {
+      error_print ("Could not start prefetch thread\n");
+      return 1;
+    }
+  buffer.prefetching = 1;
+
+  return 0;
+}
+
+//Returns the offset of the samples in a WAVE file or -1 if they can not be found.
+static ssize_t
+get_wave_data_offset (const char *map, size_t len, size_t *data_len)
+{
+  uint32_t chunk_len;
+  size_t offset = 12;
+
+  if (len < offset || memcmp (map, "RIFF", 4) || memcmp (&map[8], "WAVE", 4))
+    {
+      return -1;
+    }
+
+  while (offset + 8 <= len)
+    {
+      memcpy (&chunk_len, &map[offset + 4], sizeof (uint32_t));
+      chunk_len = le32toh (chunk_len);
+      if (!memcmp (&map[offset], "data", 4))
+	{
+	  offset += 8;
+	  *data_len = chunk_len < len - offset ? chunk_len : len - offset;
+	  return offset;
+	}
+      offset += 8 + chunk_len + (chunk_len & 1);
+    }
+
+  return -1;
+}
+
+//Only little endian 32 bits WAVE files can be used as they are as the device samples.
+static int
+map_open (const char *file)
+{
+  int fd;
+  struct stat st;
+  ssize_t offset;
+  size_t frame_size = desc->inputs * OB_BYTES_PER_SAMPLE;
+
+  if ((sfinfo.format != (SF_FORMAT_WAV | SF_FORMAT_FLOAT)
+       && sfinfo.format != (SF_FORMAT_WAV | SF_FORMAT_PCM_32))
+      || __BYTE_ORDER != __LITTLE_ENDIAN)
+    {
+      error_print
+	("Only 32 bits float or integer WAVE files can be mapped\n");
+      return 1;
+    }
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0 || fstat (fd, &st))
+    {
+      error_print ("Error while opening file: %s\n", strerror (errno));
+      if (fd >= 0)
+	{
+	  close (fd);
+	}
+      return 1;
+    }
+
+  //Populating the mapping reads the whole file now and not from the RT thread.
+  buffer.map_len = st.st_size;
+  buffer.map = mmap (NULL, buffer.map_len, PROT_READ,
+		     MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close (fd);
+  if (buffer.map == MAP_FAILED)
+    {
+      error_print ("Error while mapping file: %s\n", strerror (errno));
+      buffer.map = NULL;
+      return 1;
+    }
+
+  offset = get_wave_data_offset (buffer.map, buffer.map_len,
+				 &buffer.data_len);
+  if (offset < 0)
+    {
+      error_print ("WAVE data not found\n");
+      munmap ((void *) buffer.map, buffer.map_len);
+      buffer.map = NULL;
+      return 1;
+    }
+  buffer.data_offset = offset;
+  buffer.data_len -= buffer.data_len % frame_size;
+  buffer.pos = 0;
+
+  if (debug_level && !int32_audio)
+    {
+      ow_gather_peaks (&buffer.gather,
+		       (const float *) &buffer.map[buffer.data_offset],
+		       buffer.data_len / frame_size);
+    }
+
+  return 0;
 }
 
 static void
 signal_handler (int signo)
 {
   print_status ();
-  if (debug_level)
+  //Peaks are computed as floats so they are meaningless for int32 samples.
+  if (debug_level && !int32_audio)
     {
       for (int i = 0; i < desc->inputs; i++)
 	{
 	  fprintf (stderr, "%s: max: %f; min: %f\n",
-		   desc->input_track_names[i], max[i], min[i]);
+		   desc->input_track_names[i], buffer.gather.max[i],
+		   buffer.gather.min[i]);
 	}
     }
   if (signo == SIGHUP || signo == SIGINT || signo == SIGTERM
@@ -130,7 +371,8 @@ signal_handler (int signo)
 }
 
 static int
-run_play (int device_num, const char *device_name, const char *file)
+run_play (int device_num, const char *device_name, const char *file,
+	  int use_map)
 {
   ow_err_t err;
   struct ow_usb_device *device;
@@ -166,18 +408,45 @@ run_play (int device_num, const char *device_name, const char *file)
       goto cleanup_audio;
     }
 
-  for (int i = 0; i < desc->inputs; i++)
+  ow_gather_init (&buffer.gather, desc->inputs, NULL);
+
+  //Integer files are read as int32 samples and sent as they are so that 16, 24 and 32 bits files are played bit exact.
+  switch (sfinfo.format & SF_FORMAT_SUBMASK)
     {
-      max[i] = 0.0f;
-      min[i] = 0.0f;
+    case SF_FORMAT_PCM_16:
+    case SF_FORMAT_PCM_24:
+    case SF_FORMAT_PCM_32:
+      int32_audio = 1;
+      debug_print (1, "Using int32 samples...\n");
+      break;
+    default:
+      int32_audio = 0;
+    }
+
+  if (use_map)
+    {
+      if (map_open (file))
+	{
+	  err = OW_GENERIC_ERROR;
+	  goto cleanup_audio;
+	}
+    }
+  else if (prefetch_start ())
+    {
+      err = OW_GENERIC_ERROR;
+      goto cleanup_buffer;
     }
 
   ow_set_thread_rt_priority (pthread_self (), OW_DEFAULT_RT_PROPERTY);
 
   context.read_space = buffer_read_space;
   context.read = buffer_read;
-  context.p2o_audio = sf;
+  context.p2o_audio = &buffer;
   context.options = OW_ENGINE_OPTION_P2O_AUDIO;
+  if (int32_audio)
+    {
+      context.options |= OW_ENGINE_OPTION_INT32_AUDIO;
+    }
 
   err = ow_engine_start (engine, &context);
   if (!err)
@@ -186,6 +455,21 @@ run_play (int device_num, const char *device_name, const char *file)
       print_status ();
     }
 
+  if (buffer.prefetching)
+    {
+      prefetch_stop ();
+    }
+
+cleanup_buffer:
+  if (use_map)
+    {
+      munmap ((void *) buffer.map, buffer.map_len);
+    }
+  else if (buffer.ring)
+    {
+      sem_destroy (&buffer.sem);
+      ow_ring_free (buffer.ring);
+    }
 cleanup_audio:
   sf_close (sf);
 cleanup_engine:
@@ -201,8 +485,8 @@ end:
 int
 main (int argc, char *argv[])
 {
-  int opt;
-  int vflg = 0, lflg = 0, dflg = 0, nflg = 0, errflg = 0;
+  int opt, err;
+  int vflg = 0, lflg = 0, dflg = 0, nflg = 0, mflg = 0, errflg = 0;
   char *endstr;
   const char *device_name = NULL;
   int long_index = 0;
@@ -219,7 +503,7 @@ main (int argc, char *argv[])
   sigaction (SIGUSR1, &action, NULL);
   sigaction (SIGTSTP, &action, NULL);
 
-  while ((opt = getopt_long (argc, argv, "n:d:lvh",
+  while ((opt = getopt_long (argc, argv, "n:d:mlC:Lvh",
 			     options, &long_index)) != -1)
     {
       switch (opt)
@@ -232,9 +516,23 @@ main (int argc, char *argv[])
 	  device_name = optarg;
 	  dflg++;
 	  break;
+	case 'm':
+	  mflg++;
+	  break;
 	case 'l':
 	  lflg++;
 	  break;
+	case 'C':
+	  if (parse_cpu_list (optarg, &context.cpu_mask))
+	    {
+	      context.cpu_mask = 0;
+	      fprintf (stderr,
+		       "CPU affinity must be a list of CPUs in [0..63] like '2,3' or '2-5'. Not using it...\n");
+	    }
+	  break;
+	case 'L':
+	  context.lock_memory = 1;
+	  break;
 	case 'v':
 	  vflg++;
 	  break;
@@ -279,7 +577,10 @@ main (int argc, char *argv[])
 
   if (nflg + dflg == 1)
     {
-      return run_play (device_num, device_name, file);
+      ow_rtlog_start ();
+      err = run_play (device_num, device_name, file, mflg);
+      ow_rtlog_stop ();
+      return err;
     }
   else
     {
@@ -18,56 +18,92 @@
  *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include <signal.h>
 #include <sndfile.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include "../config.h"
 #include "utils.h"
 #include "common.h"
+#include "gather.h"
+#include "rtlog.h"
 
 #define DEFAULT_BLOCKS 24
 #define TRACK_BUF_KB 256
 #define MAX_FILENAME_LEN 64
+#define CHUNK_FRAMES 1024	//Chunks are a multiple of 4 KiB so they can be written with O_DIRECT.
+#define MIN_CHUNKS 2
+#define STEMS_FILENAME_LEN (MAX_FILENAME_LEN + 8)
 
 static struct ow_context context;
 static struct ow_engine *engine;
 static SF_INFO sfinfo;
 static SNDFILE *sf;
+static int raw_fd = -1;
 static const struct ow_device_desc *desc;
 static const char *track_mask;
 static size_t track_buf_kb = TRACK_BUF_KB;
-static float max[OB_MAX_TRACKS];
-static float min[OB_MAX_TRACKS];
 static char filename[MAX_FILENAME_LEN];
+static int format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+static int int32_audio;		//The samples are the device int32 ones instead of floats.
+static const char *extension = "wav";
 
-typedef enum
+//Every worker encodes the tracks k, k + workers, k + 2 * workers... of the data reserved by the writer thread into their own files.
+struct stems_worker
 {
-  END = -1,
-  EMPTY,
-  READY
-} buffer_status_t;
+  pthread_t pthread;
+  sem_t start;
+  int first;
+  union
+  {
+    float f[CHUNK_FRAMES];
+    int32_t i[CHUNK_FRAMES];
+  } samples;
+};
 
 static struct
 {
-  char *mem;
-  char *disk;
-  size_t len;
+  int workers;
+  struct stems_worker *worker;
+  SNDFILE *sf[OB_MAX_TRACKS];
+  struct ow_ring_vector vector[2];
+  sem_t done;
+  int end;
+} stems;
+
+//The USB thread stores the recorded samples straight into the chunks of the ring and the writer thread is woken up every time a chunk is completed.
+static struct
+{
+  struct ow_ring *ring;
+  size_t chunk_len;
+  char *chunk;			//Chunk being filled or NULL if there is no room
+  size_t pos;
   pthread_t pthread;
-  size_t disk_samples;
-  size_t disk_frames;
-  pthread_spinlock_t lock;
-  buffer_status_t status;
+  sem_t sem;
+  atomic_int end;
+  size_t frames;
+  atomic_size_t lost_frames;
   int outputs;
-  int outputs_mask_len;
+  struct ow_gather gather;
 } buffer;
 
 static struct option options[] = {
   {"use-device-number", 1, NULL, 'n'},
   {"use-device", 1, NULL, 'd'},
   {"list-devices", 0, NULL, 'l'},
+  {"cpu-affinity", 1, NULL, 'C'},
+  {"lock-memory", 0, NULL, 'L'},
   {"track-mask", 1, NULL, 'm'},
   {"track-buffer-kilobytes", 1, NULL, 'b'},
+  {"raw", 0, NULL, 'r'},
+  {"stems", 0, NULL, 's'},
+  {"flac", 0, NULL, 'f'},
+  {"int32", 0, NULL, 'i'},
   {"verbose", 0, NULL, 'v'},
   {"help", 0, NULL, 'h'},
   {NULL, 0, NULL, 0}
@@ -76,7 +112,13 @@ static struct option options[] = {
 static void
 print_status ()
 {
-  fprintf (stderr, "%lu frames written\n", sfinfo.frames);
+  size_t lost_frames = atomic_load (&buffer.lost_frames);
+
+  fprintf (stderr, "%zu frames written\n", buffer.frames);
+  if (lost_frames)
+    {
+      fprintf (stderr, "%zu frames lost\n", lost_frames);
+    }
 }
 
 static size_t
@@ -86,106 +128,312 @@ buffer_dummy_rw_space (void *data)
     OB_BYTES_PER_SAMPLE;
 }
 
-static buffer_status_t
-get_buffer_status ()
+//Only the last write might not be a whole number of chunks so O_DIRECT is disabled for it.
+static void
+write_data (char *data, size_t len)
+{
+  ssize_t written;
+
+  if (raw_fd < 0)
+    {
+      if (int32_audio)
+	{
+	  sf_write_int (sf, (int *) data, len / OB_BYTES_PER_SAMPLE);
+	}
+      else
+	{
+	  sf_write_float (sf, (float *) data, len / OB_BYTES_PER_SAMPLE);
+	}
+      return;
+    }
+
+  if (len % buffer.chunk_len)
+    {
+      fcntl (raw_fd, F_SETFL, fcntl (raw_fd, F_GETFL) & ~O_DIRECT);
+    }
+
+  while (len)
+    {
+      written = write (raw_fd, data, len);
+      if (written < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  error_print ("Error while writing to disk: %s\n", strerror (errno));
+	  return;
+	}
+      data += written;
+      len -= written;
+    }
+}
+
+//Samples are copied as integers so that both floats and int32 are kept bit exact.
+static void
+stems_write_data (struct stems_worker *worker, const char *data, size_t len)
 {
-  buffer_status_t status;
+  size_t n;
+  const int32_t *src;
+  size_t frames = len / (buffer.outputs * OB_BYTES_PER_SAMPLE);
 
-  pthread_spin_lock (&buffer.lock);
-  status = buffer.status;
-  pthread_spin_unlock (&buffer.lock);
+  if (!frames)
+    {
+      return;
+    }
 
-  return status;
+  for (int k = worker->first; k < buffer.outputs; k += stems.workers)
+    {
+      src = (const int32_t *) data + k;
+      for (size_t i = 0; i < frames; i += n)
+	{
+	  n = frames - i < CHUNK_FRAMES ? frames - i : CHUNK_FRAMES;
+	  for (size_t j = 0; j < n; j++)
+	    {
+	      worker->samples.i[j] = *src;
+	      src += buffer.outputs;
+	    }
+	  if (int32_audio)
+	    {
+	      sf_write_int (stems.sf[k], worker->samples.i, n);
+	    }
+	  else
+	    {
+	      sf_write_float (stems.sf[k], worker->samples.f, n);
+	    }
+	}
+    }
 }
 
 static void *
-dump_buffer (void *data)
+stems_run_worker (void *data)
 {
-  buffer_status_t status = get_buffer_status ();
-  while (status >= EMPTY)
+  struct stems_worker *worker = data;
+
+  while (1)
     {
-      if (status == READY)
+      sem_wait (&worker->start);
+      if (stems.end)
 	{
-	  pthread_spin_lock (&buffer.lock);
-	  debug_print (2, "Writing %ld frames to disk...\n",
-		       buffer.disk_frames);
-	  sf_write_float (sf, (float *) buffer.disk, buffer.disk_samples);
-	  debug_print (2, "Done\n");
+	  break;
+	}
+      stems_write_data (worker, stems.vector[0].buf, stems.vector[0].len);
+      stems_write_data (worker, stems.vector[1].buf, stems.vector[1].len);
+      sem_post (&stems.done);
+    }
 
-	  buffer.status = EMPTY;
-	  pthread_spin_unlock (&buffer.lock);
+  return NULL;
+}
+
+//The ring data can not be committed until all the workers are done with it.
+static void
+stems_write (struct ow_ring_vector *vector)
+{
+  stems.vector[0] = vector[0];
+  stems.vector[1] = vector[1];
+
+  for (int i = 0; i < stems.workers; i++)
+    {
+      sem_post (&stems.worker[i].start);
+    }
+  for (int i = 0; i < stems.workers; i++)
+    {
+      sem_wait (&stems.done);
+    }
+}
+
+static void
+stems_stop ()
+{
+  stems.end = 1;
+  for (int i = 0; i < stems.workers; i++)
+    {
+      sem_post (&stems.worker[i].start);
+      pthread_join (stems.worker[i].pthread, NULL);
+      sem_destroy (&stems.worker[i].start);
+    }
+  sem_destroy (&stems.done);
+  free (stems.worker);
+  stems.workers = 0;
+}
+
+static int
+stems_start ()
+{
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  stems.workers = cpus < buffer.outputs ? cpus : buffer.outputs;
+  if (stems.workers < 1)
+    {
+      stems.workers = 1;
+    }
+  stems.worker = malloc (sizeof (struct stems_worker) * stems.workers);
+  stems.end = 0;
+  sem_init (&stems.done, 0, 0);
+
+  debug_print (1, "Using %d encoding workers...\n", stems.workers);
+
+  for (int i = 0; i < stems.workers; i++)
+    {
+      stems.worker[i].first = i;
+      sem_init (&stems.worker[i].start, 0, 0);
+      if (pthread_create (&stems.worker[i].pthread, NULL, stems_run_worker,
+			  &stems.worker[i]))
+	{
+	  error_print ("Could not start encoding thread\n");
+	  sem_destroy (&stems.worker[i].start);
+	  stems.workers = i;
+	  stems_stop ();
+	  return 1;
 	}
+    }
 
-      usleep (100);
+  return 0;
+}
 
-      status = get_buffer_status ();
+static void
+stems_close ()
+{
+  for (int i = 0; i < buffer.outputs; i++)
+    {
+      if (stems.sf[i])
+	{
+	  sf_close (stems.sf[i]);
+	  stems.sf[i] = NULL;
+	}
     }
-  return NULL;
 }
 
-static size_t
-buffer_write (void *data, const char *buf, size_t size)
+static int
+stems_open (const char *prefix)
 {
-  static int print_control = 0;
-  static size_t pos = 0;
-  size_t new_pos;
-  void *dst;
-  size_t frames = size / (desc->outputs * OB_BYTES_PER_SAMPLE);
+  char stem_filename[STEMS_FILENAME_LEN];
 
-  debug_print (2, "Writing %ld bytes (%ld frames) to buffer...\n", size,
-	       frames);
-  new_pos = pos + frames * buffer.outputs * OB_BYTES_PER_SAMPLE;
-  if (new_pos >= buffer.len)
+  for (int i = 0; i < buffer.outputs; i++)
     {
-      pthread_spin_lock (&buffer.lock);
-      buffer.status = READY;
-      buffer.disk_samples = pos / OB_BYTES_PER_SAMPLE;
-      buffer.disk_frames = buffer.disk_samples / buffer.outputs;
-      memcpy (buffer.disk, buffer.mem,
-	      buffer.disk_frames * buffer.outputs * OB_BYTES_PER_SAMPLE);
-      pthread_spin_unlock (&buffer.lock);
-      sfinfo.frames += buffer.disk_frames;
-      pos = 0;
+      snprintf (stem_filename, STEMS_FILENAME_LEN, "%s_%02d.%s", prefix,
+		buffer.gather.index[i] + 1, extension);
+      debug_print (1, "Creating %s file (%s)...\n", stem_filename,
+		   desc->output_track_names[buffer.gather.index[i]]);
+      stems.sf[i] = sf_open (stem_filename, SFM_WRITE, &sfinfo);
+      if (!stems.sf[i])
+	{
+	  error_print ("Error while opening file: %s\n", sf_strerror (NULL));
+	  stems_close ();
+	  return 1;
+	}
     }
 
-  dst = &buffer.mem[pos];
-  for (int i = 0; i < frames; i++)
+  return 0;
+}
+
+//The periodic status is printed here as this thread is not real time.
+static void *
+dump_buffer (void *data)
+{
+  int end;
+  size_t len, frames;
+  size_t print_control = 0;
+  struct ow_ring_vector vector[2];
+
+  do
     {
-      for (int j = 0; j < desc->outputs; j++)
+      sem_wait (&buffer.sem);
+      end = atomic_load (&buffer.end);
+
+      while ((len = ow_ring_read_reserve (buffer.ring, vector)))
 	{
-	  if (!track_mask
-	      || (j < buffer.outputs_mask_len && (track_mask[j] != '0')))
+	  frames = len / (buffer.outputs * OB_BYTES_PER_SAMPLE);
+	  debug_print (2, "Writing %zu frames to disk...\n", frames);
+	  if (stems.workers)
+	    {
+	      stems_write (vector);
+	    }
+	  else
 	    {
-	      memcpy (dst, buf, OB_BYTES_PER_SAMPLE);
-	      dst += OB_BYTES_PER_SAMPLE;
-	      pos += OB_BYTES_PER_SAMPLE;
-	      float x = *((float *) buf);
-	      if (x >= 0.0)
+	      write_data (vector[0].buf, vector[0].len);
+	      if (vector[1].len)
 		{
-		  if (x > max[j])
-		    {
-		      max[j] = x;
-		    }
+		  write_data (vector[1].buf, vector[1].len);
 		}
-	      else
+	    }
+	  ow_ring_read_commit (buffer.ring, len);
+	  buffer.frames += frames;
+	  debug_print (2, "Done\n");
+
+	  if (debug_level)
+	    {
+	      print_control += frames;
+	      if (print_control >= OB_SAMPLE_RATE)
 		{
-		  if (x < min[j])
-		    {
-		      min[j] = x;
-		    }
+		  print_control -= OB_SAMPLE_RATE;
+		  print_status ();
 		}
 	    }
-	  buf += OB_BYTES_PER_SAMPLE;
 	}
     }
+  while (!end);
+
+  return NULL;
+}
+
+//Ring positions are always a multiple of the chunk length so the first vector always holds a whole chunk.
+static inline int
+buffer_next_chunk ()
+{
+  struct ow_ring_vector vector[2];
+
+  if (ow_ring_write_reserve (buffer.ring, vector) < buffer.chunk_len)
+    {
+      buffer.chunk = NULL;
+      return 1;
+    }
+
+  buffer.chunk = vector[0].buf;
+  buffer.pos = 0;
+  return 0;
+}
+
+//Frames are gathered in runs as long as the room left in the current chunk.
+static size_t
+buffer_write (void *data, const char *buf, size_t size)
+{
+  size_t n;
+  const float *src = (const float *) buf;
+  size_t frame_size = buffer.outputs * OB_BYTES_PER_SAMPLE;
+  size_t frames = size / (desc->outputs * OB_BYTES_PER_SAMPLE);
+  size_t pending = frames;
 
-  if (debug_level)
+  rt_debug_print (2, "Writing %zu bytes (%zu frames) to buffer...\n", size,
+		  frames);
+
+  while (pending)
     {
-      print_control += frames;
-      if (print_control >= OB_SAMPLE_RATE)
+      if (!buffer.chunk && buffer_next_chunk ())
 	{
-	  print_control -= OB_SAMPLE_RATE;
-	  print_status ();
+	  if (!atomic_fetch_add (&buffer.lost_frames, pending))
+	    {
+	      rt_error_print ("Buffer overflow. Discarding data...\n");
+	    }
+	  break;
+	}
+
+      n = (buffer.chunk_len - buffer.pos) / frame_size;
+      if (n > pending)
+	{
+	  n = pending;
+	}
+      ow_gather_run (&buffer.gather, (float *) &buffer.chunk[buffer.pos],
+		     src, n);
+      buffer.pos += n * frame_size;
+      src += n * desc->outputs;
+      pending -= n;
+
+      if (buffer.pos == buffer.chunk_len)
+	{
+	  ow_ring_write_commit (buffer.ring, buffer.chunk_len);
+	  buffer.chunk = NULL;
+	  sem_post (&buffer.sem);
 	}
     }
 
@@ -196,29 +444,37 @@ static void
 signal_handler (int signo)
 {
   print_status ();
-  if (debug_level)
+  //Peaks are computed as floats so they are meaningless for int32 samples.
+  if (debug_level && !int32_audio)
     {
-      for (int i = 0; i < desc->outputs; i++)
+      for (int i = 0; i < buffer.gather.count; i++)
 	{
-	  if (!track_mask
-	      || (i < buffer.outputs_mask_len && (track_mask[i] != '0')))
-	    {
-	      fprintf (stderr, "%s: max: %f; min: %f\n",
-		       desc->output_track_names[i], max[i], min[i]);
-	    }
+	  fprintf (stderr, "%s: max: %f; min: %f\n",
+		   desc->output_track_names[buffer.gather.index[i]],
+		   buffer.gather.max[i], buffer.gather.min[i]);
 	}
     }
   if (signo == SIGHUP || signo == SIGINT || signo == SIGTERM
       || signo == SIGTSTP)
     {
       ow_engine_stop (engine);
-      fprintf (stderr, "%s file created\n", filename);
+      if (stems.sf[0])
+	{
+	  fprintf (stderr, "%s_*.%s files created\n", filename, extension);
+	}
+      else
+	{
+	  fprintf (stderr, "%s file created\n", filename);
+	}
     }
 }
 
 static int
-run_record (int device_num, const char *device_name)
+run_record (int device_num, const char *device_name, int raw,
+	    int stems_mode)
 {
+  size_t chunks;
+  uint64_t active_tracks;
   char curr_time_string[MAX_FILENAME_LEN >> 1];
   time_t curr_time;
   struct tm tm;
@@ -241,88 +497,153 @@ run_record (int device_num, const char *device_name)
 
   desc = ow_engine_get_device_desc (engine);
 
-  if (track_mask)
-    {
-      buffer.outputs = 0;
-      const char *c = track_mask;
-      for (int i = 0; i < strlen (track_mask); i++, c++)
-	{
-	  if (*c != '0')
-	    {
-	      buffer.outputs++;
-	    }
-	}
-    }
-  else
-    {
-      buffer.outputs = desc->outputs;
-    }
-
+  buffer.outputs = ow_gather_init (&buffer.gather, desc->outputs,
+				   track_mask);
   if (buffer.outputs == 0)
     {
       err = OW_GENERIC_ERROR;
       goto cleanup_engine;
     }
 
+  //Unselected tracks are not even decoded.
+  active_tracks = 0;
+  for (int i = 0; i < buffer.outputs; i++)
+    {
+      active_tracks |= 1ULL << buffer.gather.index[i];
+    }
+  ow_engine_set_o2p_active_tracks (engine, active_tracks);
+
   sfinfo.frames = 0;
   sfinfo.samplerate = OB_SAMPLE_RATE;
-  sfinfo.channels = buffer.outputs;
-  sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+  sfinfo.channels = stems_mode ? 1 : buffer.outputs;
+  sfinfo.format = format;
 
   curr_time = time (NULL);
   localtime_r (&curr_time, &tm);
   strftime (curr_time_string, MAX_FILENAME_LEN, "%FT%T", &tm);
 
-  snprintf (filename, MAX_FILENAME_LEN, "%s_%s.wav", desc->name,
-	    curr_time_string);
+  if (stems_mode)
+    {
+      snprintf (filename, MAX_FILENAME_LEN, "%s_%s", desc->name,
+		curr_time_string);
+    }
+  else
+    {
+      snprintf (filename, MAX_FILENAME_LEN, "%s_%s.%s", desc->name,
+		curr_time_string, raw ? "raw" : extension);
+      debug_print (1, "Creating %s file (%d channels)...\n", filename,
+		   buffer.outputs);
+    }
 
-  debug_print (1, "Creating sample (%d channels)...\n", buffer.outputs);
-  sf = sf_open (filename, SFM_WRITE, &sfinfo);
+  if (raw)
+    {
+      raw_fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+		     0644);
+      if (raw_fd < 0)
+	{
+	  error_print ("Error while opening file: %s\n", strerror (errno));
+	  err = OW_GENERIC_ERROR;
+	  goto cleanup_engine;
+	}
+    }
+  else if (stems_mode)
+    {
+      if (stems_open (filename))
+	{
+	  err = OW_GENERIC_ERROR;
+	  goto cleanup_engine;
+	}
+    }
+  else
+    {
+      sf = sf_open (filename, SFM_WRITE, &sfinfo);
+      if (!sf)
+	{
+	  error_print ("Error while opening file: %s\n", sf_strerror (NULL));
+	  err = OW_GENERIC_ERROR;
+	  goto cleanup_engine;
+	}
+    }
+
+  buffer.chunk_len = CHUNK_FRAMES * buffer.outputs * OB_BYTES_PER_SAMPLE;
+  chunks = track_buf_kb * 1000 / (CHUNK_FRAMES * OB_BYTES_PER_SAMPLE);
+  if (chunks < MIN_CHUNKS)
+    {
+      chunks = MIN_CHUNKS;
+    }
+  buffer.ring = ow_ring_new (chunks, buffer.chunk_len);
+  ow_ring_mlock (buffer.ring);
+  buffer.chunk = NULL;
+  buffer.frames = 0;
+  atomic_store (&buffer.lost_frames, 0);
+  debug_print (1, "Using %s track gathering\n", buffer.gather.kernel_name);
+
+  atomic_init (&buffer.end, 0);
+  sem_init (&buffer.sem, 0, 0);
+  if (stems_mode && stems_start ())
+    {
+      err = OW_GENERIC_ERROR;
+      goto cleanup;
+    }
+  if (pthread_create (&buffer.pthread, NULL, dump_buffer, NULL))
+    {
+      error_print ("Could not start recording thread\n");
+      err = OW_GENERIC_ERROR;
+      goto cleanup;
+    }
+  ow_set_thread_rt_priority (buffer.pthread, OW_DEFAULT_RT_PROPERTY);
 
   context.write_space = buffer_dummy_rw_space;
   context.read_space = buffer_dummy_rw_space;
   context.write = buffer_write;
-  context.o2p_audio = sf;
+  context.o2p_audio = &buffer;
   context.options = OW_ENGINE_OPTION_O2P_AUDIO;
+  if (int32_audio)
+    {
+      context.options |= OW_ENGINE_OPTION_INT32_AUDIO;
+    }
 
   err = ow_engine_start (engine, &context);
-  if (err)
+  if (!err)
     {
-      goto cleanup;
+      ow_engine_wait (engine);
     }
 
-  buffer.len = track_buf_kb * 1000 * buffer.outputs;
-  buffer.mem = malloc (buffer.len * OB_BYTES_PER_SAMPLE);
-  buffer.disk = malloc (buffer.len * OB_BYTES_PER_SAMPLE);
-  buffer.outputs_mask_len = track_mask ? strlen (track_mask) : 0;
-
-  for (int i = 0; i < desc->outputs; i++)
+  //The engine is stopped so the partial chunk can be committed from here.
+  if (buffer.chunk && buffer.pos)
     {
-      max[i] = 0.0f;
-      min[i] = 0.0f;
+      ow_ring_write_commit (buffer.ring, buffer.pos);
     }
+  atomic_store (&buffer.end, 1);
+  sem_post (&buffer.sem);
+  pthread_join (buffer.pthread, NULL);
 
-  buffer.status = READY;
-  pthread_spin_init (&buffer.lock, PTHREAD_PROCESS_SHARED);
-  if (pthread_create (&buffer.pthread, NULL, dump_buffer, NULL))
+  if (raw)
     {
-      error_print ("Could not start recording thread\n");
-      goto cleanup;
+      fprintf (stderr, "%s: 32 bits %s, %d channels, %d Hz\n", filename,
+	       int32_audio ? "integer" : "float", buffer.outputs,
+	       (int) OB_SAMPLE_RATE);
     }
-  ow_set_thread_rt_priority (buffer.pthread, OW_DEFAULT_RT_PROPERTY);
-
-  ow_engine_wait (engine);
-
-  pthread_spin_lock (&buffer.lock);
-  buffer.status = END;
-  pthread_spin_unlock (&buffer.lock);
-  pthread_join (buffer.pthread, NULL);
 
 cleanup:
-  pthread_spin_destroy (&buffer.lock);
-  free (buffer.mem);
-  free (buffer.disk);
-  sf_close (sf);
+  if (stems.workers)
+    {
+      stems_stop ();
+    }
+  sem_destroy (&buffer.sem);
+  ow_ring_free (buffer.ring);
+  if (raw)
+    {
+      close (raw_fd);
+    }
+  else if (stems_mode)
+    {
+      stems_close ();
+    }
+  else
+    {
+      sf_close (sf);
+    }
 cleanup_engine:
   ow_engine_destroy (engine);
 end:
@@ -336,8 +657,9 @@ end:
 int
 main (int argc, char *argv[])
 {
-  int opt;
-  int vflg = 0, lflg = 0, dflg = 0, nflg = 0, mflg = 0, bflg = 0, errflg = 0;
+  int opt, err;
+  int vflg = 0, lflg = 0, dflg = 0, nflg = 0, mflg = 0, bflg = 0, rflg = 0,
+    sflg = 0, fflg = 0, iflg = 0, errflg = 0;
   char *endstr;
   const char *device_name = NULL;
   int long_index = 0;
@@ -354,7 +676,7 @@ main (int argc, char *argv[])
   sigaction (SIGUSR1, &action, NULL);
   sigaction (SIGTSTP, &action, NULL);
 
-  while ((opt = getopt_long (argc, argv, "n:d:m:b:lvh",
+  while ((opt = getopt_long (argc, argv, "n:d:m:b:rsfilC:Lvh",
 			     options, &long_index)) != -1)
     {
       switch (opt)
@@ -375,9 +697,35 @@ main (int argc, char *argv[])
 	  track_buf_kb = atoi (optarg);
 	  bflg++;
 	  break;
+	case 'r':
+	  rflg++;
+	  break;
+	case 's':
+	  sflg++;
+	  break;
+	case 'f':
+	  format = SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+	  extension = "flac";
+	  fflg++;
+	  break;
+	case 'i':
+	  int32_audio = 1;
+	  iflg++;
+	  break;
 	case 'l':
 	  lflg++;
 	  break;
+	case 'C':
+	  if (parse_cpu_list (optarg, &context.cpu_mask))
+	    {
+	      context.cpu_mask = 0;
+	      fprintf (stderr,
+		       "CPU affinity must be a list of CPUs in [0..63] like '2,3' or '2-5'. Not using it...\n");
+	    }
+	  break;
+	case 'L':
+	  context.lock_memory = 1;
+	  break;
 	case 'v':
 	  vflg++;
 	  break;
@@ -417,9 +765,24 @@ main (int argc, char *argv[])
       exit (EXIT_FAILURE);
     }
 
+  if (rflg && (sflg || fflg))
+    {
+      fprintf (stderr, "Raw output can not be used with stems or FLAC\n");
+      exit (EXIT_FAILURE);
+    }
+
+  //FLAC is always 24 bits so only WAVE files need a different format.
+  if (iflg && !fflg)
+    {
+      format = SF_FORMAT_WAV | SF_FORMAT_PCM_32;
+    }
+
   if (nflg + dflg == 1)
     {
-      return run_record (device_num, device_name);
+      ow_rtlog_start ();
+      err = run_record (device_num, device_name, rflg, sflg);
+      ow_rtlog_stop ();
+      return err;
     }
   else
     {
@@ -29,6 +29,7 @@
 #include "common.h"
 #include "jclient.h"
 #include "utils.h"
+#include "rtlog.h"
 
 #define MSG_JACK_SERVER_FOUND "JACK server found"
 #define MSG_NO_JACK_SERVER_FOUND "No JACK server found"
@@ -609,6 +610,13 @@ refresh_devices ()
       instance->jclient.bus = device->bus;
       instance->jclient.address = device->address;
       instance->jclient.priority = -1;
+      instance->jclient.planar = 0;
+      instance->jclient.adaptive_blocks = 0;
+      instance->jclient.transfers = 1;
+      instance->jclient.cpu_mask = 0;
+      instance->jclient.lock_memory = 0;
+      instance->jclient.group = NULL;
+      instance->jclient.resampler_group = NULL;
       instance->jclient.end_notifier = remove_jclient;
       instance->jclient.blocks_per_transfer =
 	gtk_spin_button_get_value_as_int (blocks_spin_button);
@@ -887,8 +895,12 @@ main (int argc, char *argv[])
 		NULL);
   check_jack_server_bg (refresh ? refresh_devices : NULL);
 
+  ow_rtlog_start ();
+
   gtk_widget_show (main_window);
   gtk_main ();
 
+  ow_rtlog_stop ();
+
   return 0;
 }
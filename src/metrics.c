@@ -0,0 +1,352 @@
+/*
+ *   metrics.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "metrics.h"
+#include "utils.h"
+
+#define POLL_TIMEOUT_MS 500
+#define REQUEST_TIMEOUT_MS 100
+#define RESPONSE_TIMEOUT_MS 500
+#define REQUEST_MAX_LEN 1024
+#define LABEL_MAX_LEN (OW_LABEL_MAX_LEN * 2)
+
+#define HTTP_HEADER "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"
+
+//Latencies and ratios are -1.0 until the first report. Latencies are reported in ms.
+static void
+metrics_report (void *data, double o2p_latency, double p2o_latency,
+		double o2p_max_latency, double p2o_max_latency,
+		double o2p_ratio, double p2o_ratio)
+{
+  struct metrics_device *device = data;
+
+  atomic_store_explicit (&device->o2p_latency, o2p_latency,
+			 memory_order_relaxed);
+  atomic_store_explicit (&device->p2o_latency, p2o_latency,
+			 memory_order_relaxed);
+  atomic_store_explicit (&device->o2p_max_latency, o2p_max_latency,
+			 memory_order_relaxed);
+  atomic_store_explicit (&device->p2o_max_latency, p2o_max_latency,
+			 memory_order_relaxed);
+  atomic_store_explicit (&device->o2p_ratio, o2p_ratio,
+			 memory_order_relaxed);
+  atomic_store_explicit (&device->p2o_ratio, p2o_ratio,
+			 memory_order_relaxed);
+}
+
+int
+metrics_init (struct metrics *metrics, const char *path, size_t max)
+{
+  struct sockaddr_un addr;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      error_print ("Metrics socket path too long\n");
+      return -1;
+    }
+
+  metrics->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (metrics->fd < 0)
+    {
+      error_print ("Error while creating metrics socket: %s\n",
+		   strerror (errno));
+      return -1;
+    }
+
+  //A stale socket from a previous run would make bind fail.
+  unlink (path);
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+
+  if (bind (metrics->fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+      listen (metrics->fd, 4))
+    {
+      error_print ("Error while binding metrics socket to %s: %s\n", path,
+		   strerror (errno));
+      close (metrics->fd);
+      return -1;
+    }
+
+  metrics->path = strdup (path);
+  atomic_init (&metrics->end, 0);
+  metrics->len = 0;
+  metrics->max = max;
+  metrics->devices = malloc (sizeof (struct metrics_device) * max);
+
+  debug_print (1, "Serving metrics at %s\n", path);
+
+  return 0;
+}
+
+int
+metrics_add (struct metrics *metrics, struct jclient *jclient)
+{
+  struct metrics_device *device;
+  struct ow_resampler_reporter *reporter;
+
+  if (metrics->len == metrics->max)
+    {
+      return -1;
+    }
+
+  device = &metrics->devices[metrics->len];
+  device->jclient = jclient;
+  atomic_init (&device->o2p_latency, -1.0);
+  atomic_init (&device->p2o_latency, -1.0);
+  atomic_init (&device->o2p_max_latency, -1.0);
+  atomic_init (&device->p2o_max_latency, -1.0);
+  atomic_init (&device->o2p_ratio, -1.0);
+  atomic_init (&device->p2o_ratio, -1.0);
+
+  reporter = ow_resampler_get_reporter (jclient->resampler);
+  reporter->callback = metrics_report;
+  reporter->data = device;
+
+  metrics->len++;
+
+  return 0;
+}
+
+static void
+metrics_print_histogram (FILE *f, const char *name, const char *device,
+			 struct ow_histogram *histogram)
+{
+  uint64_t acc = 0;
+
+  for (int i = 0; i < OW_HISTOGRAM_BINS - 1; i++)
+    {
+      acc += histogram->bins[i];
+      fprintf (f, "%s_bucket{device=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+	       name, device, (i + 1) * histogram->bin_width, acc);
+    }
+  fprintf (f, "%s_bucket{device=\"%s\",le=\"+Inf\"} %" PRIu64 "\n",
+	   name, device, histogram->count);
+  fprintf (f, "%s_sum{device=\"%s\"} %g\n", name, device, histogram->sum);
+  fprintf (f, "%s_count{device=\"%s\"} %" PRIu64 "\n", name, device,
+	   histogram->count);
+}
+
+//Label values must have the backslashes, the double quotes and the line feeds escaped. The names are truncated if needed.
+static void
+metrics_escape_label (char *dst, const char *src)
+{
+  char *end = dst + LABEL_MAX_LEN - 1;
+
+  for (; *src && dst < end; src++)
+    {
+      if (*src == '\\' || *src == '"' || *src == '\n')
+	{
+	  if (dst + 1 == end)
+	    {
+	      break;
+	    }
+	  *dst++ = '\\';
+	  *dst++ = *src == '\n' ? 'n' : *src;
+	}
+      else
+	{
+	  *dst++ = *src;
+	}
+    }
+  *dst = 0;
+}
+
+static void
+metrics_print_device (FILE *f, struct metrics_device *device)
+{
+  struct ow_engine_stats engine_stats;
+  struct ow_resampler_stats resampler_stats;
+  struct ow_resampler *resampler = device->jclient->resampler;
+  struct ow_engine *engine = ow_resampler_get_engine (resampler);
+  char name[LABEL_MAX_LEN];
+
+  metrics_escape_label (name, device->jclient->name);
+
+  ow_engine_get_stats (engine, &engine_stats);
+  ow_resampler_get_stats (resampler, &resampler_stats);
+
+  fprintf (f, "overwitch_engine_status{device=\"%s\"} %d\n", name,
+	   ow_engine_get_status (engine));
+  fprintf (f, "overwitch_xruns_total{device=\"%s\"} %u\n", name,
+	   ow_resampler_get_xruns (resampler));
+  fprintf (f, "overwitch_o2p_latency_seconds{device=\"%s\"} %g\n", name,
+	   atomic_load (&device->o2p_latency) / 1000.0);
+  fprintf (f, "overwitch_o2p_max_latency_seconds{device=\"%s\"} %g\n", name,
+	   atomic_load (&device->o2p_max_latency) / 1000.0);
+  fprintf (f, "overwitch_p2o_latency_seconds{device=\"%s\"} %g\n", name,
+	   atomic_load (&device->p2o_latency) / 1000.0);
+  fprintf (f, "overwitch_p2o_max_latency_seconds{device=\"%s\"} %g\n", name,
+	   atomic_load (&device->p2o_max_latency) / 1000.0);
+  fprintf (f, "overwitch_o2p_ratio{device=\"%s\"} %.9f\n", name,
+	   atomic_load (&device->o2p_ratio));
+  fprintf (f, "overwitch_p2o_ratio{device=\"%s\"} %.9f\n", name,
+	   atomic_load (&device->p2o_ratio));
+
+  metrics_print_histogram (f, "overwitch_usb_interval_seconds", name,
+			   &engine_stats.usb_interval);
+  metrics_print_histogram (f, "overwitch_o2p_buffer_seconds", name,
+			   &engine_stats.o2p_fill);
+  metrics_print_histogram (f, "overwitch_p2o_buffer_seconds", name,
+			   &engine_stats.p2o_fill);
+  metrics_print_histogram (f, "overwitch_process_seconds", name,
+			   &resampler_stats.process);
+  metrics_print_histogram (f, "overwitch_dll_error_seconds", name,
+			   &resampler_stats.dll_error);
+}
+
+static void
+metrics_print_types (FILE *f)
+{
+  fprintf (f, "# TYPE overwitch_engine_status gauge\n");
+  fprintf (f, "# TYPE overwitch_xruns_total counter\n");
+  fprintf (f, "# TYPE overwitch_o2p_latency_seconds gauge\n");
+  fprintf (f, "# TYPE overwitch_o2p_max_latency_seconds gauge\n");
+  fprintf (f, "# TYPE overwitch_p2o_latency_seconds gauge\n");
+  fprintf (f, "# TYPE overwitch_p2o_max_latency_seconds gauge\n");
+  fprintf (f, "# TYPE overwitch_o2p_ratio gauge\n");
+  fprintf (f, "# TYPE overwitch_p2o_ratio gauge\n");
+  fprintf (f, "# TYPE overwitch_usb_interval_seconds histogram\n");
+  fprintf (f, "# TYPE overwitch_o2p_buffer_seconds histogram\n");
+  fprintf (f, "# TYPE overwitch_p2o_buffer_seconds histogram\n");
+  fprintf (f, "# TYPE overwitch_process_seconds histogram\n");
+  fprintf (f, "# TYPE overwitch_dll_error_seconds histogram\n");
+}
+
+//The request is read but ignored as there is only one resource.
+static void
+metrics_serve (struct metrics *metrics, int fd)
+{
+  FILE *f;
+  char *body;
+  size_t len, sent;
+  ssize_t n;
+  char request[REQUEST_MAX_LEN];
+  struct pollfd pfd = {.fd = fd,.events = POLLIN };
+  //A client not reading the response must not block the metrics thread.
+  struct timeval timeout = {
+    .tv_sec = 0,
+    .tv_usec = RESPONSE_TIMEOUT_MS * 1000
+  };
+
+  if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout)))
+    {
+      error_print ("Error while setting the metrics socket timeout: %s\n",
+		   strerror (errno));
+      return;
+    }
+
+  if (poll (&pfd, 1, REQUEST_TIMEOUT_MS) > 0)
+    {
+      if (read (fd, request, REQUEST_MAX_LEN) < 0)
+	{
+	  return;
+	}
+    }
+
+  f = open_memstream (&body, &len);
+  fputs (HTTP_HEADER, f);
+  metrics_print_types (f);
+  for (int i = 0; i < metrics->len; i++)
+    {
+      metrics_print_device (f, &metrics->devices[i]);
+    }
+  fclose (f);
+
+  for (sent = 0; sent < len; sent += n)
+    {
+      n = send (fd, &body[sent], len - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+	{
+	  break;
+	}
+    }
+
+  free (body);
+}
+
+static void *
+metrics_run (void *data)
+{
+  int fd;
+  struct metrics *metrics = data;
+  struct pollfd pfd = {.fd = metrics->fd,.events = POLLIN };
+
+  while (!atomic_load (&metrics->end))
+    {
+      if (poll (&pfd, 1, POLL_TIMEOUT_MS) <= 0)
+	{
+	  continue;
+	}
+
+      fd = accept (metrics->fd, NULL, NULL);
+      if (fd < 0)
+	{
+	  continue;
+	}
+
+      metrics_serve (metrics, fd);
+      close (fd);
+    }
+
+  return NULL;
+}
+
+int
+metrics_start (struct metrics *metrics)
+{
+  int err = pthread_create (&metrics->thread, NULL, metrics_run, metrics);
+
+  if (err)
+    {
+      error_print ("Error while starting the metrics thread: %s\n",
+		   strerror (err));
+    }
+
+  return err;
+}
+
+void
+metrics_destroy (struct metrics *metrics)
+{
+  close (metrics->fd);
+  unlink (metrics->path);
+  free (metrics->path);
+  free (metrics->devices);
+}
+
+void
+metrics_stop (struct metrics *metrics)
+{
+  atomic_store (&metrics->end, 1);
+  pthread_join (metrics->thread, NULL);
+  metrics_destroy (metrics);
+}
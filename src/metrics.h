@@ -0,0 +1,67 @@
+/*
+ *   metrics.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "jclient.h"
+
+//Metrics in the Prometheus text format served over HTTP thru a Unix socket.
+//The reporter callbacks only store the values so the host thread never does any I/O, which is done in the metrics thread.
+
+//The values are atomic as reports might also come from the signal handlers.
+struct metrics_device
+{
+  struct jclient *jclient;
+  _Atomic double o2p_latency;
+  _Atomic double p2o_latency;
+  _Atomic double o2p_max_latency;
+  _Atomic double p2o_max_latency;
+  _Atomic double o2p_ratio;
+  _Atomic double p2o_ratio;
+};
+
+struct metrics
+{
+  char *path;
+  int fd;
+  pthread_t thread;
+  atomic_int end;
+  size_t len;
+  size_t max;
+  struct metrics_device *devices;
+};
+
+int metrics_init (struct metrics *, const char *, size_t);
+
+//This must be called after jclient_init and before jclient_start.
+int metrics_add (struct metrics *, struct jclient *);
+
+int metrics_start (struct metrics *);
+
+//The metrics thread must be stopped before destroying the clients.
+void metrics_stop (struct metrics *);
+
+//This is only for metrics that have not been started or failed to start.
+void metrics_destroy (struct metrics *);
+
+#endif
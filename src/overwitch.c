@@ -18,137 +18,48 @@
  *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <libusb.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sched.h>
+#include <sys/mman.h>
 #include "overwitch.h"
 #include "utils.h"
+#include "devices.h"
 
 #define DEVICES_FILE "/devices.json"
 
 #define ELEKTRON_VID 0x1935
 
-#define AFMK1_PID 0x0004
-#define AKEYS_PID 0x0006
-#define ARMK1_PID 0x0008
-#define AHMK1_PID 0x000a
-#define DTAKT_PID 0x000c
-#define AFMK2_PID 0x000e
-#define ARMK2_PID 0x0010
-#define DTONE_PID 0x0014
-#define AHMK2_PID 0x0016
-#define DKEYS_PID 0x001c
-#define STAKT_PID 0x001e
+#define HOTPLUG_MAX_EVENTS 64
 
 #define DEV_TAG_PID "pid"
 #define DEV_TAG_NAME "name"
 #define DEV_TAG_INPUT_TRACK_NAMES "input_track_names"
 #define DEV_TAG_OUTPUT_TRACK_NAMES "output_track_names"
 
-#if !defined(JSON_DEVS_FILE) || defined(OW_TESTING)
-static const struct ow_device_desc_static DIGITAKT_DESC = {
-  .pid = DTAKT_PID,
-  .name = "Digitakt",
-  .inputs = 2,
-  .outputs = 12,
-  .input_track_names = {"Main L Input", "Main R Input"},
-  .output_track_names =
-    {"Main L", "Main R", "Track 1", "Track 2", "Track 3", "Track 4",
-     "Track 5", "Track 6", "Track 7", "Track 8", "Input L",
-     "Input R"}
-};
-
-static const struct ow_device_desc_static DIGITONE_DESC = {
-  .pid = DTONE_PID,
-  .name = "Digitone",
-  .inputs = 2,
-  .outputs = 12,
-  .input_track_names = {"Main L Input", "Main R Input"},
-  .output_track_names =
-    {"Main L", "Main R", "Track 1 L", "Track 1 R", "Track 2 L",
-     "Track 2 R", "Track 3 L", "Track 3 R", "Track 4 L", "Track 4 R",
-     "Input L", "Input R"}
-};
-
-static const struct ow_device_desc_static AFMK2_DESC = {
-  .pid = AFMK2_PID,
-  .name = "Analog Four MKII",
-  .inputs = 6,
-  .outputs = 8,
-  .input_track_names = {"Main L Input", "Main R Input", "Synth Track 1 Input",
-			"Synth Track 2 Input", "Synth Track 3 Input",
-			"Synth Track 4 Input"},
-  .output_track_names =
-    {"Main L", "Main R", "Synth Track 1", "Synth Track 2", "Synth Track 3",
-     "Synth Track 4", "Input L", "Input R"}
-};
-
-static const struct ow_device_desc_static ARMK2_DESC = {
-  .pid = ARMK2_PID,
-  .name = "Analog Rytm MKII",
-  .inputs = 12,
-  .outputs = 12,
-  .input_track_names =
-    {"Main L Input", "Main R Input", "Main FX L Input", "Main FX R Input",
-     "BD Input", "SD Input", "RS/CP Input", "BT Input",
-     "LT Input", "MT/HT Input", "CH/OH Input", "CY/CB Input"},
-  .output_track_names = {"Main L", "Main R", "BD", "SD", "RS/CP",
-			 "BT", "LT", "MT/HT", "CH/OH", "CY/CB", "Input L",
-			 "Input R"}
-};
-
-static const struct ow_device_desc_static DKEYS_DESC = {
-  .pid = DKEYS_PID,
-  .name = "Digitone Keys",
-  .inputs = 2,
-  .outputs = 12,
-  .input_track_names = {"Main L Input", "Main R Input"},
-  .output_track_names =
-    {"Main L", "Main R", "Track 1 L", "Track 1 R", "Track 2 L",
-     "Track 2 R", "Track 3 L", "Track 3 R", "Track 4 L", "Track 4 R",
-     "Input L", "Input R"}
-};
-
-static const struct ow_device_desc_static AHMK1_DESC = {
-  .pid = AHMK1_PID,
-  .name = "Analog Heat",
-  .inputs = 4,
-  .outputs = 4,
-  .input_track_names =
-    {"Main L Input", "Main R Input", "FX Send L", "FX Send R"},
-  .output_track_names = {"Main L", "Main R", "FX Return L", "FX Return R"}
-};
-
-static const struct ow_device_desc_static AHMK2_DESC = {
-  .pid = AHMK2_PID,
-  .name = "Analog Heat MKII",
-  .inputs = 4,
-  .outputs = 4,
-  .input_track_names =
-    {"Main L Input", "Main R Input", "FX Send L", "FX Send R"},
-  .output_track_names = {"Main L", "Main R", "FX Return L", "FX Return R"}
+struct ow_hotplug_event
+{
+  struct ow_usb_device device;
+  int arrived;
 };
 
-static const struct ow_device_desc_static STAKT_DESC = {
-  .pid = STAKT_PID,
-  .name = "Syntakt",
-  .inputs = 8,
-  .outputs = 20,
-  .input_track_names =
-    {"Main L Input", "Main R Input", "Analog FX L Input", "Analog FX R Input",
-     "Track 9 Input", "Track 10 Input", "Track 11 Input", "Track 12 Input"},
-  .output_track_names =
-    {"Main L", "Main R", "Track  1", "Track  2", "Track  3", "Track  4",
-     "Track  5", "Track  6", "Track  7", "Track  8", "Track  9", "Track 10",
-     "Track 11", "Track 12", "Analog FX L", "Analog FX R",
-     "Delay/Reverb L", "Delay/Reverb R", "Input L", "Input R"}
+struct ow_hotplug
+{
+  libusb_context *context;
+  libusb_hotplug_callback_handle handle;
+  ow_hotplug_cb_t callback;
+  void *data;
+  struct ow_hotplug_event events[HOTPLUG_MAX_EVENTS];
+  int events_len;
 };
 
-static const struct ow_device_desc_static *OB_DEVICE_DESCS[] = {
-  &DIGITAKT_DESC, &DIGITONE_DESC, &AFMK2_DESC, &ARMK2_DESC, &DKEYS_DESC,
-  &AHMK1_DESC, &AHMK2_DESC, &STAKT_DESC, NULL
-};
-#endif
+static pthread_once_t device_descs_once = PTHREAD_ONCE_INIT;
+static struct ow_device_desc *device_descs;	//Sorted by PID
+static size_t device_descs_len;
 
 void
 ow_free_device_desc (struct ow_device_desc *desc)
@@ -272,26 +183,181 @@ ow_copy_device_desc_static (struct ow_device_desc *device_desc,
     }
 }
 
-int
-ow_get_device_desc_from_vid_pid (uint16_t vid, uint16_t pid,
-				 struct ow_device_desc *device_desc)
+static void
+ow_copy_device_desc (struct ow_device_desc *device_desc,
+		     const struct ow_device_desc *d)
 {
-  if (vid != ELEKTRON_VID)
+  device_desc->pid = d->pid;
+  device_desc->name = strdup (d->name);
+  device_desc->inputs = d->inputs;
+  device_desc->outputs = d->outputs;
+  device_desc->input_track_names =
+    malloc (sizeof (char *) * device_desc->inputs);
+  device_desc->output_track_names =
+    malloc (sizeof (char *) * device_desc->outputs);
+
+  for (int i = 0; i < device_desc->inputs; i++)
     {
-      return 1;
+      device_desc->input_track_names[i] = strdup (d->input_track_names[i]);
     }
 
+  for (int i = 0; i < device_desc->outputs; i++)
+    {
+      device_desc->output_track_names[i] = strdup (d->output_track_names[i]);
+    }
+}
+
+static int
+ow_device_desc_cmp (const void *a, const void *b)
+{
+  const struct ow_device_desc *da = a;
+  const struct ow_device_desc *db = b;
+  return (int) da->pid - (int) db->pid;
+}
+
+static int
+ow_device_descs_contain (uint16_t pid)
+{
+  for (int i = 0; i < device_descs_len; i++)
+    {
+      if (device_descs[i].pid == pid)
+	{
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+static void
+ow_load_device_descs_static ()
+{
+  size_t len = sizeof (OB_DEVICE_DESCS) /
+    sizeof (struct ow_device_desc_static);
+
+  device_descs = malloc (sizeof (struct ow_device_desc) * len);
+  for (int i = 0; i < len; i++)
+    {
+      if (!ow_device_descs_contain (OB_DEVICE_DESCS[i].pid))
+	{
+	  ow_copy_device_desc_static (&device_descs[device_descs_len],
+				      &OB_DEVICE_DESCS[i]);
+	  device_descs_len++;
+	}
+    }
+}
+
 #if defined(JSON_DEVS_FILE) && !defined(OW_TESTING)
-  gint dpid, err, devices;
+static int
+ow_load_device_desc_json_tracks (JsonReader * reader, const char *member,
+				 int *tracks, char ***names)
+{
+  const gchar *name;
+  int err = 0;
+
+  *tracks = 0;
+  *names = NULL;
+
+  if (!json_reader_read_member (reader, member)
+      || !json_reader_is_array (reader))
+    {
+      error_print ("Cannot read array '%s'\n", member);
+      json_reader_end_member (reader);
+      return -ENODEV;
+    }
+
+  *tracks = json_reader_count_elements (reader);
+  if (*tracks <= 0 || *tracks > OB_MAX_TRACKS)
+    {
+      error_print ("Wrong amount of tracks in '%s'\n", member);
+      *tracks = 0;
+      json_reader_end_member (reader);
+      return -ENODEV;
+    }
+
+  *names = calloc (*tracks, sizeof (char *));
+  for (int i = 0; i < *tracks; i++)
+    {
+      json_reader_read_element (reader, i);
+      name = json_reader_get_string_value (reader);
+      json_reader_end_element (reader);
+      if (!name)
+	{
+	  error_print ("Cannot read track name %d in '%s'\n", i, member);
+	  err = -ENODEV;
+	  break;
+	}
+      (*names)[i] = strdup (name);
+    }
+
+  json_reader_end_member (reader);
+  return err;
+}
+
+static int
+ow_load_device_desc_json (JsonReader * reader, int i,
+			  struct ow_device_desc *device_desc)
+{
+  const gchar *name;
+  int err = -ENODEV;
+
+  memset (device_desc, 0, sizeof (struct ow_device_desc));
+
+  if (!json_reader_read_element (reader, i))
+    {
+      error_print ("Cannot read element %d\n", i);
+      goto end;
+    }
+
+  if (!json_reader_read_member (reader, DEV_TAG_PID))
+    {
+      error_print ("Cannot read member '%s'\n", DEV_TAG_PID);
+      json_reader_end_member (reader);
+      goto end;
+    }
+  device_desc->pid = json_reader_get_int_value (reader);
+  json_reader_end_member (reader);
+
+  json_reader_read_member (reader, DEV_TAG_NAME);
+  name = json_reader_get_string_value (reader);
+  json_reader_end_member (reader);
+  if (!name)
+    {
+      error_print ("Cannot read member '%s'\n", DEV_TAG_NAME);
+      goto end;
+    }
+  device_desc->name = strdup (name);
+
+  if (ow_load_device_desc_json_tracks (reader, DEV_TAG_INPUT_TRACK_NAMES,
+				       &device_desc->inputs,
+				       &device_desc->input_track_names)
+      || ow_load_device_desc_json_tracks (reader,
+					  DEV_TAG_OUTPUT_TRACK_NAMES,
+					  &device_desc->outputs,
+					  &device_desc->output_track_names))
+    {
+      goto end;
+    }
+
+  err = 0;
+
+end:
+  json_reader_end_element (reader);
+  if (err)
+    {
+      ow_free_device_desc (device_desc);
+    }
+  return err;
+}
+
+static void
+ow_load_device_descs_json ()
+{
+  gint devices;
   JsonParser *parser;
   JsonReader *reader;
   gchar *devices_filename;
   GError *error = NULL;
-
-  device_desc->inputs = 0;
-  device_desc->outputs = 0;
-  device_desc->input_track_names = NULL;
-  device_desc->output_track_names = NULL;
+  struct ow_device_desc *device_desc;
 
   parser = json_parser_new ();
 
@@ -311,7 +377,6 @@ ow_get_device_desc_from_vid_pid (uint16_t vid, uint16_t pid,
 	{
 	  error_print ("%s", error->message);
 	  g_clear_error (&error);
-	  err = -ENODEV;
 	  goto cleanup_parser;
 	}
     }
@@ -320,152 +385,42 @@ ow_get_device_desc_from_vid_pid (uint16_t vid, uint16_t pid,
   if (!reader)
     {
       error_print ("Unable to read from parser");
-      err = -ENODEV;
       goto cleanup_parser;
     }
 
   if (!json_reader_is_array (reader))
     {
       error_print ("Not an array\n");
-      err = -ENODEV;
       goto cleanup_reader;
     }
 
   devices = json_reader_count_elements (reader);
-  if (!devices)
-    {
-      debug_print (1, "No devices found\n");
-      err = -ENODEV;
-      goto cleanup_reader;
-    }
-
-  err = -ENODEV;
+  device_descs = malloc (sizeof (struct ow_device_desc) * devices);
   for (int i = 0; i < devices; i++)
     {
-      if (!json_reader_read_element (reader, i))
-	{
-	  error_print ("Cannot read element %d. Continuing...\n", i);
-	  continue;
-	}
+      device_desc = &device_descs[device_descs_len];
 
-      if (!json_reader_read_member (reader, DEV_TAG_PID))
-	{
-	  error_print ("Cannot read member '%s'. Continuing...\n",
-		       DEV_TAG_PID);
-	  continue;
-	}
-      dpid = json_reader_get_int_value (reader);
-      json_reader_end_member (reader);
-      if (dpid != pid)
+      if (ow_load_device_desc_json (reader, i, device_desc))
 	{
-	  json_reader_end_element (reader);
+	  error_print ("Cannot load device %d. Continuing...\n", i);
 	  continue;
 	}
-      device_desc->pid = dpid;
-
-      err = 0;
-      debug_print (1, "Device with PID %d found\n", dpid);
 
-      if (!json_reader_read_member (reader, DEV_TAG_NAME))
+      if (ow_device_descs_contain (device_desc->pid))
 	{
-	  error_print ("Cannot read member '%s'. Stopping...\n",
-		       DEV_TAG_NAME);
-	  json_reader_end_element (reader);
-	  err = -ENODEV;
-	  break;
+	  debug_print (1, "Device with PID %d already loaded. Skipping...\n",
+		       device_desc->pid);
+	  ow_free_device_desc (device_desc);
+	  continue;
 	}
-      device_desc->name = strdup (json_reader_get_string_value (reader));
-      json_reader_end_member (reader);
 
-      if (!json_reader_read_member (reader, DEV_TAG_INPUT_TRACK_NAMES))
-	{
-	  error_print ("Cannot read member '%s'. Stopping...\n",
-		       DEV_TAG_INPUT_TRACK_NAMES);
-	  json_reader_end_element (reader);
-	  err = -ENODEV;
-	  break;
-	}
-      if (!json_reader_is_array (reader))
-	{
-	  error_print ("Not an array\n");
-	  err = -ENODEV;
-	  goto cleanup_reader;
-	}
-      device_desc->inputs = json_reader_count_elements (reader);
-      if (!device_desc->inputs)
-	{
-	  debug_print (1, "No tracks found\n");
-	  err = -ENODEV;
-	  goto cleanup_reader;
-	}
-      device_desc->input_track_names =
-	malloc (sizeof (char *) * device_desc->inputs);
-      for (int j = 0; j < device_desc->inputs; j++)
-	{
-	  device_desc->input_track_names[j] = NULL;
-	}
-      for (int j = 0; j < device_desc->inputs; j++)
-	{
-	  if (json_reader_read_element (reader, j))
-	    {
-	      device_desc->input_track_names[j] =
-		strdup (json_reader_get_string_value (reader));
-	      json_reader_end_element (reader);
-	    }
-	  else
-	    {
-	      error_print ("Cannot read input track name %d\n", j);
-	      ow_free_device_desc (device_desc);
-	      err = -ENODEV;
-	      goto cleanup_reader;
-	    }
-	}
-      json_reader_end_member (reader);
+      device_descs_len++;
+    }
 
-      if (!json_reader_read_member (reader, DEV_TAG_OUTPUT_TRACK_NAMES))
-	{
-	  error_print ("Cannot read member '%s'. Stopping...\n",
-		       DEV_TAG_OUTPUT_TRACK_NAMES);
-	  json_reader_end_element (reader);
-	  err = -ENODEV;
-	  break;
-	}
-      if (!json_reader_is_array (reader))
-	{
-	  error_print ("Not an array\n");
-	  err = -ENODEV;
-	  goto cleanup_reader;
-	}
-      device_desc->outputs = json_reader_count_elements (reader);
-      if (!device_desc->outputs)
-	{
-	  debug_print (1, "No tracks found\n");
-	  err = -ENODEV;
-	  goto cleanup_reader;
-	}
-      device_desc->output_track_names =
-	malloc (sizeof (char *) * device_desc->outputs);
-      for (int j = 0; j < device_desc->outputs; j++)
-	{
-	  device_desc->output_track_names[j] = NULL;
-	}
-      for (int j = 0; j < device_desc->outputs; j++)
-	{
-	  if (json_reader_read_element (reader, j))
-	    {
-	      device_desc->output_track_names[j] =
-		strdup (json_reader_get_string_value (reader));
-	      json_reader_end_element (reader);
-	    }
-	  else
-	    {
-	      error_print ("Cannot read output track name %d\n", j);
-	      ow_free_device_desc (device_desc);
-	      err = -ENODEV;
-	      goto cleanup_reader;
-	    }
-	}
-      break;
+  if (!device_descs_len)
+    {
+      free (device_descs);
+      device_descs = NULL;
     }
 
 cleanup_reader:
@@ -473,19 +428,54 @@ cleanup_reader:
 cleanup_parser:
   g_object_unref (parser);
   g_free (devices_filename);
-  return err;
-#else
-  for (const struct ow_device_desc_static ** d = OB_DEVICE_DESCS; *d != NULL;
-       d++)
+}
+#endif
+
+//The devices file is parsed just once and the compiled in descriptions are used if there is no valid device in it.
+static void
+ow_load_device_descs ()
+{
+#if defined(JSON_DEVS_FILE) && !defined(OW_TESTING)
+  ow_load_device_descs_json ();
+#endif
+
+  if (!device_descs_len)
     {
-      if ((*d)->pid == pid)
-	{
-	  ow_copy_device_desc_static (device_desc, *d);
-	  return 0;
-	}
+      debug_print (1, "Using compiled in device descriptions...\n");
+      ow_load_device_descs_static ();
     }
-  return 1;
-#endif
+
+  qsort (device_descs, device_descs_len, sizeof (struct ow_device_desc),
+	 ow_device_desc_cmp);
+
+  debug_print (1, "%zu device descriptions loaded\n", device_descs_len);
+}
+
+int
+ow_get_device_desc_from_vid_pid (uint16_t vid, uint16_t pid,
+				 struct ow_device_desc *device_desc)
+{
+  struct ow_device_desc key;
+  struct ow_device_desc *d;
+
+  if (vid != ELEKTRON_VID)
+    {
+      return 1;
+    }
+
+  pthread_once (&device_descs_once, ow_load_device_descs);
+
+  key.pid = pid;
+  d = bsearch (&key, device_descs, device_descs_len,
+	       sizeof (struct ow_device_desc), ow_device_desc_cmp);
+  if (!d)
+    {
+      return 1;
+    }
+
+  debug_print (2, "Device with PID %d found\n", pid);
+  ow_copy_device_desc (device_desc, d);
+  return 0;
 }
 
 int
@@ -537,6 +527,130 @@ ow_get_usb_device_from_device_attrs (int device_num, const char *device_name,
   return err;
 }
 
+//Events are only stored here as libusb does not allow to perform I/O from its hotplug callbacks.
+static int LIBUSB_CALL
+ow_hotplug_libusb_cb (libusb_context * context, libusb_device * device,
+		      libusb_hotplug_event event, void *data)
+{
+  struct libusb_device_descriptor desc;
+  struct ow_hotplug *hotplug = data;
+  struct ow_hotplug_event *e;
+
+  if (hotplug->events_len == HOTPLUG_MAX_EVENTS)
+    {
+      error_print ("Too many pending USB hotplug events. Ignoring...\n");
+      return 0;
+    }
+
+  e = &hotplug->events[hotplug->events_len];
+  if (libusb_get_device_descriptor (device, &desc) ||
+      ow_get_device_desc_from_vid_pid (desc.idVendor, desc.idProduct,
+				       &e->device.desc))
+    {
+      return 0;
+    }
+
+  e->device.vid = desc.idVendor;
+  e->device.pid = desc.idProduct;
+  e->device.bus = libusb_get_bus_number (device);
+  e->device.address = libusb_get_device_address (device);
+  e->arrived = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+  hotplug->events_len++;
+
+  debug_print (1, "%s %s (bus %03d, address %03d)\n",
+	       e->device.desc.name, e->arrived ? "arrived" : "left",
+	       e->device.bus, e->device.address);
+
+  return 0;
+}
+
+ow_err_t
+ow_hotplug_init (struct ow_hotplug **hotplug_, ow_hotplug_cb_t callback,
+		 void *data)
+{
+  int err;
+  struct ow_hotplug *hotplug = malloc (sizeof (struct ow_hotplug));
+
+  if (libusb_init (&hotplug->context) != LIBUSB_SUCCESS)
+    {
+      free (hotplug);
+      return OW_USB_ERROR_LIBUSB_INIT_FAILED;
+    }
+
+  if (!libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG))
+    {
+      error_print ("USB hotplug is not supported\n");
+      libusb_exit (hotplug->context);
+      free (hotplug);
+      return OW_GENERIC_ERROR;
+    }
+
+  hotplug->callback = callback;
+  hotplug->data = data;
+  hotplug->events_len = 0;
+
+  err = libusb_hotplug_register_callback (hotplug->context,
+					  LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED
+					  | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+					  LIBUSB_HOTPLUG_ENUMERATE,
+					  ELEKTRON_VID,
+					  LIBUSB_HOTPLUG_MATCH_ANY,
+					  LIBUSB_HOTPLUG_MATCH_ANY,
+					  ow_hotplug_libusb_cb, hotplug,
+					  &hotplug->handle);
+  if (err != LIBUSB_SUCCESS)
+    {
+      error_print ("Error while registering USB hotplug callback: %s\n",
+		   libusb_error_name (err));
+      libusb_exit (hotplug->context);
+      free (hotplug);
+      return OW_GENERIC_ERROR;
+    }
+
+  *hotplug_ = hotplug;
+  return OW_OK;
+}
+
+static void
+ow_hotplug_dispatch_events (struct ow_hotplug *hotplug)
+{
+  struct ow_hotplug_event *e = hotplug->events;
+
+  for (int i = 0; i < hotplug->events_len; i++, e++)
+    {
+      hotplug->callback (hotplug->data, &e->device, e->arrived);
+      ow_free_device_desc (&e->device.desc);
+    }
+  hotplug->events_len = 0;
+}
+
+void
+ow_hotplug_handle_events (struct ow_hotplug *hotplug, double wait)
+{
+  struct timeval tv;
+
+  //The devices found when registering the callback are already pending.
+  ow_hotplug_dispatch_events (hotplug);
+
+  tv.tv_sec = wait;
+  tv.tv_usec = (wait - tv.tv_sec) * 1.0e6;
+  libusb_handle_events_timeout_completed (hotplug->context, &tv, NULL);
+
+  ow_hotplug_dispatch_events (hotplug);
+}
+
+void
+ow_hotplug_destroy (struct ow_hotplug *hotplug)
+{
+  libusb_hotplug_deregister_callback (hotplug->context, hotplug->handle);
+  for (int i = 0; i < hotplug->events_len; i++)
+    {
+      ow_free_device_desc (&hotplug->events[i].device.desc);
+    }
+  libusb_exit (hotplug->context);
+  free (hotplug);
+}
+
 void
 ow_set_thread_rt_priority (pthread_t thread, int p)
 {
@@ -545,3 +659,34 @@ ow_set_thread_rt_priority (pthread_t thread, int p)
   };
   pthread_setschedparam (thread, SCHED_FIFO, &default_rt_param);
 }
+
+void
+ow_set_thread_affinity (pthread_t thread, uint64_t cpu_mask)
+{
+  cpu_set_t cpus;
+
+  CPU_ZERO (&cpus);
+  for (int i = 0; i < 64; i++)
+    {
+      if (cpu_mask & (1ULL << i))
+	{
+	  CPU_SET (i, &cpus);
+	}
+    }
+
+  if (pthread_setaffinity_np (thread, sizeof (cpu_set_t), &cpus))
+    {
+      error_print ("Could not set CPU affinity\n");
+    }
+}
+
+int
+ow_lock_memory ()
+{
+  int err = mlockall (MCL_CURRENT | MCL_FUTURE);
+  if (err)
+    {
+      error_print ("Could not lock memory: %s\n", strerror (errno));
+    }
+  return err;
+}
@@ -35,6 +35,13 @@
 
 #define OW_LABEL_MAX_LEN 64
 
+#define OW_MAX_AUDIO_TRANSFERS 8
+
+#define OW_ENGINE_MIN_BLOCKS 2
+#define OW_ENGINE_MAX_BLOCKS 32
+
+#define OW_HISTOGRAM_BINS 32
+
 typedef size_t (*ow_buffer_rw_space_t) (void *);
 typedef size_t (*ow_buffer_read_t) (void *, char *, size_t);
 typedef size_t (*ow_buffer_write_t) (void *, const char *, size_t);
@@ -49,6 +56,10 @@ typedef void (*ow_set_rt_priority_t) (pthread_t, int);
 typedef void (*ow_resampler_report_t) (void *, double, double, double, double,
 				       double, double);
 
+struct ow_usb_device;
+
+typedef void (*ow_hotplug_cb_t) (void *, const struct ow_usb_device *, int);
+
 typedef enum
 {
   OW_OK = 0,
@@ -70,7 +81,8 @@ typedef enum
   OW_INIT_ERROR_NO_O2P_MIDI_BUF,
   OW_INIT_ERROR_NO_P2O_MIDI_BUF,
   OW_INIT_ERROR_NO_GET_TIME,
-  OW_INIT_ERROR_NO_DLL
+  OW_INIT_ERROR_NO_DLL,
+  OW_INIT_ERROR_INT32_AUDIO
 } ow_err_t;
 
 typedef enum
@@ -99,7 +111,10 @@ typedef enum
   OW_ENGINE_OPTION_P2O_AUDIO = 2,
   OW_ENGINE_OPTION_O2P_MIDI = 4,
   OW_ENGINE_OPTION_P2O_MIDI = 8,
-  OW_ENGINE_OPTION_DLL = 16
+  OW_ENGINE_OPTION_DLL = 16,
+  OW_ENGINE_OPTION_PLANAR_AUDIO = 32,
+  OW_ENGINE_OPTION_RINGS = 64,
+  OW_ENGINE_OPTION_INT32_AUDIO = 128
 } ow_engine_option_t;
 
 struct ow_context
@@ -112,6 +127,9 @@ struct ow_context
   //Needed for MIDI and the DLL
   ow_get_time_t get_time;
   //Data
+  //If OW_ENGINE_OPTION_PLANAR_AUDIO is set, audio buffers are arrays of buffers, one per track, holding just floats.
+  //If OW_ENGINE_OPTION_RINGS is set, all the buffers are struct ow_ring and the functions are not needed.
+  //If OW_ENGINE_OPTION_INT32_AUDIO is set, audio buffers hold the device samples as native endian int32 instead of floats. As these can not be resampled, this can not be used with the DLL nor with planar audio.
   void *p2o_audio;
   void *o2p_audio;
   void *p2o_midi;
@@ -123,8 +141,14 @@ struct ow_context
   //RT priority is always activated. If this is NULL, Overwitch will set itself with its default RT priority and policy.
   ow_set_rt_priority_t set_rt_priority;
   int priority;
+  //CPUs the USB thread is pinned to, one bit per CPU. If this is 0, the thread can run on any CPU.
+  uint64_t cpu_mask;
+  //If set, all the process memory is locked when starting so that the RT threads never take page faults.
+  int lock_memory;
   //Options
   int options;
+  //Audio USB transfers in flight per direction. Values lower than 1 mean 1.
+  int transfers;
 };
 
 struct ow_device_desc
@@ -169,8 +193,44 @@ struct ow_resampler_reporter
   void *data;
 };
 
+struct ow_ring_vector
+{
+  char *buf;
+  size_t len;
+};
+
+//Values are in seconds. The last bin also counts all the greater values.
+struct ow_histogram
+{
+  double bin_width;
+  double max;
+  double sum;
+  uint64_t count;
+  uint64_t bins[OW_HISTOGRAM_BINS];
+};
+
+//Distributions collected by the engine thread.
+struct ow_engine_stats
+{
+  struct ow_histogram usb_interval;	//Time between o2p USB audio transfers
+  struct ow_histogram o2p_fill;	//o2p buffer level before every write
+  struct ow_histogram p2o_fill;	//p2o buffer level before every read
+  struct ow_histogram p2o_midi;	//p2o MIDI scheduling error
+};
+
+//Distributions collected by the host thread.
+struct ow_resampler_stats
+{
+  struct ow_histogram process;	//Host process callback duration
+  struct ow_histogram dll_error;	//Absolute DLL error
+};
+
 struct ow_engine;
+struct ow_engine_group;
 struct ow_resampler;
+struct ow_resampler_group;
+struct ow_ring;
+struct ow_hotplug;
 
 //Common
 const char *ow_get_err_str (ow_err_t);
@@ -187,15 +247,76 @@ int ow_get_device_desc_from_vid_pid (uint16_t, uint16_t,
 int ow_get_usb_device_from_device_attrs (int, const char *,
 					 struct ow_usb_device **);
 
+//Hotplug
+//The callback gets the device and 1 when it arrives or 0 when it leaves. The devices already connected when initializing are notified as arrivals.
+//Events are only dispatched from ow_hotplug_handle_events, which waits for them for the given time in seconds, and outside of libusb so the callback can open or close devices.
+ow_err_t ow_hotplug_init (struct ow_hotplug **, ow_hotplug_cb_t, void *);
+
+void ow_hotplug_handle_events (struct ow_hotplug *, double);
+
+void ow_hotplug_destroy (struct ow_hotplug *);
+
 void ow_set_thread_rt_priority (pthread_t, int);
 
+void ow_set_thread_affinity (pthread_t, uint64_t);
+
+//Locks all the current and future memory of the process. Returns 0 on success.
+int ow_lock_memory ();
+
 void ow_copy_device_desc_static (struct ow_device_desc *,
 				 const struct ow_device_desc_static *);
 
+//Histograms
+//The value below which the given fraction of the values fall, e.g., 0.99. It is the upper limit of the bin found so it never underestimates.
+double ow_histogram_get_percentile (struct ow_histogram *, double);
+
+//Ring buffer
+//Lock-free single producer single consumer ring buffer. Sizes are in bytes but only whole frames are read or written.
+//The reserve functions fill two vectors with the contiguous regions available and return the total length.
+struct ow_ring *ow_ring_new (size_t, size_t);	//Frames and frame size
+
+void ow_ring_free (struct ow_ring *);
+
+int ow_ring_mlock (struct ow_ring *);
+
+void ow_ring_reset (struct ow_ring *);
+
+size_t ow_ring_get_frame_size (struct ow_ring *);
+
+size_t ow_ring_write_space (struct ow_ring *);
+
+size_t ow_ring_write_reserve (struct ow_ring *, struct ow_ring_vector *);
+
+void ow_ring_write_commit (struct ow_ring *, size_t);
+
+size_t ow_ring_write (struct ow_ring *, const char *, size_t);
+
+size_t ow_ring_read_space (struct ow_ring *);
+
+size_t ow_ring_read_reserve (struct ow_ring *, struct ow_ring_vector *);
+
+void ow_ring_read_commit (struct ow_ring *, size_t);
+
+size_t ow_ring_read (struct ow_ring *, char *, size_t);	//If the destination is NULL, data is just discarded.
+
+size_t ow_ring_peek (struct ow_ring *, char *, size_t);
+
+void ow_ring_set_context_functions (struct ow_context *);
+
 //Engine
 ow_err_t ow_engine_init_from_bus_address (struct ow_engine **, uint8_t,
 					  uint8_t, int);
 
+//The engines of a group share their USB event threads, which are started here.
+//Every engine must be destroyed before destroying the group.
+ow_err_t ow_engine_group_init (struct ow_engine_group **, int);
+
+void ow_engine_group_destroy (struct ow_engine_group *);
+
+ow_err_t ow_engine_init_from_bus_address_in_group (struct ow_engine **,
+						   struct ow_engine_group *,
+						   uint8_t, uint8_t, int);
+
 ow_err_t ow_engine_init_from_libusb_device_descriptor (struct ow_engine **,
 						       int, int);
 
@@ -213,6 +334,27 @@ int ow_engine_is_option (struct ow_engine *, ow_engine_option_t);
 
 void ow_engine_set_option (struct ow_engine *, ow_engine_option_t, int);
 
+//Bit n enables the o2p track n and all of them are enabled by default. The samples of disabled tracks are undefined.
+//Disabled tracks are not decoded. In planar mode, their planes are kept in sync but, with rings, nothing is copied into them and the resampler skips them.
+void ow_engine_set_o2p_active_tracks (struct ow_engine *, uint64_t);
+
+//This is the mask that has been applied to the data already in the o2p buffers.
+uint64_t ow_engine_get_o2p_active_tracks (struct ow_engine *);
+
+//Blocks per transfer can be changed while running as the buffers are always allocated for OW_ENGINE_MAX_BLOCKS.
+//The value is clamped to [OW_ENGINE_MIN_BLOCKS, OW_ENGINE_MAX_BLOCKS] and only applies to the transfers submitted from then on.
+void ow_engine_set_blocks_per_transfer (struct ow_engine *, int);
+
+int ow_engine_get_blocks_per_transfer (struct ow_engine *);
+
+//Clients must call this after writing p2o MIDI events as the engine might be waiting for USB events only.
+void ow_engine_notify_p2o_midi (struct ow_engine *);
+
+void ow_engine_get_p2o_midi_histogram (struct ow_engine *,
+				       struct ow_histogram *);
+
+void ow_engine_get_stats (struct ow_engine *, struct ow_engine_stats *);
+
 struct ow_device_desc *ow_engine_get_device_desc (struct ow_engine *);
 
 void ow_engine_stop (struct ow_engine *);
@@ -225,6 +367,11 @@ const char *ow_engine_get_overbridge_name (struct ow_engine *);
 ow_err_t ow_resampler_init_from_bus_address (struct ow_resampler **, uint8_t,
 					     uint8_t, int, int);
 
+ow_err_t ow_resampler_init_from_bus_address_in_group (struct ow_resampler **,
+						      struct ow_engine_group
+						      *, uint8_t, uint8_t,
+						      int, int);
+
 ow_err_t ow_resampler_start (struct ow_resampler *, struct ow_context *);
 
 void ow_resampler_wait (struct ow_resampler *);
@@ -241,10 +388,17 @@ void ow_resampler_read_audio (struct ow_resampler *);
 
 void ow_resampler_write_audio (struct ow_resampler *);
 
+void ow_resampler_read_audio_planar (struct ow_resampler *, float **);
+
+void ow_resampler_write_audio_planar (struct ow_resampler *, float **);
+
 int ow_resampler_compute_ratios (struct ow_resampler *, double);
 
 void ow_resampler_inc_xruns (struct ow_resampler *);
 
+//Xruns since the resampler was created.
+unsigned int ow_resampler_get_xruns (struct ow_resampler *);
+
 ow_resampler_status_t ow_resampler_get_status (struct ow_resampler *);
 
 struct ow_engine *ow_resampler_get_engine (struct ow_resampler *);
@@ -255,15 +409,48 @@ void ow_resampler_set_buffer_size (struct ow_resampler *, uint32_t);
 
 void ow_resampler_set_samplerate (struct ow_resampler *, uint32_t);
 
+//Hosts that know their actual sample rate against the get_time clock can set it before ow_resampler_compute_ratios so that the DLL starts from the right ratio.
+void ow_resampler_set_host_rate (struct ow_resampler *, double);
+
+//In adaptive mode, the blocks per transfer grow when there are xruns or o2p underflows and shrink back slowly while there are none. This must be set before ow_resampler_start.
+void ow_resampler_set_adaptive_blocks (struct ow_resampler *, int);
+
+//The tuned clock ratio of every device is kept in a file named after it in the configuration directory.
+//Loading must happen before ow_resampler_start and saving once the host has stopped calling ow_resampler_compute_ratios. Nothing is saved if the DLL never got tuned.
+//With a cached ratio, the DLL starts tuning right away with a narrower bandwidth.
+void ow_resampler_load_clock_cache (struct ow_resampler *);
+
+void ow_resampler_save_clock_cache (struct ow_resampler *);
+
 size_t ow_resampler_get_o2p_frame_size (struct ow_resampler *);
 
 size_t ow_resampler_get_p2o_frame_size (struct ow_resampler *);
 
 float *ow_resampler_get_o2p_audio_buffer (struct ow_resampler *);
 
+//The buffer is part of the p2o queue so it changes on every ow_resampler_write_audio call and must be got again every cycle.
 float *ow_resampler_get_p2o_audio_buffer (struct ow_resampler *);
 
 struct ow_resampler_reporter *ow_resampler_get_reporter (struct ow_resampler
 							 *);
 
+void ow_resampler_get_stats (struct ow_resampler *,
+			     struct ow_resampler_stats *);
+
+//Hosts call this at the end of every process callback with the time spent in it.
+void ow_resampler_add_process_time (struct ow_resampler *, double);
+
+//Resampler groups
+ow_err_t ow_resampler_group_init (struct ow_resampler_group **);
+
+void ow_resampler_group_destroy (struct ow_resampler_group *);
+
+//Resamplers must be added before starting them and are removed when destroyed.
+ow_err_t ow_resampler_group_add (struct ow_resampler_group *,
+				 struct ow_resampler *);
+
+//Target delay and the highest o2p latency of the running resamplers in ms. The latter is -1.0 if none is running.
+void ow_resampler_group_get_latency (struct ow_resampler_group *, double *,
+				     double *);
+
 #endif
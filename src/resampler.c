@@ -18,50 +18,157 @@
  *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "resampler.h"
+#include "histogram.h"
+#include "rtlog.h"
 
 #define MAX_READ_FRAMES 5
 #define STARTUP_TIME 5
 #define DEFAULT_REPORT_PERIOD 2
+#define MAX_SRC_QUALITY SRC_SINC_MEDIUM_QUALITY	//Higher values use the built-in interpolators.
+#define PROCESS_HISTOGRAM_BIN_WIDTH 0.00005
+#define DLL_ERROR_HISTOGRAM_BIN_WIDTH 0.0001
+#define RATIO_MAX_DEVIATION 0.01	//Measured or cached ratios farther than this from the nominal one are wrong.
+#define CLOCK_CACHE_DIR "/clocks"
+#define P2O_BUF_SCALE 8		//The 8 times scale allow up to more than 192 kHz sample rate in JACK.
+#define ADAPTIVE_QUIET_REPORTS 30	//Reports without trouble before trying less blocks.
+
+static int
+ow_resampler_state_init (struct ow_resampler_state *state, int quality,
+			 int channels, src_callback_t callback, void *cb_data)
+{
+  int err = 0;
+
+  state->src = NULL;
+  state->interp = NULL;
+
+  if (quality > MAX_SRC_QUALITY)
+    {
+      //SRC_SINC_FASTEST and SRC_ZERO_ORDER_HOLD use the cubic interpolator while the lowest quality is the linear one as in libsamplerate.
+      state->interp =
+	ow_interpolator_new (quality == SRC_LINEAR ? OW_INTERPOLATOR_LINEAR :
+			     OW_INTERPOLATOR_CUBIC, channels, callback,
+			     cb_data);
+    }
+  else if (callback)
+    {
+      state->src = src_callback_new (callback, quality, channels, &err,
+				     cb_data);
+    }
+  else
+    {
+      state->src = src_new (quality, channels, &err);
+    }
+
+  if (err)
+    {
+      error_print ("Error while creating resampler: %s\n",
+		   src_strerror (err));
+    }
+
+  return err;
+}
+
+static void
+ow_resampler_state_delete (struct ow_resampler_state *state)
+{
+  if (state->interp)
+    {
+      ow_interpolator_delete (state->interp);
+      state->interp = NULL;
+    }
+  if (state->src)
+    {
+      src_delete (state->src);
+      state->src = NULL;
+    }
+}
+
+static inline long
+ow_resampler_state_callback_read (struct ow_resampler_state *state,
+				  double ratio, long frames, float *data)
+{
+  if (state->interp)
+    {
+      return ow_interpolator_callback_read (state->interp, ratio, frames,
+					    data);
+    }
+  return src_callback_read (state->src, ratio, frames, data);
+}
+
+static inline int
+ow_resampler_state_process (struct ow_resampler_state *state,
+			    SRC_DATA * data)
+{
+  if (state->interp)
+    {
+      return ow_interpolator_process (state->interp, data);
+    }
+  return src_process (state->src, data);
+}
+
+static inline void
+ow_resampler_state_reset (struct ow_resampler_state *state)
+{
+  if (state->interp)
+    {
+      ow_interpolator_reset (state->interp);
+    }
+  else
+    {
+      src_reset (state->src);
+    }
+}
+
+static inline const char *
+ow_resampler_state_strerror (struct ow_resampler_state *state, int err)
+{
+  if (state->interp)
+    {
+      return "invalid ratio";
+    }
+  return src_strerror (err);
+}
+
+static inline double
+ow_resampler_get_o2p_latency_ms (struct ow_resampler *resampler,
+				 size_t frames)
+{
+  return frames * 1000.0 /
+    (resampler->engine->o2p_frame_size * OB_SAMPLE_RATE);
+}
 
 inline void
 ow_resampler_report_status (struct ow_resampler *resampler)
 {
-  size_t o2p_latency_s, o2p_max_latency_s, p2o_latency_s, p2o_max_latency_s;
+  struct ow_engine_latency latency;
   double o2p_latency_d, o2p_max_latency_d, p2o_latency_d, p2o_max_latency_d;
-  ow_engine_status_t status;
+  ow_engine_status_t status = ow_engine_get_status (resampler->engine);
 
-  pthread_spin_lock (&resampler->engine->lock);
-  o2p_latency_s = resampler->engine->o2p_latency;
-  o2p_max_latency_s = resampler->engine->o2p_max_latency;
-  p2o_latency_s = resampler->engine->p2o_latency;
-  p2o_max_latency_s = resampler->engine->p2o_max_latency;
-  status = resampler->engine->status;
-  pthread_spin_unlock (&resampler->engine->lock);
+  ow_engine_get_latency (resampler->engine, &latency);
 
   int p2o_enabled =
     ow_engine_is_option (resampler->engine, OW_ENGINE_OPTION_P2O_AUDIO);
 
   if (status == OW_ENGINE_STATUS_RUN)
     {
-      o2p_latency_d =
-	o2p_latency_s * 1000.0 / (resampler->engine->o2p_frame_size *
-				  OB_SAMPLE_RATE);
-      o2p_max_latency_d =
-	o2p_max_latency_s * 1000.0 / (resampler->engine->o2p_frame_size *
-				      OB_SAMPLE_RATE);
+      o2p_latency_d = ow_resampler_get_o2p_latency_ms (resampler,
+						       latency.o2p);
+      o2p_max_latency_d = ow_resampler_get_o2p_latency_ms (resampler,
+							   latency.o2p_max);
 
       if (p2o_enabled)
 	{
-	  p2o_latency_d =
-	    p2o_latency_s * 1000.0 / (resampler->engine->p2o_frame_size *
-				      OB_SAMPLE_RATE);
-	  p2o_max_latency_d =
-	    p2o_max_latency_s * 1000.0 / (resampler->engine->p2o_frame_size *
-					  OB_SAMPLE_RATE);
+	  p2o_latency_d = latency.p2o * 1000.0 /
+	    (resampler->engine->p2o_frame_size * OB_SAMPLE_RATE);
+	  p2o_max_latency_d = latency.p2o_max * 1000.0 /
+	    (resampler->engine->p2o_frame_size * OB_SAMPLE_RATE);
 	}
       else
 	{
@@ -100,6 +207,8 @@ void
 ow_resampler_reset_buffers (struct ow_resampler *resampler)
 {
   size_t rso2p, bytes;
+  int outputs, inputs;
+  void **planes;
   struct ow_context *context = resampler->engine->context;
 
   resampler->o2p_bufsize =
@@ -107,37 +216,103 @@ ow_resampler_reset_buffers (struct ow_resampler *resampler)
   resampler->p2o_bufsize =
     resampler->bufsize * resampler->engine->p2o_frame_size;
 
-  if (resampler->p2o_aux)
+  if (resampler->p2o_queues[0])
     {
-      free (resampler->p2o_aux);
       free (resampler->p2o_buf_out);
-      free (resampler->p2o_buf_in);
-      free (resampler->p2o_queue);
+      free (resampler->p2o_queues[0]);
       free (resampler->o2p_buf_in);
       free (resampler->o2p_buf_out);
     }
 
-  //The 8 times scale allow up to more than 192 kHz sample rate in JACK.
-  resampler->p2o_buf_in = malloc (resampler->p2o_bufsize);
-  resampler->p2o_buf_out = malloc (resampler->p2o_bufsize * 8);
-  resampler->p2o_aux = malloc (resampler->p2o_bufsize * 8);
-  resampler->p2o_queue = malloc (resampler->p2o_bufsize * 8);
+  resampler->p2o_buf_out = malloc (resampler->p2o_bufsize * P2O_BUF_SCALE);
+  resampler->p2o_queues[0] =
+    malloc (resampler->p2o_bufsize * P2O_BUF_SCALE * 2);
+  resampler->p2o_queues[1] =
+    &resampler->p2o_queues[0][resampler->bufsize * P2O_BUF_SCALE *
+			      resampler->engine->device_desc.inputs];
+  resampler->p2o_queue = 0;
   resampler->p2o_queue_len = 0;
+  resampler->p2o_acc = 0.0;
 
   resampler->o2p_buf_in = malloc (resampler->o2p_bufsize);
   resampler->o2p_buf_out = malloc (resampler->o2p_bufsize);
+  resampler->o2p_last_frames = 1;
 
-  memset (resampler->p2o_aux, 0, resampler->p2o_bufsize);
+  memset (resampler->p2o_queues[0], 0,
+	  resampler->p2o_bufsize * P2O_BUF_SCALE * 2);
   memset (resampler->o2p_buf_in, 0, resampler->p2o_bufsize);
+  //The output buffers are written too so that the first cycles do not take page faults.
+  memset (resampler->p2o_buf_out, 0, resampler->p2o_bufsize * P2O_BUF_SCALE);
+  memset (resampler->o2p_buf_out, 0, resampler->o2p_bufsize);
 
   resampler->reading_at_o2p_end = 0;
+  resampler->o2p_hold = 0;
+
+  if (resampler->o2p_planar_buf_in)
+    {
+      free (resampler->o2p_planar_buf_in);
+      free (resampler->o2p_planar_buf_out);
+      free (resampler->p2o_planar_queue);
+      free (resampler->p2o_planar_buf_out);
+      resampler->o2p_planar_buf_in = NULL;
+    }
+
+  if (resampler->planar)
+    {
+      outputs = resampler->engine->device_desc.outputs;
+      inputs = resampler->engine->device_desc.inputs;
+
+      resampler->o2p_planar_buf_in =
+	malloc (outputs * MAX_READ_FRAMES * OB_BYTES_PER_SAMPLE);
+      memset (resampler->o2p_planar_buf_in, 0,
+	      outputs * MAX_READ_FRAMES * OB_BYTES_PER_SAMPLE);
+      resampler->o2p_planar_buf_out = malloc (resampler->o2p_bufsize);
+      memset (resampler->o2p_planar_buf_out, 0, resampler->o2p_bufsize);
+      for (int i = 0; i < outputs; i++)
+	{
+	  resampler->o2p_planar_bufs_out[i] =
+	    &resampler->o2p_planar_buf_out[i * resampler->bufsize];
+	}
+      resampler->o2p_planar_frames = 0;
+      resampler->o2p_planar_pos = 0;
+      resampler->o2p_planar_last_frames = 1;
+      resampler->o2p_planar_tracks = UINT64_MAX;
+      memset (resampler->o2p_planar_mute, 0,
+	      sizeof (resampler->o2p_planar_mute));
+
+      resampler->p2o_planar_queue =
+	malloc (resampler->p2o_bufsize * P2O_BUF_SCALE);
+      memset (resampler->p2o_planar_queue, 0,
+	      resampler->p2o_bufsize * P2O_BUF_SCALE);
+      resampler->p2o_planar_buf_out =
+	malloc (resampler->p2o_bufsize * P2O_BUF_SCALE);
+      memset (resampler->p2o_planar_buf_out, 0,
+	      resampler->p2o_bufsize * P2O_BUF_SCALE);
+
+      debug_print (2, "Using planar buffers for %d and %d tracks\n",
+		   outputs, inputs);
+    }
 
   if (context && context->o2p_audio)
     {
-      rso2p = context->read_space (context->o2p_audio);
-      bytes =
-	ow_bytes_to_frame_bytes (rso2p, resampler->engine->o2p_frame_size);
-      context->read (context->o2p_audio, NULL, bytes);
+      if (resampler->planar)
+	{
+	  planes = context->o2p_audio;
+	  rso2p = context->read_space (planes[outputs - 1]);
+	  bytes = ow_bytes_to_frame_bytes (rso2p, OB_BYTES_PER_SAMPLE);
+	  for (int i = 0; i < outputs; i++)
+	    {
+	      context->read (planes[i], NULL, bytes);
+	    }
+	}
+      else
+	{
+	  rso2p = context->read_space (context->o2p_audio);
+	  bytes =
+	    ow_bytes_to_frame_bytes (rso2p,
+				     resampler->engine->o2p_frame_size);
+	  context->read (context->o2p_audio, NULL, bytes);
+	}
     }
 }
 
@@ -148,7 +323,7 @@ ow_resampler_reset_dll (struct ow_resampler *resampler,
   if (resampler->dll.set
       && ow_engine_get_status (resampler->engine) == OW_ENGINE_STATUS_RUN)
     {
-      debug_print (2, "Just adjusting DLL ratio...\n");
+      rt_debug_print (2, "Just adjusting DLL ratio...\n");
       resampler->dll.ratio =
 	resampler->dll.last_ratio_avg * new_samplerate /
 	resampler->samplerate;
@@ -158,10 +333,12 @@ ow_resampler_reset_dll (struct ow_resampler *resampler,
     }
   else
     {
-      debug_print (2, "Resetting the DLL...\n");
+      rt_debug_print (2, "Resetting the DLL...\n");
       ow_dll_primary_reset (&resampler->dll, new_samplerate, OB_SAMPLE_RATE,
 			    resampler->bufsize,
 			    resampler->engine->frames_per_transfer);
+      atomic_store_explicit (&resampler->kdel, resampler->dll.kdel,
+			     memory_order_relaxed);
     }
 
   ow_engine_set_status (resampler->engine, OW_ENGINE_STATUS_BOOT);
@@ -176,17 +353,17 @@ resampler_p2o_reader (void *cb_data, float **data)
   long ret;
   struct ow_resampler *resampler = cb_data;
 
-  *data = resampler->p2o_aux;
-
+  //The callback is only called again once the returned frames have been used so the queue that is not being written can always be handed.
   if (resampler->p2o_queue_len == 0)
     {
-      debug_print (2, "p2o: Can not read data from queue\n");
+      rt_debug_print (2, "p2o: Can not read data from queue\n");
+      *data = resampler->p2o_queues[!resampler->p2o_queue];
       return resampler->bufsize;
     }
 
+  *data = resampler->p2o_queues[resampler->p2o_queue];
   ret = resampler->p2o_queue_len;
-  memcpy (resampler->p2o_aux, resampler->p2o_queue,
-	  ret * resampler->engine->p2o_frame_size);
+  resampler->p2o_queue = !resampler->p2o_queue;
   resampler->p2o_queue_len = 0;
 
   return ret;
@@ -198,7 +375,6 @@ resampler_o2p_reader (void *cb_data, float **data)
   size_t rso2p;
   size_t bytes;
   long frames;
-  static int last_frames = 1;
   struct ow_resampler *resampler = cb_data;
 
   *data = resampler->o2p_buf_in;
@@ -208,6 +384,21 @@ resampler_o2p_reader (void *cb_data, float **data)
 					    o2p_audio);
   if (resampler->reading_at_o2p_end)
     {
+      if (resampler->o2p_hold)
+	{
+	  //The buffer is being filled up to a greater delay so nothing is consumed.
+	  if (resampler->o2p_last_frames > 1)
+	    {
+	      uint64_t pos = (resampler->o2p_last_frames - 1) *
+		resampler->engine->device_desc.outputs;
+	      memcpy (resampler->o2p_buf_in, &resampler->o2p_buf_in[pos],
+		      resampler->engine->o2p_frame_size);
+	    }
+	  resampler->o2p_hold--;
+	  resampler->o2p_last_frames = 1;
+	  return 1;
+	}
+
       if (rso2p >= resampler->engine->o2p_frame_size)
 	{
 	  frames = rso2p / resampler->engine->o2p_frame_size;
@@ -220,13 +411,14 @@ resampler_o2p_reader (void *cb_data, float **data)
 	}
       else
 	{
-	  debug_print (2,
-		       "o2p: Audio ring buffer underflow (%zu < %zu). Replicating last samples...\n",
-		       rso2p, resampler->engine->o2p_transfer_size);
-	  if (last_frames > 1)
+	  rt_debug_print (2,
+			  "o2p: Audio ring buffer underflow (%zu < %zu). Replicating last samples...\n",
+			  rso2p, resampler->engine->o2p_transfer_size);
+	  resampler->adaptive_trouble++;
+	  if (resampler->o2p_last_frames > 1)
 	    {
-	      uint64_t pos =
-		(last_frames - 1) * resampler->engine->device_desc.outputs;
+	      uint64_t pos = (resampler->o2p_last_frames - 1) *
+		resampler->engine->device_desc.outputs;
 	      memcpy (resampler->o2p_buf_in, &resampler->o2p_buf_in[pos],
 		      resampler->engine->o2p_frame_size);
 	    }
@@ -238,8 +430,8 @@ resampler_o2p_reader (void *cb_data, float **data)
       if (rso2p >= resampler->o2p_bufsize)
 	{
 	  bytes = ow_bytes_to_frame_bytes (rso2p, resampler->o2p_bufsize);
-	  debug_print (2, "o2p: Emptying buffer (%zu B) and running...\n",
-		       bytes);
+	  rt_debug_print (2, "o2p: Emptying buffer (%zu B) and running...\n",
+			  bytes);
 	  resampler->engine->context->read (resampler->engine->
 					    context->o2p_audio, NULL, bytes);
 	  resampler->reading_at_o2p_end = 1;
@@ -248,7 +440,162 @@ resampler_o2p_reader (void *cb_data, float **data)
     }
 
   resampler->dll.kj += frames;
-  last_frames = frames;
+  resampler->o2p_last_frames = frames;
+  return frames;
+}
+
+//Only the tracks decoded by the engine are resampled. If there are none, the first one still is as the frames used in every step come from it.
+//When a track starts being resampled, the frames already in its plane were not decoded so they are muted.
+static void
+ow_resampler_update_o2p_planar_tracks (struct ow_resampler *resampler)
+{
+  uint64_t tracks, started;
+  size_t frames;
+  struct ow_context *context = resampler->engine->context;
+  void **planes = context->o2p_audio;
+  int outputs = resampler->engine->device_desc.outputs;
+
+  tracks = ow_engine_get_o2p_active_tracks (resampler->engine);
+  if (outputs < OB_MAX_TRACKS)
+    {
+      tracks &= (1ULL << outputs) - 1;
+    }
+  if (!tracks)
+    {
+      tracks = 1;
+    }
+
+  started = tracks & ~resampler->o2p_planar_tracks;
+  resampler->o2p_planar_tracks = tracks;
+  if (!started)
+    {
+      return;
+    }
+
+  frames = context->read_space (planes[outputs - 1]) / OB_BYTES_PER_SAMPLE;
+  frames = frames > resampler->engine->frames_per_transfer ?
+    frames - resampler->engine->frames_per_transfer : 0;
+
+  for (int i = 0; i < outputs; i++)
+    {
+      if (started & (1ULL << i))
+	{
+	  rt_debug_print (2, "o2p: Resampling track %d\n", i);
+	  ow_resampler_state_reset (&resampler->o2p_planar_states[i]);
+	  memset (&resampler->o2p_planar_buf_in[i * MAX_READ_FRAMES], 0,
+		  MAX_READ_FRAMES * OB_BYTES_PER_SAMPLE);
+	  resampler->o2p_planar_mute[i] = frames;
+	}
+    }
+}
+
+//The buffer might be NULL if the frames are discarded.
+static inline void
+ow_resampler_mute_o2p_planar_track (struct ow_resampler *resampler, int track,
+				    float *buf, size_t frames)
+{
+  size_t *mute = &resampler->o2p_planar_mute[track];
+
+  if (*mute == 0)
+    {
+      return;
+    }
+
+  frames = frames > *mute ? *mute : frames;
+  if (buf)
+    {
+      memset (buf, 0, frames * OB_BYTES_PER_SAMPLE);
+    }
+  *mute -= frames;
+}
+
+//This is the planar version of resampler_o2p_reader. Every track reads the same amount of frames but only the resampled ones are copied.
+static long
+resampler_o2p_planar_reader (struct ow_resampler *resampler)
+{
+  size_t rso2p;
+  size_t bytes;
+  long frames;
+  float *buf = resampler->o2p_planar_buf_in;
+  struct ow_context *context = resampler->engine->context;
+  void **planes = context->o2p_audio;
+  int outputs = resampler->engine->device_desc.outputs;
+
+  rso2p = context->read_space (planes[outputs - 1]);
+  if (resampler->reading_at_o2p_end)
+    {
+      if (resampler->o2p_hold)
+	{
+	  if (resampler->o2p_planar_last_frames > 1)
+	    {
+	      for (int i = 0; i < outputs; i++, buf += MAX_READ_FRAMES)
+		{
+		  buf[0] = buf[resampler->o2p_planar_last_frames - 1];
+		}
+	    }
+	  resampler->o2p_hold--;
+	  resampler->o2p_planar_last_frames = 1;
+	  return 1;
+	}
+
+      if (rso2p >= OB_BYTES_PER_SAMPLE)
+	{
+	  frames = rso2p / OB_BYTES_PER_SAMPLE;
+	  frames = frames > MAX_READ_FRAMES ? MAX_READ_FRAMES : frames;
+	  bytes = frames * OB_BYTES_PER_SAMPLE;
+	  for (int i = 0; i < outputs; i++, buf += MAX_READ_FRAMES)
+	    {
+	      if (resampler->o2p_planar_tracks & (1ULL << i))
+		{
+		  context->read (planes[i], (void *) buf, bytes);
+		  ow_resampler_mute_o2p_planar_track (resampler, i, buf,
+						      frames);
+		}
+	      else
+		{
+		  context->read (planes[i], NULL, bytes);
+		}
+	    }
+	}
+      else
+	{
+	  rt_debug_print (2,
+			  "o2p: Audio ring buffer underflow (%zu < %zu). Replicating last samples...\n",
+			  rso2p * outputs,
+			  resampler->engine->o2p_transfer_size);
+	  resampler->adaptive_trouble++;
+	  if (resampler->o2p_planar_last_frames > 1)
+	    {
+	      for (int i = 0; i < outputs; i++, buf += MAX_READ_FRAMES)
+		{
+		  buf[0] = buf[resampler->o2p_planar_last_frames - 1];
+		}
+	    }
+	  frames = MAX_READ_FRAMES;
+	}
+    }
+  else
+    {
+      if (rso2p >= resampler->bufsize * OB_BYTES_PER_SAMPLE)
+	{
+	  bytes = ow_bytes_to_frame_bytes (rso2p,
+					   resampler->bufsize *
+					   OB_BYTES_PER_SAMPLE);
+	  rt_debug_print (2, "o2p: Emptying buffer (%zu B) and running...\n",
+			  bytes * outputs);
+	  for (int i = 0; i < outputs; i++)
+	    {
+	      context->read (planes[i], NULL, bytes);
+	      ow_resampler_mute_o2p_planar_track (resampler, i, NULL,
+						  bytes / OB_BYTES_PER_SAMPLE);
+	    }
+	  resampler->reading_at_o2p_end = 1;
+	}
+      frames = MAX_READ_FRAMES;
+    }
+
+  resampler->dll.kj += frames;
+  resampler->o2p_planar_last_frames = frames;
   return frames;
 }
 
@@ -258,48 +605,54 @@ ow_resampler_read_audio (struct ow_resampler *resampler)
   long gen_frames;
 
   gen_frames =
-    src_callback_read (resampler->o2p_state, resampler->o2p_ratio,
-		       resampler->bufsize, resampler->o2p_buf_out);
+    ow_resampler_state_callback_read (&resampler->o2p_state,
+				      resampler->o2p_ratio,
+				      resampler->bufsize,
+				      resampler->o2p_buf_out);
   if (gen_frames != resampler->bufsize)
     {
-      error_print
+      rt_error_print
 	("o2p: Unexpected frames with ratio %f (output %ld, expected %d)\n",
 	 resampler->o2p_ratio, gen_frames, resampler->bufsize);
     }
 }
 
+static inline int
+ow_resampler_get_p2o_frames (struct ow_resampler *resampler)
+{
+  int inc;
+
+  resampler->p2o_acc += resampler->bufsize * (resampler->p2o_ratio - 1.0);
+  inc = trunc (resampler->p2o_acc);
+  resampler->p2o_acc -= inc;
+  return resampler->bufsize + inc;
+}
+
 void
 ow_resampler_write_audio (struct ow_resampler *resampler)
 {
   long gen_frames;
-  int inc;
   int frames;
   size_t bytes;
   size_t wsp2o;
-  static double p2o_acc = .0;
 
   if (resampler->status < OW_RESAMPLER_STATUS_RUN)
     {
       return;
     }
 
-  memcpy (&resampler->p2o_queue
-	  [resampler->p2o_queue_len *
-	   resampler->engine->p2o_frame_size], resampler->p2o_buf_in,
-	  resampler->p2o_bufsize);
+  //The host has already written the frames in the queue.
   resampler->p2o_queue_len += resampler->bufsize;
 
-  p2o_acc += resampler->bufsize * (resampler->p2o_ratio - 1.0);
-  inc = trunc (p2o_acc);
-  p2o_acc -= inc;
-  frames = resampler->bufsize + inc;
+  frames = ow_resampler_get_p2o_frames (resampler);
 
   gen_frames =
-    src_callback_read (resampler->p2o_state,
-		       resampler->p2o_ratio, frames, resampler->p2o_buf_out);
+    ow_resampler_state_callback_read (&resampler->p2o_state,
+				      resampler->p2o_ratio, frames,
+				      resampler->p2o_buf_out);
   if (gen_frames != frames)
     {
-      error_print
+      rt_error_print
 	("p2o: Unexpected frames with ratio %f (output %ld, expected %d)\n",
 	 resampler->p2o_ratio, gen_frames, frames);
     }
@@ -318,10 +671,219 @@ ow_resampler_write_audio (struct ow_resampler *resampler)
     }
   else
     {
-      error_print ("p2o: Audio ring buffer overflow. Discarding data...\n");
+      rt_error_print ("p2o: Audio ring buffer overflow. Discarding data...\n");
     }
 }
 
+void
+ow_resampler_read_audio_planar (struct ow_resampler *resampler,
+				float **buffers)
+{
+  int err;
+  SRC_DATA data;
+  long gen_frames = 0;
+  int outputs = resampler->engine->device_desc.outputs;
+
+  data.src_ratio = resampler->o2p_ratio;
+  data.end_of_input = 0;
+
+  ow_resampler_update_o2p_planar_tracks (resampler);
+
+  while (gen_frames < resampler->bufsize)
+    {
+      if (resampler->o2p_planar_frames == 0)
+	{
+	  resampler->o2p_planar_frames =
+	    resampler_o2p_planar_reader (resampler);
+	  resampler->o2p_planar_pos = 0;
+	}
+
+      //All the resampled tracks use the same amount of frames, recorded in data.
+      for (int i = 0; i < outputs; i++)
+	{
+	  if (!(resampler->o2p_planar_tracks & (1ULL << i)))
+	    {
+	      continue;
+	    }
+	  data.data_in = &resampler->o2p_planar_buf_in[i * MAX_READ_FRAMES +
+						       resampler->o2p_planar_pos];
+	  data.input_frames = resampler->o2p_planar_frames;
+	  data.data_out = &buffers[i][gen_frames];
+	  data.output_frames = resampler->bufsize - gen_frames;
+	  err = ow_resampler_state_process (&resampler->o2p_planar_states[i],
+					    &data);
+	  if (err)
+	    {
+	      rt_error_print ("o2p: Error while resampling: %s\n",
+			      ow_resampler_state_strerror
+			      (&resampler->o2p_planar_states[i], err));
+	      return;
+	    }
+	}
+
+      resampler->o2p_planar_pos += data.input_frames_used;
+      resampler->o2p_planar_frames -= data.input_frames_used;
+      gen_frames += data.output_frames_gen;
+    }
+}
+
+void
+ow_resampler_write_audio_planar (struct ow_resampler *resampler,
+				 float **buffers)
+{
+  int err;
+  SRC_DATA data;
+  int frames;
+  size_t bytes;
+  size_t wsp2o;
+  long pos, len, gen_frames;
+  size_t plane_len = resampler->bufsize * P2O_BUF_SCALE;
+  int inputs = resampler->engine->device_desc.inputs;
+  struct ow_context *context = resampler->engine->context;
+  void **planes = context->p2o_audio;
+
+  if (resampler->status < OW_RESAMPLER_STATUS_RUN)
+    {
+      return;
+    }
+
+  for (int i = 0; i < inputs; i++)
+    {
+      memcpy (&resampler->p2o_planar_queue[i * plane_len +
+					   resampler->p2o_queue_len],
+	      buffers[i], resampler->bufsize * OB_BYTES_PER_SAMPLE);
+    }
+  resampler->p2o_queue_len += resampler->bufsize;
+
+  frames = ow_resampler_get_p2o_frames (resampler);
+
+  data.src_ratio = resampler->p2o_ratio;
+  data.end_of_input = 0;
+
+  pos = 0;
+  len = resampler->p2o_queue_len;
+  gen_frames = 0;
+  while (gen_frames < frames)
+    {
+      if (pos == len)
+	{
+	  //As in resampler_p2o_reader, the data at the beginning of the queue is used again.
+	  rt_debug_print (2, "p2o: Can not read data from queue\n");
+	  pos = 0;
+	  len = resampler->bufsize;
+	}
+
+      for (int i = 0; i < inputs; i++)
+	{
+	  data.data_in = &resampler->p2o_planar_queue[i * plane_len + pos];
+	  data.input_frames = len - pos;
+	  data.data_out =
+	    &resampler->p2o_planar_buf_out[i * plane_len + gen_frames];
+	  data.output_frames = frames - gen_frames;
+	  err = ow_resampler_state_process (&resampler->p2o_planar_states[i],
+					    &data);
+	  if (err)
+	    {
+	      rt_error_print ("p2o: Error while resampling: %s\n",
+			      ow_resampler_state_strerror
+			      (&resampler->p2o_planar_states[i], err));
+	      return;
+	    }
+	}
+
+      pos += data.input_frames_used;
+      gen_frames += data.output_frames_gen;
+    }
+
+  resampler->p2o_queue_len = len - pos;
+  if (pos && resampler->p2o_queue_len)
+    {
+      for (int i = 0; i < inputs; i++)
+	{
+	  memmove (&resampler->p2o_planar_queue[i * plane_len],
+		   &resampler->p2o_planar_queue[i * plane_len + pos],
+		   resampler->p2o_queue_len * OB_BYTES_PER_SAMPLE);
+	}
+    }
+
+  bytes = gen_frames * OB_BYTES_PER_SAMPLE;
+  wsp2o = context->write_space (planes[inputs - 1]);
+
+  if (bytes <= wsp2o)
+    {
+      for (int i = 0; i < inputs; i++)
+	{
+	  context->write (planes[i],
+			  (void *) &resampler->p2o_planar_buf_out[i *
+								  plane_len],
+			  bytes);
+	}
+    }
+  else
+    {
+      rt_error_print ("p2o: Audio ring buffer overflow. Discarding data...\n");
+    }
+}
+
+//Every time there was trouble since the last report, the blocks grow and the minimum is raised above the failing value so that the policy settles down.
+//After enough reports without trouble, a block less is tried.
+static void
+ow_resampler_adapt_blocks (struct ow_resampler *resampler)
+{
+  int blocks, new_blocks, kdel;
+  struct ow_dll *dll = &resampler->dll;
+
+  blocks = ow_engine_get_blocks_per_transfer (resampler->engine);
+  new_blocks = blocks;
+
+  if (resampler->adaptive_trouble)
+    {
+      resampler->adaptive_quiet = 0;
+      if (resampler->adaptive_min_blocks <= blocks)
+	{
+	  resampler->adaptive_min_blocks = blocks + 1;
+	}
+      new_blocks = blocks + blocks / 2;
+    }
+  else
+    {
+      resampler->adaptive_quiet++;
+      if (resampler->adaptive_quiet == ADAPTIVE_QUIET_REPORTS)
+	{
+	  resampler->adaptive_quiet = 0;
+	  if (blocks > resampler->adaptive_min_blocks)
+	    {
+	      new_blocks = blocks - 1;
+	    }
+	}
+    }
+  resampler->adaptive_trouble = 0;
+
+  ow_engine_set_blocks_per_transfer (resampler->engine, new_blocks);
+  new_blocks = ow_engine_get_blocks_per_transfer (resampler->engine);
+  if (new_blocks == blocks)
+    {
+      return;
+    }
+
+  rt_debug_print (1, "%s: Blocks per transfer: %d -> %d\n",
+		  resampler->engine->name, blocks, new_blocks);
+
+  kdel = 2.0 * new_blocks * OB_FRAMES_PER_BLOCK + 1.5 * resampler->bufsize;
+  atomic_store_explicit (&resampler->kdel, kdel, memory_order_relaxed);
+  if (resampler->group)
+    {
+      kdel = ow_resampler_group_get_kdel (resampler->group);
+    }
+
+  //A greater delay is reached by not consuming frames for a while. A lower one is reached by the DLL itself.
+  if (kdel > dll->kdel)
+    {
+      resampler->o2p_hold = kdel - dll->kdel;
+    }
+  dll->kdel = kdel;
+}
+
 int
 ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
 {
@@ -329,14 +891,22 @@ ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
   ow_engine_status_t engine_status;
   struct ow_dll *dll = &resampler->dll;
 
-  pthread_spin_lock (&resampler->lock);
-  xruns = resampler->xruns;
-  resampler->xruns = 0;
-  pthread_spin_unlock (&resampler->lock);
+  unsigned int seq;
+
+  xruns = atomic_exchange_explicit (&resampler->xruns, 0,
+				    memory_order_relaxed);
+
+  do
+    {
+      seq = ow_seqlock_read_begin (&resampler->engine->seqlock);
+      ow_dll_primary_load_dll_overwitch (dll);
+    }
+  while (ow_seqlock_read_retry (&resampler->engine->seqlock, seq));
 
-  pthread_spin_lock (&resampler->engine->lock);
-  ow_dll_primary_load_dll_overwitch (dll);
-  pthread_spin_unlock (&resampler->engine->lock);
+  if (resampler->group)
+    {
+      dll->kdel = ow_resampler_group_get_kdel (resampler->group);
+    }
 
   engine_status = ow_engine_get_status (resampler->engine);
   if (resampler->status == OW_RESAMPLER_STATUS_READY
@@ -345,7 +915,7 @@ ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
       if (engine_status == OW_ENGINE_STATUS_READY)
 	{
 	  ow_engine_set_status (resampler->engine, OW_ENGINE_STATUS_BOOT);
-	  debug_print (2, "Booting Overbridge side...\n");
+	  rt_debug_print (2, "Booting Overbridge side...\n");
 	}
       return 1;
     }
@@ -353,28 +923,66 @@ ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
   if (resampler->status == OW_RESAMPLER_STATUS_READY
       && engine_status == OW_ENGINE_STATUS_WAIT)
     {
+      if (resampler->cached_ratio)
+	{
+	  ow_dll_primary_set_ratio (dll,
+				    resampler->cached_ratio *
+				    resampler->samplerate / OB_SAMPLE_RATE);
+	}
+      else if (fabs (resampler->host_rate - resampler->samplerate) <
+	       resampler->samplerate * RATIO_MAX_DEVIATION)
+	{
+	  ow_dll_primary_set_ratio (dll,
+				    resampler->host_rate / OB_SAMPLE_RATE);
+	}
+
       ow_dll_primary_update_err (dll, time);
       ow_dll_primary_first_time_run (dll);
 
-      debug_print (2, "Starting up resampler...\n");
-      ow_dll_primary_set_loop_filter (dll, 1.0, resampler->bufsize,
-				      resampler->samplerate);
-      resampler->status = OW_RESAMPLER_STATUS_BOOT;
-
       resampler->log_cycles = 0;
-      resampler->log_control_cycles =
-	STARTUP_TIME * resampler->samplerate / resampler->bufsize;
+
+      //A cached ratio is close enough to skip the wide bandwidth startup.
+      if (resampler->cached_ratio)
+	{
+	  rt_debug_print (2, "Tuning resampler from the cached ratio...\n");
+	  ow_dll_primary_set_loop_filter (dll, 0.05, resampler->bufsize,
+					  resampler->samplerate);
+	  dll->ratio_avg = dll->ratio;
+	  resampler->status = OW_RESAMPLER_STATUS_TUNE;
+	  resampler->log_control_cycles =
+	    resampler->reporter.period * resampler->samplerate /
+	    resampler->bufsize;
+	}
+      else
+	{
+	  rt_debug_print (2, "Starting up resampler...\n");
+	  ow_dll_primary_set_loop_filter (dll, 1.0, resampler->bufsize,
+					  resampler->samplerate);
+	  resampler->status = OW_RESAMPLER_STATUS_BOOT;
+	  resampler->log_control_cycles =
+	    STARTUP_TIME * resampler->samplerate / resampler->bufsize;
+	}
       return 0;
     }
 
   if (xruns)
     {
-      debug_print (2, "Fixing %d xruns...\n", xruns);
+      rt_debug_print (2, "Fixing %d xruns...\n", xruns);
+
+      resampler->adaptive_trouble += xruns;
 
       //With this, we try to recover from the unreaded frames that are in the o2p buffer and...
       resampler->o2p_ratio = dll->ratio * (1 + xruns);
       resampler->p2o_ratio = 1.0 / resampler->o2p_ratio;
-      ow_resampler_read_audio (resampler);
+      if (resampler->planar)
+	{
+	  ow_resampler_read_audio_planar (resampler,
+					  resampler->o2p_planar_bufs_out);
+	}
+      else
+	{
+	  ow_resampler_read_audio (resampler);
+	}
 
       //... we skip the current cycle DLL update as time masurements are not precise enough and would lead to errors.
       return 0;
@@ -383,9 +991,14 @@ ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
   ow_dll_primary_update_err (dll, time);
   ow_dll_primary_update (dll);
 
+  ow_seqlock_write_begin (&resampler->stats_seqlock);
+  ow_histogram_add (&resampler->stats.dll_error,
+		    fabs (dll->err) / resampler->samplerate);
+  ow_seqlock_write_end (&resampler->stats_seqlock);
+
   if (dll->ratio < 0.0)
     {
-      error_print ("Negative ratio detected. Stopping resampler...\n");
+      rt_error_print ("Negative ratio detected. Stopping resampler...\n");
       ow_engine_set_status (resampler->engine, OW_ENGINE_STATUS_ERROR);
       return 1;
     }
@@ -404,7 +1017,7 @@ ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
 
       if (resampler->status == OW_RESAMPLER_STATUS_BOOT)
 	{
-	  debug_print (2, "Tuning resampler...\n");
+	  rt_debug_print (2, "Tuning resampler...\n");
 	  ow_dll_primary_set_loop_filter (dll, 0.05, resampler->bufsize,
 					  resampler->samplerate);
 	  resampler->status = OW_RESAMPLER_STATUS_TUNE;
@@ -415,49 +1028,224 @@ ow_resampler_compute_ratios (struct ow_resampler *resampler, double time)
 
       if (resampler->status == OW_RESAMPLER_STATUS_TUNE && ow_dll_tuned (dll))
 	{
-	  debug_print (2, "Running resampler...\n");
+	  rt_debug_print (2, "Running resampler...\n");
 	  ow_dll_primary_set_loop_filter (dll, 0.02, resampler->bufsize,
 					  resampler->samplerate);
 	  resampler->status = OW_RESAMPLER_STATUS_RUN;
 	  ow_engine_set_status (resampler->engine, OW_ENGINE_STATUS_RUN);
+	  //Whatever happened while tuning is not taken into account.
+	  resampler->adaptive_trouble = 0;
+	  resampler->adaptive_quiet = 0;
+	}
+
+      if (resampler->status == OW_RESAMPLER_STATUS_RUN)
+	{
+	  resampler->tuned_ratio =
+	    dll->ratio_avg * OB_SAMPLE_RATE / resampler->samplerate;
+
+	  if (resampler->adaptive_blocks)
+	    {
+	      ow_resampler_adapt_blocks (resampler);
+	    }
 	}
     }
 
   return 0;
 }
 
+//Like mkdir -p, errors are ignored as opening the file will fail anyway.
+static void
+ow_resampler_mkdirs (char *path)
+{
+  for (char *c = &path[1]; *c; c++)
+    {
+      if (*c == '/')
+	{
+	  *c = 0;
+	  mkdir (path, 0755);
+	  *c = '/';
+	}
+    }
+  mkdir (path, 0755);
+}
+
+//Names might contain slashes so these are replaced.
+static char *
+ow_resampler_get_clock_cache_path (struct ow_resampler *resampler,
+				   int create)
+{
+  size_t len;
+  char *path = get_expanded_dir (CONF_DIR);
+
+  len = strlen (path);
+  snprintf (&path[len], PATH_MAX - len, CLOCK_CACHE_DIR);
+
+  if (create)
+    {
+      ow_resampler_mkdirs (path);
+    }
+
+  len = strlen (path);
+  snprintf (&path[len], PATH_MAX - len, "/%s",
+	    ow_engine_get_overbridge_name (resampler->engine));
+
+  for (char *c = &path[len + 1]; *c; c++)
+    {
+      if (*c == '/')
+	{
+	  *c = '_';
+	}
+    }
+
+  return path;
+}
+
+void
+ow_resampler_load_clock_cache (struct ow_resampler *resampler)
+{
+  FILE *f;
+  double ratio;
+  char *path = ow_resampler_get_clock_cache_path (resampler, 0);
+
+  resampler->cached_ratio = 0;
+
+  f = fopen (path, "r");
+  if (f)
+    {
+      if (fscanf (f, "%lf", &ratio) == 1
+	  && fabs (ratio - 1.0) < RATIO_MAX_DEVIATION)
+	{
+	  debug_print (1, "Using cached clock ratio %.9f from %s\n", ratio,
+		       path);
+	  resampler->cached_ratio = ratio;
+	}
+      fclose (f);
+    }
+
+  free (path);
+}
+
+void
+ow_resampler_save_clock_cache (struct ow_resampler *resampler)
+{
+  FILE *f;
+  char *path;
+
+  if (!resampler->tuned_ratio)
+    {
+      return;
+    }
+
+  path = ow_resampler_get_clock_cache_path (resampler, 1);
+
+  f = fopen (path, "w");
+  if (f)
+    {
+      debug_print (1, "Saving clock ratio %.9f to %s\n",
+		   resampler->tuned_ratio, path);
+      fprintf (f, "%.12f\n", resampler->tuned_ratio);
+      fclose (f);
+    }
+  else
+    {
+      error_print ("Error while saving clock ratio to %s: %s\n", path,
+		   strerror (errno));
+    }
+
+  free (path);
+}
+
+inline void
+ow_resampler_set_host_rate (struct ow_resampler *resampler, double host_rate)
+{
+  resampler->host_rate = host_rate;
+}
+
+inline void
+ow_resampler_set_adaptive_blocks (struct ow_resampler *resampler,
+				  int adaptive_blocks)
+{
+  resampler->adaptive_blocks = adaptive_blocks;
+}
+
 ow_err_t
 ow_resampler_init_from_bus_address (struct ow_resampler **resampler_,
 				    uint8_t bus, uint8_t address,
 				    int blocks_per_transfer, int quality)
 {
-  struct ow_resampler *resampler = malloc (sizeof (struct ow_resampler));
+  return ow_resampler_init_from_bus_address_in_group (resampler_, NULL, bus,
+						      address,
+						      blocks_per_transfer,
+						      quality);
+}
+
+ow_err_t
+ow_resampler_init_from_bus_address_in_group (struct ow_resampler
+					     **resampler_,
+					     struct ow_engine_group *group,
+					     uint8_t bus, uint8_t address,
+					     int blocks_per_transfer,
+					     int quality)
+{
+  struct ow_engine *engine;
   ow_err_t err =
-    ow_engine_init_from_bus_address (&resampler->engine, bus, address,
-				     blocks_per_transfer);
+    ow_engine_init_from_bus_address_in_group (&engine, group, bus,
+					      address, blocks_per_transfer);
   if (err)
     {
-      free (resampler);
       return err;
     }
 
-  *resampler_ = resampler;
+  err = ow_resampler_init_from_engine (resampler_, engine, quality);
+  if (err)
+    {
+      ow_engine_destroy (engine);
+    }
+
+  return err;
+}
+
+ow_err_t
+ow_resampler_init_from_engine (struct ow_resampler **resampler_,
+			       struct ow_engine *engine, int quality)
+{
+  struct ow_resampler *resampler = malloc (sizeof (struct ow_resampler));
 
+  resampler->engine = engine;
   resampler->samplerate = 0;
   resampler->bufsize = 0;
-  resampler->xruns = 0;
-  resampler->p2o_aux = NULL;
+  resampler->host_rate = 0;
+  resampler->cached_ratio = 0;
+  resampler->tuned_ratio = 0;
+  atomic_init (&resampler->xruns, 0);
+  atomic_init (&resampler->total_xruns, 0);
+  resampler->group = NULL;
+  atomic_init (&resampler->kdel, 0);
+  resampler->p2o_queues[0] = NULL;
   resampler->status = OW_RESAMPLER_STATUS_READY;
-
-  resampler->p2o_state =
-    src_callback_new (resampler_p2o_reader, quality,
-		      resampler->engine->device_desc.inputs, NULL, resampler);
-  resampler->o2p_state =
-    src_callback_new (resampler_o2p_reader, quality,
-		      resampler->engine->device_desc.outputs, NULL,
-		      resampler);
-
-  pthread_spin_init (&resampler->lock, PTHREAD_PROCESS_SHARED);
+  resampler->quality = quality;
+  resampler->planar = 0;
+  resampler->o2p_planar_buf_in = NULL;
+  resampler->adaptive_blocks = 0;
+  resampler->adaptive_min_blocks = OW_ENGINE_MIN_BLOCKS;
+  resampler->adaptive_trouble = 0;
+  resampler->adaptive_quiet = 0;
+  resampler->o2p_hold = 0;
+
+  memset (&resampler->p2o_state, 0, sizeof (struct ow_resampler_state));
+  memset (&resampler->o2p_state, 0, sizeof (struct ow_resampler_state));
+  if (ow_resampler_state_init (&resampler->p2o_state, quality,
+			       resampler->engine->device_desc.inputs,
+			       resampler_p2o_reader, resampler) ||
+      ow_resampler_state_init (&resampler->o2p_state, quality,
+			       resampler->engine->device_desc.outputs,
+			       resampler_o2p_reader, resampler))
+    {
+      ow_resampler_state_delete (&resampler->p2o_state);
+      ow_resampler_state_delete (&resampler->o2p_state);
+      free (resampler);
+      return OW_GENERIC_ERROR;
+    }
 
   resampler->reporter.callback = NULL;
   resampler->reporter.data = NULL;
@@ -465,24 +1253,241 @@ ow_resampler_init_from_bus_address (struct ow_resampler **resampler_,
 
   ow_dll_primary_init (&resampler->dll);
 
+  ow_seqlock_init (&resampler->stats_seqlock);
+  ow_histogram_init (&resampler->stats.process, PROCESS_HISTOGRAM_BIN_WIDTH);
+  ow_histogram_init (&resampler->stats.dll_error,
+		     DLL_ERROR_HISTOGRAM_BIN_WIDTH);
+
+  *resampler_ = resampler;
+
+  return OW_OK;
+}
+
+static void
+ow_resampler_delete_planar_states (struct ow_resampler *resampler)
+{
+  for (int i = 0; i < resampler->engine->device_desc.outputs; i++)
+    {
+      ow_resampler_state_delete (&resampler->o2p_planar_states[i]);
+    }
+  for (int i = 0; i < resampler->engine->device_desc.inputs; i++)
+    {
+      ow_resampler_state_delete (&resampler->p2o_planar_states[i]);
+    }
+}
+
+static ow_err_t
+ow_resampler_init_planar (struct ow_resampler *resampler)
+{
+  ow_err_t ret = OW_OK;
+
+  memset (resampler->o2p_planar_states, 0,
+	  sizeof (resampler->o2p_planar_states));
+  memset (resampler->p2o_planar_states, 0,
+	  sizeof (resampler->p2o_planar_states));
+  resampler->planar = 1;
+
+  for (int i = 0; i < resampler->engine->device_desc.outputs; i++)
+    {
+      if (ow_resampler_state_init (&resampler->o2p_planar_states[i],
+				   resampler->quality, 1, NULL, NULL))
+	{
+	  ret = OW_GENERIC_ERROR;
+	}
+    }
+  for (int i = 0; i < resampler->engine->device_desc.inputs; i++)
+    {
+      if (ow_resampler_state_init (&resampler->p2o_planar_states[i],
+				   resampler->quality, 1, NULL, NULL))
+	{
+	  ret = OW_GENERIC_ERROR;
+	}
+    }
+
+  if (ret)
+    {
+      ow_resampler_delete_planar_states (resampler);
+      resampler->planar = 0;
+    }
+
+  return ret;
+}
+
+ow_err_t
+ow_resampler_group_init (struct ow_resampler_group **group_)
+{
+  struct ow_resampler_group *group =
+    malloc (sizeof (struct ow_resampler_group));
+
+  for (int i = 0; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      atomic_init (&group->resamplers[i], NULL);
+    }
+
+  *group_ = group;
+
   return OW_OK;
 }
 
+void
+ow_resampler_group_destroy (struct ow_resampler_group *group)
+{
+  struct ow_resampler *resampler;
+
+  for (int i = 0; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      resampler = atomic_load (&group->resamplers[i]);
+      if (resampler)
+	{
+	  resampler->group = NULL;
+	}
+    }
+
+  free (group);
+}
+
+ow_err_t
+ow_resampler_group_add (struct ow_resampler_group *group,
+			struct ow_resampler *resampler)
+{
+  struct ow_resampler *expected;
+
+  if (resampler->group)
+    {
+      return OW_GENERIC_ERROR;
+    }
+
+  for (int i = 0; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      expected = NULL;
+      if (atomic_compare_exchange_strong (&group->resamplers[i], &expected,
+					  resampler))
+	{
+	  resampler->group = group;
+	  debug_print (1, "%s: Added to resampler group\n",
+		       resampler->engine->name);
+	  return OW_OK;
+	}
+    }
+
+  error_print ("Resampler group full (max. %d)\n",
+	       OW_RESAMPLER_GROUP_MAX_RESAMPLERS);
+
+  return OW_GENERIC_ERROR;
+}
+
+static void
+ow_resampler_group_remove (struct ow_resampler_group *group,
+			   struct ow_resampler *resampler)
+{
+  struct ow_resampler *expected;
+
+  for (int i = 0; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      expected = resampler;
+      if (atomic_compare_exchange_strong (&group->resamplers[i], &expected,
+					  NULL))
+	{
+	  break;
+	}
+    }
+  resampler->group = NULL;
+}
+
+//This runs in every cycle so that a member that resets its DLL, e.g., after a buffer size change, moves the rest.
+int
+ow_resampler_group_get_kdel (struct ow_resampler_group *group)
+{
+  int kdel, max = 0;
+  struct ow_resampler *resampler;
+
+  for (int i = 0; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      resampler = atomic_load_explicit (&group->resamplers[i],
+					memory_order_acquire);
+      if (resampler)
+	{
+	  kdel = atomic_load_explicit (&resampler->kdel,
+				       memory_order_relaxed);
+	  if (kdel > max)
+	    {
+	      max = kdel;
+	    }
+	}
+    }
+
+  return max;
+}
+
+void
+ow_resampler_group_get_latency (struct ow_resampler_group *group,
+				double *target, double *max)
+{
+  struct ow_engine_latency latency;
+  struct ow_resampler *resampler;
+  double o2p_latency;
+  int kdel, max_kdel = 0;
+
+  *target = -1.0;
+  *max = -1.0;
+
+  for (int i = 0; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      resampler = atomic_load_explicit (&group->resamplers[i],
+					memory_order_acquire);
+      if (!resampler)
+	{
+	  continue;
+	}
+
+      //The target delay is measured in host frames.
+      kdel = atomic_load_explicit (&resampler->kdel, memory_order_relaxed);
+      if (kdel > max_kdel)
+	{
+	  max_kdel = kdel;
+	  *target = kdel * 1000.0 / resampler->samplerate;
+	}
+
+      if (ow_engine_get_status (resampler->engine) == OW_ENGINE_STATUS_RUN)
+	{
+	  ow_engine_get_latency (resampler->engine, &latency);
+	  o2p_latency = ow_resampler_get_o2p_latency_ms (resampler,
+							 latency.o2p);
+	  if (o2p_latency > *max)
+	    {
+	      *max = o2p_latency;
+	    }
+	}
+    }
+}
+
 void
 ow_resampler_destroy (struct ow_resampler *resampler)
 {
-  src_delete (resampler->p2o_state);
-  src_delete (resampler->o2p_state);
-  if (resampler->p2o_aux)
+  if (resampler->group)
+    {
+      ow_resampler_group_remove (resampler->group, resampler);
+    }
+  ow_resampler_state_delete (&resampler->p2o_state);
+  ow_resampler_state_delete (&resampler->o2p_state);
+  if (resampler->p2o_queues[0])
     {
-      free (resampler->p2o_aux);
       free (resampler->p2o_buf_out);
-      free (resampler->p2o_buf_in);
-      free (resampler->p2o_queue);
+      free (resampler->p2o_queues[0]);
       free (resampler->o2p_buf_in);
       free (resampler->o2p_buf_out);
     }
-  pthread_spin_destroy (&resampler->lock);
+  if (resampler->planar)
+    {
+      ow_resampler_delete_planar_states (resampler);
+    }
+  if (resampler->o2p_planar_buf_in)
+    {
+      free (resampler->o2p_planar_buf_in);
+      free (resampler->o2p_planar_buf_out);
+      free (resampler->p2o_planar_queue);
+      free (resampler->p2o_planar_buf_out);
+    }
   ow_engine_destroy (resampler->engine);
   free (resampler);
 }
@@ -495,6 +1500,20 @@ ow_resampler_start (struct ow_resampler *resampler,
   context->dll_init = (ow_dll_overwitch_init_t) ow_dll_overwitch_init;
   context->dll_inc = (ow_dll_overwitch_inc_t) ow_dll_overwitch_inc;
   context->options |= OW_ENGINE_OPTION_DLL;
+
+  if ((context->options & OW_ENGINE_OPTION_PLANAR_AUDIO)
+      && !resampler->planar)
+    {
+      if (ow_resampler_init_planar (resampler))
+	{
+	  return OW_GENERIC_ERROR;
+	}
+      if (resampler->bufsize)
+	{
+	  ow_resampler_reset_buffers (resampler);
+	}
+    }
+
   return ow_engine_start (resampler->engine, context);
 }
 
@@ -507,9 +1526,16 @@ ow_resampler_wait (struct ow_resampler *resampler)
 void
 ow_resampler_inc_xruns (struct ow_resampler *resampler)
 {
-  pthread_spin_lock (&resampler->lock);
-  resampler->xruns++;
-  pthread_spin_unlock (&resampler->lock);
+  atomic_fetch_add_explicit (&resampler->xruns, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit (&resampler->total_xruns, 1,
+			     memory_order_relaxed);
+}
+
+unsigned int
+ow_resampler_get_xruns (struct ow_resampler *resampler)
+{
+  return atomic_load_explicit (&resampler->total_xruns,
+			       memory_order_relaxed);
 }
 
 inline ow_resampler_status_t
@@ -550,7 +1576,7 @@ ow_resampler_set_samplerate (struct ow_resampler *resampler,
   if (resampler->samplerate != samplerate)
     {
       debug_print (1, "resampler sample rate: %d\n", samplerate);
-      if (resampler->p2o_aux)	//This means that ow_resampler_reset_buffers has been called and thus bufsize has been set.
+      if (resampler->p2o_queues[0])	//This means that ow_resampler_reset_buffers has been called and thus bufsize has been set.
 	{
 	  ow_resampler_reset_dll (resampler, samplerate);
 	}
@@ -582,7 +1608,8 @@ ow_resampler_get_o2p_audio_buffer (struct ow_resampler *resampler)
 inline float *
 ow_resampler_get_p2o_audio_buffer (struct ow_resampler *resampler)
 {
-  return resampler->p2o_buf_in;
+  return &resampler->p2o_queues[resampler->p2o_queue]
+    [resampler->p2o_queue_len * resampler->engine->device_desc.inputs];
 }
 
 struct ow_resampler_reporter *
@@ -590,3 +1617,25 @@ ow_resampler_get_reporter (struct ow_resampler *resampler)
 {
   return &resampler->reporter;
 }
+
+void
+ow_resampler_get_stats (struct ow_resampler *resampler,
+			struct ow_resampler_stats *stats)
+{
+  unsigned int seq;
+
+  do
+    {
+      seq = ow_seqlock_read_begin (&resampler->stats_seqlock);
+      *stats = resampler->stats;
+    }
+  while (ow_seqlock_read_retry (&resampler->stats_seqlock, seq));
+}
+
+void
+ow_resampler_add_process_time (struct ow_resampler *resampler, double time)
+{
+  ow_seqlock_write_begin (&resampler->stats_seqlock);
+  ow_histogram_add (&resampler->stats.process, time);
+  ow_seqlock_write_end (&resampler->stats_seqlock);
+}
@@ -18,34 +18,95 @@
  *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
 #include "dll.h"
 #include "engine.h"
+#include "interpolator.h"
 #include "overwitch.h"
+#include "seqlock.h"
+
+//Either a libsamplerate state or a built-in interpolator, depending on the quality.
+struct ow_resampler_state
+{
+  SRC_STATE *src;
+  struct ow_interpolator *interp;
+};
+
+#define OW_RESAMPLER_GROUP_MAX_RESAMPLERS 16
+
+//Resamplers in a group converge to the same target delay, which is the highest one required by any of them.
+//The ratio is still computed for every device as every one has its own clock.
+struct ow_resampler_group
+{
+  _Atomic (struct ow_resampler *)
+    resamplers[OW_RESAMPLER_GROUP_MAX_RESAMPLERS];
+};
 
 struct ow_resampler
 {
   ow_resampler_status_t status;
+  struct ow_resampler_group *group;
+  atomic_int kdel;		//Target delay required by this device only.
   struct ow_engine *engine;
   struct ow_dll dll;		//The DLL is based on o2j data
+  struct ow_seqlock stats_seqlock;	//Only the host thread writes the stats.
+  struct ow_resampler_stats stats;
   double o2p_ratio;
   double p2o_ratio;
-  SRC_STATE *p2o_state;
-  SRC_STATE *o2p_state;
-  float *p2o_buf_in;
+  struct ow_resampler_state p2o_state;
+  struct ow_resampler_state o2p_state;
   float *p2o_buf_out;
-  float *p2o_aux;
-  float *p2o_queue;
+  //The host writes straight into one queue while the resampler might still be reading from the other one.
+  float *p2o_queues[2];
+  int p2o_queue;		//Queue being written.
+  size_t p2o_queue_len;
+  double p2o_acc;
   float *o2p_buf_in;
   float *o2p_buf_out;
-  size_t p2o_queue_len;
+  int o2p_last_frames;
   int log_control_cycles;
   int log_cycles;
-  int xruns;
-  pthread_spinlock_t lock;	//Used to synchronize access to xruns.
+  atomic_int xruns;		//Incremented by the JACK xrun callback.
+  atomic_uint total_xruns;
   int reading_at_o2p_end;
+  //Adaptive blocks per transfer. The minimum is raised every time a value was not enough.
+  int adaptive_blocks;
+  int adaptive_min_blocks;
+  int adaptive_trouble;		//Underflows and xruns since the last report.
+  int adaptive_quiet;		//Consecutive reports without trouble.
+  size_t o2p_hold;		//Frames to replicate while the o2p buffer fills up to a greater delay.
   size_t o2p_bufsize;
   size_t p2o_bufsize;
   uint32_t bufsize;
   double samplerate;
+  double host_rate;		//Measured host sample rate or 0 if unknown.
+  //Clock ratios normalized to the nominal sample rates or 0 if unknown.
+  double cached_ratio;
+  double tuned_ratio;
   struct ow_resampler_reporter reporter;
+  int quality;
+  //Planar mode. Every track has its own mono resampler and all of them are run in lockstep.
+  int planar;
+  struct ow_resampler_state o2p_planar_states[OB_MAX_TRACKS];
+  struct ow_resampler_state p2o_planar_states[OB_MAX_TRACKS];
+  float *o2p_planar_buf_in;
+  float *o2p_planar_buf_out;
+  float *o2p_planar_bufs_out[OB_MAX_TRACKS];	//Used to discard data while fixing xruns.
+  long o2p_planar_frames;
+  long o2p_planar_pos;
+  int o2p_planar_last_frames;
+  uint64_t o2p_planar_tracks;	//Resampled tracks
+  size_t o2p_planar_mute[OB_MAX_TRACKS];	//Frames that were in the planes before their tracks were decoded.
+  float *p2o_planar_queue;
+  float *p2o_planar_buf_out;
 };
+
+int ow_resampler_group_get_kdel (struct ow_resampler_group *);
+
+//The resampler owns the engine after a successful call. This allows to use engines not backed by a device.
+ow_err_t ow_resampler_init_from_engine (struct ow_resampler **,
+					struct ow_engine *, int);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ *   ring.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ring.h"
+
+struct ow_ring *
+ow_ring_new (size_t frames, size_t frame_size)
+{
+  struct ow_ring *ring;
+
+  if (!frames || !frame_size)
+    {
+      return NULL;
+    }
+
+  if (posix_memalign ((void **) &ring, OW_RING_CACHE_LINE_SIZE,
+		      sizeof (struct ow_ring)))
+    {
+      return NULL;
+    }
+
+  ring->size = frames * frame_size;
+  ring->frame_size = frame_size;
+  //Adding up to size to a position never overflows.
+  ring->wrap = ring->size;
+  while (ring->wrap <= (SIZE_MAX - ring->size) / 2)
+    {
+      ring->wrap <<= 1;
+    }
+  ring->locked = 0;
+  //Page aligned memory can be used for direct I/O.
+  if (posix_memalign ((void **) &ring->data, sysconf (_SC_PAGESIZE),
+		      ring->size))
+    {
+      free (ring);
+      return NULL;
+    }
+
+  ow_ring_reset (ring);
+
+  return ring;
+}
+
+void
+ow_ring_free (struct ow_ring *ring)
+{
+  if (!ring)
+    {
+      return;
+    }
+  if (ring->locked)
+    {
+      munlock (ring->data, ring->size);
+    }
+  free (ring->data);
+  free (ring);
+}
+
+int
+ow_ring_mlock (struct ow_ring *ring)
+{
+  if (!ring->locked && !mlock (ring->data, ring->size))
+    {
+      ring->locked = 1;
+    }
+  return !ring->locked;
+}
+
+//This is not thread safe.
+void
+ow_ring_reset (struct ow_ring *ring)
+{
+  atomic_store_explicit (&ring->write_pos, 0, memory_order_relaxed);
+  atomic_store_explicit (&ring->read_pos, 0, memory_order_relaxed);
+  ring->read_pos_cache = 0;
+  ring->write_pos_cache = 0;
+  memset (ring->data, 0, ring->size);
+}
+
+size_t
+ow_ring_get_frame_size (struct ow_ring *ring)
+{
+  return ring->frame_size;
+}
+
+static inline size_t
+ow_ring_advance (struct ow_ring *ring, size_t pos, size_t len)
+{
+  pos += len;
+  return pos >= ring->wrap ? pos - ring->wrap : pos;
+}
+
+static inline size_t
+ow_ring_distance (struct ow_ring *ring, size_t from, size_t to)
+{
+  return to >= from ? to - from : to + (ring->wrap - from);
+}
+
+static inline size_t
+ow_ring_get_write_space_cached (struct ow_ring *ring, size_t w,
+				size_t needed)
+{
+  size_t space = ring->size - ow_ring_distance (ring, ring->read_pos_cache,
+						w);
+  if (space < needed)
+    {
+      ring->read_pos_cache = atomic_load_explicit (&ring->read_pos,
+						   memory_order_acquire);
+      space = ring->size - ow_ring_distance (ring, ring->read_pos_cache, w);
+    }
+  return space;
+}
+
+static inline size_t
+ow_ring_get_read_space_cached (struct ow_ring *ring, size_t r, size_t needed)
+{
+  size_t space = ow_ring_distance (ring, r, ring->write_pos_cache);
+  if (space < needed)
+    {
+      ring->write_pos_cache = atomic_load_explicit (&ring->write_pos,
+						    memory_order_acquire);
+      space = ow_ring_distance (ring, r, ring->write_pos_cache);
+    }
+  return space;
+}
+
+static inline size_t
+ow_ring_get_vector (struct ow_ring *ring, size_t pos, size_t len,
+		    struct ow_ring_vector *vector)
+{
+  size_t offset = pos % ring->size;
+  size_t first = ring->size - offset;
+
+  if (first > len)
+    {
+      first = len;
+    }
+  vector[0].buf = &ring->data[offset];
+  vector[0].len = first;
+  vector[1].buf = ring->data;
+  vector[1].len = len - first;
+
+  return len;
+}
+
+//The space functions do not use the cached positions so they can be called from any thread.
+//As the read position is loaded first, the write position can only be ahead of it but it might be more than size ahead, so the result is clamped.
+
+static inline size_t
+ow_ring_get_used (struct ow_ring *ring)
+{
+  size_t r = atomic_load_explicit (&ring->read_pos, memory_order_acquire);
+  size_t w = atomic_load_explicit (&ring->write_pos, memory_order_acquire);
+  size_t used = ow_ring_distance (ring, r, w);
+
+  if (used > ring->size)
+    {
+      return ring->size;
+    }
+  return used;
+}
+
+size_t
+ow_ring_write_space (struct ow_ring *ring)
+{
+  return ring->size - ow_ring_get_used (ring);
+}
+
+//Producer side
+
+size_t
+ow_ring_write_reserve (struct ow_ring *ring, struct ow_ring_vector *vector)
+{
+  size_t w = atomic_load_explicit (&ring->write_pos, memory_order_relaxed);
+  size_t space = ow_ring_get_write_space_cached (ring, w, ring->size);
+  return ow_ring_get_vector (ring, w, space, vector);
+}
+
+void
+ow_ring_write_commit (struct ow_ring *ring, size_t size)
+{
+  size_t w = atomic_load_explicit (&ring->write_pos, memory_order_relaxed);
+  atomic_store_explicit (&ring->write_pos, ow_ring_advance (ring, w, size),
+			 memory_order_release);
+}
+
+size_t
+ow_ring_write (struct ow_ring *ring, const char *src, size_t size)
+{
+  struct ow_ring_vector vector[2];
+  size_t w = atomic_load_explicit (&ring->write_pos, memory_order_relaxed);
+  size_t space = ow_ring_get_write_space_cached (ring, w, size);
+
+  if (size > space)
+    {
+      size = space;
+    }
+  size -= size % ring->frame_size;
+
+  ow_ring_get_vector (ring, w, size, vector);
+  memcpy (vector[0].buf, src, vector[0].len);
+  memcpy (vector[1].buf, src + vector[0].len, vector[1].len);
+
+  atomic_store_explicit (&ring->write_pos, ow_ring_advance (ring, w, size),
+			 memory_order_release);
+
+  return size;
+}
+
+//Consumer side
+
+size_t
+ow_ring_read_space (struct ow_ring *ring)
+{
+  return ow_ring_get_used (ring);
+}
+
+size_t
+ow_ring_read_reserve (struct ow_ring *ring, struct ow_ring_vector *vector)
+{
+  size_t r = atomic_load_explicit (&ring->read_pos, memory_order_relaxed);
+  size_t space = ow_ring_get_read_space_cached (ring, r, ring->size);
+  return ow_ring_get_vector (ring, r, space, vector);
+}
+
+void
+ow_ring_read_commit (struct ow_ring *ring, size_t size)
+{
+  size_t r = atomic_load_explicit (&ring->read_pos, memory_order_relaxed);
+  atomic_store_explicit (&ring->read_pos, ow_ring_advance (ring, r, size),
+			 memory_order_release);
+}
+
+static inline size_t
+ow_ring_copy (struct ow_ring *ring, char *dst, size_t size, int consume)
+{
+  struct ow_ring_vector vector[2];
+  size_t r = atomic_load_explicit (&ring->read_pos, memory_order_relaxed);
+  size_t space = ow_ring_get_read_space_cached (ring, r, size);
+
+  if (size > space)
+    {
+      size = space;
+    }
+  size -= size % ring->frame_size;
+
+  if (dst)
+    {
+      ow_ring_get_vector (ring, r, size, vector);
+      memcpy (dst, vector[0].buf, vector[0].len);
+      memcpy (dst + vector[0].len, vector[1].buf, vector[1].len);
+    }
+
+  if (consume)
+    {
+      atomic_store_explicit (&ring->read_pos, ow_ring_advance (ring, r, size),
+			     memory_order_release);
+    }
+
+  return size;
+}
+
+size_t
+ow_ring_read (struct ow_ring *ring, char *dst, size_t size)
+{
+  return ow_ring_copy (ring, dst, size, 1);
+}
+
+size_t
+ow_ring_peek (struct ow_ring *ring, char *dst, size_t size)
+{
+  return ow_ring_copy (ring, dst, size, 0);
+}
+
+void
+ow_ring_set_context_functions (struct ow_context *context)
+{
+  context->read_space = (ow_buffer_rw_space_t) ow_ring_read_space;
+  context->write_space = (ow_buffer_rw_space_t) ow_ring_write_space;
+  context->read = (ow_buffer_read_t) ow_ring_read;
+  context->write = (ow_buffer_write_t) ow_ring_write;
+}
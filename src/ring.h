@@ -0,0 +1,48 @@
+/*
+ *   ring.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include "overwitch.h"
+
+#define OW_RING_CACHE_LINE_SIZE 64
+
+//Single producer single consumer ring buffer.
+//Positions are byte counters so the whole capacity is usable. Each one is in its own cache line together with the cached copy of the other one, which is only refreshed when the cached value is not enough.
+//They wrap at the highest power of 2 multiple of the size that can be used instead of at SIZE_MAX, which is not a multiple of it, so the memory offsets are continuous when they do.
+
+struct ow_ring
+{
+  char *data;
+  size_t size;			//A multiple of frame_size
+  size_t wrap;			//A power of 2 multiple of size
+  size_t frame_size;
+  int locked;
+  _Alignas (OW_RING_CACHE_LINE_SIZE) atomic_size_t write_pos;
+  size_t read_pos_cache;
+  _Alignas (OW_RING_CACHE_LINE_SIZE) atomic_size_t read_pos;
+  size_t write_pos_cache;
+  char padding[OW_RING_CACHE_LINE_SIZE - sizeof (atomic_size_t) -
+	       sizeof (size_t)];
+};
+
+#endif
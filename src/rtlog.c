@@ -0,0 +1,366 @@
+/*
+ *   rtlog.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include "rtlog.h"
+
+#define OW_RTLOG_CACHE_LINE_SIZE 64
+#define OW_RTLOG_SPEC_LEN 16
+
+//Bounded multiple producer queue where every record has its own sequence.
+//Sequences are stored relative to the record index so the zeroed static state is the initial one. For the position p of the record at index i, a sequence of p - i means free and p + 1 - i means ready to be read.
+
+struct ow_rtlog_record
+{
+  atomic_size_t seq;
+  struct ow_rtlog_site *site;
+  int level;
+  int nargs;
+  unsigned int suppressed;
+  struct ow_rtlog_arg args[OW_RTLOG_MAX_ARGS];
+  char strings[OW_RTLOG_MAX_ARGS][OW_RTLOG_STRING_LEN];	//String arguments point here.
+};
+
+struct ow_rtlog
+{
+  struct ow_rtlog_record records[OW_RTLOG_RECORDS];
+  _Alignas (OW_RTLOG_CACHE_LINE_SIZE) atomic_size_t write_pos;
+  atomic_uint lost;
+  _Alignas (OW_RTLOG_CACHE_LINE_SIZE) size_t read_pos;
+  pthread_t thread;
+  atomic_int end;
+  int running;
+};
+
+static struct ow_rtlog rtlog;
+
+static inline long long
+ow_rtlog_get_time ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void
+ow_rtlog_push (struct ow_rtlog_site *site, int level, int nargs,
+	       const struct ow_rtlog_arg *args)
+{
+  size_t pos, index, len;
+  ssize_t diff;
+  struct ow_rtlog_record *record;
+  long long now = ow_rtlog_get_time ();
+  long long last = atomic_load_explicit (&site->last, memory_order_relaxed);
+
+  //Concurrent messages from the same site might both be emitted, which is harmless.
+  if (last && now - last < OW_RTLOG_INTERVAL_NS)
+    {
+      atomic_fetch_add_explicit (&site->suppressed, 1, memory_order_relaxed);
+      return;
+    }
+  atomic_store_explicit (&site->last, now, memory_order_relaxed);
+
+  pos = atomic_load_explicit (&rtlog.write_pos, memory_order_relaxed);
+  while (1)
+    {
+      index = pos & (OW_RTLOG_RECORDS - 1);
+      record = &rtlog.records[index];
+      diff = atomic_load_explicit (&record->seq, memory_order_acquire) +
+	index - pos;
+      if (diff == 0)
+	{
+	  if (atomic_compare_exchange_weak_explicit (&rtlog.write_pos, &pos,
+						     pos + 1,
+						     memory_order_relaxed,
+						     memory_order_relaxed))
+	    {
+	      break;
+	    }
+	}
+      else if (diff < 0)
+	{
+	  atomic_fetch_add_explicit (&rtlog.lost, 1, memory_order_relaxed);
+	  return;
+	}
+      else
+	{
+	  pos = atomic_load_explicit (&rtlog.write_pos, memory_order_relaxed);
+	}
+    }
+
+  record->site = site;
+  record->level = level;
+  record->nargs = nargs < OW_RTLOG_MAX_ARGS ? nargs : OW_RTLOG_MAX_ARGS;
+  record->suppressed = atomic_exchange_explicit (&site->suppressed, 0,
+						 memory_order_relaxed);
+  memcpy (record->args, args, sizeof (struct ow_rtlog_arg) * record->nargs);
+  for (int i = 0; i < record->nargs; i++)
+    {
+      if (args[i].type == OW_RTLOG_ARG_STRING && args[i].s)
+	{
+	  len = strnlen (args[i].s, OW_RTLOG_STRING_LEN - 1);
+	  memcpy (record->strings[i], args[i].s, len);
+	  record->strings[i][len] = 0;
+	  record->args[i].s = record->strings[i];
+	}
+    }
+
+  atomic_store_explicit (&record->seq, pos + 1 - index,
+			 memory_order_release);
+}
+
+static long long
+ow_rtlog_get_int (const struct ow_rtlog_arg *arg)
+{
+  return arg->type == OW_RTLOG_ARG_DOUBLE ? (long long) arg->d : arg->i;
+}
+
+static double
+ow_rtlog_get_double (const struct ow_rtlog_arg *arg)
+{
+  return arg->type == OW_RTLOG_ARG_DOUBLE ? arg->d : arg->i;
+}
+
+static const char *
+ow_rtlog_get_string (const struct ow_rtlog_arg *arg)
+{
+  return arg->type == OW_RTLOG_ARG_STRING && arg->s ? arg->s : "(null)";
+}
+
+//Each conversion is printed on its own with the length modifier adapted to the stored type.
+//Malformed conversions and the ones without argument are printed verbatim.
+static void
+ow_rtlog_print_message (FILE *f, const char *format, int nargs,
+			const struct ow_rtlog_arg *args)
+{
+  size_t len;
+  const char *start;
+  const struct ow_rtlog_arg *arg;
+  char spec[OW_RTLOG_SPEC_LEN];
+  const char *c = format;
+  int n = 0;
+
+  while (*c)
+    {
+      if (*c != '%')
+	{
+	  fputc (*c, f);
+	  c++;
+	  continue;
+	}
+
+      if (c[1] == '%')
+	{
+	  fputc ('%', f);
+	  c += 2;
+	  continue;
+	}
+
+      start = c;
+      c++;
+      while (*c && strchr ("-+ #0123456789.", *c))
+	{
+	  c++;
+	}
+      len = c - start;
+      while (*c && strchr ("hljztL", *c))
+	{
+	  c++;
+	}
+
+      if (!*c || n == nargs || len > OW_RTLOG_SPEC_LEN - 4)
+	{
+	  fputs (start, f);
+	  return;
+	}
+
+      memcpy (spec, start, len);
+      arg = &args[n];
+      n++;
+
+      switch (*c)
+	{
+	case 'd':
+	case 'i':
+	  strcpy (&spec[len], "lld");
+	  fprintf (f, spec, ow_rtlog_get_int (arg));
+	  break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	  spec[len] = 'l';
+	  spec[len + 1] = 'l';
+	  spec[len + 2] = *c;
+	  spec[len + 3] = 0;
+	  fprintf (f, spec, (unsigned long long) ow_rtlog_get_int (arg));
+	  break;
+	case 'c':
+	  strcpy (&spec[len], "c");
+	  fprintf (f, spec, (int) ow_rtlog_get_int (arg));
+	  break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+	  spec[len] = *c;
+	  spec[len + 1] = 0;
+	  fprintf (f, spec, ow_rtlog_get_double (arg));
+	  break;
+	case 's':
+	  strcpy (&spec[len], "s");
+	  fprintf (f, spec, ow_rtlog_get_string (arg));
+	  break;
+	default:
+	  fwrite (start, 1, c + 1 - start, f);
+	}
+      c++;
+    }
+}
+
+//The prefixes are the same as the ones used by debug_print and error_print.
+static void
+ow_rtlog_print_prefix (FILE *f, int level, struct ow_rtlog_site *site)
+{
+  if (level == OW_RTLOG_ERROR)
+    {
+      fprintf (f, "%sERROR:%s:%d:(%s): ",
+	       isatty (fileno (f)) ? "\x1b[31m" : "", site->file, site->line,
+	       site->function);
+    }
+  else
+    {
+      fprintf (f, "DEBUG:%s:%d:(%s): ", site->file, site->line,
+	       site->function);
+    }
+}
+
+static void
+ow_rtlog_print_suffix (FILE *f, int level)
+{
+  if (level == OW_RTLOG_ERROR && isatty (fileno (f)))
+    {
+      fputs ("\x1b[m", f);
+    }
+}
+
+static void
+ow_rtlog_print_record (FILE *f, struct ow_rtlog_record *record)
+{
+  if (record->suppressed)
+    {
+      ow_rtlog_print_prefix (f, record->level, record->site);
+      fprintf (f, "%u similar messages were suppressed\n",
+	       record->suppressed);
+      ow_rtlog_print_suffix (f, record->level);
+    }
+
+  ow_rtlog_print_prefix (f, record->level, record->site);
+  ow_rtlog_print_message (f, record->site->format, record->nargs,
+			  record->args);
+  ow_rtlog_print_suffix (f, record->level);
+}
+
+int
+ow_rtlog_drain (FILE *f)
+{
+  size_t index;
+  struct ow_rtlog_record *record;
+  int n = 0;
+  unsigned int lost = atomic_exchange_explicit (&rtlog.lost, 0,
+						memory_order_relaxed);
+
+  if (lost)
+    {
+      fprintf (f, "%sERROR:%s:%d:(%s): %u log messages were lost%s\n",
+	       isatty (fileno (f)) ? "\x1b[31m" : "", __FILE__, __LINE__,
+	       __FUNCTION__, lost, isatty (fileno (f)) ? "\x1b[m" : "");
+    }
+
+  while (1)
+    {
+      index = rtlog.read_pos & (OW_RTLOG_RECORDS - 1);
+      record = &rtlog.records[index];
+      if (atomic_load_explicit (&record->seq, memory_order_acquire) + index !=
+	  rtlog.read_pos + 1)
+	{
+	  break;
+	}
+
+      ow_rtlog_print_record (f, record);
+
+      atomic_store_explicit (&record->seq,
+			     rtlog.read_pos + OW_RTLOG_RECORDS - index,
+			     memory_order_release);
+      rtlog.read_pos++;
+      n++;
+    }
+
+  fflush (f);
+
+  return n;
+}
+
+static void *
+ow_rtlog_run (void *data)
+{
+  struct timespec ts = {
+    .tv_sec = 0,
+    .tv_nsec = OW_RTLOG_DRAIN_PERIOD_MS * 1000000
+  };
+
+  while (!atomic_load (&rtlog.end))
+    {
+      ow_rtlog_drain (stderr);
+      nanosleep (&ts, NULL);
+    }
+
+  return NULL;
+}
+
+int
+ow_rtlog_start ()
+{
+  int err;
+
+  atomic_store (&rtlog.end, 0);
+  err = pthread_create (&rtlog.thread, NULL, ow_rtlog_run, NULL);
+  rtlog.running = !err;
+  return err;
+}
+
+void
+ow_rtlog_stop ()
+{
+  if (rtlog.running)
+    {
+      atomic_store (&rtlog.end, 1);
+      pthread_join (rtlog.thread, NULL);
+      rtlog.running = 0;
+    }
+  ow_rtlog_drain (stderr);
+}
@@ -0,0 +1,133 @@
+/*
+ *   rtlog.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "utils.h"
+
+//Deferred logging for the real time threads.
+//The producers store the format and the arguments of a message in a fixed size record of a lock free ring that a non real time thread formats and prints later on.
+//A message is emitted at most once per OW_RTLOG_INTERVAL_NS at each call site and the following ones are only counted.
+//String arguments are copied into the record and truncated to OW_RTLOG_STRING_LEN - 1 characters so they can be freed right after the call.
+
+#define OW_RTLOG_RECORDS 256	//A power of 2
+#define OW_RTLOG_MAX_ARGS 6
+#define OW_RTLOG_STRING_LEN 32
+#define OW_RTLOG_INTERVAL_NS 1000000000LL
+#define OW_RTLOG_DRAIN_PERIOD_MS 100
+
+#define OW_RTLOG_ERROR -1
+
+typedef enum
+{
+  OW_RTLOG_ARG_INT = 0,
+  OW_RTLOG_ARG_DOUBLE,
+  OW_RTLOG_ARG_STRING
+} ow_rtlog_arg_type_t;
+
+struct ow_rtlog_arg
+{
+  ow_rtlog_arg_type_t type;
+  union
+  {
+    long long i;
+    double d;
+    const char *s;
+  };
+};
+
+//There is one of these for each call site.
+struct ow_rtlog_site
+{
+  const char *file;
+  int line;
+  const char *function;
+  const char *format;
+  atomic_llong last;		//Time of the last emitted message in ns
+  atomic_uint suppressed;
+};
+
+static inline struct ow_rtlog_arg
+ow_rtlog_int (long long i)
+{
+  struct ow_rtlog_arg arg = {.type = OW_RTLOG_ARG_INT,.i = i };
+  return arg;
+}
+
+static inline struct ow_rtlog_arg
+ow_rtlog_double (double d)
+{
+  struct ow_rtlog_arg arg = {.type = OW_RTLOG_ARG_DOUBLE,.d = d };
+  return arg;
+}
+
+static inline struct ow_rtlog_arg
+ow_rtlog_string (const char *s)
+{
+  struct ow_rtlog_arg arg = {.type = OW_RTLOG_ARG_STRING,.s = s };
+  return arg;
+}
+
+#define OW_RTLOG_ARG(x) _Generic ((x), float: ow_rtlog_double, double: ow_rtlog_double, char *: ow_rtlog_string, const char *: ow_rtlog_string, default: ow_rtlog_int) (x)
+
+#define OW_RTLOG_COUNT(...) OW_RTLOG_COUNT_ (_, ## __VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define OW_RTLOG_COUNT_(_, a, b, c, d, e, f, n, ...) n
+
+#define OW_RTLOG_CAT(a, b) OW_RTLOG_CAT_ (a, b)
+#define OW_RTLOG_CAT_(a, b) a ## b
+
+#define OW_RTLOG_ARGS_0()
+#define OW_RTLOG_ARGS_1(a) , OW_RTLOG_ARG (a)
+#define OW_RTLOG_ARGS_2(a, ...) , OW_RTLOG_ARG (a) OW_RTLOG_ARGS_1 (__VA_ARGS__)
+#define OW_RTLOG_ARGS_3(a, ...) , OW_RTLOG_ARG (a) OW_RTLOG_ARGS_2 (__VA_ARGS__)
+#define OW_RTLOG_ARGS_4(a, ...) , OW_RTLOG_ARG (a) OW_RTLOG_ARGS_3 (__VA_ARGS__)
+#define OW_RTLOG_ARGS_5(a, ...) , OW_RTLOG_ARG (a) OW_RTLOG_ARGS_4 (__VA_ARGS__)
+#define OW_RTLOG_ARGS_6(a, ...) , OW_RTLOG_ARG (a) OW_RTLOG_ARGS_5 (__VA_ARGS__)
+#define OW_RTLOG_ARGS(...) OW_RTLOG_CAT (OW_RTLOG_ARGS_, OW_RTLOG_COUNT (__VA_ARGS__)) (__VA_ARGS__)
+
+//The first element is only there to avoid empty initializers.
+#define ow_rtlog_print(level, format, ...) do { \
+  static struct ow_rtlog_site ow_rtlog_site__ = { __FILE__, __LINE__, __FUNCTION__, format }; \
+  const struct ow_rtlog_arg ow_rtlog_args__[] = { { 0 } OW_RTLOG_ARGS (__VA_ARGS__) }; \
+  ow_rtlog_push (&ow_rtlog_site__, level, OW_RTLOG_COUNT (__VA_ARGS__), &ow_rtlog_args__[1]); \
+} while (0)
+
+//These replace debug_print and error_print in the real time threads and take up to OW_RTLOG_MAX_ARGS arguments.
+#define rt_debug_print(level, format, ...) if (level <= debug_level) ow_rtlog_print (level, format, ## __VA_ARGS__)
+#define rt_error_print(format, ...) ow_rtlog_print (OW_RTLOG_ERROR, format, ## __VA_ARGS__)
+
+//This never blocks. If the ring is full, the message is lost and counted.
+void ow_rtlog_push (struct ow_rtlog_site *, int, int,
+		    const struct ow_rtlog_arg *);
+
+//Prints every pending message and returns how many there were. Only one thread can drain at a time.
+int ow_rtlog_drain (FILE *);
+
+//The drain thread prints to stderr every OW_RTLOG_DRAIN_PERIOD_MS.
+int ow_rtlog_start ();
+
+//The pending messages are printed before returning.
+void ow_rtlog_stop ();
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ *   seqlock.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Overwitch.
+ *
+ *   Overwitch is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Overwitch is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Overwitch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdatomic.h>
+
+//Sequence lock for data with a single writer.
+//The writer never waits and readers retry while the sequence is odd or has changed, so the protected data must only be copied inside the read section.
+
+struct ow_seqlock
+{
+  atomic_uint seq;
+};
+
+static inline void
+ow_seqlock_init (struct ow_seqlock *lock)
+{
+  atomic_init (&lock->seq, 0);
+}
+
+static inline void
+ow_seqlock_write_begin (struct ow_seqlock *lock)
+{
+  unsigned int seq = atomic_load_explicit (&lock->seq, memory_order_relaxed);
+  atomic_store_explicit (&lock->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+}
+
+static inline void
+ow_seqlock_write_end (struct ow_seqlock *lock)
+{
+  unsigned int seq = atomic_load_explicit (&lock->seq, memory_order_relaxed);
+  atomic_store_explicit (&lock->seq, seq + 1, memory_order_release);
+}
+
+static inline unsigned int
+ow_seqlock_read_begin (struct ow_seqlock *lock)
+{
+  unsigned int seq;
+
+  while ((seq = atomic_load_explicit (&lock->seq, memory_order_acquire)) & 1);
+
+  return seq;
+}
+
+static inline int
+ow_seqlock_read_retry (struct ow_seqlock *lock, unsigned int seq)
+{
+  atomic_thread_fence (memory_order_acquire);
+  return atomic_load_explicit (&lock->seq, memory_order_relaxed) != seq;
+}
+
+#endif
@@ -0,0 +1,425 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/jclient.h"
+#include "../src/engine.h"
+#include "../src/resampler.h"
+#include "../src/ring.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES 1
+#endif
+
+//Benchmarks of the audio paths without hardware. The USB blocks and the JACK buffers are synthetic.
+
+#define ELEKTRON_VID 0x1935
+#define MAX_PID 0x40
+#define DEFAULT_BLOCKS 24
+#define DEFAULT_BUFSIZE 64
+#define DEFAULT_QUALITY 2
+#define DEFAULT_SECONDS 10	//Seconds of audio processed at OB_SAMPLE_RATE by every benchmark.
+#define BENCH_RATIO 1.0001	//Close to the usual ratios but not 1.0.
+#define RING_BUFSIZES 8
+
+struct bench_timer
+{
+  struct timespec start;
+#ifdef BENCH_CYCLES
+  uint64_t start_cycles;
+#endif
+};
+
+struct bench_context
+{
+  struct ow_engine *engine;
+  struct ow_resampler *resampler;
+  struct ow_context context;
+  int bufsize;
+  long frames;
+  jack_default_audio_sample_t *jack_o2p[OB_MAX_TRACKS];
+  jack_default_audio_sample_t *jack_p2o[OB_MAX_TRACKS];
+};
+
+static struct option options[] = {
+  {"device", 1, NULL, 'd'},
+  {"transfer-blocks", 1, NULL, 'b'},
+  {"buffer-size", 1, NULL, 'j'},
+  {"resampling-quality", 1, NULL, 'q'},
+  {"seconds", 1, NULL, 's'},
+  {"help", 0, NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+static void
+bench_usage (const char *exec)
+{
+  struct option *o = options;
+
+  printf ("Usage: %s [options]\nOptions:\n", exec);
+  while (o->name)
+    {
+      printf ("  --%s, -%c%s\n", o->name, o->val, o->has_arg ? " value" : "");
+      o++;
+    }
+}
+
+static inline void
+bench_timer_start (struct bench_timer *timer)
+{
+  clock_gettime (CLOCK_MONOTONIC, &timer->start);
+#ifdef BENCH_CYCLES
+  timer->start_cycles = __rdtsc ();
+#endif
+}
+
+//On x86, cycles are TSC ones, which run at a constant rate and might not match the core ones.
+static void
+bench_timer_report (struct bench_timer *timer, const char *name,
+		    long frames, int tracks)
+{
+  struct timespec end;
+  double ns;
+
+#ifdef BENCH_CYCLES
+  uint64_t cycles = __rdtsc () - timer->start_cycles;
+#endif
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  ns = (end.tv_sec - timer->start.tv_sec) * 1e9 +
+    (end.tv_nsec - timer->start.tv_nsec);
+
+#ifdef BENCH_CYCLES
+  printf ("  %-18s %8.2f ns/frame %8.3f cycles/sample\n", name,
+	  ns / frames, (double) cycles / (frames * tracks));
+#else
+  printf ("  %-18s %8.2f ns/frame %8s cycles/sample\n", name,
+	  ns / frames, "-");
+#endif
+}
+
+static void
+bench_fill (float *buf, size_t samples)
+{
+  for (size_t i = 0; i < samples; i++)
+    {
+      buf[i] = (rand () / (float) RAND_MAX) * 2.0f - 1.0f;
+    }
+}
+
+static void
+bench_usb (struct bench_context *bench)
+{
+  struct bench_timer timer;
+  struct ow_engine *engine = bench->engine;
+  long iterations = bench->frames / engine->frames_per_transfer;
+  long frames = iterations * engine->frames_per_transfer;
+
+  //Valid blocks are created by writing the p2o data as the o2p blocks just need to be long enough.
+  bench_fill (engine->p2o_transfer_buf,
+	      engine->frames_per_transfer * engine->device_desc.inputs);
+  for (int i = 0; i < engine->blocks_per_transfer; i++)
+    {
+      bench_fill ((float *) GET_NTH_INPUT_USB_BLK (engine, i)->data,
+		  OB_FRAMES_PER_BLOCK * engine->device_desc.outputs);
+    }
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      ow_engine_read_usb_input_blocks (engine);
+    }
+  bench_timer_report (&timer, "usb read:", frames,
+		      engine->device_desc.outputs);
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      ow_engine_write_usb_output_blocks (engine);
+    }
+  bench_timer_report (&timer, "usb write:", frames,
+		      engine->device_desc.inputs);
+}
+
+//Every cycle the ring gets the frames a device would have sent during the cycle.
+static void
+bench_resampler (struct bench_context *bench)
+{
+  struct bench_timer timer;
+  struct ow_resampler *resampler = bench->resampler;
+  struct ow_engine *engine = bench->engine;
+  long iterations = bench->frames / bench->bufsize;
+  long frames = iterations * bench->bufsize;
+  size_t bytes = bench->bufsize * engine->o2p_frame_size;
+  size_t wso2p;
+  char *o2p = malloc (bytes);
+
+  bench_fill ((float *) o2p, bench->bufsize * engine->device_desc.outputs);
+  bench_fill (ow_resampler_get_p2o_audio_buffer (resampler),
+	      bench->bufsize * engine->device_desc.inputs);
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      wso2p = ow_ring_write_space (bench->context.o2p_audio);
+      if (wso2p >= bytes)
+	{
+	  ow_ring_write (bench->context.o2p_audio, o2p, bytes);
+	}
+      ow_resampler_read_audio (resampler);
+    }
+  bench_timer_report (&timer, "resampler read:", frames,
+		      engine->device_desc.outputs);
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      ow_resampler_write_audio (resampler);
+      ow_ring_read (bench->context.p2o_audio, NULL,
+		    ow_ring_read_space (bench->context.p2o_audio));
+    }
+  bench_timer_report (&timer, "resampler write:", frames,
+		      engine->device_desc.inputs);
+
+  free (o2p);
+}
+
+static void
+bench_jack (struct bench_context *bench)
+{
+  struct bench_timer timer;
+  struct ow_resampler *resampler = bench->resampler;
+  struct ow_engine *engine = bench->engine;
+  long iterations = bench->frames / bench->bufsize;
+  long frames = iterations * bench->bufsize;
+  float *p2o = ow_resampler_get_p2o_audio_buffer (resampler);
+  const struct ow_interleave_kernels *generic =
+    ow_interleave_get_generic_kernels ();
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      jclient_copy_o2j_audio (resampler->o2p_buf_out, bench->bufsize,
+			      bench->jack_o2p, &engine->device_desc,
+			      engine->o2p_interleave);
+    }
+  bench_timer_report (&timer, "jack o2j copy:", frames,
+		      engine->device_desc.outputs);
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      jclient_copy_o2j_audio (resampler->o2p_buf_out, bench->bufsize,
+			      bench->jack_o2p, &engine->device_desc, generic);
+    }
+  bench_timer_report (&timer, "jack o2j copy (generic):", frames,
+		      engine->device_desc.outputs);
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      jclient_copy_j2o_audio (p2o, bench->bufsize, bench->jack_p2o,
+			      &engine->device_desc, engine->p2o_interleave);
+    }
+  bench_timer_report (&timer, "jack j2o copy:", frames,
+		      engine->device_desc.inputs);
+
+  bench_timer_start (&timer);
+  for (long i = 0; i < iterations; i++)
+    {
+      jclient_copy_j2o_audio (p2o, bench->bufsize, bench->jack_p2o,
+			      &engine->device_desc, generic);
+    }
+  bench_timer_report (&timer, "jack j2o copy (generic):", frames,
+		      engine->device_desc.inputs);
+}
+
+static int
+bench_init (struct bench_context *bench, struct ow_device_desc *desc,
+	    int blocks, int bufsize, int quality, int seconds)
+{
+  size_t ring_frames;
+
+  //The engine is not backed by a device so the USB handle must be NULL.
+  bench->engine = calloc (1, sizeof (struct ow_engine));
+  bench->engine->device_desc = *desc;
+  ow_engine_init_mem (bench->engine, blocks);
+
+  ring_frames = RING_BUFSIZES * bufsize + bench->engine->frames_per_transfer;
+  ow_ring_set_context_functions (&bench->context);
+  bench->context.o2p_audio = ow_ring_new (ring_frames,
+					  bench->engine->o2p_frame_size);
+  bench->context.p2o_audio = ow_ring_new (ring_frames * 2,
+					  bench->engine->p2o_frame_size);
+  bench->context.options = OW_ENGINE_OPTION_O2P_AUDIO |
+    OW_ENGINE_OPTION_P2O_AUDIO;
+  bench->engine->context = &bench->context;
+
+  if (ow_resampler_init_from_engine (&bench->resampler, bench->engine,
+				     quality))
+    {
+      ow_ring_free (bench->context.o2p_audio);
+      ow_ring_free (bench->context.p2o_audio);
+      ow_engine_destroy (bench->engine);
+      return 1;
+    }
+
+  ow_resampler_set_samplerate (bench->resampler, OB_SAMPLE_RATE);
+  ow_resampler_set_buffer_size (bench->resampler, bufsize);
+  bench->resampler->status = OW_RESAMPLER_STATUS_RUN;
+  bench->resampler->o2p_ratio = BENCH_RATIO;
+  bench->resampler->p2o_ratio = 1.0 / BENCH_RATIO;
+
+  bench->bufsize = bufsize;
+  bench->frames = (long) seconds * OB_SAMPLE_RATE;
+
+  for (int i = 0; i < desc->outputs; i++)
+    {
+      bench->jack_o2p[i] =
+	malloc (sizeof (jack_default_audio_sample_t) * bufsize);
+    }
+  for (int i = 0; i < desc->inputs; i++)
+    {
+      bench->jack_p2o[i] =
+	malloc (sizeof (jack_default_audio_sample_t) * bufsize);
+      bench_fill (bench->jack_p2o[i], bufsize);
+    }
+
+  return 0;
+}
+
+static void
+bench_destroy (struct bench_context *bench)
+{
+  for (int i = 0; i < bench->engine->device_desc.outputs; i++)
+    {
+      free (bench->jack_o2p[i]);
+    }
+  for (int i = 0; i < bench->engine->device_desc.inputs; i++)
+    {
+      free (bench->jack_p2o[i]);
+    }
+  ow_ring_free (bench->context.o2p_audio);
+  ow_ring_free (bench->context.p2o_audio);
+  ow_resampler_destroy (bench->resampler);
+}
+
+static int
+bench_run (struct ow_device_desc *desc, int blocks, int bufsize,
+	   int quality, int seconds)
+{
+  struct bench_context bench;
+
+  printf ("%s (%d inputs, %d outputs), %d blocks, %d frames, quality %d:\n",
+	  desc->name, desc->inputs, desc->outputs, blocks, bufsize, quality);
+
+  if (bench_init (&bench, desc, blocks, bufsize, quality, seconds))
+    {
+      fprintf (stderr, "Error while initializing the benchmark\n");
+      return 1;
+    }
+
+  bench_usb (&bench);
+  bench_resampler (&bench);
+  bench_jack (&bench);
+
+  bench_destroy (&bench);
+
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int opt, err = 0, found = 0;
+  int long_index = 0;
+  char *endstr;
+  char *device_name = NULL;
+  int blocks = DEFAULT_BLOCKS;
+  int bufsize = DEFAULT_BUFSIZE;
+  int quality = DEFAULT_QUALITY;
+  int seconds = DEFAULT_SECONDS;
+  struct ow_device_desc desc;
+
+  while ((opt = getopt_long (argc, argv, "d:b:j:q:s:h",
+			     options, &long_index)) != -1)
+    {
+      errno = 0;
+      switch (opt)
+	{
+	case 'd':
+	  device_name = optarg;
+	  break;
+	case 'b':
+	  blocks = (int) strtol (optarg, &endstr, 10);
+	  if (errno || endstr == optarg || *endstr != '\0' || blocks < 2
+	      || blocks > 32)
+	    {
+	      fprintf (stderr, "Blocks value must be in [2..32]\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+	case 'j':
+	  bufsize = (int) strtol (optarg, &endstr, 10);
+	  if (errno || endstr == optarg || *endstr != '\0' || bufsize < 16
+	      || bufsize > 4096)
+	    {
+	      fprintf (stderr, "Buffer size value must be in [16..4096]\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+	case 'q':
+	  quality = (int) strtol (optarg, &endstr, 10);
+	  if (errno || endstr == optarg || *endstr != '\0' || quality < 0
+	      || quality > 4)
+	    {
+	      fprintf (stderr, "Resampling quality value must be in [0..4]\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+	case 's':
+	  seconds = (int) strtol (optarg, &endstr, 10);
+	  if (errno || endstr == optarg || *endstr != '\0' || seconds < 1)
+	    {
+	      fprintf (stderr, "Seconds value must be greater than 0\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+	case 'h':
+	  bench_usage (argv[0]);
+	  exit (EXIT_SUCCESS);
+	case '?':
+	  bench_usage (argv[0]);
+	  exit (EXIT_FAILURE);
+	}
+    }
+
+  //These are the same devices found in res/devices.json.
+  for (int pid = 0; pid < MAX_PID; pid++)
+    {
+      if (ow_get_device_desc_from_vid_pid (ELEKTRON_VID, pid, &desc))
+	{
+	  continue;
+	}
+
+      if (device_name && strcmp (device_name, desc.name))
+	{
+	  ow_free_device_desc (&desc);
+	  continue;
+	}
+
+      found++;
+      err |= bench_run (&desc, blocks, bufsize, quality, seconds);
+    }
+
+  if (!found)
+    {
+      fprintf (stderr, "Device not found\n");
+      exit (EXIT_FAILURE);
+    }
+
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
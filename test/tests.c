@@ -4,11 +4,29 @@
 #include <CUnit/Basic.h>
 #include "../src/jclient.h"
 #include "../src/engine.h"
+#include "../src/resampler.h"
+#include "../src/convert.h"
+#include "../src/interleave.h"
+#include "../src/interpolator.h"
+#include "../src/ring.h"
+#include "../src/histogram.h"
+#include "../src/gather.h"
+#include "../src/rtlog.h"
 
 #define OW_CONV_SCALE_32 (1.0f / (float) INT_MAX)
 #define BLOCKS 4
 #define TRACKS 6
 #define NFRAMES 64
+#define CONVERT_SAMPLES 1031
+#define INTERPOLATOR_FRAMES 4096
+#define INTERPOLATOR_CHANNELS 11	//Two groups of 4 and 3 more channels.
+#define RING_FRAMES 10
+#define RING_FRAME_SIZE (TRACKS * sizeof (float))
+#define GATHER_FRAMES 37
+#define INTERLEAVE_TRACKS 24
+#define INTERLEAVE_OFFSET 3
+//This is not a multiple of 4 to test the frames left after the tiles.
+#define INTERLEAVE_FRAMES (NFRAMES - 1)
 
 static const struct ow_device_desc_static TESTDEV_DESC = {
   .pid = 0,
@@ -27,6 +45,7 @@ test_sizes ()
   printf ("\n");
 
   ow_copy_device_desc_static (&engine.device_desc, &TESTDEV_DESC);
+  engine.usb.device_handle = NULL;
   ow_engine_init_mem (&engine, BLOCKS);
 
   printf ("\n");
@@ -36,6 +55,18 @@ test_sizes ()
   CU_ASSERT_EQUAL (engine.usb.audio_in_blk_len,
 		   TRACKS * OB_FRAMES_PER_BLOCK * OB_BYTES_PER_SAMPLE + 32);
 
+  for (int i = 0; i < OW_MAX_AUDIO_TRANSFERS; i++)
+    {
+      engine.usb.xfr_audio_out_data =
+	&engine.usb.xfr_audio_out_pool[i * engine.usb.xfr_audio_out_max_len];
+      for (int j = 0; j < OW_ENGINE_MAX_BLOCKS; j++)
+	{
+	  CU_ASSERT_EQUAL (0x7ff,
+			   be16toh (GET_NTH_OUTPUT_USB_BLK (&engine, j)->
+				    header));
+	}
+    }
+
   ow_engine_free_mem (&engine);
 }
 
@@ -49,6 +80,7 @@ test_usb_blocks ()
   printf ("\n");
 
   ow_copy_device_desc_static (&engine.device_desc, &TESTDEV_DESC);
+  engine.usb.device_handle = NULL;
   ow_engine_init_mem (&engine, BLOCKS);
 
   blk_size =
@@ -109,6 +141,193 @@ test_usb_blocks ()
   ow_engine_free_mem (&engine);
 }
 
+void
+test_usb_blocks_planar ()
+{
+  float *a, *b;
+  char *blks;
+  struct ow_engine engine;
+
+  printf ("\n");
+
+  ow_copy_device_desc_static (&engine.device_desc, &TESTDEV_DESC);
+  engine.usb.device_handle = NULL;
+  ow_engine_init_mem (&engine, BLOCKS);
+
+  a = engine.p2o_transfer_buf;
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK; i++)
+    {
+      for (int k = 0; k < engine.device_desc.inputs; k++)
+	{
+	  a[i * TRACKS + k] = 1e-3 * (i + 1) * (k + 1);
+	}
+    }
+
+  ow_engine_write_usb_output_blocks (&engine);
+  blks = malloc (engine.usb.xfr_audio_out_data_len);
+  memcpy (blks, engine.usb.xfr_audio_out_data,
+	  engine.usb.xfr_audio_out_data_len);
+
+  //Planar buffers hold every track contiguously.
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK; i++)
+    {
+      for (int k = 0; k < engine.device_desc.inputs; k++)
+	{
+	  a[k * engine.frames_per_transfer + i] = 1e-3 * (i + 1) * (k + 1);
+	}
+    }
+
+  engine.usb.audio_frames_counter = 0;
+  ow_engine_write_usb_output_blocks_planar (&engine);
+
+  CU_ASSERT_EQUAL (memcmp (blks, engine.usb.xfr_audio_out_data,
+			   engine.usb.xfr_audio_out_data_len), 0);
+
+  memcpy (engine.usb.xfr_audio_in_data, engine.usb.xfr_audio_out_data,
+	  engine.usb.xfr_audio_in_data_len);
+
+  ow_engine_read_usb_input_blocks_planar (&engine);
+
+  b = engine.o2p_transfer_buf;
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK * TRACKS; i++)
+    {
+      CU_ASSERT_TRUE (fabsf (a[i] - b[i]) < 1e-8);
+    }
+
+  free (blks);
+  ow_engine_free_mem (&engine);
+}
+
+//Inactive tracks keep whatever was there.
+void
+test_usb_blocks_active ()
+{
+  float *a, *b;
+  uint64_t mask = 0x5;
+  struct ow_engine engine;
+
+  ow_copy_device_desc_static (&engine.device_desc, &TESTDEV_DESC);
+  engine.usb.device_handle = NULL;
+  ow_engine_init_mem (&engine, BLOCKS);
+
+  a = engine.p2o_transfer_buf;
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK * TRACKS; i++)
+    {
+      a[i] = 1e-3 * (i + 1);
+    }
+
+  ow_engine_write_usb_output_blocks (&engine);
+  memcpy (engine.usb.xfr_audio_in_data, engine.usb.xfr_audio_out_data,
+	  engine.usb.xfr_audio_in_data_len);
+
+  ow_engine_set_o2p_active_tracks (&engine, mask);
+
+  b = engine.o2p_transfer_buf;
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK * TRACKS; i++)
+    {
+      b[i] = -1.0;
+    }
+
+  ow_engine_read_usb_input_blocks (&engine);
+
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK; i++)
+    {
+      for (int k = 0; k < TRACKS; k++)
+	{
+	  if (mask & (1ULL << k))
+	    {
+	      CU_ASSERT_TRUE (fabsf (a[i * TRACKS + k] - b[i * TRACKS + k]) <
+			      1e-8);
+	    }
+	  else
+	    {
+	      CU_ASSERT_EQUAL (b[i * TRACKS + k], -1.0);
+	    }
+	}
+    }
+
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK * TRACKS; i++)
+    {
+      b[i] = -1.0;
+    }
+
+  ow_engine_read_usb_input_blocks_planar (&engine);
+
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK; i++)
+    {
+      for (int k = 0; k < TRACKS; k++)
+	{
+	  if (mask & (1ULL << k))
+	    {
+	      CU_ASSERT_TRUE (fabsf (a[i * TRACKS + k] -
+				     b[k * engine.frames_per_transfer + i]) <
+			      1e-8);
+	    }
+	  else
+	    {
+	      CU_ASSERT_EQUAL (b[k * engine.frames_per_transfer + i], -1.0);
+	    }
+	}
+    }
+
+  ow_engine_set_o2p_active_tracks (&engine, UINT64_MAX);
+  ow_engine_read_usb_input_blocks (&engine);
+
+  for (int i = 0; i < BLOCKS * OB_FRAMES_PER_BLOCK * TRACKS; i++)
+    {
+      CU_ASSERT_TRUE (fabsf (a[i] - b[i]) < 1e-8);
+    }
+
+  ow_engine_free_mem (&engine);
+}
+
+void
+test_blocks ()
+{
+  struct ow_engine engine;
+  struct ow_dll_overwitch dll_ow;
+  double e2;
+
+  printf ("\n");
+
+  ow_copy_device_desc_static (&engine.device_desc, &TESTDEV_DESC);
+  engine.usb.device_handle = NULL;
+  ow_engine_init_mem (&engine, BLOCKS);
+
+  CU_ASSERT_EQUAL (ow_engine_get_blocks_per_transfer (&engine), BLOCKS);
+  CU_ASSERT_EQUAL (engine.usb.xfr_audio_in_data_len,
+		   engine.usb.audio_in_blk_len * BLOCKS);
+  CU_ASSERT_EQUAL (engine.usb.xfr_audio_in_max_len,
+		   engine.usb.audio_in_blk_len * OW_ENGINE_MAX_BLOCKS);
+  CU_ASSERT_EQUAL (engine.usb.xfr_audio_out_max_len,
+		   engine.usb.audio_out_blk_len * OW_ENGINE_MAX_BLOCKS);
+
+  ow_engine_set_blocks_per_transfer (&engine, 8);
+  CU_ASSERT_EQUAL (ow_engine_get_blocks_per_transfer (&engine), 8);
+  //Nothing changes until a transfer is processed.
+  CU_ASSERT_EQUAL (engine.blocks_per_transfer, BLOCKS);
+  CU_ASSERT_EQUAL (engine.o2p_transfer_size,
+		   BLOCKS * OB_FRAMES_PER_BLOCK * engine.o2p_frame_size);
+
+  ow_engine_set_blocks_per_transfer (&engine, 1);
+  CU_ASSERT_EQUAL (ow_engine_get_blocks_per_transfer (&engine),
+		   OW_ENGINE_MIN_BLOCKS);
+
+  ow_engine_set_blocks_per_transfer (&engine, 100);
+  CU_ASSERT_EQUAL (ow_engine_get_blocks_per_transfer (&engine),
+		   OW_ENGINE_MAX_BLOCKS);
+
+  ow_engine_free_mem (&engine);
+
+  //The period estimation follows the new transfer length.
+  ow_dll_overwitch_init (&dll_ow, OB_SAMPLE_RATE,
+			 BLOCKS * OB_FRAMES_PER_BLOCK, 0.0);
+  e2 = dll_ow.e2;
+  ow_dll_overwitch_set_frames (&dll_ow, OB_SAMPLE_RATE,
+			       2 * BLOCKS * OB_FRAMES_PER_BLOCK);
+  CU_ASSERT_DOUBLE_EQUAL (dll_ow.e2, 2 * e2, 1e-12);
+}
+
 void
 test_jack_buffers ()
 {
@@ -133,12 +352,14 @@ test_jack_buffers ()
 	}
     }
 
-  jclient_copy_j2o_audio (output, NFRAMES, jack_input, &engine.device_desc);
+  jclient_copy_j2o_audio (output, NFRAMES, jack_input, &engine.device_desc,
+			  ow_interleave_get_kernels (TRACKS));
 
   memcpy (input, output,
 	  TRACKS * NFRAMES * sizeof (jack_default_audio_sample_t));
 
-  jclient_copy_o2j_audio (input, NFRAMES, jack_output, &engine.device_desc);
+  jclient_copy_o2j_audio (input, NFRAMES, jack_output, &engine.device_desc,
+			  ow_interleave_get_kernels (TRACKS));
 
   for (int i = 0; i < TRACKS; i++)
     {
@@ -153,6 +374,932 @@ test_jack_buffers ()
     }
 }
 
+//Every kernel must give the same results as the generic one, which is the reference implementation.
+void
+test_interleave ()
+{
+  float src[INTERLEAVE_TRACKS * NFRAMES];
+  float dst[INTERLEAVE_TRACKS * NFRAMES];
+  float exp[INTERLEAVE_TRACKS * NFRAMES];
+  float data[INTERLEAVE_TRACKS][INTERLEAVE_OFFSET + NFRAMES];
+  float expdata[INTERLEAVE_TRACKS][INTERLEAVE_OFFSET + NFRAMES];
+  float *planes[INTERLEAVE_TRACKS];
+  float *expplanes[INTERLEAVE_TRACKS];
+  const struct ow_interleave_kernels *generic =
+    ow_interleave_get_generic_kernels ();
+  const struct ow_interleave_kernels *kernels;
+
+  printf ("\n");
+
+  for (int i = 0; i < INTERLEAVE_TRACKS * NFRAMES; i++)
+    {
+      src[i] = i;
+    }
+
+  for (int k = 0; k < INTERLEAVE_TRACKS; k++)
+    {
+      planes[k] = data[k];
+      expplanes[k] = expdata[k];
+    }
+
+  for (int tracks = 1; tracks <= INTERLEAVE_TRACKS; tracks++)
+    {
+      kernels = ow_interleave_get_kernels (tracks);
+      if (kernels == generic)
+	{
+	  continue;
+	}
+
+      printf ("Testing %d tracks interleave kernels...\n", tracks);
+      CU_ASSERT_EQUAL (kernels->tracks, tracks);
+
+      memset (data, 0, sizeof (data));
+      memset (expdata, 0, sizeof (expdata));
+      kernels->deinterleave (planes, INTERLEAVE_OFFSET, src,
+			     INTERLEAVE_FRAMES, tracks);
+      generic->deinterleave (expplanes, INTERLEAVE_OFFSET, src,
+			     INTERLEAVE_FRAMES, tracks);
+      CU_ASSERT_EQUAL (memcmp (data, expdata, sizeof (data)), 0);
+      CU_ASSERT_EQUAL (data[tracks - 1][INTERLEAVE_OFFSET + 1],
+		       2 * tracks - 1);
+
+      memset (dst, 0, sizeof (dst));
+      memset (exp, 0, sizeof (exp));
+      kernels->interleave (dst, planes, INTERLEAVE_OFFSET, INTERLEAVE_FRAMES,
+			   tracks);
+      generic->interleave (exp, expplanes, INTERLEAVE_OFFSET,
+			   INTERLEAVE_FRAMES, tracks);
+      CU_ASSERT_EQUAL (memcmp (dst, exp, sizeof (dst)), 0);
+      CU_ASSERT_EQUAL (memcmp (dst, src,
+			       tracks * INTERLEAVE_FRAMES * sizeof (float)), 0);
+    }
+}
+
+void
+test_convert ()
+{
+  float fin[CONVERT_SAMPLES], fexp[CONVERT_SAMPLES], fout[CONVERT_SAMPLES];
+  int32_t iexp[CONVERT_SAMPLES], iout[CONVERT_SAMPLES];
+  const struct ow_convert_kernels **kernels =
+    ow_convert_get_available_kernels ();
+  const struct ow_convert_kernels *scalar = *kernels;
+  const struct ow_convert_kernels *kernel;
+  int32_t v;
+
+  printf ("\n");
+
+  for (int i = 0; i < CONVERT_SAMPLES; i++)
+    {
+      fin[i] = sinf (i * 0.1f) * 1.1f;
+    }
+  fin[0] = 1.0f;
+  fin[1] = -1.0f;
+  fin[2] = 2.0f;
+  fin[3] = -2.0f;
+  fin[4] = NAN;
+  fin[5] = INFINITY;
+  fin[6] = -INFINITY;
+
+  scalar->float_to_be32 (iexp, fin, CONVERT_SAMPLES);
+  scalar->be32_to_float (fexp, iexp, CONVERT_SAMPLES);
+
+  CU_ASSERT_EQUAL (be32toh (iexp[0]), INT_MAX);
+  CU_ASSERT_EQUAL (be32toh (iexp[1]), INT_MIN);
+  CU_ASSERT_EQUAL (be32toh (iexp[2]), INT_MAX);
+  CU_ASSERT_EQUAL (be32toh (iexp[3]), INT_MIN);
+  CU_ASSERT_EQUAL (be32toh (iexp[4]), 0);
+  CU_ASSERT_EQUAL (be32toh (iexp[5]), INT_MAX);
+  CU_ASSERT_EQUAL (be32toh (iexp[6]), INT_MIN);
+
+  for (const struct ow_convert_kernels ** k = kernels + 1; *k; k++)
+    {
+      printf ("Testing %s conversion kernels...\n", (*k)->name);
+
+      //All the lengths are tested to cover the scalar tails.
+      for (int n = CONVERT_SAMPLES - 16; n <= CONVERT_SAMPLES; n++)
+	{
+	  memset (iout, 0, sizeof (iout));
+	  memset (fout, 0, sizeof (fout));
+	  (*k)->float_to_be32 (iout, fin, n);
+	  (*k)->be32_to_float (fout, iexp, n);
+	  CU_ASSERT_EQUAL (memcmp (iout, iexp, n * sizeof (int32_t)), 0);
+	  CU_ASSERT_EQUAL (memcmp (fout, fexp, n * sizeof (float)), 0);
+	}
+    }
+
+  kernel = ow_convert_get_int32_kernels ();
+  printf ("Testing %s conversion kernels...\n", kernel->name);
+  memset (iout, 0, sizeof (iout));
+  kernel->be32_to_float (fout, iexp, CONVERT_SAMPLES);
+  kernel->float_to_be32 (iout, fout, CONVERT_SAMPLES);
+  CU_ASSERT_EQUAL (memcmp (iout, iexp, CONVERT_SAMPLES * sizeof (int32_t)),
+		   0);
+  for (int i = 0; i < CONVERT_SAMPLES; i++)
+    {
+      memcpy (&v, &fout[i], sizeof (int32_t));
+      CU_ASSERT_EQUAL (v, be32toh (iexp[i]));
+    }
+}
+
+static long
+test_interpolator_cb (void *cb_data, float **data)
+{
+  *data = cb_data;
+  return NFRAMES;
+}
+
+void
+test_interpolator ()
+{
+  long frames;
+  SRC_DATA data;
+  float diff, expected;
+  float in[INTERPOLATOR_FRAMES * 2];
+  float out[INTERPOLATOR_FRAMES * 2];
+  float cb_data[NFRAMES * 2];
+  double ratio = OB_SAMPLE_RATE / 44100.0;
+  struct ow_interpolator *interp;
+
+  printf ("\n");
+
+  //A ramp must stay a ramp with both interpolators.
+  for (int i = 0; i < INTERPOLATOR_FRAMES; i++)
+    {
+      in[i * 2] = i * 1e-4;
+      in[i * 2 + 1] = -i * 1e-4;
+    }
+
+  for (int type = OW_INTERPOLATOR_CUBIC; type <= OW_INTERPOLATOR_LINEAR;
+       type++)
+    {
+      interp = ow_interpolator_new (type, 2, NULL, NULL);
+
+      data.data_in = in;
+      data.input_frames = INTERPOLATOR_FRAMES / 2;
+      data.data_out = out;
+      data.output_frames = INTERPOLATOR_FRAMES;
+      data.src_ratio = ratio;
+      data.end_of_input = 0;
+
+      CU_ASSERT_EQUAL (ow_interpolator_process (interp, &data), 0);
+      CU_ASSERT_EQUAL (data.input_frames_used, INTERPOLATOR_FRAMES / 2);
+      CU_ASSERT_TRUE (fabs (data.output_frames_gen -
+			    INTERPOLATOR_FRAMES / 2 * ratio) < 2);
+
+      expected = 1e-4 / ratio;
+      for (int i = 8; i < data.output_frames_gen; i++)
+	{
+	  diff = out[i * 2] - out[(i - 1) * 2];
+	  CU_ASSERT_TRUE (fabsf (diff - expected) < 1e-5);
+	  CU_ASSERT_TRUE (fabsf (out[i * 2] + out[i * 2 + 1]) < 1e-6);
+	}
+
+      ow_interpolator_delete (interp);
+    }
+
+  //Every channel must give the same output as a mono interpolator, which checks the vector code against the scalar one.
+  for (int type = OW_INTERPOLATOR_CUBIC; type <= OW_INTERPOLATOR_LINEAR;
+       type++)
+    {
+      struct ow_interpolator *mono;
+      float mono_in[INTERPOLATOR_FRAMES / INTERPOLATOR_CHANNELS];
+      float mono_out[INTERPOLATOR_FRAMES];
+      long mono_frames = INTERPOLATOR_FRAMES / INTERPOLATOR_CHANNELS;
+
+      for (int i = 0; i < mono_frames; i++)
+	{
+	  for (int j = 0; j < INTERPOLATOR_CHANNELS; j++)
+	    {
+	      in[i * INTERPOLATOR_CHANNELS + j] = sinf (i * 0.01f * (j + 1));
+	    }
+	}
+
+      interp = ow_interpolator_new (type, INTERPOLATOR_CHANNELS, NULL, NULL);
+      data.data_in = in;
+      data.input_frames = mono_frames;
+      data.data_out = out;
+      data.output_frames = INTERPOLATOR_FRAMES * 2 / INTERPOLATOR_CHANNELS;
+      data.src_ratio = ratio;
+      CU_ASSERT_EQUAL (ow_interpolator_process (interp, &data), 0);
+      frames = data.output_frames_gen;
+      ow_interpolator_delete (interp);
+
+      for (int j = 0; j < INTERPOLATOR_CHANNELS; j++)
+	{
+	  for (int i = 0; i < mono_frames; i++)
+	    {
+	      mono_in[i] = in[i * INTERPOLATOR_CHANNELS + j];
+	    }
+
+	  mono = ow_interpolator_new (type, 1, NULL, NULL);
+	  data.data_in = mono_in;
+	  data.input_frames = mono_frames;
+	  data.data_out = mono_out;
+	  data.output_frames = INTERPOLATOR_FRAMES * 2 / INTERPOLATOR_CHANNELS;
+	  data.src_ratio = ratio;
+	  CU_ASSERT_EQUAL (ow_interpolator_process (mono, &data), 0);
+	  CU_ASSERT_EQUAL (data.output_frames_gen, frames);
+	  ow_interpolator_delete (mono);
+
+	  for (int i = 0; i < frames; i++)
+	    {
+	      CU_ASSERT_TRUE (fabsf (out[i * INTERPOLATOR_CHANNELS + j] -
+				     mono_out[i]) < 1e-6);
+	    }
+	}
+    }
+
+  //The callback API always returns the requested frames.
+  memset (cb_data, 0, sizeof (cb_data));
+  interp = ow_interpolator_new (OW_INTERPOLATOR_CUBIC, 2,
+				test_interpolator_cb, cb_data);
+  for (int i = 0; i < 16; i++)
+    {
+      frames = ow_interpolator_callback_read (interp, 1.0 / ratio, NFRAMES,
+					      out);
+      CU_ASSERT_EQUAL (frames, NFRAMES);
+    }
+  ow_interpolator_delete (interp);
+
+  //A few frames are stretched into a whole transfer starting from the primed frame as in the p2o underflows.
+  for (int i = 0; i < 5; i++)
+    {
+      in[i * 2] = i + 1;
+      in[i * 2 + 1] = -(i + 1);
+    }
+  memset (cb_data, 0, sizeof (cb_data));
+  interp = ow_interpolator_new (OW_INTERPOLATOR_LINEAR, 2, NULL, NULL);
+  ow_interpolator_prime (interp, cb_data);
+
+  data.data_in = in;
+  data.input_frames = 5;
+  data.data_out = out;
+  data.output_frames = BLOCKS * OB_FRAMES_PER_BLOCK;
+  data.src_ratio = BLOCKS * OB_FRAMES_PER_BLOCK / 5.0;
+
+  CU_ASSERT_EQUAL (ow_interpolator_process (interp, &data), 0);
+  CU_ASSERT_EQUAL (data.output_frames_gen, BLOCKS * OB_FRAMES_PER_BLOCK);
+  CU_ASSERT_EQUAL (out[0], 0.0);
+  for (int i = 1; i < data.output_frames_gen; i++)
+    {
+      CU_ASSERT_TRUE (out[i * 2] > out[(i - 1) * 2]);
+      CU_ASSERT_TRUE (out[i * 2] <= 5.0);
+      CU_ASSERT_EQUAL (out[i * 2], -out[i * 2 + 1]);
+    }
+  ow_interpolator_delete (interp);
+}
+
+void
+test_ring ()
+{
+  size_t len;
+  struct ow_ring_vector vector[2];
+  char in[RING_FRAMES * RING_FRAME_SIZE];
+  char out[RING_FRAMES * RING_FRAME_SIZE];
+  struct ow_ring *ring = ow_ring_new (RING_FRAMES, RING_FRAME_SIZE);
+  const size_t size = RING_FRAMES * RING_FRAME_SIZE;
+
+  printf ("\n");
+
+  for (int i = 0; i < size; i++)
+    {
+      in[i] = i;
+    }
+
+  CU_ASSERT_EQUAL (ow_ring_get_frame_size (ring), RING_FRAME_SIZE);
+  CU_ASSERT_EQUAL (ow_ring_read_space (ring), 0);
+  CU_ASSERT_EQUAL (ow_ring_write_space (ring), size);
+
+  //The whole capacity is usable and only whole frames are written.
+  CU_ASSERT_EQUAL (ow_ring_write (ring, in, size + 1), size);
+  CU_ASSERT_EQUAL (ow_ring_write_space (ring), 0);
+  CU_ASSERT_EQUAL (ow_ring_read (ring, out, RING_FRAME_SIZE * 3 + 1),
+		   RING_FRAME_SIZE * 3);
+  CU_ASSERT_EQUAL (memcmp (in, out, RING_FRAME_SIZE * 3), 0);
+
+  //Peeking does not consume and a NULL destination just discards data.
+  CU_ASSERT_EQUAL (ow_ring_peek (ring, out, RING_FRAME_SIZE),
+		   RING_FRAME_SIZE);
+  CU_ASSERT_EQUAL (memcmp (&in[RING_FRAME_SIZE * 3], out, RING_FRAME_SIZE),
+		   0);
+  CU_ASSERT_EQUAL (ow_ring_read_space (ring), RING_FRAME_SIZE * 7);
+  CU_ASSERT_EQUAL (ow_ring_read (ring, NULL, RING_FRAME_SIZE * 2),
+		   RING_FRAME_SIZE * 2);
+  CU_ASSERT_EQUAL (ow_ring_read_space (ring), RING_FRAME_SIZE * 5);
+
+  //Writes wrap around the end of the memory.
+  CU_ASSERT_EQUAL (ow_ring_write (ring, in, RING_FRAME_SIZE * 4),
+		   RING_FRAME_SIZE * 4);
+  CU_ASSERT_EQUAL (ow_ring_read (ring, NULL, RING_FRAME_SIZE * 5),
+		   RING_FRAME_SIZE * 5);
+  CU_ASSERT_EQUAL (ow_ring_read (ring, out, size), RING_FRAME_SIZE * 4);
+  CU_ASSERT_EQUAL (memcmp (in, out, RING_FRAME_SIZE * 4), 0);
+
+  //The reserved regions cover all the free space and are split at the end of the memory.
+  len = ow_ring_write_reserve (ring, vector);
+  CU_ASSERT_EQUAL (len, size);
+  CU_ASSERT_EQUAL (vector[0].len, RING_FRAME_SIZE * 6);
+  CU_ASSERT_EQUAL (vector[1].len, RING_FRAME_SIZE * 4);
+  CU_ASSERT_EQUAL (vector[1].buf, ring->data);
+  memcpy (vector[0].buf, in, vector[0].len);
+  memcpy (vector[1].buf, &in[vector[0].len], vector[1].len);
+  ow_ring_write_commit (ring, len);
+
+  len = ow_ring_read_reserve (ring, vector);
+  CU_ASSERT_EQUAL (len, size);
+  CU_ASSERT_EQUAL (vector[0].len + vector[1].len, size);
+  CU_ASSERT_EQUAL (memcmp (vector[0].buf, in, vector[0].len), 0);
+  CU_ASSERT_EQUAL (memcmp (vector[1].buf, &in[vector[0].len],
+			   vector[1].len), 0);
+  ow_ring_read_commit (ring, len);
+  CU_ASSERT_EQUAL (ow_ring_read_space (ring), 0);
+
+  ow_ring_reset (ring);
+  CU_ASSERT_EQUAL (ow_ring_write_space (ring), size);
+
+  ow_ring_free (ring);
+}
+
+void
+test_ring_wrap ()
+{
+  size_t pos;
+  char in[RING_FRAMES * RING_FRAME_SIZE];
+  char out[RING_FRAMES * RING_FRAME_SIZE];
+  struct ow_ring *ring = ow_ring_new (RING_FRAMES, RING_FRAME_SIZE);
+  const size_t size = RING_FRAMES * RING_FRAME_SIZE;
+
+  printf ("\n");
+
+  for (int i = 0; i < size; i++)
+    {
+      in[i] = i;
+    }
+
+  CU_ASSERT_EQUAL (ring->wrap % size, 0);
+  CU_ASSERT (ring->wrap > SIZE_MAX / 2 - size);
+
+  //The positions start at the highest values they can take.
+  pos = ring->wrap - RING_FRAME_SIZE * 3;
+  atomic_store (&ring->write_pos, pos);
+  atomic_store (&ring->read_pos, pos);
+  ring->read_pos_cache = pos;
+  ring->write_pos_cache = pos;
+
+  CU_ASSERT_EQUAL (ow_ring_read_space (ring), 0);
+  CU_ASSERT_EQUAL (ow_ring_write_space (ring), size);
+
+  for (int i = 0; i < 3; i++)
+    {
+      CU_ASSERT_EQUAL (ow_ring_write (ring, in, RING_FRAME_SIZE * 7),
+		       RING_FRAME_SIZE * 7);
+      CU_ASSERT_EQUAL (ow_ring_read_space (ring), RING_FRAME_SIZE * 7);
+      CU_ASSERT_EQUAL (ow_ring_write_space (ring), RING_FRAME_SIZE * 3);
+      CU_ASSERT_EQUAL (ow_ring_read (ring, out, size), RING_FRAME_SIZE * 7);
+      CU_ASSERT_EQUAL (memcmp (in, out, RING_FRAME_SIZE * 7), 0);
+    }
+
+  CU_ASSERT_EQUAL (atomic_load (&ring->write_pos), RING_FRAME_SIZE * 18);
+  CU_ASSERT_EQUAL (atomic_load (&ring->read_pos), RING_FRAME_SIZE * 18);
+
+  ow_ring_free (ring);
+}
+
+void
+test_engine_state ()
+{
+  struct ow_engine engine;
+  struct ow_engine_latency latency;
+
+  printf ("\n");
+
+  ow_copy_device_desc_static (&engine.device_desc, &TESTDEV_DESC);
+  engine.usb.device_handle = NULL;
+  ow_engine_init_mem (&engine, BLOCKS);
+
+  atomic_init (&engine.options, OW_ENGINE_OPTION_O2P_AUDIO);
+  ow_engine_set_option (&engine, OW_ENGINE_OPTION_P2O_AUDIO, 1);
+  CU_ASSERT_TRUE (ow_engine_is_option (&engine, OW_ENGINE_OPTION_O2P_AUDIO));
+  CU_ASSERT_TRUE (ow_engine_is_option (&engine, OW_ENGINE_OPTION_P2O_AUDIO));
+  ow_engine_set_option (&engine, OW_ENGINE_OPTION_O2P_AUDIO, 0);
+  CU_ASSERT_FALSE (ow_engine_is_option (&engine, OW_ENGINE_OPTION_O2P_AUDIO));
+  CU_ASSERT_TRUE (ow_engine_is_option (&engine, OW_ENGINE_OPTION_P2O_AUDIO));
+
+  ow_engine_set_status (&engine, OW_ENGINE_STATUS_WAIT);
+  CU_ASSERT_EQUAL (ow_engine_get_status (&engine), OW_ENGINE_STATUS_WAIT);
+
+  ow_seqlock_write_begin (&engine.seqlock);
+  engine.latency.o2p = 1;
+  engine.latency.o2p_max = 2;
+  engine.latency.p2o = 3;
+  engine.latency.p2o_max = 4;
+  ow_seqlock_write_end (&engine.seqlock);
+
+  ow_engine_get_latency (&engine, &latency);
+  CU_ASSERT_EQUAL (latency.o2p, 1);
+  CU_ASSERT_EQUAL (latency.o2p_max, 2);
+  CU_ASSERT_EQUAL (latency.p2o, 3);
+  CU_ASSERT_EQUAL (latency.p2o_max, 4);
+  CU_ASSERT_FALSE (ow_seqlock_read_retry (&engine.seqlock,
+					  ow_seqlock_read_begin
+					  (&engine.seqlock)));
+
+  ow_engine_free_mem (&engine);
+}
+
+void
+test_engine_group ()
+{
+  struct ow_engine_group *group;
+
+  printf ("\n");
+
+  CU_ASSERT_NOT_EQUAL (ow_engine_group_init (&group, 0), OW_OK);
+
+  CU_ASSERT_EQUAL (ow_engine_group_init (&group, 3), OW_OK);
+  CU_ASSERT_EQUAL (group->loops_len, 3);
+  CU_ASSERT_EQUAL (group->next_loop, 0);
+  for (int i = 0; i < group->loops_len; i++)
+    {
+      for (int j = 0; j < OW_ENGINE_GROUP_MAX_ENGINES; j++)
+	{
+	  CU_ASSERT_PTR_NULL (atomic_load (&group->loops[i].engines[j]));
+	}
+    }
+  ow_engine_group_destroy (group);
+}
+
+void
+test_set_rt_priority (pthread_t thread, int priority)
+{
+}
+
+void
+test_engine_loop ()
+{
+  struct ow_engine_loop loop;
+  struct ow_context context;
+  static struct ow_engine engines[OW_ENGINE_GROUP_MAX_ENGINES + 1];
+  struct ow_engine *engine = &engines[0];
+  struct ow_engine *extra = &engines[OW_ENGINE_GROUP_MAX_ENGINES];
+
+  printf ("\n");
+
+  memset (&loop, 0, sizeof (loop));
+  CU_ASSERT_EQUAL (libusb_init (&loop.context), LIBUSB_SUCCESS);
+  for (int i = 0; i < OW_ENGINE_GROUP_MAX_ENGINES; i++)
+    {
+      atomic_init (&loop.engines[i], NULL);
+    }
+
+  memset (&context, 0, sizeof (context));
+  context.set_rt_priority = test_set_rt_priority;
+
+  memset (engines, 0, sizeof (engines));
+  for (int i = 0; i <= OW_ENGINE_GROUP_MAX_ENGINES; i++)
+    {
+      snprintf (engines[i].name, OW_LABEL_MAX_LEN, "test %d", i);
+      engines[i].loop = &loop;
+      engines[i].context = &context;
+      atomic_init (&engines[i].status, OW_ENGINE_STATUS_READY);
+      atomic_init (&engines[i].usb.xfr_in_flight, 0);
+    }
+
+  for (int i = 0; i < OW_ENGINE_GROUP_MAX_ENGINES; i++)
+    {
+      CU_ASSERT_EQUAL (ow_engine_loop_add (&engines[i]), OW_OK);
+      CU_ASSERT_EQUAL (atomic_load (&engines[i].running), 1);
+      CU_ASSERT_PTR_EQUAL (atomic_load (&loop.engines[i]), &engines[i]);
+    }
+
+  //A full loop rejects the engine and leaves it stopped.
+  CU_ASSERT_NOT_EQUAL (ow_engine_loop_add (extra), OW_OK);
+  CU_ASSERT_EQUAL (atomic_load (&extra->running), 0);
+
+  CU_ASSERT_EQUAL (engine->loop_state, OW_ENGINE_LOOP_STATE_IDLE);
+  CU_ASSERT_EQUAL (ow_engine_loop_step (engine), 0);
+  CU_ASSERT_EQUAL (engine->loop_state, OW_ENGINE_LOOP_STATE_IDLE);
+
+  //Without a DLL the engine goes straight to run.
+  ow_engine_set_status (engine, OW_ENGINE_STATUS_BOOT);
+  CU_ASSERT_EQUAL (ow_engine_loop_step (engine), 0);
+  CU_ASSERT_EQUAL (engine->loop_state, OW_ENGINE_LOOP_STATE_RUN);
+  CU_ASSERT_EQUAL (ow_engine_get_status (engine), OW_ENGINE_STATUS_RUN);
+  CU_ASSERT_EQUAL (ow_engine_loop_step (engine), 0);
+  CU_ASSERT_EQUAL (engine->loop_state, OW_ENGINE_LOOP_STATE_RUN);
+
+  //The engine is only released once there are no transfers in flight.
+  atomic_store (&engine->usb.xfr_in_flight, 2);
+  ow_engine_set_status (engine, OW_ENGINE_STATUS_STOP);
+  CU_ASSERT_EQUAL (ow_engine_loop_step (engine), 0);
+  CU_ASSERT_EQUAL (engine->loop_state, OW_ENGINE_LOOP_STATE_DRAIN);
+  atomic_store (&engine->usb.xfr_in_flight, 1);
+  CU_ASSERT_EQUAL (ow_engine_loop_step (engine), 0);
+  atomic_store (&engine->usb.xfr_in_flight, 0);
+  CU_ASSERT_EQUAL (ow_engine_loop_step (engine), 1);
+
+  ow_engine_loop_release (&loop, 0);
+  CU_ASSERT_EQUAL (atomic_load (&engine->running), 0);
+  CU_ASSERT_PTR_NULL (atomic_load (&loop.engines[0]));
+
+  //The released slot is reused.
+  CU_ASSERT_EQUAL (ow_engine_loop_add (extra), OW_OK);
+  CU_ASSERT_EQUAL (atomic_load (&extra->running), 1);
+  CU_ASSERT_PTR_EQUAL (atomic_load (&loop.engines[0]), extra);
+
+  libusb_exit (loop.context);
+}
+
+void
+test_resampler_group ()
+{
+  struct ow_resampler_group *group;
+  struct ow_engine engine;
+  struct ow_resampler resamplers[OW_RESAMPLER_GROUP_MAX_RESAMPLERS + 1];
+  struct ow_resampler *r;
+
+  printf ("\n");
+
+  strcpy (engine.name, "test");
+  r = resamplers;
+  for (int i = 0; i <= OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++, r++)
+    {
+      r->engine = &engine;
+      r->group = NULL;
+      atomic_init (&r->kdel, 0);
+    }
+
+  CU_ASSERT_EQUAL (ow_resampler_group_init (&group), OW_OK);
+  CU_ASSERT_EQUAL (ow_resampler_group_get_kdel (group), 0);
+
+  CU_ASSERT_EQUAL (ow_resampler_group_add (group, &resamplers[0]), OW_OK);
+  CU_ASSERT_TRUE (resamplers[0].group == group);
+  CU_ASSERT_NOT_EQUAL (ow_resampler_group_add (group, &resamplers[0]),
+		       OW_OK);
+  atomic_store (&resamplers[0].kdel, 100);
+  CU_ASSERT_EQUAL (ow_resampler_group_get_kdel (group), 100);
+
+  CU_ASSERT_EQUAL (ow_resampler_group_add (group, &resamplers[1]), OW_OK);
+  atomic_store (&resamplers[1].kdel, 50);
+  CU_ASSERT_EQUAL (ow_resampler_group_get_kdel (group), 100);
+  atomic_store (&resamplers[1].kdel, 200);
+  CU_ASSERT_EQUAL (ow_resampler_group_get_kdel (group), 200);
+
+  //A member with a lower delay takes over when the highest one lowers it.
+  atomic_store (&resamplers[1].kdel, 20);
+  CU_ASSERT_EQUAL (ow_resampler_group_get_kdel (group), 100);
+
+  for (int i = 2; i < OW_RESAMPLER_GROUP_MAX_RESAMPLERS; i++)
+    {
+      CU_ASSERT_EQUAL (ow_resampler_group_add (group, &resamplers[i]),
+		       OW_OK);
+    }
+  CU_ASSERT_NOT_EQUAL (ow_resampler_group_add
+		       (group, &resamplers[OW_RESAMPLER_GROUP_MAX_RESAMPLERS]),
+		       OW_OK);
+  CU_ASSERT_PTR_NULL (resamplers[OW_RESAMPLER_GROUP_MAX_RESAMPLERS].group);
+
+  ow_resampler_group_destroy (group);
+  CU_ASSERT_PTR_NULL (resamplers[0].group);
+}
+
+//JACK never sets the host rate so its DLL must start from the nominal ratio with the integrator cleared while a measured rate seeds it.
+void
+test_resampler_startup ()
+{
+  struct ow_engine engine;
+  struct ow_resampler resampler;
+  double host_rates[] = { 0.0, 44110.0, 48000.0 };
+  double ratios[] = { 44100.0 / OB_SAMPLE_RATE, 44110.0 / OB_SAMPLE_RATE,
+    44100.0 / OB_SAMPLE_RATE
+  };
+
+  printf ("\n");
+
+  for (int i = 0; i < 3; i++)
+    {
+      memset (&engine, 0, sizeof (engine));
+      atomic_init (&engine.status, OW_ENGINE_STATUS_WAIT);
+
+      memset (&resampler, 0, sizeof (resampler));
+      resampler.engine = &engine;
+      resampler.status = OW_RESAMPLER_STATUS_READY;
+      resampler.samplerate = 44100;
+      resampler.bufsize = NFRAMES;
+      atomic_init (&resampler.xruns, 0);
+      ow_resampler_set_host_rate (&resampler, host_rates[i]);
+
+      ow_dll_primary_reset (&resampler.dll, 44100, OB_SAMPLE_RATE, NFRAMES,
+			    BLOCKS * OB_FRAMES_PER_BLOCK);
+      resampler.dll.dll_ow.i0.frames = BLOCKS * OB_FRAMES_PER_BLOCK;
+      resampler.dll.dll_ow.i0.time = 1.0;
+      resampler.dll.dll_ow.i1.frames = 2 * BLOCKS * OB_FRAMES_PER_BLOCK;
+      resampler.dll.dll_ow.i1.time =
+	1.0 + BLOCKS * OB_FRAMES_PER_BLOCK / (double) OB_SAMPLE_RATE;
+
+      CU_ASSERT_EQUAL (ow_resampler_compute_ratios (&resampler, 1.001), 0);
+      CU_ASSERT_EQUAL (resampler.status, OW_RESAMPLER_STATUS_BOOT);
+      CU_ASSERT_DOUBLE_EQUAL (resampler.dll.ratio, ratios[i], 1e-12);
+      CU_ASSERT_DOUBLE_EQUAL (resampler.dll._z3,
+			      host_rates[i] == 44110.0 ? 1.0 - ratios[i] : 0.0,
+			      1e-12);
+    }
+}
+
+void
+test_histogram ()
+{
+  struct ow_histogram histogram;
+
+  printf ("\n");
+
+  ow_histogram_init (&histogram, 0.001);
+  ow_histogram_add (&histogram, 0.0);
+  ow_histogram_add (&histogram, 0.0015);
+  ow_histogram_add (&histogram, 0.0019);
+  ow_histogram_add (&histogram, 1.0);
+  ow_histogram_add (&histogram, -1.0);
+
+  CU_ASSERT_EQUAL (histogram.count, 5);
+  CU_ASSERT_EQUAL (histogram.bins[0], 2);
+  CU_ASSERT_EQUAL (histogram.bins[1], 2);
+  CU_ASSERT_EQUAL (histogram.bins[OW_HISTOGRAM_BINS - 1], 1);
+  CU_ASSERT_EQUAL (histogram.max, 1.0);
+  CU_ASSERT_DOUBLE_EQUAL (histogram.sum, 0.0034, 1e-9);
+
+  CU_ASSERT_DOUBLE_EQUAL (ow_histogram_get_percentile (&histogram, 0.4),
+			  0.001, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL (ow_histogram_get_percentile (&histogram, 0.8),
+			  0.002, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL (ow_histogram_get_percentile (&histogram, 0.999),
+			  1.0, 1e-9);
+
+  ow_histogram_init (&histogram, 0.001);
+  CU_ASSERT_EQUAL (ow_histogram_get_percentile (&histogram, 0.5), 0.0);
+
+  //Values that do not fit in an int bin are clamped too.
+  ow_histogram_add (&histogram, 1e300);
+  ow_histogram_add (&histogram, -1e300);
+  ow_histogram_add (&histogram, NAN);
+  CU_ASSERT_EQUAL (histogram.bins[0], 2);
+  CU_ASSERT_EQUAL (histogram.bins[OW_HISTOGRAM_BINS - 1], 1);
+
+  ow_histogram_init (&histogram, 0.0);
+  ow_histogram_add (&histogram, 0.0);
+  ow_histogram_add (&histogram, 0.5);
+  CU_ASSERT_EQUAL (histogram.bins[0], 1);
+  CU_ASSERT_EQUAL (histogram.bins[OW_HISTOGRAM_BINS - 1], 1);
+}
+
+void
+test_clock_cache ()
+{
+  struct ow_engine engine;
+  struct ow_resampler resampler;
+  char home[] = "/tmp/overwitch-test-XXXXXX";
+  char path[PATH_MAX];
+  char *old_home = getenv ("HOME");
+
+  printf ("\n");
+
+  //The value returned by getenv might be overwritten by setenv.
+  if (old_home)
+    {
+      old_home = strdup (old_home);
+    }
+
+  CU_ASSERT_PTR_NOT_NULL (mkdtemp (home));
+  setenv ("HOME", home, 1);
+
+  strcpy (engine.overbridge_name, "Test/1");
+  resampler.engine = &engine;
+
+  ow_resampler_load_clock_cache (&resampler);
+  CU_ASSERT_EQUAL (resampler.cached_ratio, 0.0);
+
+  //Nothing is saved until the DLL is tuned.
+  resampler.tuned_ratio = 0.0;
+  ow_resampler_save_clock_cache (&resampler);
+  ow_resampler_load_clock_cache (&resampler);
+  CU_ASSERT_EQUAL (resampler.cached_ratio, 0.0);
+
+  resampler.tuned_ratio = 1.000012345678;
+  ow_resampler_save_clock_cache (&resampler);
+  ow_resampler_load_clock_cache (&resampler);
+  CU_ASSERT_DOUBLE_EQUAL (resampler.cached_ratio, 1.000012345678, 1e-12);
+
+  //Wrong values are ignored.
+  resampler.tuned_ratio = 1.5;
+  ow_resampler_save_clock_cache (&resampler);
+  ow_resampler_load_clock_cache (&resampler);
+  CU_ASSERT_EQUAL (resampler.cached_ratio, 0.0);
+
+  snprintf (path, PATH_MAX, "%s/.config/%s/clocks/Test_1", home, PACKAGE);
+  CU_ASSERT_EQUAL (unlink (path), 0);
+  //This removes the clocks, the package and the .config directories.
+  for (int i = 0; i < 3; i++)
+    {
+      *strrchr (path, '/') = 0;
+      CU_ASSERT_EQUAL (rmdir (path), 0);
+    }
+  CU_ASSERT_EQUAL (rmdir (home), 0);
+
+  if (old_home)
+    {
+      setenv ("HOME", old_home, 1);
+      free (old_home);
+    }
+  else
+    {
+      unsetenv ("HOME");
+    }
+}
+
+void
+test_device_descs ()
+{
+  struct ow_device_desc desc;
+
+  printf ("\n");
+
+  CU_ASSERT_EQUAL (ow_get_device_desc_from_vid_pid (0x1935, 0x000c, &desc),
+		   0);
+  CU_ASSERT_EQUAL (desc.pid, 0x000c);
+  CU_ASSERT_STRING_EQUAL (desc.name, "Digitakt");
+  CU_ASSERT_EQUAL (desc.inputs, 2);
+  CU_ASSERT_EQUAL (desc.outputs, 12);
+  CU_ASSERT_STRING_EQUAL (desc.output_track_names[11], "Input R");
+  ow_free_device_desc (&desc);
+
+  CU_ASSERT_EQUAL (ow_get_device_desc_from_vid_pid (0x1935, 0x001e, &desc),
+		   0);
+  CU_ASSERT_STRING_EQUAL (desc.name, "Syntakt");
+  CU_ASSERT_EQUAL (desc.outputs, 20);
+  ow_free_device_desc (&desc);
+
+  CU_ASSERT_NOT_EQUAL (ow_get_device_desc_from_vid_pid
+		       (0x1935, 0x0002, &desc), 0);
+  CU_ASSERT_NOT_EQUAL (ow_get_device_desc_from_vid_pid
+		       (0x1234, 0x000c, &desc), 0);
+}
+
+static void
+test_gather_mask (const char *mask, const char *kernel_name)
+{
+  struct ow_gather gather;
+  float src[GATHER_FRAMES * TRACKS];
+  float dst[GATHER_FRAMES * TRACKS];
+  float max, min;
+  int count;
+
+  for (int i = 0; i < GATHER_FRAMES * TRACKS; i++)
+    {
+      src[i] = sinf (i * 0.37f) * (1.0f + i % TRACKS);
+    }
+
+  count = ow_gather_init (&gather, TRACKS, mask);
+  CU_ASSERT_EQUAL (count, gather.count);
+  CU_ASSERT_STRING_EQUAL (gather.kernel_name, kernel_name);
+
+  ow_gather_run (&gather, dst, src, GATHER_FRAMES);
+
+  for (int k = 0; k < count; k++)
+    {
+      max = 0.0f;
+      min = 0.0f;
+      for (int i = 0; i < GATHER_FRAMES; i++)
+	{
+	  float x = src[i * TRACKS + gather.index[k]];
+	  CU_ASSERT_EQUAL (dst[i * count + k], x);
+	  max = x > max ? x : max;
+	  min = x < min ? x : min;
+	}
+      CU_ASSERT_EQUAL (gather.max[k], max);
+      CU_ASSERT_EQUAL (gather.min[k], min);
+    }
+
+  ow_gather_reset_peaks (&gather);
+  ow_gather_peaks (&gather, src, GATHER_FRAMES);
+
+  for (int k = 0; k < count; k++)
+    {
+      CU_ASSERT_TRUE (gather.max[k] >= 0.0f);
+      CU_ASSERT_TRUE (gather.min[k] <= 0.0f);
+      for (int i = 0; i < GATHER_FRAMES; i++)
+	{
+	  float x = src[i * TRACKS + gather.index[k]];
+	  CU_ASSERT_TRUE (x <= gather.max[k]);
+	  CU_ASSERT_TRUE (x >= gather.min[k]);
+	}
+    }
+}
+
+void
+test_gather ()
+{
+  struct ow_gather gather;
+
+  printf ("\n");
+
+  test_gather_mask (NULL, "all");
+  test_gather_mask ("111111", "all");
+  test_gather_mask ("11", "stereo");
+  test_gather_mask ("0011", "stereo");
+  test_gather_mask ("011111", "contiguous");
+  test_gather_mask ("11111", "contiguous");
+  test_gather_mask ("101", "indexed");
+  test_gather_mask ("110011111", "indexed");
+
+  CU_ASSERT_EQUAL (ow_gather_init (&gather, TRACKS, "0000"), 0);
+  CU_ASSERT_EQUAL (ow_gather_init (&gather, TRACKS, "0000001"), 0);
+}
+
+static void
+test_rtlog_repeat (int i)
+{
+  rt_error_print ("Repeated %d\n", i);
+}
+
+void
+test_rtlog ()
+{
+  FILE *f;
+  char *buf;
+  size_t len;
+  size_t bytes = 4096;
+  const char *s = "static";
+  char name[OW_RTLOG_STRING_LEN];
+  char long_name[OW_RTLOG_STRING_LEN * 2];
+  char expected[OW_RTLOG_STRING_LEN * 3];
+  struct ow_rtlog_arg arg = ow_rtlog_int (0);
+  static struct ow_rtlog_site sites[OW_RTLOG_RECORDS + 1];
+
+  printf ("\n");
+
+  memset (long_name, 'x', sizeof (long_name) - 1);
+  long_name[sizeof (long_name) - 1] = 0;
+
+  //The previous tests might have left messages.
+  f = open_memstream (&buf, &len);
+  ow_rtlog_drain (f);
+  fclose (f);
+  free (buf);
+
+  rt_error_print ("No arguments\n");
+  rt_error_print ("%zu B, %s, %.3f, 0x%02x, %-3d|, 100%%\n", bytes, s, 0.25,
+		  9, -1);
+  rt_debug_print (1, "Hidden\n");
+  for (int i = 0; i < 3; i++)
+    {
+      test_rtlog_repeat (i);
+    }
+
+  f = open_memstream (&buf, &len);
+  CU_ASSERT_EQUAL (ow_rtlog_drain (f), 3);
+  fclose (f);
+  CU_ASSERT_PTR_NOT_NULL (strstr (buf, "): No arguments\n"));
+  CU_ASSERT_PTR_NOT_NULL (strstr
+			  (buf, "): 4096 B, static, 0.250, 0x09, -1 |, 100%\n"));
+  CU_ASSERT_PTR_NULL (strstr (buf, "Hidden"));
+  CU_ASSERT_PTR_NOT_NULL (strstr (buf, "): Repeated 0\n"));
+  CU_ASSERT_PTR_NULL (strstr (buf, "): Repeated 1\n"));
+  free (buf);
+
+  //Strings are copied when pushed and truncated.
+  strcpy (name, "before");
+  rt_error_print ("Name %s\n", name);
+  strcpy (name, "after");
+  rt_error_print ("Long %s|\n", long_name);
+
+  f = open_memstream (&buf, &len);
+  CU_ASSERT_EQUAL (ow_rtlog_drain (f), 2);
+  fclose (f);
+  CU_ASSERT_PTR_NOT_NULL (strstr (buf, "): Name before\n"));
+  long_name[OW_RTLOG_STRING_LEN - 1] = 0;
+  snprintf (expected, sizeof (expected), "): Long %s|\n", long_name);
+  CU_ASSERT_PTR_NOT_NULL (strstr (buf, expected));
+  free (buf);
+
+  //Every site is different so that nothing is suppressed.
+  for (int i = 0; i < OW_RTLOG_RECORDS + 1; i++)
+    {
+      sites[i].file = __FILE__;
+      sites[i].line = __LINE__;
+      sites[i].function = __FUNCTION__;
+      sites[i].format = "Site %d\n";
+      arg.i = i;
+      ow_rtlog_push (&sites[i], OW_RTLOG_ERROR, 1, &arg);
+    }
+
+  f = open_memstream (&buf, &len);
+  CU_ASSERT_EQUAL (ow_rtlog_drain (f), OW_RTLOG_RECORDS);
+  fclose (f);
+  CU_ASSERT_PTR_NOT_NULL (strstr (buf, "): 1 log messages were lost\n"));
+  CU_ASSERT_PTR_NOT_NULL (strstr (buf, "): Site 0\n"));
+  CU_ASSERT_PTR_NULL (strstr (buf, "): Site 256\n"));
+  free (buf);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -178,11 +1325,101 @@ main (int argc, char *argv[])
       goto cleanup;
     }
 
+  if (!CU_add_test (suite, "test_usb_blocks_planar", test_usb_blocks_planar))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_usb_blocks_active", test_usb_blocks_active))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_blocks", test_blocks))
+    {
+      goto cleanup;
+    }
+
   if (!CU_add_test (suite, "test_jack_buffers", test_jack_buffers))
     {
       goto cleanup;
     }
 
+  if (!CU_add_test (suite, "test_interleave", test_interleave))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_convert", test_convert))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_interpolator", test_interpolator))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_ring", test_ring))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_ring_wrap", test_ring_wrap))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_engine_state", test_engine_state))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_engine_group", test_engine_group))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_engine_loop", test_engine_loop))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_resampler_group", test_resampler_group))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_resampler_startup", test_resampler_startup))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_histogram", test_histogram))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_clock_cache", test_clock_cache))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_device_descs", test_device_descs))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_gather", test_gather))
+    {
+      goto cleanup;
+    }
+
+  if (!CU_add_test (suite, "test_rtlog", test_rtlog))
+    {
+      goto cleanup;
+    }
+
   CU_basic_set_mode (CU_BRM_VERBOSE);
 
   CU_basic_run_tests ();